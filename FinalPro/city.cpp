@@ -0,0 +1,388 @@
+#include <render/buildings.h>
+#include <render/shader.h>
+#include <render/resources.h>
+#include <render/render_queue.h>
+#include <render/async_loader.h>
+#include <render/frame_uniforms.h>
+#include <render/occlusion.h>
+#include <render/texture_streaming.h>
+
+#include <memory>
+
+// What the last submit() drew
+struct CityStats {
+	int blocks;
+	int blocksDrawn;
+	int buildings;
+	int buildingsDrawn;
+};
+
+// Procedural buildings (see CitySettings), baked once into static geometry. Every
+// block is one range of a shared vertex and index buffer, so all blocks read through
+// one VAO; blocks are culled against the frustum and the occluders as units, and the
+// visible ones go out as a single multi-draw. Facades are layers of one texture
+// array picked per vertex, the roof is a plain layer after them, so the whole city
+// needs one texture bind. The array streams its mip levels like the models' textures.
+//
+// Buildings are occluders too, and cast shadows through the models' depth program.
+struct City {
+	CitySettings settings;
+	AsyncLoader* loader;
+
+	// Block ranges in the shared buffers, and their boxes and occluders
+	struct BlockRange {
+		AABB bounds;
+		int buildingCount;
+		GLint baseVertex;
+		GLuint firstIndex;
+		GLsizei indexCount;
+	};
+	std::vector<BlockRange> blocks;
+	std::vector<CityBlock> occluders;		// Only the occluder and bounds are kept after upload
+	bool resident;
+
+	GLuint vertexArrayID;
+	GLuint vertexBufferID;
+	GLuint indexBufferID;
+
+	// Draws sample facadeTextureID: the white placeholder array until every layer is
+	// in facadeArrayID
+	GLuint facadeTextureID;
+	GLuint facadeArrayID;
+	GLuint placeholderTextureID;
+	std::shared_ptr<std::vector<MipChain> > facadeLayers;	// Built so far, one chain per layer
+	int facadesLoaded;
+
+	GLuint programID;
+
+	// Identity transform for the depth program, which reads the Object block
+	ObjectBuffer object;
+
+	// Bumped when buildings appear, so the shadow caches redraw them
+	unsigned int casterVersion;
+
+	// Multi-draw arguments of the blocks visible in the last submit()
+	std::vector<GLsizei> drawCounts;
+	std::vector<const void*> drawOffsets;
+	std::vector<GLint> drawBaseVertices;
+	CityStats stats;
+
+	// Blocks are generated on the loader's workers when one is given, right away otherwise
+	void initialize(AsyncLoader* loader, const CitySettings& settings, const std::function<float(float, float)>& height) {
+		this->loader = loader;
+		this->settings = settings;
+		resident = false;
+		vertexArrayID = 0;
+		vertexBufferID = 0;
+		indexBufferID = 0;
+		facadesLoaded = 0;
+		programID = 0;
+		casterVersion = 0;
+		stats = CityStats();
+
+		ObjectBlock block = ObjectBlock();
+		block.modelMatrix = glm::mat4(1.0f);
+		block.baseColorFactor = glm::vec4(1.0f);
+		block.positionScale = glm::vec4(1.0f);
+		object.upload(std::vector<ObjectBlock>(1, block));
+
+		loadFacades();
+
+		// The blocks are small, one job builds them all
+		std::shared_ptr<std::vector<CityBlock> > generated(new std::vector<CityBlock>(settings.blocksX * settings.blocksZ));
+		CitySettings citySettings = settings;
+		std::function<void()> generate = [citySettings, height, generated]() {
+			for (int z = 0; z < citySettings.blocksZ; ++z) {
+				for (int x = 0; x < citySettings.blocksX; ++x) {
+					GenerateCityBlock(citySettings, x, z, height, (*generated)[z * citySettings.blocksX + x]);
+				}
+			}
+		};
+		if (!loader) {
+			generate();
+			upload(*generated);
+			setProgram(AcquireShaders("../FinalPro/shaders/building.vert", "../FinalPro/shaders/building.frag"));
+			return;
+		}
+		loader->submit(generate, [this, generated]() {
+			upload(*generated);
+		});
+		loader->loadShaders("../FinalPro/shaders/building.vert", "../FinalPro/shaders/building.frag", [this](GLuint programID) {
+			setProgram(programID);
+		});
+	}
+
+	void setProgram(GLuint programID) {
+		if (programID == 0) {
+			std::cerr << "Failed to load shaders." << std::endl;
+			return;
+		}
+		this->programID = programID;
+
+		// Facades on unit 0 and shadows on unit 1, as the models' albedo and shadows
+		glUseProgram(programID);
+		glUniform1i(glGetUniformLocation(programID, "facades"), 0);
+		glUniform1i(glGetUniformLocation(programID, "shadowMap"), 1);
+		glUseProgram(0);
+	}
+
+	// Facade layers are decoded and their mip chains built on workers, the roof layer
+	// is a plain colour; once every layer is in, they go to the texture streamer as one
+	// array. The array size is that of the first facade, facades of another size are
+	// reported and left plain.
+	void loadFacades() {
+		int layers = settings.facadeCount + 1;
+		const unsigned char white[4] = { 255, 255, 255, 255 };
+		std::vector<unsigned char> placeholder(layers * 4);
+		for (int layer = 0; layer < layers; ++layer) {
+			std::copy(white, white + 4, &placeholder[layer * 4]);
+		}
+		glGenTextures(1, &placeholderTextureID);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, placeholderTextureID);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_SRGB8_ALPHA8, 1, 1, layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, &placeholder[0]);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		facadeTextureID = placeholderTextureID;
+		facadeArrayID = 0;
+
+		int width = 0, height = 0, channels;
+		if (!stbi_info(facadePath(0).c_str(), &width, &height, &channels)) {
+			std::cout << "Failed to load texture " << facadePath(0) << std::endl;
+			return;
+		}
+
+		facadeLayers.reset(new std::vector<MipChain>(layers));
+		for (int layer = 0; layer < layers; ++layer) {
+			std::shared_ptr<std::vector<MipChain> > chains = facadeLayers;
+			bool roof = layer == settings.facadeCount;
+			std::string path = roof ? std::string() : facadePath(layer);
+			std::function<void()> build = [chains, layer, roof, path, width, height]() {
+				// Concrete grey roofs, plain walls where a facade is missing
+				std::vector<unsigned char> pixels((size_t)width * height * 3, 160);
+				if (roof) {
+					for (size_t i = 0; i < pixels.size(); i += 3) {
+						pixels[i] = 96;
+						pixels[i + 1] = 96;
+						pixels[i + 2] = 100;
+					}
+				}
+				else {
+					int w, h, channels;
+					uint8_t* img = stbi_load(path.c_str(), &w, &h, &channels, 3);
+					if (!img) {
+						std::cout << "Failed to load texture " << path << std::endl;
+					}
+					else if (w == width && h == height) {
+						pixels.assign(img, img + (size_t)w * h * 3);
+					}
+					else {
+						std::cout << "Facade " << path << " is " << w << "x" << h << ", the array is " << width << "x" << height << std::endl;
+					}
+					stbi_image_free(img);
+				}
+				MakeMipChain(&pixels[0], width, height, 3, true, (*chains)[layer]);
+			};
+			std::function<void()> finish = [this, layers]() {
+				if (++facadesLoaded < layers) {
+					return;
+				}
+				MipChain array;
+				StackMipChains(*facadeLayers, array);
+				facadeLayers.reset();
+				facadeArrayID = SharedTextureStreamer().add(0, array);
+				facadeTextureID = facadeArrayID;
+			};
+			if (loader) {
+				loader->submit(build, finish);
+			}
+			else {
+				build();
+				finish();
+			}
+		}
+	}
+
+	std::string facadePath(int layer) const {
+		return "../FinalPro/textures/facade" + std::to_string(layer) + ".jpg";
+	}
+
+	// Packs every block into the shared buffers, 16-bit indices relative to the block
+	void upload(std::vector<CityBlock>& generated) {
+		std::vector<BuildingVertex> vertices;
+		std::vector<unsigned short> indices;
+		blocks.clear();
+		stats.buildings = 0;
+		for (size_t b = 0; b < generated.size(); ++b) {
+			CityBlock& block = generated[b];
+			if (block.buildingCount == 0) {
+				continue;
+			}
+			BlockRange range;
+			range.bounds = block.bounds;
+			range.buildingCount = block.buildingCount;
+			range.baseVertex = (GLint)vertices.size();
+			range.firstIndex = (GLuint)indices.size();
+			range.indexCount = (GLsizei)block.indices.size();
+			blocks.push_back(range);
+			stats.buildings += block.buildingCount;
+
+			vertices.insert(vertices.end(), block.vertices.begin(), block.vertices.end());
+			indices.insert(indices.end(), block.indices.begin(), block.indices.end());
+			std::vector<BuildingVertex>().swap(block.vertices);
+			std::vector<unsigned short>().swap(block.indices);
+			occluders.push_back(block);
+		}
+		stats.blocks = (int)blocks.size();
+		if (blocks.empty()) {
+			return;
+		}
+
+		glGenVertexArrays(1, &vertexArrayID);
+		glBindVertexArray(vertexArrayID);
+		glGenBuffers(1, &vertexBufferID);
+		glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
+		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(BuildingVertex), &vertices[0], GL_STATIC_DRAW);
+		glGenBuffers(1, &indexBufferID);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned short), &indices[0], GL_STATIC_DRAW);
+
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(BuildingVertex), (void*)offsetof(BuildingVertex, position));
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(BuildingVertex), (void*)offsetof(BuildingVertex, normal));
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(BuildingVertex), (void*)offsetof(BuildingVertex, uv));
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		resident = true;
+		casterVersion++;
+	}
+
+	// Whether x, z is on the city's ground, streets included, or within margin of it
+	bool covers(float x, float z, float margin) const {
+		glm::vec2 min, max, corner;
+		CityBlockArea(settings, 0, 0, min, corner);
+		CityBlockArea(settings, settings.blocksX - 1, settings.blocksZ - 1, corner, max);
+		return x >= min.x - margin && x <= max.x + margin && z >= min.y - margin && z <= max.y + margin;
+	}
+
+	// Adds the buildings of every block in the frustum
+	void addOccluders(OcclusionBuffer& occlusion, const Frustum& frustum) const {
+		for (size_t b = 0; b < occluders.size(); ++b) {
+			if (IsAABBVisible(frustum, occluders[b].bounds)) {
+				occlusion.addOccluder(&occluders[b].occluder[0], &occluders[b].occluderIndices[0], occluders[b].occluderIndices.size());
+			}
+		}
+	}
+
+	// Fills the multi-draw arguments with the blocks that pass both tests, and returns
+	// the distance from eye to the nearest of them
+	float cullBlocks(const Frustum& frustum, const glm::vec3& eye, OcclusionBuffer* occlusion) {
+		drawCounts.clear();
+		drawOffsets.clear();
+		drawBaseVertices.clear();
+		stats.buildingsDrawn = 0;
+		float nearest = FLT_MAX;
+		for (size_t b = 0; b < blocks.size(); ++b) {
+			const BlockRange& block = blocks[b];
+			if (!IsAABBVisible(frustum, block.bounds) || (occlusion && !occlusion->isVisible(block.bounds))) {
+				continue;
+			}
+			drawCounts.push_back(block.indexCount);
+			drawOffsets.push_back(BUFFER_OFFSET(block.firstIndex * sizeof(unsigned short)));
+			drawBaseVertices.push_back(block.baseVertex);
+			stats.buildingsDrawn += block.buildingCount;
+			nearest = std::min(nearest, glm::length(glm::clamp(eye, block.bounds.min, block.bounds.max) - eye));
+		}
+		stats.blocksDrawn = (int)drawCounts.size();
+		return nearest;
+	}
+
+	// The facades go on unit 0 as an array, the queue only binds 2D textures
+	static void applyDraw(const DrawItem& item) {
+		const City& city = *(const City*)item.owner;
+		glBindTexture(GL_TEXTURE_2D_ARRAY, city.facadeTextureID);
+	}
+
+	static void drawBlocks(const DrawItem& item) {
+		const City& city = *(const City*)item.owner;
+		glMultiDrawElementsBaseVertex(GL_TRIANGLES, &city.drawCounts[0], GL_UNSIGNED_SHORT, &city.drawOffsets[0],
+			(GLsizei)city.drawCounts.size(), &city.drawBaseVertices[0]);
+	}
+
+	// Culls the blocks and queues the visible ones as one draw. occlusion, when given,
+	// must be finished for this camera.
+	void submit(RenderQueue& queue, const Frustum& frustum, const glm::vec3& eye, OcclusionBuffer* occlusion = NULL) {
+		if (programID == 0 || !resident) {
+			return;
+		}
+		float nearest = cullBlocks(frustum, eye, occlusion);
+		if (drawCounts.empty()) {
+			return;
+		}
+		if (facadeArrayID != 0) {
+			TextureStreamer& streamer = SharedTextureStreamer();
+			streamer.request(facadeArrayID, 1.0f / settings.facadeSize, streamer.pixelsPerUnit(nearest));
+		}
+
+		DrawItem item;
+		item.program = programID;
+		item.texture = 0;
+		item.vertexArray = vertexArrayID;
+		item.blend = false;
+		item.indexCount = 0;
+		item.firstIndex = 0;
+		item.indexType = GL_UNSIGNED_SHORT;
+		item.baseVertex = 0;
+		item.instanceCount = 1;
+		item.apply = applyDraw;
+		item.draw = drawBlocks;
+		item.owner = this;
+		item.userData[0] = 0;
+		item.userData[1] = 0;
+		item.key = queue.makeKey(PASS_OPAQUE, item.blend, item.program, facadeTextureID, item.vertexArray, nearest);
+		queue.submit(item);
+	}
+
+	// Draws the blocks in the light's frustum with the models' depth program, which
+	// takes an instance matrix at locations 3 to 6; the identity is set as a constant.
+	// Returns the draw calls issued.
+	int renderDepth(GLuint programID, GLuint mvpMatrixID, const glm::mat4& lightSpaceMatrix) {
+		if (!resident) {
+			return 0;
+		}
+		cullBlocks(ExtractFrustum(lightSpaceMatrix), glm::vec3(0.0f), NULL);
+		if (drawCounts.empty()) {
+			return 0;
+		}
+		glUseProgram(programID);
+		glUniformMatrix4fv(mvpMatrixID, 1, GL_FALSE, &lightSpaceMatrix[0][0]);
+		object.bind(0);
+		glBindVertexArray(vertexArrayID);
+		glm::mat4 identity(1.0f);
+		for (int column = 0; column < 4; ++column) {
+			glVertexAttrib4fv(3 + column, &identity[column][0]);
+		}
+		glMultiDrawElementsBaseVertex(GL_TRIANGLES, &drawCounts[0], GL_UNSIGNED_SHORT, &drawOffsets[0],
+			(GLsizei)drawCounts.size(), &drawBaseVertices[0]);
+		glBindVertexArray(0);
+		glUseProgram(0);
+		return 1;
+	}
+
+	void cleanup() {
+		glDeleteVertexArrays(1, &vertexArrayID);
+		glDeleteBuffers(1, &vertexBufferID);
+		glDeleteBuffers(1, &indexBufferID);
+		SharedTextureStreamer().remove(facadeArrayID);
+		glDeleteTextures(1, &facadeArrayID);
+		glDeleteTextures(1, &placeholderTextureID);
+		object.cleanup();
+		ReleaseShaders(programID);
+		blocks.clear();
+		occluders.clear();
+		resident = false;
+	}
+};
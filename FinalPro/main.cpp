@@ -4,17 +4,19 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include <render/shader.h>
+#include <render/program_cache.h>
+#include <render/shadows.h>
+#include <render/profiler.h>
 
 #include <vector>
 #include <iostream>
 #define _USE_MATH_DEFINES
 #include <math.h>
 
-#include <assimp/Importer.hpp>
-#include <assimp/scene.h>
-#include <assimp/postprocess.h>
 #include <glm/gtc/type_ptr.hpp>
 
+#include "scene.cpp"
+
 static GLFWwindow *window;
 static void key_callback(GLFWwindow *window, int key, int scancode, int action, int mode);
 
@@ -28,6 +30,12 @@ static float viewAzimuth = 0.f;
 static float viewPolar = 0.f;
 static float viewDistance = 300.0f;
 
+// Set by the P key, the profile is written at the end of the frame
+static bool dumpProfile = false;
+
+// Video memory the textures stream within; the smallest mips always stay resident
+static const size_t textureBudgetMB = 32;
+
 
 
 
@@ -40,7 +48,8 @@ int main(void)
 		return -1;
 	}
 
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+	// GL 4.3 enables the GPU-driven path; without it everything runs on 3.3
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE); // For MacOS
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
@@ -48,6 +57,12 @@ int main(void)
 	// Open a window and create its OpenGL context
 	window = glfwCreateWindow(1024, 768, "Lab 2", NULL, NULL);
 	if (window == NULL)
+	{
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+		window = glfwCreateWindow(1024, 768, "Lab 2", NULL, NULL);
+	}
+	if (window == NULL)
 	{
 		std::cerr << "Failed to open a GLFW window." << std::endl;
 		glfwTerminate();
@@ -66,6 +81,11 @@ int main(void)
 		std::cerr << "Failed to initialize OpenGL context." << std::endl;
 		return -1;
 	}
+	bool gpuDriven = LoadGpuCullingFunctions(glfwGetProcAddress);
+	// Linked programs are stored next to the executable and loaded instead of compiled
+	SharedProgramCache().initialize(glfwGetProcAddress, "program_binaries.bin");
+	SharedProfiler().initializeGpu();
+	std::cout << (gpuDriven ? "GPU-driven culling (GL 4.3)" : "CPU culling (GL 3.3)") << std::endl;
 
 	// Background
 	glClearColor(0.2f, 0.2f, 0.25f, 0.0f);
@@ -73,23 +93,23 @@ int main(void)
 	glEnable(GL_DEPTH_TEST);
 	glEnable(GL_CULL_FACE);
 
-	// TODO: Create more buildings
-	// ---------------------------
-	
-
-	
-	std::vector<glm::vec3> treePositions = {
-		glm::vec3(0.0f, 0.0f, -5.0f),
-		glm::vec3(-5.0f, 0.0f, -10.0f),
-		glm::vec3(100.0f, 0.0f, -15.0f),
-		glm::vec3(15.0f, 0.0f, -20.0f),
-		// Add more positions as needed
-	};
+	// Set before any texture loads, streaming applies to those loaded after
+	SharedTextureStreamer().initialize(textureBudgetMB << 20);
 
+	// Assets stream in on worker threads; the window comes up right away and every
+	// frame spends a bounded slice on the GL side of the loading
+	AsyncLoader loader;
+	loader.start();
+	double loadStart = glfwGetTime();
+	bool assetsResident = false;
 
+	glm::float32 FoV = 45;
+	glm::float32 zNear = 0.1f;
+	glm::float32 zFar = 1000.0f;
 
-    
-	// ---------------------------m
+	// Terrain, city and trees, see Scene
+	Scene scene;
+	scene.initialize(loader, gpuDriven, zFar);
 
 	// Camera setup
 	eye_center.y = viewDistance * cos(viewPolar);
@@ -97,37 +117,64 @@ int main(void)
 	eye_center.z = viewDistance * sin(viewAzimuth);
 
 	glm::mat4 viewMatrix, projectionMatrix;
-	glm::float32 FoV = 45;
-	glm::float32 zNear = 0.1f;
-	glm::float32 zFar = 1000.0f;
 	projectionMatrix = glm::perspective(glm::radians(FoV), 4.0f / 3.0f, zNear, zFar);
-     
 
+	double lastFrame = glfwGetTime();
 	do
 	{
+		double now = glfwGetTime();
+		float deltaTime = (float)(now - lastFrame);
+		lastFrame = now;
+
+		SharedProfiler().beginFrame();
+		PROFILE_SCOPE("Frame");
+
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-		viewMatrix = glm::lookAt(eye_center, lookat, up);
-		glm::mat4 vp = projectionMatrix * viewMatrix;
-		// Modify tree positions and make sure they're within the camera's view.
-		
+		// Finish whatever the loader has ready, within 2 ms
+		{
+			PROFILE_SCOPE("Loader pump");
+			loader.pump(2.0);
+		}
+		if (!assetsResident && loader.isIdle()) {
+			assetsResident = true;
+			std::cout << "Assets resident after " << (glfwGetTime() - loadStart) * 1000.0 << " ms" << std::endl;
+		}
 
-		//TreeModel.Draw(modelShader, vp);
-		// Render the building
-		// b.render(vp);
-		// rendering my grass terrain (flat)
-	
+		viewMatrix = glm::lookAt(eye_center, lookat, up);
+		scene.render(viewMatrix, projectionMatrix, eye_center, glm::radians(FoV), 4.0f / 3.0f, zNear, 0, 1024, 768, deltaTime);
 
 		// Swap buffers
-		glfwSwapBuffers(window);
+		{
+			PROFILE_SCOPE("Swap buffers");
+			glfwSwapBuffers(window);
+		}
 		glfwPollEvents();
 
+		if (dumpProfile) {
+			dumpProfile = false;
+			SharedProfiler().writeChromeTrace("profile.json");
+		}
+
 	} // Check if the ESC key was pressed or the window was closed
 	while (!glfwWindowShouldClose(window));
 
 	// Clean up
 	// b.cleanup();
+	loader.shutdown();
+	scene.cleanup();
 
+	PrintResourceStats("Textures", GetTextureStats());
+	PrintResourceStats("Shaders", GetShaderStats());
+	std::cout << "Programs: " << SharedProgramCache().stats.binaryHits << " loaded from binaries, "
+		<< SharedProgramCache().stats.compiled << " compiled" << std::endl;
+	SharedProgramCache().save();
+	PrintResourceStats("Meshes", Model::meshStats());
+	scene.printStats();
+
+
+	SharedProfiler().writeChromeTrace("profile.json");
+	SharedProfiler().cleanup();
 
 	// Close OpenGL window and terminate GLFW
 	glfwTerminate();
@@ -174,6 +221,11 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
 		eye_center.z = viewDistance * sin(viewAzimuth);
 	}
 
+	if (key == GLFW_KEY_P && action == GLFW_PRESS)
+	{
+		dumpProfile = true;
+	}
+
 	if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS)
 		glfwSetWindowShouldClose(window, GL_TRUE);
 }
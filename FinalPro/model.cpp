@@ -1,66 +1,253 @@
 #include <render/texture.h>
 #include <render/shader.h>
+#include <render/frustum.h>
+#include <render/mesh.h>
+#include <render/simplify.h>
+#include <render/mesh_optimize.h>
+#include <render/async_loader.h>
+#include <render/resources.h>
+#include <render/geometry_arena.h>
+#include <render/render_queue.h>
+#include <render/gpu_culling.h>
+#include <render/occlusion.h>
+#include <render/profiler.h>
+#include <render/frame_uniforms.h>
+#include <render/scene_graph.h>
+#include <render/animation.h>
+#include <render/obj_loader.h>
+#include <render/impostor.h>
+#include <render/texture_streaming.h>
+
+#include <tuple>
 
 #define BUFFER_OFFSET(i) ((char *)NULL + (i))
 
+// Detail levels kept per primitive, LOD 0 is the mesh as imported
+#define MODEL_LOD_COUNT 4
+
 struct Model {
-    // Shader variable IDs
-    GLuint mvpMatrixID;
+    // Shader variable IDs; the camera and materials come in uniform blocks.
+    // jointMatricesID is the joint palette sampler.
     GLuint jointMatricesID;
     GLuint programID;
     GLuint textureSamplerID;
-    GLuint modelMatrixID;
-    GLuint baseColorFactorID;
-    GLuint isLightID;
 
-    glm::mat4 modelMatrix;
+    // Place in the shared scene graph: rootNode holds the translation and scale given
+    // to initialize() and the asset's glTF nodes hang below it. The object blocks and
+    // world bounds were last built from the graph at sceneVersion.
+    SceneNode rootNode;
+    std::vector<SceneNode> nodes;
+    unsigned int sceneVersion;
+
+    // Per-instance world matrices, streamed to vertex attributes 3-6
+    GLuint instanceBufferID;
+    std::vector<glm::mat4> instanceMatrices;
+
+    // Skinning. The skeleton and its clips are shared by every Model of the file; each
+    // instance has its own playback state and joint palette, see animate()
+    std::shared_ptr<const Skeleton> skeleton;
+    std::vector<AnimationState> animationStates;
+    std::vector<glm::mat4> jointPalettes;
+    JointPaletteBuffer paletteBuffer;
+    GLuint instancePaletteBufferID;     // First palette entry of each visible instance, attribute 7
+    std::vector<GLint> visiblePalettes;
+
+    // Bumped whenever instances or geometry change, so cached shadow maps know to redraw
+    unsigned int casterVersion;
+
+    // World-space bounds of every instance, and of every primitive of every instance
+    AABBList instanceBounds;
+    std::vector<AABBList> primitiveInstanceBounds;
+    AABB instanceExtent;                    // All instances together
+
+    // Smallest axis scale of each primitive's world transform over every instance,
+    // where its texture is densest in world space
+    std::vector<float> primitiveScales;
+
+    // Scratch state for the instances that survive culling in the current pass
+    std::vector<unsigned char> instanceVisible;
+    std::vector<unsigned char> primitiveVisible;
+    std::vector<unsigned char> primitiveInstanceVisible;
+    std::vector<unsigned int> visibleInstances;
+    std::vector<glm::mat4> visibleMatrices;
+    CullStats cullStats;                // Of the last camera pass on the CPU, see readCullStats()
+
+    // LOD selection. An instance drops to level i + 1 once its projected size, as a
+    // fraction of the viewport height, falls below lodScreenSizes[i]. The hysteresis
+    // band stops instances sitting on a threshold from switching every frame.
+    float lodScreenSizes[MODEL_LOD_COUNT - 1];
+    float lodHysteresis;
+    std::vector<unsigned char> instanceLod;
+    std::vector<float> instanceDepth;   // View depth from the last selectLods()
+    std::vector<unsigned char> casterLod;   // Of the last shadow cascade drawn, see selectCasterLods()
+
+    // Visible instances are uploaded grouped by LOD, group i starts at lodGroupStart[i].
+    // Group MODEL_LOD_COUNT holds the impostors.
+    GLsizei lodGroupStart[MODEL_LOD_COUNT + 2];
+
+    // Octahedral impostor (impostor.h). Instances whose projected size falls below
+    // impostorScreenSize draw as one camera-facing quad each, whatever their mesh LOD
+    // would be; 0 disables them. The atlas is baked in the asset's own space, below
+    // the root node, so it does not depend on where the model is placed.
+    float impostorScreenSize;
+    ImpostorAtlas impostor;
+    GLuint impostorProgramID;
+    GLint impostorSphereID;
+    GLint impostorRootID;
+    std::string assetPath;
+
+    // GPU-driven path (GL 4.3): every instance stays on the GPU, cull.comp culls them
+    // and picks LODs, and each batch of primitives sharing a VAO and material goes out
+    // as one glMultiDrawElementsIndirect
+    struct GpuBatch {
+        int primitive;          // Supplies the material and VAO of the batch
+        GLuint firstCommand;
+        GLsizei commandCount;
+    };
+    bool gpuDriven;
+    bool gpuDirty;
+    GpuCuller gpuCuller;
+    std::vector<GpuBatch> gpuBatches;
+
+    // Used by render() alone; set its depthRange to the camera's far plane
+    RenderQueue renderQueue;
 
     tinygltf::Model model;
 
-    // Each VAO corresponds to each mesh primitive in the GLTF model
+    // Surface parameters shared by the glTF and OBJ import paths. The importers only
+    // record where the texture comes from; textureID is filled in on the GL thread.
+    struct PrimitiveMaterial {
+        GLuint textureID;
+        int gltfTexture;            // Index into the glTF textures, -1 if none
+        std::string texturePath;    // Image file for OBJ materials, empty if none
+        glm::vec4 baseColorFactor;
+        bool isLight;
+    };
+
+    // A node of the asset's hierarchy in parent-sorted order; parent indexes the same
+    // list, -1 for nodes directly under the model's root
+    struct ModelNode {
+        int parent;
+        int skin;           // Skin bound at the node, index into the skeleton's skins or -1
+        glm::vec3 translation;
+        glm::quat rotation;
+        glm::vec3 scale;
+    };
+
+    // One decoded mesh drawn at one node. A glTF mesh used by several nodes is
+    // decoded and uploaded once and placed once per node. node -1 is the root.
+    struct PrimitivePlacement {
+        int mesh;
+        int node;
+    };
+
+    // Everything the CPU side of an import produces. Filled without any GL call, so
+    // the async path can build it on a worker thread.
+    struct ModelImport {
+        tinygltf::Model gltf;
+        std::vector<MeshPrimitive> meshes;
+        std::vector<PrimitiveMaterial> materials;
+        std::vector<ModelNode> nodes;
+        std::vector<PrimitivePlacement> placements;
+        std::shared_ptr<Skeleton> skeleton;     // Only for files with skins
+        bool loaded;
+    };
+
+    // A mesh primitive's range in the shared geometry arena; all of its LODs share the
+    // vertices and live back to back in the index range
     struct PrimitiveObject {
-        GLuint vao;
-        std::map<int, GLuint> vbos;
-        int indexCount;
-        GLenum indexType;
+        GeometryRange geometry;
+        MeshLod lods[MODEL_LOD_COUNT];
         GLuint textureID;
         glm::vec4 baseColorFactor;
         bool isLight;
+        AABB bounds;    // Object space, from the POSITION accessor
+        float uvDensity;    // Texture coordinates per object unit of LOD 0
+        VertexQuantization quantization;    // Decodes packed vertices, identity for floats
+        int node;       // Index into nodes, -1 for the root
+        int skin;       // Index into the skeleton's skins, -1 if not skinned
     };
     std::vector<PrimitiveObject> primitiveObjects;
 
-    glm::mat4 getNodeTransform(const tinygltf::Node& node) {
-        glm::mat4 transform(1.0f);
+    // Object block of every primitive, in primitiveObjects order. The blocks carry the
+    // node transforms, so unlike the geometry they belong to this Model alone.
+    ObjectBuffer objects;
+
+    // GPU geometry, materials, textures and node hierarchy of one file, shared by every
+    // Model loaded from it. geometry lists every arena range once, however many
+    // primitives draw it.
+    struct SharedMeshes {
+        std::vector<PrimitiveObject> primitives;
+        std::vector<GeometryRange> geometry;
+        std::vector<ModelNode> nodes;
+        std::shared_ptr<const Skeleton> skeleton;
+        std::vector<GLuint> textureIDs;
+    };
+    std::string meshKey;
+
+    static ResourceCache<SharedMeshes>& meshCache() {
+        static ResourceCache<SharedMeshes> cache;
+        return cache;
+    }
+
+    static ResourceStats meshStats() {
+        return meshCache().stats();
+    }
+
+    // Local transform of a glTF node. A matrix is split back into TRS, which the glTF
+    // spec guarantees is possible.
+    ModelNode readNode(const tinygltf::Node& node, int parent) {
+        ModelNode result;
+        result.parent = parent;
+        result.skin = -1;
+        result.translation = glm::vec3(0.0f);
+        result.rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+        result.scale = glm::vec3(1.0f);
 
         if (node.matrix.size() == 16) {
-            transform = glm::make_mat4(node.matrix.data());
+            glm::mat4 matrix = glm::make_mat4(node.matrix.data());
+            result.translation = glm::vec3(matrix[3]);
+            result.scale = glm::vec3(glm::length(glm::vec3(matrix[0])), glm::length(glm::vec3(matrix[1])), glm::length(glm::vec3(matrix[2])));
+            glm::mat3 rotation(glm::vec3(matrix[0]) / result.scale.x, glm::vec3(matrix[1]) / result.scale.y, glm::vec3(matrix[2]) / result.scale.z);
+            result.rotation = glm::quat_cast(rotation);
         }
         else {
             if (node.translation.size() == 3) {
-                transform = glm::translate(transform, glm::vec3(node.translation[0], node.translation[1], node.translation[2]));
+                result.translation = glm::vec3(node.translation[0], node.translation[1], node.translation[2]);
             }
             if (node.rotation.size() == 4) {
-                glm::quat q(node.rotation[3], node.rotation[0], node.rotation[1], node.rotation[2]);
-                transform *= glm::mat4_cast(q);
+                result.rotation = glm::quat((float)node.rotation[3], (float)node.rotation[0], (float)node.rotation[1], (float)node.rotation[2]);
             }
             if (node.scale.size() == 3) {
-                transform = glm::scale(transform, glm::vec3(node.scale[0], node.scale[1], node.scale[2]));
+                result.scale = glm::vec3(node.scale[0], node.scale[1], node.scale[2]);
             }
         }
-        return transform;
+        return result;
     }
 
-    void computeGlobalNodeTransform(const tinygltf::Model& model,
-        int nodeIndex,
-        const glm::mat4& parentTransform,
-        std::vector<glm::mat4>& globalTransforms) {
-        const tinygltf::Node& node = model.nodes[nodeIndex];
-        glm::mat4 currentTransform = parentTransform * getNodeTransform(node);
-
-        globalTransforms[nodeIndex] = currentTransform;
+    // Depth-first, so every node is listed after its parent. Each mesh primitive of the
+    // node is placed at it. nodeMap receives the imported index of each glTF node.
+    void importNode(const tinygltf::Model& model, int nodeIndex, int parent, const std::vector<std::vector<int> >& meshPrimitives,
+        std::vector<int>& nodeMap, ModelImport& import) {
+        if (nodeIndex < 0 || nodeIndex >= (int)model.nodes.size() || nodeMap[nodeIndex] >= 0) {
+            return;
+        }
 
-        for (int childIndex : node.children) {
-            computeGlobalNodeTransform(model, childIndex, currentTransform, globalTransforms);
+        const tinygltf::Node& node = model.nodes[nodeIndex];
+        int index = (int)import.nodes.size();
+        nodeMap[nodeIndex] = index;
+        import.nodes.push_back(readNode(node, parent));
+
+        if (node.mesh >= 0 && node.mesh < (int)meshPrimitives.size()) {
+            for (size_t i = 0; i < meshPrimitives[node.mesh].size(); ++i) {
+                PrimitivePlacement placement;
+                placement.mesh = meshPrimitives[node.mesh][i];
+                placement.node = index;
+                import.placements.push_back(placement);
+            }
+        }
+        for (size_t c = 0; c < node.children.size(); ++c) {
+            importNode(model, node.children[c], index, meshPrimitives, nodeMap, import);
         }
     }
 
@@ -86,6 +273,288 @@ struct Model {
         return res;
     }
 
+    // Wavefront OBJ/MTL through LoadObj, producing the same primitives as the glTF path
+    bool loadObj(const char* filename, std::vector<MeshPrimitive>& meshes, std::vector<PrimitiveMaterial>& materials, WorkerPool* workers) {
+        std::vector<ObjMaterial> objMaterials;
+        if (!LoadObj(filename, meshes, objMaterials, workers)) {
+            std::cout << "Failed to load OBJ: " << filename << std::endl;
+            return false;
+        }
+
+        for (size_t m = 0; m < objMaterials.size(); ++m) {
+            PrimitiveMaterial material;
+            material.textureID = 0;
+            material.gltfTexture = -1;
+            material.isLight = false;
+            material.baseColorFactor = objMaterials[m].diffuse;
+            material.texturePath = objMaterials[m].texturePath;
+            materials.push_back(material);
+        }
+
+        std::cout << " Succesfullyloaded OBJ: " << filename << std::endl;
+        return true;
+    }
+
+    // Replace the set of copies drawn by render(). Each transform places one copy
+    // of the model in the world and is applied on top of the scene graph transforms.
+    void setInstances(const std::vector<glm::mat4>& transforms) {
+        instanceMatrices = transforms;
+        animationStates.resize(instanceMatrices.size());
+        instanceLod.resize(instanceMatrices.size(), 0);
+        instanceDepth.resize(instanceMatrices.size(), 0.0f);
+        casterLod.resize(instanceMatrices.size(), 0);
+
+        updateInstanceBounds();
+        uploadInstances(instanceMatrices);
+    }
+
+    // Orphan the previous storage so the driver does not stall on in-flight draws
+    void uploadInstances(const std::vector<glm::mat4>& matrices) {
+        glBindBuffer(GL_ARRAY_BUFFER, instanceBufferID);
+        glBufferData(GL_ARRAY_BUFFER, matrices.size() * sizeof(glm::mat4), NULL, GL_DYNAMIC_DRAW);
+        if (!matrices.empty()) {
+            glBufferSubData(GL_ARRAY_BUFFER, 0, matrices.size() * sizeof(glm::mat4), &matrices[0][0][0]);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // World transform of a primitive's node, without the instance transform
+    const glm::mat4& primitiveWorld(const PrimitiveObject& primitive) const {
+        return SharedSceneGraph().world(primitive.node < 0 ? rootNode : nodes[primitive.node]);
+    }
+
+    // Instances only move through setInstances() and nodes through the scene graph, so
+    // their world bounds are computed here once rather than every frame
+    void updateInstanceBounds() {
+        casterVersion++;
+        gpuDirty = true;
+        instanceBounds.resize(instanceMatrices.size());
+        primitiveInstanceBounds.resize(primitiveObjects.size());
+        primitiveScales.assign(primitiveObjects.size(), FLT_MAX);
+        for (size_t p = 0; p < primitiveObjects.size(); ++p) {
+            primitiveInstanceBounds[p].resize(instanceMatrices.size());
+        }
+
+        for (size_t i = 0; i < instanceMatrices.size(); ++i) {
+            AABB merged;
+            for (size_t p = 0; p < primitiveObjects.size(); ++p) {
+                glm::mat4 world = instanceMatrices[i] * primitiveWorld(primitiveObjects[p]);
+                AABB box = TransformAABB(primitiveObjects[p].bounds, world);
+                primitiveInstanceBounds[p].set(i, box);
+                merged = p == 0 ? box : MergeAABB(merged, box);
+                glm::vec3 axes(glm::length(glm::vec3(world[0])), glm::length(glm::vec3(world[1])), glm::length(glm::vec3(world[2])));
+                primitiveScales[p] = std::min(primitiveScales[p], std::min(axes.x, std::min(axes.y, axes.z)));
+            }
+            if (!primitiveObjects.empty()) {
+                instanceBounds.set(i, merged);
+                instanceExtent = i == 0 ? merged : MergeAABB(instanceExtent, merged);
+            }
+        }
+    }
+
+    // Asks the texture streamer for the levels the primitives need with the nearest
+    // instance drawn as a mesh at viewDepth; only those visible in the last cull unless
+    // allPrimitives
+    void requestTextures(float viewDepth, bool allPrimitives) {
+        TextureStreamer& streamer = SharedTextureStreamer();
+        float pixelsPerUnit = streamer.pixelsPerUnit(viewDepth);
+        for (size_t p = 0; p < primitiveObjects.size(); ++p) {
+            const PrimitiveObject& primitive = primitiveObjects[p];
+            if (primitive.textureID != 0 && (allPrimitives || primitiveVisible[p])) {
+                streamer.request(primitive.textureID, primitive.uvDensity / std::max(primitiveScales[p], 1e-6f), pixelsPerUnit);
+            }
+        }
+    }
+
+    // Cull every instance against the frustum and the occluders, if any, and then every
+    // primitive against the frustum, collecting the surviving instances in
+    // visibleInstances and the counts in stats. Returns how many are left to draw.
+    GLsizei cullInstances(const Frustum& frustum, CullStats& stats, OcclusionBuffer* occlusion = NULL) {
+        ResetCullStats(stats);
+
+        size_t visibleCount = CullAABBs(frustum, instanceBounds, instanceVisible);
+        if (occlusion && visibleCount > 0) {
+            size_t unoccluded = occlusion->cullAABBs(instanceBounds, instanceVisible);
+            stats.instancesOccluded = (int)(visibleCount - unoccluded);
+            visibleCount = unoccluded;
+        }
+        stats.instancesVisible = (int)visibleCount;
+        stats.instancesCulled = (int)(instanceMatrices.size() - visibleCount);
+
+        // A primitive is drawn if any visible instance sees it
+        primitiveVisible.assign(primitiveObjects.size(), 0);
+        for (size_t p = 0; p < primitiveObjects.size() && visibleCount > 0; ++p) {
+            CullAABBs(frustum, primitiveInstanceBounds[p], primitiveInstanceVisible);
+            for (size_t i = 0; i < instanceVisible.size(); ++i) {
+                if (instanceVisible[i] & primitiveInstanceVisible[i]) {
+                    primitiveVisible[p] = 1;
+                    break;
+                }
+            }
+            stats.primitivesVisible += primitiveVisible[p];
+        }
+        stats.primitivesCulled = (int)primitiveObjects.size() - stats.primitivesVisible;
+
+        visibleInstances.clear();
+        if (visibleCount == 0 || stats.primitivesVisible == 0) {
+            return 0;
+        }
+
+        for (size_t i = 0; i < instanceVisible.size(); ++i) {
+            if (instanceVisible[i]) {
+                visibleInstances.push_back((unsigned int)i);
+            }
+        }
+        return (GLsizei)visibleInstances.size();
+    }
+
+    // Choose a LOD for every visible instance from the projected size of its bounding
+    // sphere. Impostors have their own threshold and hysteresis band; an instance coming
+    // back from one starts at the last mesh LOD.
+    void selectLods(const glm::mat4& cameraMatrix) {
+        bool impostors = impostorsActive();
+        // For a perspective view-projection, the length of the second row is the
+        // projection's y scale and the fourth row gives the view depth (clip w)
+        glm::vec3 row1(cameraMatrix[0][1], cameraMatrix[1][1], cameraMatrix[2][1]);
+        glm::vec4 row3(cameraMatrix[0][3], cameraMatrix[1][3], cameraMatrix[2][3], cameraMatrix[3][3]);
+        float yScale = glm::length(row1);
+
+        for (size_t v = 0; v < visibleInstances.size(); ++v) {
+            unsigned int i = visibleInstances[v];
+            glm::vec3 boxMin(instanceBounds.minX[i], instanceBounds.minY[i], instanceBounds.minZ[i]);
+            glm::vec3 boxMax(instanceBounds.maxX[i], instanceBounds.maxY[i], instanceBounds.maxZ[i]);
+            glm::vec3 center = (boxMin + boxMax) * 0.5f;
+            float radius = glm::length(boxMax - boxMin) * 0.5f;
+
+            float depth = std::max(glm::dot(row3, glm::vec4(center, 1.0f)), 1e-4f);
+            instanceDepth[i] = depth;
+            float screenSize = radius * yScale / depth;
+
+            int lod = meshLodForSize(screenSize, std::min((int)instanceLod[i], MODEL_LOD_COUNT - 1), lodHysteresis);
+            bool impostor = instanceLod[i] == MODEL_LOD_COUNT;
+            if (impostors && screenSize < impostorScreenSize * (impostor ? 1.0f + lodHysteresis : 1.0f - lodHysteresis)) {
+                lod = MODEL_LOD_COUNT;
+            }
+            instanceLod[i] = (unsigned char)lod;
+        }
+    }
+
+    // Mesh LOD for a projected size, moving from lod only once the size is past a
+    // threshold by the hysteresis fraction
+    int meshLodForSize(float screenSize, int lod, float hysteresis) const {
+        while (lod < MODEL_LOD_COUNT - 1 && screenSize < lodScreenSizes[lod] * (1.0f - hysteresis)) {
+            lod++;
+        }
+        while (lod > 0 && screenSize > lodScreenSizes[lod - 1] * (1.0f + hysteresis)) {
+            lod--;
+        }
+        return lod;
+    }
+
+    // LODs of the visible casters seen from a shadow cascade, from the same thresholds
+    // as selectLods() against the cascade's extent. The orthographic projection has no
+    // depth to divide by, and each cascade is drawn from scratch, so there is no
+    // hysteresis; casters are never impostors, whose quads would cast flat shadows.
+    void selectCasterLods(const glm::mat4& lightSpaceMatrix) {
+        glm::vec3 row1(lightSpaceMatrix[0][1], lightSpaceMatrix[1][1], lightSpaceMatrix[2][1]);
+        float yScale = glm::length(row1);
+
+        for (size_t v = 0; v < visibleInstances.size(); ++v) {
+            unsigned int i = visibleInstances[v];
+            glm::vec3 boxMin(instanceBounds.minX[i], instanceBounds.minY[i], instanceBounds.minZ[i]);
+            glm::vec3 boxMax(instanceBounds.maxX[i], instanceBounds.maxY[i], instanceBounds.maxZ[i]);
+            float radius = glm::length(boxMax - boxMin) * 0.5f;
+            casterLod[i] = (unsigned char)meshLodForSize(radius * yScale, 0, 0.0f);
+        }
+    }
+
+    bool impostorsActive() const {
+        return impostorScreenSize > 0.0f && impostor.ready() && impostorProgramID != 0 && !skeleton;
+    }
+
+    // Counting sort of the visible instances by their entry in lods, impostors last,
+    // then upload them in that order
+    void uploadVisibleInstances(const std::vector<unsigned char>& lods) {
+        GLsizei counts[MODEL_LOD_COUNT + 1] = { 0 };
+        for (size_t v = 0; v < visibleInstances.size(); ++v) {
+            counts[lods[visibleInstances[v]]]++;
+        }
+
+        lodGroupStart[0] = 0;
+        for (int lod = 0; lod <= MODEL_LOD_COUNT; ++lod) {
+            lodGroupStart[lod + 1] = lodGroupStart[lod] + counts[lod];
+        }
+
+        GLsizei cursor[MODEL_LOD_COUNT + 1];
+        for (int lod = 0; lod <= MODEL_LOD_COUNT; ++lod) {
+            cursor[lod] = lodGroupStart[lod];
+        }
+
+        visibleMatrices.resize(visibleInstances.size());
+        visiblePalettes.resize(skeleton ? visibleInstances.size() : 0);
+        for (size_t v = 0; v < visibleInstances.size(); ++v) {
+            unsigned int i = visibleInstances[v];
+            GLsizei slot = cursor[lods[i]]++;
+            visibleMatrices[slot] = instanceMatrices[i];
+            if (skeleton) {
+                visiblePalettes[slot] = (GLint)(i * skeleton->paletteSize);
+            }
+        }
+        uploadInstances(visibleMatrices);
+
+        // Palette starts follow the same order, so skinned draws find their instance's joints
+        if (skeleton) {
+            glBindBuffer(GL_ARRAY_BUFFER, instancePaletteBufferID);
+            glBufferData(GL_ARRAY_BUFFER, visiblePalettes.size() * sizeof(GLint), NULL, GL_DYNAMIC_DRAW);
+            if (!visiblePalettes.empty()) {
+                glBufferSubData(GL_ARRAY_BUFFER, 0, visiblePalettes.size() * sizeof(GLint), &visiblePalettes[0]);
+            }
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+        }
+    }
+
+    // A mat4 attribute occupies four consecutive locations, one per column
+    static void bindInstanceAttributes(GLuint buffer, GLsizeiptr byteOffset) {
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        for (int column = 0; column < 4; ++column) {
+            glEnableVertexAttribArray(3 + column);
+            glVertexAttribPointer(3 + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+                BUFFER_OFFSET(byteOffset + sizeof(glm::vec4) * column));
+            glVertexAttribDivisor(3 + column, 1);
+        }
+    }
+
+    // Palette start per instance at location 7, disabled for models without skins as the
+    // VAO is shared with them
+    static void bindPaletteAttribute(GLuint buffer, GLsizeiptr byteOffset) {
+        if (buffer == 0) {
+            glDisableVertexAttribArray(7);
+            return;
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glEnableVertexAttribArray(7);
+        glVertexAttribIPointer(7, 1, GL_INT, sizeof(GLint), BUFFER_OFFSET(byteOffset));
+        glVertexAttribDivisor(7, 1);
+    }
+
+    // Whether a glTF texture holds colour (sRGB) rather than data: only textures no
+    // material uses as base colour or emission and some uses as a normal, occlusion or
+    // metallic-roughness map are sampled linearly
+    static bool isColorTexture(const tinygltf::Model& model, int textureIndex) {
+        bool data = false;
+        for (size_t m = 0; m < model.materials.size(); ++m) {
+            const tinygltf::Material& material = model.materials[m];
+            if (material.pbrMetallicRoughness.baseColorTexture.index == textureIndex ||
+                material.emissiveTexture.index == textureIndex) {
+                return true;
+            }
+            data = data || material.normalTexture.index == textureIndex ||
+                material.occlusionTexture.index == textureIndex ||
+                material.pbrMetallicRoughness.metallicRoughnessTexture.index == textureIndex;
+        }
+        return !data;
+    }
+
     std::vector<GLuint> loadTextures(const tinygltf::Model& model) {
         std::vector<GLuint> textureIDs(model.textures.size(), 0);
 
@@ -93,13 +562,25 @@ struct Model {
             const tinygltf::Texture& texture = model.textures[i];
             const tinygltf::Image& image = model.images[texture.source];
 
+            // Embedded images have no path, identical pixels share one texture
+            bool srgb = isColorTexture(model, (int)i);
+            std::string key = ContentKey(image.image.data(), image.image.size()) + (srgb ? "" : "#linear");
+            if (AcquireCachedTexture(key, textureIDs[i])) {
+                continue;
+            }
+
             GLuint texID;
             glGenTextures(1, &texID);
             glBindTexture(GL_TEXTURE_2D, texID);
 
-            // Upload texture data to OpenGL
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, image.width, image.height, 0,
-                GL_RGBA, GL_UNSIGNED_BYTE, image.image.data());
+            // Upload texture data to OpenGL in the layout tinygltf decoded it to
+            GLenum format;
+            GLint internalFormat;
+            ImageFormat(image.component, srgb, format, internalFormat);
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, image.width, image.height, 0,
+                format, GL_UNSIGNED_BYTE, image.image.data());
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 
             // Set texture parameters
             glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -110,296 +591,1273 @@ struct Model {
             glGenerateMipmap(GL_TEXTURE_2D);
 
             textureIDs[i] = texID;
+            InsertCachedTexture(key, texID);
             glBindTexture(GL_TEXTURE_2D, 0); // Unbind texture
         }
 
         return textureIDs;
     }
 
-    void initialize(GLuint programID, glm::vec3 translation, glm::vec3 scale, const char * filepath) {
-        // Modify your path if needed
-        if (!loadModel(model, filepath /*"../final/model/tree/tree_small_02_1k.gltf"*/)) {
+    // GL-side setup that does not depend on the asset: root node, LOD settings and
+    // the instance buffer
+    void prepare(glm::vec3 translation, glm::vec3 scale) {
+        // Scale and translate the model
+        rootNode = SharedSceneGraph().create(NO_SCENE_NODE);
+        SharedSceneGraph().setLocal(rootNode, translation, glm::quat(1.0f, 0.0f, 0.0f, 0.0f), scale);
+        SharedSceneGraph().update();
+        nodes.clear();
+        sceneVersion = 0;
+
+        lodScreenSizes[0] = 0.25f;
+        lodScreenSizes[1] = 0.1f;
+        lodScreenSizes[2] = 0.04f;
+        lodHysteresis = 0.15f;
+
+        programID = 0;
+        casterVersion = 0;
+        gpuDriven = false;
+        ResetCullStats(cullStats);
+
+        impostorScreenSize = 0.0f;
+        impostorProgramID = 0;
+        impostorSphereID = -1;
+        impostorRootID = -1;
+
+        // Instance buffer must exist before the VAOs reference it; start with a single copy
+        glGenBuffers(1, &instanceBufferID);
+        glGenBuffers(1, &instancePaletteBufferID);
+        setInstances(std::vector<glm::mat4>(1, glm::mat4(1.0f)));
+    }
+
+    // Instantiates the asset's nodes below the root
+    void placeNodes(const std::vector<ModelNode>& assetNodes) {
+        SceneGraph& graph = SharedSceneGraph();
+        nodes.resize(assetNodes.size());
+        for (size_t n = 0; n < assetNodes.size(); ++n) {
+            const ModelNode& node = assetNodes[n];
+            nodes[n] = graph.create(node.parent < 0 ? rootNode : nodes[node.parent]);
+            graph.setLocal(nodes[n], node.translation, node.rotation, node.scale);
+        }
+    }
+
+    // Picks up nodes moved in the scene graph since the last call and rebuilds the
+    // object blocks and world bounds from them. Nothing to do unless the graph changed.
+    void updateTransforms() {
+        SceneGraph& graph = SharedSceneGraph();
+        graph.update();
+        if (graph.version == sceneVersion) {
             return;
         }
 
-        // Scale and translate the model
-        modelMatrix = glm::mat4(1.0f);
-        modelMatrix = glm::translate(modelMatrix, translation);
-        modelMatrix = glm::scale(modelMatrix, scale);
+        bool moved = graph.movedSince(rootNode, sceneVersion);
+        for (size_t n = 0; n < nodes.size() && !moved; ++n) {
+            moved = graph.movedSince(nodes[n], sceneVersion);
+        }
+        sceneVersion = graph.version;
+        if (moved) {
+            uploadObjects();
+            updateInstanceBounds();
+        }
+    }
 
-        // Prepare buffers for rendering
-        primitiveObjects = bindModel(model);
+    // Rebuilds the object blocks and world bounds after the primitives or nodes were
+    // replaced. An import finishing between frames creates no node that moves, so
+    // updateTransforms() alone would keep the bounds of the primitives before it.
+    void rebuildTransforms() {
+        SceneGraph& graph = SharedSceneGraph();
+        graph.update();
+        sceneVersion = graph.version;
+        uploadObjects();
+        updateInstanceBounds();
+    }
 
-        // Create and compile our GLSL program from the shaders
+    void uploadObjects() {
+        std::vector<ObjectBlock> blocks(primitiveObjects.size(), ObjectBlock());
+        for (size_t p = 0; p < primitiveObjects.size(); ++p) {
+            blocks[p].modelMatrix = primitiveWorld(primitiveObjects[p]);
+            blocks[p].baseColorFactor = primitiveObjects[p].baseColorFactor;
+            const VertexQuantization& quantization = primitiveObjects[p].quantization;
+            blocks[p].positionOffset = glm::vec4(quantization.positionOffset, 0.0f);
+            blocks[p].positionScale = glm::vec4(quantization.positionScale, 0.0f);
+            blocks[p].uvTransform = glm::vec4(quantization.uvOffset, quantization.uvScale);
+            blocks[p].packedNormals = primitiveObjects[p].geometry.format == VERTEX_PACKED ? 1 : 0;
+            blocks[p].isLight = primitiveObjects[p].isLight ? 1 : 0;
+            if (skeleton && primitiveObjects[p].skin >= 0) {
+                blocks[p].skinned = 1;
+                blocks[p].jointOffset = skeleton->skins[primitiveObjects[p].skin].paletteOffset;
+            }
+        }
+        objects.upload(blocks);
+    }
+
+    // Advances every instance's animation and evaluates their joint palettes, batches of
+    // instances in parallel on workers, then uploads all palettes in one buffer. Call once
+    // per frame on the GL thread. Culling keeps using the bind pose bounds.
+    void animate(WorkerPool& workers, float deltaTime) {
+        if (!skeleton || instanceMatrices.empty()) {
+            return;
+        }
+        PROFILE_SCOPE("Animate");
+        for (size_t i = 0; i < animationStates.size(); ++i) {
+            AdvanceAnimation(*skeleton, animationStates[i], deltaTime);
+        }
+        EvaluatePalettes(workers, *skeleton, animationStates, jointPalettes);
+        paletteBuffer.upload(jointPalettes);
+
+        // Every pose may have changed, cached shadows must be redrawn
+        casterVersion++;
+    }
+
+    // Starts the named clip on one instance; blends are set up on animationStates directly.
+    // False, leaving the instance as it was, when the model has no clip of that name.
+    bool playClip(size_t instance, const std::string& clipName) {
+        int clip = skeleton ? skeleton->findClip(clipName) : -1;
+        if (clip < 0 || instance >= animationStates.size()) {
+            return false;
+        }
+        PlayClip(animationStates[instance], clip);
+        return true;
+    }
+
+    // Skinned draws need a palette for every instance; until animate() has run, or after
+    // the instances changed, they get the rest pose
+    void ensurePalettes() {
+        if (!skeleton || jointPalettes.size() == instanceMatrices.size() * skeleton->paletteSize) {
+            return;
+        }
+        std::vector<glm::mat4> rest(skeleton->paletteSize);
+        std::vector<glm::mat4> worlds;
+        BuildJointPalette(*skeleton, skeleton->restPose, worlds, rest.empty() ? NULL : &rest[0]);
+        jointPalettes.clear();
+        for (size_t i = 0; i < instanceMatrices.size(); ++i) {
+            jointPalettes.insert(jointPalettes.end(), rest.begin(), rest.end());
+        }
+        paletteBuffer.upload(jointPalettes);
+    }
+
+    void setProgram(GLuint programID) {
         this->programID = programID;
 
         // Get a handle for GLSL variables
-        mvpMatrixID = glGetUniformLocation(programID, "MVP");
-        modelMatrixID = glGetUniformLocation(programID, "modelMatrix");
         textureSamplerID = glGetUniformLocation(programID, "textureSampler");
-        baseColorFactorID = glGetUniformLocation(programID, "baseColorFactor");
-        isLightID = glGetUniformLocation(programID, "isLight");
+        jointMatricesID = glGetUniformLocation(programID, "jointPalettes");
+
+        // Textures always come in on unit 0, shadow cascades on unit 1 so the two
+        // sampler types never share a unit even before shadows are set up. Joint
+        // palettes are on unit 3, unit 2 is the terrain's.
+        glUseProgram(programID);
+        glUniform1i(textureSamplerID, 0);
+        glUniform1i(glGetUniformLocation(programID, "shadowMap"), 1);
+        glUniform1i(jointMatricesID, 3);
+        glUseProgram(0);
     }
 
-    void bindMesh(std::vector<PrimitiveObject>& primitiveObjects,
-        tinygltf::Model& model,
-        tinygltf::Mesh& mesh) {
-        std::map<int, GLuint> vbos;
-        for (size_t i = 0; i < model.bufferViews.size(); ++i) {
-            const tinygltf::BufferView& bufferView = model.bufferViews[i];
+    // Parse the file, decode its primitives and build their LOD chains, packing their
+    // vertices for VERTEX_PACKED. No GL calls. OBJ files are parsed on workers when given.
+    bool importModel(const char* filepath, ModelImport& import, WorkerPool* workers, VertexFormat format) {
+        std::string path(filepath);
+        bool isObj = path.size() > 4 && (path.compare(path.size() - 4, 4, ".obj") == 0 || path.compare(path.size() - 4, 4, ".OBJ") == 0);
+        if (isObj) {
+            // OBJ has no hierarchy, every mesh sits at the root
+            import.loaded = loadObj(filepath, import.meshes, import.materials, workers);
+            for (size_t m = 0; m < import.meshes.size(); ++m) {
+                PrimitivePlacement placement;
+                placement.mesh = (int)m;
+                placement.node = -1;
+                import.placements.push_back(placement);
+            }
+        }
+        else {
+            // Modify your path if needed
+            import.loaded = loadModel(import.gltf, filepath /*"../final/model/tree/tree_small_02_1k.gltf"*/);
+            if (import.loaded) {
+                importGltf(import);
+            }
+        }
+        if (!import.loaded) {
+            return false;
+        }
 
-            if (bufferView.target == 0) {
+        std::vector<float> lodRatios;
+        lodRatios.push_back(0.5f);
+        lodRatios.push_back(0.25f);
+        lodRatios.push_back(0.1f);
+        // LODs first, so every level gets reordered and they all share the vertex order
+        VertexCacheStats before, after;
+        for (size_t m = 0; m < import.meshes.size(); ++m) {
+            MeshPrimitive& mesh = import.meshes[m];
+            mesh.uvDensity = ComputeUvDensity(mesh.vertices, mesh.indices, mesh.indices.size());
+            if (mesh.indices.empty()) {
                 continue;
             }
+            BuildMeshLods(mesh, lodRatios);
+            before.add(AnalyzeVertexCache(&mesh.indices[0], mesh.lods[0].indexCount, mesh.vertices.size()));
+            OptimizeMesh(mesh);
+            after.add(AnalyzeVertexCache(&mesh.indices[0], mesh.lods[0].indexCount, mesh.vertices.size()));
+        }
+        std::cout << filepath << ": ACMR " << before.acmr() << " -> " << after.acmr() << ", ATVR " << before.atvr()
+            << " -> " << after.atvr() << " over " << after.triangles << " triangles" << std::endl;
+
+        // Primitives the packed format is too coarse for keep their float vertices
+        if (format == VERTEX_PACKED) {
+            QuantizationError largest = { 0.0f, 0.0f, 0.0f };
+            size_t rejected = 0;
+            for (size_t m = 0; m < import.meshes.size(); ++m) {
+                MeshPrimitive& mesh = import.meshes[m];
+                QuantizationError error = QuantizeMesh(mesh);
+                if (!QuantizationAcceptable(error, mesh.quantization)) {
+                    std::vector<PackedVertex>().swap(mesh.packed);
+                    mesh.quantization = VertexQuantization();
+                    rejected++;
+                    continue;
+                }
+                largest.position = std::max(largest.position, error.position);
+                largest.normalDegrees = std::max(largest.normalDegrees, error.normalDegrees);
+                largest.uv = std::max(largest.uv, error.uv);
+            }
+            std::cout << filepath << ": packed vertices, errors up to " << largest.position << " units, "
+                << largest.normalDegrees << " degrees, " << largest.uv << " uv; " << rejected << " of "
+                << import.meshes.size() << " primitives kept floats" << std::endl;
+        }
+        return true;
+    }
 
-            const tinygltf::Buffer& buffer = model.buffers[bufferView.buffer];
-            GLuint vbo;
-            glGenBuffers(1, &vbo);
-            glBindBuffer(bufferView.target, vbo);
-            glBufferData(bufferView.target, bufferView.byteLength,
-                &buffer.data.at(0) + bufferView.byteOffset, GL_STATIC_DRAW);
-            vbos[i] = vbo;
+    // Share the GPU data of a file another Model already uploaded
+    bool useSharedMeshes(const std::string& key, bool countLookup) {
+        SharedMeshes shared;
+        if (countLookup ? !meshCache().acquire(key, shared) : !meshCache().share(key, shared)) {
+            return false;
         }
+        meshKey = key;
+        primitiveObjects = shared.primitives;
+        skeleton = shared.skeleton;
+        placeNodes(shared.nodes);
+        rebuildTransforms();
+        return true;
+    }
 
-        for (size_t i = 0; i < mesh.primitives.size(); ++i) {
-            tinygltf::Primitive primitive = mesh.primitives[i];
+    // GL half of an import: create textures (through the loader when given one, so they
+    // show a placeholder until resident) and upload the geometry
+    void finishImport(ModelImport& import, AsyncLoader* loader, const std::string& key) {
+        // Another Model may have finished loading the same file in the meantime
+        if (useSharedMeshes(key, false)) {
+            return;
+        }
 
-            GLuint vao;
-            glGenVertexArrays(1, &vao);
-            glBindVertexArray(vao);
+        SharedMeshes shared;
+        std::vector<GLuint> gltfTextures;
+        if (loader) {
+            for (size_t t = 0; t < import.gltf.textures.size(); ++t) {
+                const tinygltf::Image& image = import.gltf.images[import.gltf.textures[t].source];
+                gltfTextures.push_back(loader->uploadTexture(&image.image[0], image.width, image.height, image.component,
+                    isColorTexture(import.gltf, (int)t)));
+            }
+        }
+        else {
+            gltfTextures = loadTextures(import.gltf);
+        }
+        shared.textureIDs = gltfTextures;
 
-            for (auto& attrib : primitive.attributes) {
-                const tinygltf::Accessor& accessor = model.accessors[attrib.second];
-                const tinygltf::BufferView& bufferView = model.bufferViews[accessor.bufferView];
-                glBindBuffer(GL_ARRAY_BUFFER, vbos[accessor.bufferView]);
+        for (size_t m = 0; m < import.materials.size(); ++m) {
+            PrimitiveMaterial& material = import.materials[m];
+            if (material.gltfTexture >= 0) {
+                material.textureID = gltfTextures[material.gltfTexture];
+            }
+            else if (!material.texturePath.empty()) {
+                const char* texturePath = material.texturePath.c_str();
+                material.textureID = loader ? loader->loadTexture(texturePath) : AcquireTexture(texturePath);
+                shared.textureIDs.push_back(material.textureID);
+            }
+        }
 
-                int size = accessor.type == TINYGLTF_TYPE_SCALAR ? 1 : accessor.type;
-                int vaa = -1;
-                if (attrib.first == "POSITION") vaa = 0;
-                if (attrib.first == "NORMAL") vaa = 1;
-                if (attrib.first == "TEXCOORD_0") vaa = 2;
+        // Prepare buffers for rendering
+        primitiveObjects = bindModel(import, shared.geometry);
+        skeleton = import.skeleton;
+        placeNodes(import.nodes);
+        rebuildTransforms();
+
+        shared.primitives = primitiveObjects;
+        shared.nodes = import.nodes;
+        shared.skeleton = skeleton;
+        meshCache().insert(key, shared);
+        meshKey = key;
+
+        // Keep the glTF document for its node hierarchy
+        std::swap(model, import.gltf);
+    }
 
-                if (vaa > -1) {
-                    glEnableVertexAttribArray(vaa);
-                    glVertexAttribPointer(vaa, size, accessor.componentType,
-                        accessor.normalized ? GL_TRUE : GL_FALSE,
-                        accessor.ByteStride(bufferView),
-                        BUFFER_OFFSET(accessor.byteOffset));
-                }
-                else {
-                    std::cout << "vaa missing: " << attrib.first << std::endl;
-                }
-            }
+    // Files loaded with each vertex format are cached apart
+    static std::string meshCacheKey(const char* filepath, VertexFormat format) {
+        return CanonicalPath(filepath) + (format == VERTEX_PACKED ? "#packed" : "");
+    }
 
-            PrimitiveObject primitiveObject;
-            primitiveObject.vao = vao;
-            primitiveObject.vbos = vbos;
-            primitiveObjects.push_back(primitiveObject);
+    // VERTEX_PACKED halves the vertex memory, for assets drawn in large numbers
+    void initialize(GLuint programID, glm::vec3 translation, glm::vec3 scale, const char * filepath,
+        VertexFormat format = VERTEX_FLOAT) {
+        prepare(translation, scale);
+        assetPath = filepath;
 
-            glBindVertexArray(0);
+        std::string key = meshCacheKey(filepath, format);
+        ModelImport import;
+        if (!useSharedMeshes(key, true) && importModel(filepath, import, NULL, format)) {
+            finishImport(import, NULL, key);
         }
+
+        // Create and compile our GLSL program from the shaders
+        setProgram(programID);
     }
 
-    std::vector<PrimitiveObject> bindModel(tinygltf::Model& model) {
-        std::vector<PrimitiveObject> primitives;
+    // Same as initialize(), but the file is read and processed on the loader's workers.
+    // The model draws nothing until finishImport() has run inside loader.pump().
+    // Pass 0 as programID to set the program later, e.g. from AsyncLoader::loadShaders.
+    void initializeAsync(AsyncLoader& loader, GLuint programID, glm::vec3 translation, glm::vec3 scale, const char * filepath,
+        VertexFormat format = VERTEX_FLOAT) {
+        prepare(translation, scale);
+        assetPath = filepath;
+        if (programID != 0) {
+            setProgram(programID);
+        }
 
-        // Load all textures
-        std::vector<GLuint> textureIDs = loadTextures(model);
+        std::string key = meshCacheKey(filepath, format);
+        if (useSharedMeshes(key, true)) {
+            return;
+        }
 
-        // Create VBOs for all buffer views
-        std::map<int, GLuint> bufferViewVBOs;
-        for (size_t i = 0; i < model.bufferViews.size(); ++i) {
-            const tinygltf::BufferView& bufferView = model.bufferViews[i];
-            const tinygltf::Buffer& buffer = model.buffers[bufferView.buffer];
+        std::shared_ptr<ModelImport> import(new ModelImport());
+        std::string path(filepath);
+        AsyncLoader* asyncLoader = &loader;
+        loader.submit([this, import, path, asyncLoader, format]() {
+            importModel(path.c_str(), *import, &asyncLoader->workers, format);
+        }, [this, import, asyncLoader, key]() {
+            if (import->loaded) {
+                finishImport(*import, asyncLoader, key);
+            }
+        });
+    }
 
-            GLuint vbo;
-            glGenBuffers(1, &vbo);
-            glBindBuffer(GL_ARRAY_BUFFER, vbo);
-            glBufferData(GL_ARRAY_BUFFER, bufferView.byteLength,
-                &buffer.data[bufferView.byteOffset], GL_STATIC_DRAW);
+    // glTF requires min/max on POSITION accessors; without them the box is unbounded
+    // so the primitive is never culled
+    AABB accessorBounds(const tinygltf::Accessor& accessor) {
+        AABB box;
+        if (accessor.minValues.size() >= 3 && accessor.maxValues.size() >= 3) {
+            box.min = glm::vec3(accessor.minValues[0], accessor.minValues[1], accessor.minValues[2]);
+            box.max = glm::vec3(accessor.maxValues[0], accessor.maxValues[1], accessor.maxValues[2]);
+        }
+        else {
+            // Large but finite, infinities turn into NaN in the plane tests
+            box.min = glm::vec3(-1e30f);
+            box.max = glm::vec3(1e30f);
+        }
+        return box;
+    }
 
-            bufferViewVBOs[i] = vbo;
+    // Read element `index` of an accessor as floats, honouring stride and normalization
+    glm::vec4 readAccessor(const tinygltf::Model& model, const tinygltf::Accessor& accessor, size_t index) {
+        glm::vec4 value(0.0f);
+        if (accessor.bufferView < 0) {
+            return value;
+        }
+        const tinygltf::BufferView& bufferView = model.bufferViews[accessor.bufferView];
+        const tinygltf::Buffer& buffer = model.buffers[bufferView.buffer];
+        const unsigned char* data = &buffer.data[bufferView.byteOffset + accessor.byteOffset + index * accessor.ByteStride(bufferView)];
+
+        int components = accessor.type == TINYGLTF_TYPE_SCALAR ? 1 : accessor.type;
+        for (int c = 0; c < components && c < 4; ++c) {
+            switch (accessor.componentType) {
+            case TINYGLTF_COMPONENT_TYPE_FLOAT:
+                value[c] = ((const float*)data)[c];
+                break;
+            case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+                value[c] = accessor.normalized ? data[c] / 255.0f : data[c];
+                break;
+            case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+                value[c] = accessor.normalized ? ((const unsigned short*)data)[c] / 65535.0f : ((const unsigned short*)data)[c];
+                break;
+            case TINYGLTF_COMPONENT_TYPE_BYTE:
+                value[c] = accessor.normalized ? std::max(((const signed char*)data)[c] / 127.0f, -1.0f) : ((const signed char*)data)[c];
+                break;
+            case TINYGLTF_COMPONENT_TYPE_SHORT:
+                value[c] = accessor.normalized ? std::max(((const short*)data)[c] / 32767.0f, -1.0f) : ((const short*)data)[c];
+                break;
+            case TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT:
+                value[c] = (float)((const unsigned int*)data)[c];
+                break;
+            }
+        }
+        return value;
+    }
+
+    unsigned int readIndex(const tinygltf::Model& model, const tinygltf::Accessor& accessor, size_t index) {
+        const tinygltf::BufferView& bufferView = model.bufferViews[accessor.bufferView];
+        const tinygltf::Buffer& buffer = model.buffers[bufferView.buffer];
+        const unsigned char* data = &buffer.data[bufferView.byteOffset + accessor.byteOffset + index * accessor.ByteStride(bufferView)];
+
+        switch (accessor.componentType) {
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+            return *data;
+        case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+            return *(const unsigned short*)data;
+        default:
+            return *(const unsigned int*)data;
+        }
+    }
+
+    // Decode every triangle primitive into MeshPrimitives, resolve its material and
+    // place it at the nodes of the default scene that use its mesh
+    void importGltf(ModelImport& import) {
+        const tinygltf::Model& model = import.gltf;
+        std::vector<MeshPrimitive>& meshes = import.meshes;
+        std::vector<PrimitiveMaterial>& materials = import.materials;
+        for (size_t m = 0; m < model.materials.size(); ++m) {
+            const tinygltf::Material& source = model.materials[m];
+            PrimitiveMaterial material;
+            material.textureID = 0;
+            material.gltfTexture = source.pbrMetallicRoughness.baseColorTexture.index;
+
+            // Extract baseColorFactor
+            if (source.pbrMetallicRoughness.baseColorFactor.size() == 4) {
+                material.baseColorFactor = glm::vec4(
+                    source.pbrMetallicRoughness.baseColorFactor[0],
+                    source.pbrMetallicRoughness.baseColorFactor[1],
+                    source.pbrMetallicRoughness.baseColorFactor[2],
+                    source.pbrMetallicRoughness.baseColorFactor[3]
+                );
+            }
+            else {
+                material.baseColorFactor = glm::vec4(1.0f); // Default to opaque white
+            }
+            material.isLight = (source.name == "street_lamp_01_bulb");
+            materials.push_back(material);
         }
 
         // Iterate through all meshes and primitives
-        for (const auto& mesh : model.meshes) {
-            for (const auto& primitive : mesh.primitives) {
-                PrimitiveObject primitiveObject;
+        std::vector<std::vector<int> > meshPrimitives(model.meshes.size());
+        for (size_t m = 0; m < model.meshes.size(); ++m) {
+            for (const auto& primitive : model.meshes[m].primitives) {
+                if (primitive.mode != TINYGLTF_MODE_TRIANGLES && primitive.mode != -1) {
+                    continue;
+                }
+                std::map<std::string, int>::const_iterator position = primitive.attributes.find("POSITION");
+                if (position == primitive.attributes.end()) {
+                    continue;
+                }
+
+                MeshPrimitive meshPrimitive;
+                meshPrimitive.material = primitive.material;
 
-                // Create a VAO for the primitive
-                glGenVertexArrays(1, &primitiveObject.vao);
-                glBindVertexArray(primitiveObject.vao);
+                const tinygltf::Accessor& positionAccessor = model.accessors[position->second];
+                meshPrimitive.bounds = accessorBounds(positionAccessor);
+                meshPrimitive.vertices.resize(positionAccessor.count);
 
                 // Set up attributes (POSITION, TEXCOORD_0, NORMAL)
                 for (const auto& attrib : primitive.attributes) {
                     const std::string& attribName = attrib.first;
                     const tinygltf::Accessor& accessor = model.accessors[attrib.second];
-                    const tinygltf::BufferView& bufferView = model.bufferViews[accessor.bufferView];
+                    size_t count = std::min(accessor.count, positionAccessor.count);
 
-                    int size = 1;
-                    if (accessor.type != TINYGLTF_TYPE_SCALAR) {
-                        size = accessor.type;
+                    for (size_t v = 0; v < count; ++v) {
+                        MeshVertex& vertex = meshPrimitive.vertices[v];
+                        if (attribName == "POSITION") vertex.position = glm::vec3(readAccessor(model, accessor, v));
+                        if (attribName == "NORMAL") vertex.normal = glm::vec3(readAccessor(model, accessor, v));
+                        if (attribName == "TEXCOORD_0") vertex.uv = glm::vec2(readAccessor(model, accessor, v));
                     }
+                }
 
-                    GLuint vbo = bufferViewVBOs[accessor.bufferView];
-                    glBindBuffer(GL_ARRAY_BUFFER, vbo);
-
-                    int location = -1;
-                    if (attribName == "POSITION") location = 0;
-                    if (attribName == "NORMAL") location = 1;
-                    if (attribName == "TEXCOORD_0") location = 2;
-
-                    if (location != -1) {
-                        glEnableVertexAttribArray(location);
-                        glVertexAttribPointer(location, size, accessor.componentType,
-                            accessor.normalized ? GL_TRUE : GL_FALSE,
-                            accessor.ByteStride(bufferView),
-                            (void*)(accessor.byteOffset));
+                // Skinned primitives keep up to four influences per vertex. Weights are
+                // renormalized before quantizing, so they still sum to one.
+                std::map<std::string, int>::const_iterator joints = primitive.attributes.find("JOINTS_0");
+                std::map<std::string, int>::const_iterator weights = primitive.attributes.find("WEIGHTS_0");
+                if (joints != primitive.attributes.end() && weights != primitive.attributes.end()) {
+                    const tinygltf::Accessor& jointAccessor = model.accessors[joints->second];
+                    const tinygltf::Accessor& weightAccessor = model.accessors[weights->second];
+                    meshPrimitive.skin.resize(positionAccessor.count);
+                    size_t count = std::min(positionAccessor.count, std::min(jointAccessor.count, weightAccessor.count));
+                    for (size_t v = 0; v < meshPrimitive.skin.size(); ++v) {
+                        glm::vec4 joint = v < count ? readAccessor(model, jointAccessor, v) : glm::vec4(0.0f);
+                        glm::vec4 weight = v < count ? readAccessor(model, weightAccessor, v) : glm::vec4(1.0f, 0.0f, 0.0f, 0.0f);
+                        float sum = weight.x + weight.y + weight.z + weight.w;
+                        if (sum <= 0.0f) {
+                            weight = glm::vec4(1.0f, 0.0f, 0.0f, 0.0f);
+                            sum = 1.0f;
+                        }
+
+                        SkinVertex& skin = meshPrimitive.skin[v];
+                        int total = 0, largest = 0;
+                        for (int c = 0; c < 4; ++c) {
+                            skin.joints[c] = (unsigned short)joint[c];
+                            skin.weights[c] = (unsigned short)(weight[c] / sum * 65535.0f + 0.5f);
+                            total += skin.weights[c];
+                            largest = skin.weights[c] > skin.weights[largest] ? c : largest;
+                        }
+                        skin.weights[largest] = (unsigned short)(skin.weights[largest] + 65535 - total);
                     }
                 }
 
-                // Set up the element array buffer (indices)
+                // Non-indexed primitives get a trivial index list
                 if (primitive.indices >= 0) {
                     const tinygltf::Accessor& indexAccessor = model.accessors[primitive.indices];
-                    const tinygltf::BufferView& indexBufferView = model.bufferViews[indexAccessor.bufferView];
+                    meshPrimitive.indices.resize(indexAccessor.count);
+                    for (size_t i = 0; i < indexAccessor.count; ++i) {
+                        meshPrimitive.indices[i] = readIndex(model, indexAccessor, i);
+                    }
+                }
+                else {
+                    meshPrimitive.indices.resize(positionAccessor.count);
+                    for (size_t i = 0; i < positionAccessor.count; ++i) {
+                        meshPrimitive.indices[i] = (unsigned int)i;
+                    }
+                }
 
-                    GLuint ebo;
-                    glGenBuffers(1, &ebo);
-                    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-                    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBufferView.byteLength,
-                        &model.buffers[indexBufferView.buffer].data[indexBufferView.byteOffset], GL_STATIC_DRAW);
+                meshPrimitives[m].push_back((int)meshes.size());
+                meshes.push_back(meshPrimitive);
+            }
+        }
 
-                    primitiveObject.indexCount = indexAccessor.count;
-                    primitiveObject.indexType = indexAccessor.componentType;
+        std::vector<int> nodeMap(model.nodes.size(), -1);
+        if (!model.scenes.empty()) {
+            const tinygltf::Scene& scene = model.scenes[model.defaultScene >= 0 ? model.defaultScene : 0];
+            for (size_t n = 0; n < scene.nodes.size(); ++n) {
+                importNode(model, scene.nodes[n], -1, meshPrimitives, nodeMap, import);
+            }
+        }
+        else {
+            // No scene: every node nobody claims as a child is a root
+            std::vector<unsigned char> isChild(model.nodes.size(), 0);
+            for (size_t n = 0; n < model.nodes.size(); ++n) {
+                for (size_t c = 0; c < model.nodes[n].children.size(); ++c) {
+                    int child = model.nodes[n].children[c];
+                    if (child >= 0 && child < (int)isChild.size()) {
+                        isChild[child] = 1;
+                    }
                 }
+            }
+            for (size_t n = 0; n < model.nodes.size(); ++n) {
+                if (!isChild[n]) {
+                    importNode(model, (int)n, -1, meshPrimitives, nodeMap, import);
+                }
+            }
+        }
 
-                // Bind texture and retrieve baseColorFactor
-                if (primitive.material >= 0) {
-                    const tinygltf::Material& material = model.materials[primitive.material];
+        // A file with meshes but no nodes still shows them, at the root
+        if (model.nodes.empty()) {
+            for (size_t m = 0; m < meshes.size(); ++m) {
+                PrimitivePlacement placement;
+                placement.mesh = (int)m;
+                placement.node = -1;
+                import.placements.push_back(placement);
+            }
+        }
 
-                    if (material.pbrMetallicRoughness.baseColorTexture.index >= 0) {
-                        int textureIndex = material.pbrMetallicRoughness.baseColorTexture.index;
-                        primitiveObject.textureID = textureIDs[textureIndex];
-                    }
-                    else {
-                        primitiveObject.textureID = 0;
-                    }
+        importSkins(model, nodeMap, import);
+    }
 
-                    // Extract baseColorFactor
-                    if (material.pbrMetallicRoughness.baseColorFactor.size() == 4) {
-                        primitiveObject.baseColorFactor = glm::vec4(
-                            material.pbrMetallicRoughness.baseColorFactor[0],
-                            material.pbrMetallicRoughness.baseColorFactor[1],
-                            material.pbrMetallicRoughness.baseColorFactor[2],
-                            material.pbrMetallicRoughness.baseColorFactor[3]
-                        );
-                    }
-                    else {
-                        primitiveObject.baseColorFactor = glm::vec4(1.0f); // Default to opaque white
+    // The skins bound to imported nodes and the clips moving their joints. The node
+    // hierarchy doubles as the skeleton. Rigid node animation is not played.
+    void importSkins(const tinygltf::Model& model, const std::vector<int>& nodeMap, ModelImport& import) {
+        std::shared_ptr<Skeleton> skeleton(new Skeleton());
+        skeleton->paletteSize = 0;
+        for (size_t n = 0; n < import.nodes.size(); ++n) {
+            const ModelNode& node = import.nodes[n];
+            skeleton->parents.push_back(node.parent);
+            skeleton->restPose.translations.push_back(node.translation);
+            skeleton->restPose.rotations.push_back(node.rotation);
+            skeleton->restPose.scales.push_back(node.scale);
+        }
+
+        std::vector<glm::mat4> restWorlds;
+        for (size_t n = 0; n < import.nodes.size(); ++n) {
+            const ModelNode& node = import.nodes[n];
+            glm::mat4 local = ComposeTransform(node.translation, node.rotation, node.scale);
+            restWorlds.push_back(node.parent >= 0 ? restWorlds[node.parent] * local : local);
+        }
+
+        for (size_t g = 0; g < model.nodes.size(); ++g) {
+            int skinIndex = model.nodes[g].skin;
+            if (nodeMap[g] < 0 || skinIndex < 0 || skinIndex >= (int)model.skins.size()) {
+                continue;
+            }
+            const tinygltf::Skin& source = model.skins[skinIndex];
+
+            SkinBinding skin;
+            skin.inverseNodeTransform = glm::inverse(restWorlds[nodeMap[g]]);
+            skin.paletteOffset = skeleton->paletteSize;
+            for (size_t j = 0; j < source.joints.size(); ++j) {
+                int joint = source.joints[j];
+                skin.joints.push_back(joint >= 0 && joint < (int)nodeMap.size() ? nodeMap[joint] : -1);
+
+                // Matrices are always floats; without them the bind pose is the identity
+                glm::mat4 inverseBind(1.0f);
+                if (source.inverseBindMatrices >= 0) {
+                    const tinygltf::Accessor& accessor = model.accessors[source.inverseBindMatrices];
+                    const tinygltf::BufferView& bufferView = model.bufferViews[accessor.bufferView];
+                    const tinygltf::Buffer& buffer = model.buffers[bufferView.buffer];
+                    if (j < accessor.count) {
+                        size_t offset = bufferView.byteOffset + accessor.byteOffset + j * accessor.ByteStride(bufferView);
+                        inverseBind = glm::make_mat4((const float*)&buffer.data[offset]);
                     }
-                    primitiveObject.isLight = (material.name == "street_lamp_01_bulb");
+                }
+                skin.inverseBindMatrices.push_back(inverseBind);
+            }
+
+            import.nodes[nodeMap[g]].skin = (int)skeleton->skins.size();
+            skeleton->paletteSize += (int)skin.joints.size();
+            skeleton->skins.push_back(skin);
+        }
+        if (skeleton->skins.empty()) {
+            return;
+        }
+
+        for (size_t a = 0; a < model.animations.size(); ++a) {
+            const tinygltf::Animation& animation = model.animations[a];
+            AnimationClip clip;
+            clip.name = animation.name;
+            clip.duration = 0.0f;
+
+            for (size_t c = 0; c < animation.channels.size(); ++c) {
+                const tinygltf::AnimationChannel& source = animation.channels[c];
+                if (source.target_node < 0 || source.target_node >= (int)nodeMap.size() || nodeMap[source.target_node] < 0 ||
+                    source.sampler < 0 || source.sampler >= (int)animation.samplers.size()) {
+                    continue;
+                }
+
+                AnimationChannel channel;
+                channel.node = nodeMap[source.target_node];
+                if (source.target_path == "translation") {
+                    channel.path = ANIMATION_TRANSLATION;
+                }
+                else if (source.target_path == "rotation") {
+                    channel.path = ANIMATION_ROTATION;
+                }
+                else if (source.target_path == "scale") {
+                    channel.path = ANIMATION_SCALE;
                 }
                 else {
-                    primitiveObject.textureID = 0;
-                    primitiveObject.baseColorFactor = glm::vec4(1.0f); // Default to opaque white
+                    // Morph target weights
+                    continue;
+                }
+
+                const tinygltf::AnimationSampler& sampler = animation.samplers[source.sampler];
+                channel.interpolation = sampler.interpolation == "STEP" ? ANIMATION_STEP :
+                    sampler.interpolation == "CUBICSPLINE" ? ANIMATION_CUBICSPLINE : ANIMATION_LINEAR;
+
+                const tinygltf::Accessor& input = model.accessors[sampler.input];
+                const tinygltf::Accessor& output = model.accessors[sampler.output];
+                for (size_t k = 0; k < input.count; ++k) {
+                    channel.times.push_back(readAccessor(model, input, k).x);
+                }
+                for (size_t k = 0; k < output.count; ++k) {
+                    channel.values.push_back(readAccessor(model, output, k));
                 }
 
-                glBindVertexArray(0);
-                primitives.push_back(primitiveObject);
+                size_t valuesPerKey = channel.interpolation == ANIMATION_CUBICSPLINE ? 3 : 1;
+                if (channel.times.empty() || channel.values.size() < channel.times.size() * valuesPerKey) {
+                    continue;
+                }
+                clip.duration = std::max(clip.duration, channel.times.back());
+                clip.channels.push_back(channel);
+            }
+            skeleton->clips.push_back(clip);
+        }
+        import.skeleton = skeleton;
+    }
+
+    // Copy every mesh with its LOD chain into the geometry arena, once however many
+    // nodes draw it, and build a primitive for every placement. The arena ranges are
+    // added to geometry.
+    std::vector<PrimitiveObject> bindModel(const ModelImport& import, std::vector<GeometryRange>& geometry) {
+        const std::vector<MeshPrimitive>& meshes = import.meshes;
+        const std::vector<PrimitiveMaterial>& materials = import.materials;
+        std::vector<int> meshRange(meshes.size(), -1);
+        for (size_t m = 0; m < meshes.size(); ++m) {
+            GeometryRange range;
+            bool packed = !meshes[m].packed.empty();
+            if (!meshes[m].vertices.empty() && !meshes[m].lods.empty() && (packed ?
+                SharedGeometryArena().allocate(meshes[m].packed, meshes[m].indices, range) :
+                SharedGeometryArena().allocate(meshes[m].vertices, meshes[m].indices, range))) {
+                if (!meshes[m].skin.empty()) {
+                    SharedGeometryArena().uploadSkin(range, meshes[m].skin);
+                }
+                meshRange[m] = (int)geometry.size();
+                geometry.push_back(range);
             }
         }
+
+        std::vector<PrimitiveObject> primitives;
+        for (size_t i = 0; i < import.placements.size(); ++i) {
+            const PrimitivePlacement& placement = import.placements[i];
+            if (meshRange[placement.mesh] < 0) {
+                continue;
+            }
+            const MeshPrimitive& mesh = meshes[placement.mesh];
+
+            PrimitiveObject primitiveObject;
+            for (int lod = 0; lod < MODEL_LOD_COUNT; ++lod) {
+                primitiveObject.lods[lod] = mesh.lods[std::min(lod, (int)mesh.lods.size() - 1)];
+            }
+            primitiveObject.bounds = mesh.bounds;
+            primitiveObject.uvDensity = mesh.uvDensity;
+            primitiveObject.quantization = mesh.quantization;
+            primitiveObject.geometry = geometry[meshRange[placement.mesh]];
+            primitiveObject.node = placement.node;
+            primitiveObject.skin = !mesh.skin.empty() && placement.node >= 0 ? import.nodes[placement.node].skin : -1;
+
+            // Bind texture and retrieve baseColorFactor
+            if (mesh.material >= 0 && mesh.material < (int)materials.size()) {
+                const PrimitiveMaterial& material = materials[mesh.material];
+                primitiveObject.textureID = material.textureID;
+                primitiveObject.baseColorFactor = material.baseColorFactor;
+                primitiveObject.isLight = material.isLight;
+            }
+            else {
+                primitiveObject.textureID = 0;
+                primitiveObject.baseColorFactor = glm::vec4(1.0f); // Default to opaque white
+                primitiveObject.isLight = false;
+            }
+
+            primitives.push_back(primitiveObject);
+        }
         return primitives;
     }
 
+    // First LOD group after lod drawn with a different index range. The simplifier
+    // repeats a level it could not reduce, and the impostor group, drawn with the last
+    // level where meshes stand in for impostors, repeats that level too.
+    static int nextLod(const PrimitiveObject& primitive, int lod) {
+        const MeshLod& level = primitive.lods[std::min(lod, MODEL_LOD_COUNT - 1)];
+        int next = lod + 1;
+        while (next <= MODEL_LOD_COUNT && primitive.lods[std::min(next, MODEL_LOD_COUNT - 1)].indexOffset == level.indexOffset &&
+            primitive.lods[std::min(next, MODEL_LOD_COUNT - 1)].indexCount == level.indexCount) {
+            next++;
+        }
+        return next;
+    }
+
+    // One instanced draw per LOD group that has instances in it. Primitives in the same
+    // arena block share a VAO, which is only rebound when the block changes. Impostor
+    // instances draw the last mesh LOD, so they still cast shadows. Returns the draws.
+    int drawLods(size_t p, GLuint& boundVertexArray) {
+        const PrimitiveObject& primitive = primitiveObjects[p];
+        objects.bind(p);
+        GLuint vertexArray = SharedGeometryArena().vertexArray(primitive.geometry);
+        if (vertexArray != boundVertexArray) {
+            glBindVertexArray(vertexArray);
+            boundVertexArray = vertexArray;
+        }
+        int draws = 0;
+        for (int group = 0; group <= MODEL_LOD_COUNT; group = nextLod(primitive, group)) {
+            GLsizei count = lodGroupStart[nextLod(primitive, group)] - lodGroupStart[group];
+            if (count == 0) {
+                continue;
+            }
+            int lod = std::min(group, MODEL_LOD_COUNT - 1);
+            bindInstanceAttributes(instanceBufferID, lodGroupStart[group] * sizeof(glm::mat4));
+            bindPaletteAttribute(skeleton ? instancePaletteBufferID : 0, lodGroupStart[group] * sizeof(GLint));
+            GLuint firstIndex = primitive.geometry.firstIndex + primitive.lods[lod].indexOffset;
+            glDrawElementsInstancedBaseVertex(GL_TRIANGLES, primitive.lods[lod].indexCount, primitive.geometry.indexType,
+                BUFFER_OFFSET(firstIndex * IndexSize(primitive.geometry.indexType)), count, primitive.geometry.baseVertex);
+            draws++;
+        }
+        return draws;
+    }
+
+    // The Camera block must already hold this camera, see FrameUniforms::setCamera()
     void render(const glm::mat4& cameraMatrix){
-        glUseProgram(programID);
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        render(cameraMatrix, ExtractFrustum(cameraMatrix));
+    }
 
-        // Combine transformations with the camera matrix
-        glm::mat4 mvpMatrix = cameraMatrix * modelMatrix;
+    // Callers drawing many models can extract the frustum once per frame and share it
+    void render(const glm::mat4& cameraMatrix, const Frustum& frustum){
+        submit(renderQueue, cameraMatrix, frustum);
+        renderQueue.flush();
+    }
 
-        // Pass the updated MVP matrix to the shader
-        glUniformMatrix4fv(mvpMatrixID, 1, GL_FALSE, &mvpMatrix[0][0]);
-        glUniformMatrix4fv(modelMatrixID, 1, GL_FALSE, &modelMatrix[0][0]);
+    // Per-draw state for items queued by submit(): userData[0] is the primitive and
+    // userData[1] the LOD group
+    static void applyDraw(const DrawItem& item) {
+        const Model& owner = *(const Model*)item.owner;
 
-        // Separate opaque and transparent objects
-        std::vector<const PrimitiveObject*> opaqueObjects;
-        std::vector<const PrimitiveObject*> transparentObjects;
+        // Instance transforms come from the instance buffer and the camera from its block,
+        // the node transform and material are the primitive's range of the object buffer
+        owner.objects.bind(item.userData[0]);
 
-        for (const auto& primitive : primitiveObjects) {
-            if (primitive.baseColorFactor.a < 1.0f) {
-                transparentObjects.push_back(&primitive);
+        GLsizei firstInstance = owner.lodGroupStart[item.userData[1]];
+        bindInstanceAttributes(owner.instanceBufferID, firstInstance * sizeof(glm::mat4));
+        if (owner.skeleton) {
+            bindPaletteAttribute(owner.instancePaletteBufferID, firstInstance * sizeof(GLint));
+            owner.paletteBuffer.bind(3);
+        }
+        else {
+            bindPaletteAttribute(0, 0);
+        }
+    }
+
+    // Cull, pick LODs and upload the instances, then queue one item per visible
+    // primitive and LOD group. Opaque and transparent primitives both draw with
+    // blending on, as the leaf textures rely on their alpha. Skinned models stay on this
+    // path with the GPU-driven one enabled, as their palette starts have to follow the
+    // order instances are drawn in. occlusion, when given, must be finished for this
+    // camera.
+    void submit(RenderQueue& queue, const glm::mat4& cameraMatrix, const Frustum& frustum, OcclusionBuffer* occlusion = NULL) {
+        updateTransforms();
+        ensurePalettes();
+        if (programID != 0 && gpuDriven && !skeleton) {
+            submitIndirect(queue, cameraMatrix, occlusion);
+            return;
+        }
+        if (programID == 0 || cullInstances(frustum, cullStats, occlusion) == 0) {
+            return;
+        }
+        selectLods(cameraMatrix);
+        uploadVisibleInstances(instanceLod);
+
+        // Nearest and farthest instance of each LOD group, for the sort keys
+        float nearest[MODEL_LOD_COUNT + 1], farthest[MODEL_LOD_COUNT + 1];
+        for (int lod = 0; lod <= MODEL_LOD_COUNT; ++lod) {
+            nearest[lod] = FLT_MAX;
+            farthest[lod] = 0.0f;
+        }
+        for (size_t v = 0; v < visibleInstances.size(); ++v) {
+            unsigned int i = visibleInstances[v];
+            nearest[instanceLod[i]] = std::min(nearest[instanceLod[i]], instanceDepth[i]);
+            farthest[instanceLod[i]] = std::max(farthest[instanceLod[i]], instanceDepth[i]);
+        }
+        float nearestMesh = *std::min_element(nearest, nearest + MODEL_LOD_COUNT);
+        if (nearestMesh < FLT_MAX) {
+            requestTextures(nearestMesh, false);
+        }
+
+        for (size_t p = 0; p < primitiveObjects.size(); ++p) {
+            const PrimitiveObject& primitive = primitiveObjects[p];
+            if (!primitiveVisible[p]) {
+                continue;
             }
-            else {
-                opaqueObjects.push_back(&primitive);
+            bool transparent = primitive.baseColorFactor.a < 1.0f;
+
+            DrawItem item;
+            item.program = programID;
+            item.texture = primitive.textureID;
+            item.vertexArray = SharedGeometryArena().vertexArray(primitive.geometry);
+            item.blend = true;
+            item.baseVertex = primitive.geometry.baseVertex;
+            item.apply = applyDraw;
+            item.draw = NULL;
+            item.owner = this;
+            item.userData[0] = (int)p;
+
+            for (int lod = 0; lod < MODEL_LOD_COUNT; lod = nextLod(primitive, lod)) {
+                // Levels sharing an index range are adjacent in the instance buffer and go
+                // out as one draw; impostors are drawn below
+                int end = std::min(nextLod(primitive, lod), MODEL_LOD_COUNT);
+                item.instanceCount = lodGroupStart[end] - lodGroupStart[lod];
+                if (item.instanceCount == 0) {
+                    continue;
+                }
+                float depth = transparent ? *std::max_element(farthest + lod, farthest + end) :
+                    *std::min_element(nearest + lod, nearest + end);
+                item.indexCount = primitive.lods[lod].indexCount;
+                item.firstIndex = primitive.geometry.firstIndex + primitive.lods[lod].indexOffset;
+                item.indexType = primitive.geometry.indexType;
+                item.userData[1] = lod;
+                item.key = queue.makeKey(transparent ? PASS_TRANSPARENT : PASS_OPAQUE, item.blend, item.program,
+                    item.texture, item.vertexArray, depth);
+                queue.submit(item);
             }
         }
 
-        // Render opaque objects first
-        for (const auto* primitive : opaqueObjects) {
-            glBindVertexArray(primitive->vao);
+        GLsizei impostorCount = lodGroupStart[MODEL_LOD_COUNT + 1] - lodGroupStart[MODEL_LOD_COUNT];
+        if (impostorCount > 0) {
+            DrawItem item = impostorItem(queue, nearest[MODEL_LOD_COUNT]);
+            item.instanceCount = impostorCount;
+            queue.submit(item);
+        }
+    }
+
+    // One quad per impostor instance, alpha-tested and opaque. Instances come from the
+    // impostor LOD group, or from the culled buffer when drawn indirectly.
+    DrawItem impostorItem(const RenderQueue& queue, float depth) {
+        DrawItem item;
+        item.program = impostorProgramID;
+        item.texture = impostor.albedoTexture;
+        item.vertexArray = impostor.vertexArray;
+        item.blend = false;
+        item.indexCount = 6;
+        item.firstIndex = 0;
+        item.indexType = GL_UNSIGNED_SHORT;
+        item.baseVertex = 0;
+        item.instanceCount = 0;
+        item.apply = applyImpostor;
+        item.draw = NULL;
+        item.owner = this;
+        item.userData[0] = 0;
+        item.userData[1] = 0;
+        item.key = queue.makeKey(PASS_OPAQUE, item.blend, item.program, item.texture, item.vertexArray, depth);
+        return item;
+    }
 
-            if (primitive->textureID) {
-                glActiveTexture(GL_TEXTURE0);
-                glBindTexture(GL_TEXTURE_2D, primitive->textureID);
-                glUniform1i(textureSamplerID, 0);
+    static void applyImpostor(const DrawItem& item) {
+        const Model& owner = *(const Model*)item.owner;
+        if (item.draw) {
+            bindInstanceAttributes(owner.gpuCuller.visibleBuffer, 0);
+        }
+        else {
+            bindInstanceAttributes(owner.instanceBufferID, owner.lodGroupStart[MODEL_LOD_COUNT] * sizeof(glm::mat4));
+        }
+        const glm::mat4& root = SharedSceneGraph().world(owner.rootNode);
+        glUniformMatrix4fv(owner.impostorRootID, 1, GL_FALSE, &root[0][0]);
+        glUniform4f(owner.impostorSphereID, owner.impostor.center.x, owner.impostor.center.y, owner.impostor.center.z,
+            owner.impostor.radius);
+
+        // The normal and depth atlas goes on unit 4, next to the units setProgram() lists
+        glActiveTexture(GL_TEXTURE4);
+        glBindTexture(GL_TEXTURE_2D, owner.impostor.normalDepthTexture);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    static void drawImpostorIndirect(const DrawItem& item) {
+        const Model& owner = *(const Model*)item.owner;
+        owner.gpuCuller.draw((GLuint)owner.gpuCuller.commands.size() - 1, 1, GL_UNSIGNED_SHORT);
+    }
+
+    void setImpostorProgram(GLuint programID) {
+        impostorProgramID = programID;
+        impostorSphereID = glGetUniformLocation(programID, "impostorSphere");
+        impostorRootID = glGetUniformLocation(programID, "rootMatrix");
+
+        glUseProgram(programID);
+        glUniform1i(glGetUniformLocation(programID, "albedoAtlas"), 0);
+        glUniform1i(glGetUniformLocation(programID, "shadowMap"), 1);
+        glUniform1i(glGetUniformLocation(programID, "normalDepthAtlas"), 4);
+        glUseProgram(0);
+        gpuDirty = true;
+    }
+
+    // Far instances switch to the impostor once loadImpostor() has run and an impostor
+    // program is set. Skinned models keep their meshes.
+    void enableImpostors(float screenSize) {
+        impostorScreenSize = screenSize;
+        gpuDirty = true;
+    }
+
+    bool needsImpostor() const {
+        return impostorScreenSize > 0.0f && !impostor.ready() && !primitiveObjects.empty() && !skeleton;
+    }
+
+    // Bounding sphere of the asset below the root node, which the frames are fitted to
+    void assetSphere(glm::vec3& center, float& radius) {
+        glm::mat4 toAsset = glm::inverse(SharedSceneGraph().world(rootNode));
+        AABB box;
+        for (size_t p = 0; p < primitiveObjects.size(); ++p) {
+            AABB primitiveBox = TransformAABB(primitiveObjects[p].bounds, toAsset * primitiveWorld(primitiveObjects[p]));
+            box = p == 0 ? primitiveBox : MergeAABB(box, primitiveBox);
+        }
+        center = (box.min + box.max) * 0.5f;
+        radius = glm::length(box.max - box.min) * 0.5f;
+    }
+
+    // Asks the texture streamer for the levels the impostor frames sample, each frame
+    // spanning the asset's bounding sphere
+    void requestImpostorTextures() {
+        glm::vec3 center;
+        float radius;
+        assetSphere(center, radius);
+        float pixelsPerUnit = IMPOSTOR_FRAME_SIZE / std::max(2.0f * radius, 1e-6f);
+        for (size_t p = 0; p < primitiveObjects.size(); ++p) {
+            if (primitiveObjects[p].textureID != 0) {
+                SharedTextureStreamer().request(primitiveObjects[p].textureID, primitiveObjects[p].uvDensity, pixelsPerUnit);
             }
+        }
+    }
 
-            glUniform1i(isLightID, primitive->isLight ? 1 : 0);
-            glUniform4fv(baseColorFactorID, 1, &primitive->baseColorFactor[0]);
-            glDrawElements(GL_TRIANGLES, primitive->indexCount, primitive->indexType, 0);
+    // Renders LOD 0 of every primitive into an impostor atlas through an offscreen
+    // framebuffer. The geometry and its textures must be resident.
+    bool bakeImpostor(ImpostorImages& images) {
+        updateTransforms();
+        if (primitiveObjects.empty() || skeleton) {
+            return false;
+        }
+        glm::vec3 center;
+        float radius;
+        assetSphere(center, radius);
+
+        // The instance undoes the root transform, leaving the asset's own space
+        GLuint rootBufferID;
+        glm::mat4 toAsset = glm::inverse(SharedSceneGraph().world(rootNode));
+        glGenBuffers(1, &rootBufferID);
+        glBindBuffer(GL_ARRAY_BUFFER, rootBufferID);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(glm::mat4), &toAsset[0][0], GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        bool baked = BakeImpostor(center, radius, [this, rootBufferID]() {
+            glActiveTexture(GL_TEXTURE0);
+            for (size_t p = 0; p < primitiveObjects.size(); ++p) {
+                const PrimitiveObject& primitive = primitiveObjects[p];
+                if (primitive.isLight) {
+                    continue;
+                }
+                objects.bind(p);
+                glBindVertexArray(SharedGeometryArena().vertexArray(primitive.geometry));
+                bindInstanceAttributes(rootBufferID, 0);
+                bindPaletteAttribute(0, 0);
+                glBindTexture(GL_TEXTURE_2D, primitive.textureID);
+                GLuint firstIndex = primitive.geometry.firstIndex + primitive.lods[0].indexOffset;
+                glDrawElementsInstancedBaseVertex(GL_TRIANGLES, primitive.lods[0].indexCount, primitive.geometry.indexType,
+                    BUFFER_OFFSET(firstIndex * IndexSize(primitive.geometry.indexType)), 1, primitive.geometry.baseVertex);
+            }
             glBindTexture(GL_TEXTURE_2D, 0);
+            glBindVertexArray(0);
+        }, images);
+
+        glDeleteBuffers(1, &rootBufferID);
+        return baked;
+    }
+
+    // Uses the atlas baked next to the asset (bake_impostors) when it was baked around
+    // the same sphere, bakes one in place otherwise. Impostors are disabled on failure.
+    bool loadImpostor() {
+        PROFILE_SCOPE("loadImpostor");
+        glm::vec3 center;
+        float radius;
+        assetSphere(center, radius);
+
+        ImpostorImages images;
+        std::string path = ImpostorPath(assetPath.c_str());
+        bool stored = ReadImpostor(path.c_str(), images) && glm::length(images.center - center) < 1e-3f * radius &&
+            fabsf(images.radius - radius) < 1e-3f * radius;
+        if (!stored && !bakeImpostor(images)) {
+            std::cout << "Failed to bake the impostor of " << assetPath << std::endl;
+            impostorScreenSize = 0.0f;
+            return false;
         }
+        std::cout << (stored ? "Loaded impostor " : "Baked impostor for ") << (stored ? path : assetPath) << std::endl;
 
-        // Sort transparent objects by distance from the camera
-        std::sort(transparentObjects.begin(), transparentObjects.end(),
-            [&cameraMatrix](const PrimitiveObject* a, const PrimitiveObject* b) {
-                glm::vec3 aPos = glm::vec3(cameraMatrix * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f)); // Center of object A
-                glm::vec3 bPos = glm::vec3(cameraMatrix * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f)); // Center of object B
-                return glm::length(aPos) > glm::length(bPos); // Sort back-to-front
-            });
+        impostor.upload(images);
+        gpuDirty = true;
+        return true;
+    }
+
+    // Switches to the GPU-driven path when the context has GL 4.3; returns whether it did
+    bool enableGpuDriven() {
+        if (!gpuDriven && GpuCullingSupported() && gpuCuller.initialize()) {
+            gpuDriven = true;
+            gpuDirty = true;
+        }
+        return gpuDriven;
+    }
+
+    // Instances culled on the CPU are counted by the occlusion buffer as they are tested;
+    // the GPU-driven path counts on the GPU, and this adds the counts of its last cull.
+    // Waits for the GPU, so it is meant for reports.
+    void readOcclusionStats(OcclusionStats& stats) const {
+        if (gpuDriven && !skeleton) {
+            gpuCuller.readOcclusionStats(stats);
+        }
+    }
 
-        // Render transparent objects
-        for (const auto* primitive : transparentObjects) {
-            glBindVertexArray(primitive->vao);
+    // What the last camera pass culled, on whichever path it ran. Shadow passes do not
+    // count. Waits for the GPU on the GPU-driven path, so it is meant for reports.
+    void readCullStats(CullStats& stats) const {
+        if (gpuDriven && !skeleton) {
+            gpuCuller.readCullStats(stats);
+        }
+        else {
+            stats = cullStats;
+        }
+    }
 
-            if (primitive->textureID) {
-                glActiveTexture(GL_TEXTURE0);
-                glBindTexture(GL_TEXTURE_2D, primitive->textureID);
-                glUniform1i(textureSamplerID, 0);
+    // Orders the primitives so those sharing a VAO and material are adjacent, then
+    // uploads one command per primitive and LOD and every instance with its bounds.
+    // With impostors, one more command at the end draws their quads.
+    void rebuildGpuBatches() {
+        std::vector<int> order(primitiveObjects.size());
+        for (size_t p = 0; p < order.size(); ++p) {
+            order[p] = (int)p;
+        }
+        std::stable_sort(order.begin(), order.end(), [this](int a, int b) {
+            return batchOrder(primitiveObjects[a]) < batchOrder(primitiveObjects[b]);
+        });
+
+        std::vector<DrawElementsIndirectCommand> commands;
+        std::vector<const AABBList*> slotBounds;
+        gpuBatches.clear();
+        for (size_t s = 0; s < order.size(); ++s) {
+            const PrimitiveObject& primitive = primitiveObjects[order[s]];
+            for (int lod = 0; lod < MODEL_LOD_COUNT; ++lod) {
+                DrawElementsIndirectCommand command;
+                command.count = primitive.lods[lod].indexCount;
+                command.instanceCount = 0;
+                command.firstIndex = primitive.geometry.firstIndex + primitive.lods[lod].indexOffset;
+                command.baseVertex = primitive.geometry.baseVertex;
+                command.baseInstance = 0;
+                commands.push_back(command);
             }
-            glUniform1i(isLightID, primitive->isLight ? 1 : 0);
-            glUniform4fv(baseColorFactorID, 1, &primitive->baseColorFactor[0]);
-            glDrawElements(GL_TRIANGLES, primitive->indexCount, primitive->indexType, 0);
-            glBindTexture(GL_TEXTURE_2D, 0);
+            slotBounds.push_back(&primitiveInstanceBounds[order[s]]);
+
+            if (s == 0 || batchOrder(primitive) != batchOrder(primitiveObjects[order[s - 1]])) {
+                GpuBatch batch;
+                batch.primitive = order[s];
+                batch.firstCommand = (GLuint)(s * MODEL_LOD_COUNT);
+                batch.commandCount = 0;
+                gpuBatches.push_back(batch);
+            }
+            gpuBatches.back().commandCount += MODEL_LOD_COUNT;
+        }
+        if (impostorsActive()) {
+            DrawElementsIndirectCommand command;
+            command.count = 6;
+            command.instanceCount = 0;
+            command.firstIndex = 0;
+            command.baseVertex = 0;
+            command.baseInstance = 0;
+            commands.push_back(command);
         }
 
-        // Reset state
-        glDisable(GL_BLEND);
-        glUseProgram(0);
-        glBindVertexArray(0);
+        gpuCuller.setCommands(commands);
+        gpuCuller.setInstances(instanceMatrices, instanceBounds, slotBounds);
+        gpuDirty = false;
     }
 
-    void renderDepth(GLuint programID, GLuint mvpMatrixID, const glm::mat4& lightSpaceMatrix) {
-        glUseProgram(programID);
+    // Everything that has to match for two primitives to share an indirect draw
+    typedef std::tuple<GLuint, GLuint, int, bool, float, float, float, float> BatchKey;
+    BatchKey batchOrder(const PrimitiveObject& primitive) const {
+        const glm::vec4& color = primitive.baseColorFactor;
+        return std::make_tuple(SharedGeometryArena().vertexArray(primitive.geometry), primitive.textureID,
+            primitive.node, primitive.isLight, color.r, color.g, color.b, color.a);
+    }
 
-        // Combine transformations with the camera matrix
-        glm::mat4 mvpMatrix = lightSpaceMatrix * modelMatrix;
+    // Material of the batch; matrices come from the culled buffer, where every
+    // command's baseInstance points into
+    static void applyIndirect(const DrawItem& item) {
+        const Model& owner = *(const Model*)item.owner;
+        owner.objects.bind(item.userData[0]);
+        bindInstanceAttributes(owner.gpuCuller.visibleBuffer, 0);
+        bindPaletteAttribute(0, 0);
+    }
 
-        // Pass the updated MVP matrix to the shader
-        glUniformMatrix4fv(mvpMatrixID, 1, GL_FALSE, &mvpMatrix[0][0]);
+    static void drawIndirect(const DrawItem& item) {
+        const Model& owner = *(const Model*)item.owner;
+        const GpuBatch& batch = owner.gpuBatches[item.userData[1]];
+        owner.gpuCuller.draw(batch.firstCommand, batch.commandCount, item.indexType);
+    }
+
+    // Culls on the GPU and queues one indirect draw per batch. The CPU work here does
+    // not depend on the number of instances.
+    void submitIndirect(RenderQueue& queue, const glm::mat4& cameraMatrix, OcclusionBuffer* occlusion) {
+        if (gpuDirty) {
+            rebuildGpuBatches();
+        }
+        if (instanceMatrices.empty() || gpuBatches.empty()) {
+            return;
+        }
+        bool impostors = impostorsActive();
+        gpuCuller.cull(cameraMatrix, lodScreenSizes, lodHysteresis, impostors ? impostorScreenSize : 0.0f, occlusion);
+
+        // Which instances are drawn is only known on the GPU, so textures are asked for
+        // as sharp as the nearest point of any instance needs them
+        glm::vec4 row3(cameraMatrix[0][3], cameraMatrix[1][3], cameraMatrix[2][3], cameraMatrix[3][3]);
+        float nearestDepth = FLT_MAX;
+        for (int c = 0; c < 8; ++c) {
+            glm::vec3 corner(c & 1 ? instanceExtent.max.x : instanceExtent.min.x, c & 2 ? instanceExtent.max.y : instanceExtent.min.y,
+                c & 4 ? instanceExtent.max.z : instanceExtent.min.z);
+            nearestDepth = std::min(nearestDepth, glm::dot(row3, glm::vec4(corner, 1.0f)));
+        }
+        requestTextures(nearestDepth, true);
+
+        for (size_t b = 0; b < gpuBatches.size(); ++b) {
+            const PrimitiveObject& primitive = primitiveObjects[gpuBatches[b].primitive];
+            bool transparent = primitive.baseColorFactor.a < 1.0f;
+
+            DrawItem item;
+            item.program = programID;
+            item.texture = primitive.textureID;
+            item.vertexArray = SharedGeometryArena().vertexArray(primitive.geometry);
+            item.blend = true;
+            item.indexCount = 0;
+            item.firstIndex = 0;
+            item.indexType = primitive.geometry.indexType;
+            item.baseVertex = 0;
+            item.instanceCount = 0;
+            item.apply = applyIndirect;
+            item.draw = drawIndirect;
+            item.owner = this;
+            item.userData[0] = gpuBatches[b].primitive;
+            item.userData[1] = (int)b;
+
+            // Depths are only known on the GPU, batches sort by state alone
+            item.key = queue.makeKey(transparent ? PASS_TRANSPARENT : PASS_OPAQUE, item.blend, item.program,
+                item.texture, item.vertexArray, 0.0f);
+            queue.submit(item);
+        }
+        if (impostors) {
+            DrawItem item = impostorItem(queue, 0.0f);
+            item.draw = drawImpostorIndirect;
+            queue.submit(item);
+        }
+    }
+
+    // The depth program must read the same per-instance matrix at location 3 and the same
+    // Object block as model.vert.
+    // Casters are culled against the light's own frustum and get LODs for the cascade,
+    // see selectCasterLods(); the camera's LODs and their hysteresis are left alone.
+    // Returns the draw calls issued.
+    int renderDepth(GLuint programID, GLuint mvpMatrixID, const glm::mat4& lightSpaceMatrix) {
+        PROFILE_SCOPE("renderDepth");
+        updateTransforms();
+        ensurePalettes();
+        CullStats casterStats;
+        if (cullInstances(ExtractFrustum(lightSpaceMatrix), casterStats) == 0) {
+            return 0;
+        }
+        selectCasterLods(lightSpaceMatrix);
+        uploadVisibleInstances(casterLod);
+
+        glUseProgram(programID);
+
+        // Pass the light's view-projection, model transforms are per instance and per node
+        glUniformMatrix4fv(mvpMatrixID, 1, GL_FALSE, &lightSpaceMatrix[0][0]);
+        if (skeleton) {
+            paletteBuffer.bind(3);
+        }
 
         // Render each primitive
-        for (const auto& primitive : primitiveObjects) {
-            glBindVertexArray(primitive.vao);
-            glDrawElements(GL_TRIANGLES, primitive.indexCount, primitive.indexType, 0);
+        GLuint boundVertexArray = 0;
+        int draws = 0;
+        for (size_t p = 0; p < primitiveObjects.size(); ++p) {
+            if (primitiveVisible[p]) {
+                draws += drawLods(p, boundVertexArray);
+            }
         }
 
         // Reset state
         glBindVertexArray(0);
         glUseProgram(0);
+        return draws;
     }
-};
-
 
+    // The geometry and textures are freed with the last Model using them
+    void cleanup() {
+        SharedMeshes shared;
+        if (!meshKey.empty() && meshCache().release(meshKey, shared)) {
+            for (size_t g = 0; g < shared.geometry.size(); ++g) {
+                SharedGeometryArena().release(shared.geometry[g]);
+            }
+            for (size_t t = 0; t < shared.textureIDs.size(); ++t) {
+                ReleaseTexture(shared.textureIDs[t]);
+            }
+        }
+        meshKey.clear();
+        primitiveObjects.clear();
+        objects.cleanup();
+        paletteBuffer.cleanup();
+        skeleton.reset();
+        jointPalettes.clear();
+        glDeleteBuffers(1, &instancePaletteBufferID);
+        SharedSceneGraph().destroy(rootNode);
+        nodes.clear();
+        glDeleteBuffers(1, &instanceBufferID);
+        impostor.cleanup();
+        if (gpuDriven) {
+            gpuCuller.cleanup();
+            gpuDriven = false;
+        }
+    }
+};
@@ -0,0 +1,201 @@
+#include "animation.h"
+#include "scene_graph.h"
+#include "profiler.h"
+
+#include <cmath>
+
+namespace {
+
+// Instances per batch handed to one thread
+const size_t PALETTE_BATCH = 16;
+
+glm::quat toQuat(const glm::vec4& value) {
+	return glm::quat(value.w, value.x, value.y, value.z);
+}
+
+// Value of the channel at time, clamped to its first and last key
+glm::vec4 sampleChannel(const AnimationChannel& channel, float time) {
+	const std::vector<float>& times = channel.times;
+	bool cubic = channel.interpolation == ANIMATION_CUBICSPLINE;
+	size_t stride = cubic ? 3 : 1;
+	size_t value = cubic ? 1 : 0;
+
+	if (time <= times.front()) {
+		return channel.values[value];
+	}
+	if (time >= times.back()) {
+		return channel.values[(times.size() - 1) * stride + value];
+	}
+
+	size_t next = std::upper_bound(times.begin(), times.end(), time) - times.begin();
+	size_t previous = next - 1;
+	float interval = times[next] - times[previous];
+	float t = interval > 0.0f ? (time - times[previous]) / interval : 0.0f;
+	const glm::vec4& from = channel.values[previous * stride + value];
+	const glm::vec4& to = channel.values[next * stride + value];
+
+	switch (channel.interpolation) {
+	case ANIMATION_STEP:
+		return from;
+	case ANIMATION_CUBICSPLINE: {
+		// Hermite spline, tangents are scaled by the key interval
+		const glm::vec4& outTangent = channel.values[previous * stride + 2];
+		const glm::vec4& inTangent = channel.values[next * stride];
+		float t2 = t * t, t3 = t2 * t;
+		glm::vec4 result = (2.0f * t3 - 3.0f * t2 + 1.0f) * from + (t3 - 2.0f * t2 + t) * interval * outTangent +
+			(-2.0f * t3 + 3.0f * t2) * to + (t3 - t2) * interval * inTangent;
+		if (channel.path == ANIMATION_ROTATION) {
+			result = glm::normalize(result);
+		}
+		return result;
+	}
+	default:
+		if (channel.path == ANIMATION_ROTATION) {
+			glm::quat q = glm::slerp(toQuat(from), toQuat(to), t);
+			return glm::vec4(q.x, q.y, q.z, q.w);
+		}
+		return glm::mix(from, to, t);
+	}
+}
+
+float wrapTime(float time, float duration) {
+	if (duration <= 0.0f) {
+		return 0.0f;
+	}
+	time = std::fmod(time, duration);
+	return time < 0.0f ? time + duration : time;
+}
+
+}
+
+int Skeleton::findClip(const std::string& name) const {
+	for (size_t c = 0; c < clips.size(); ++c) {
+		if (clips[c].name == name) {
+			return (int)c;
+		}
+	}
+	return -1;
+}
+
+AnimationState::AnimationState() : clip(0), time(0.0f), blendClip(-1), blendTime(0.0f), blendWeight(0.0f), speed(1.0f) {
+}
+
+void PlayClip(AnimationState& state, int clip) {
+	state.clip = clip;
+	state.time = 0.0f;
+	state.blendClip = -1;
+	state.blendTime = 0.0f;
+	state.blendWeight = 0.0f;
+}
+
+void AdvanceAnimation(const Skeleton& skeleton, AnimationState& state, float deltaTime) {
+	if (state.clip >= 0 && state.clip < (int)skeleton.clips.size()) {
+		state.time = wrapTime(state.time + deltaTime * state.speed, skeleton.clips[state.clip].duration);
+	}
+	if (state.blendClip >= 0 && state.blendClip < (int)skeleton.clips.size()) {
+		state.blendTime = wrapTime(state.blendTime + deltaTime * state.speed, skeleton.clips[state.blendClip].duration);
+	}
+}
+
+void SampleClip(const AnimationClip& clip, float time, Pose& pose) {
+	for (size_t c = 0; c < clip.channels.size(); ++c) {
+		const AnimationChannel& channel = clip.channels[c];
+		glm::vec4 value = sampleChannel(channel, time);
+		switch (channel.path) {
+		case ANIMATION_TRANSLATION:
+			pose.translations[channel.node] = glm::vec3(value);
+			break;
+		case ANIMATION_ROTATION:
+			pose.rotations[channel.node] = toQuat(value);
+			break;
+		case ANIMATION_SCALE:
+			pose.scales[channel.node] = glm::vec3(value);
+			break;
+		}
+	}
+}
+
+void BlendPoses(const Pose& a, const Pose& b, float weight, Pose& out) {
+	out.translations.resize(a.translations.size());
+	out.rotations.resize(a.rotations.size());
+	out.scales.resize(a.scales.size());
+	for (size_t n = 0; n < a.translations.size(); ++n) {
+		out.translations[n] = glm::mix(a.translations[n], b.translations[n], weight);
+		out.rotations[n] = glm::slerp(a.rotations[n], b.rotations[n], weight);
+		out.scales[n] = glm::mix(a.scales[n], b.scales[n], weight);
+	}
+}
+
+void BuildJointPalette(const Skeleton& skeleton, const Pose& pose, std::vector<glm::mat4>& worlds, glm::mat4* palette) {
+	// Parent-sorted, so one pass gives every node's transform in model space
+	worlds.resize(skeleton.parents.size());
+	for (size_t n = 0; n < skeleton.parents.size(); ++n) {
+		glm::mat4 local = ComposeTransform(pose.translations[n], pose.rotations[n], pose.scales[n]);
+		int parent = skeleton.parents[n];
+		worlds[n] = parent >= 0 ? worlds[parent] * local : local;
+	}
+
+	// The skinned node's own transform is applied by the draw, so it is taken back out
+	for (size_t s = 0; s < skeleton.skins.size(); ++s) {
+		const SkinBinding& skin = skeleton.skins[s];
+		for (size_t j = 0; j < skin.joints.size(); ++j) {
+			glm::mat4 joint = skin.joints[j] >= 0 ? worlds[skin.joints[j]] : glm::mat4(1.0f);
+			palette[skin.paletteOffset + j] = skin.inverseNodeTransform * joint * skin.inverseBindMatrices[j];
+		}
+	}
+}
+
+void EvaluatePalettes(WorkerPool& workers, const Skeleton& skeleton, const std::vector<AnimationState>& states,
+	std::vector<glm::mat4>& palettes) {
+	PROFILE_SCOPE("EvaluatePalettes");
+	palettes.resize(states.size() * skeleton.paletteSize);
+	ParallelFor(workers, states.size(), PALETTE_BATCH, [&](size_t begin, size_t end) {
+		Pose pose, blend;
+		std::vector<glm::mat4> worlds;
+		for (size_t i = begin; i < end; ++i) {
+			const AnimationState& state = states[i];
+			pose = skeleton.restPose;
+			if (state.clip >= 0 && state.clip < (int)skeleton.clips.size()) {
+				SampleClip(skeleton.clips[state.clip], state.time, pose);
+			}
+			if (state.blendWeight > 0.0f && state.blendClip >= 0 && state.blendClip < (int)skeleton.clips.size()) {
+				blend = skeleton.restPose;
+				SampleClip(skeleton.clips[state.blendClip], state.blendTime, blend);
+				BlendPoses(pose, blend, state.blendWeight, pose);
+			}
+			BuildJointPalette(skeleton, pose, worlds, &palettes[i * skeleton.paletteSize]);
+		}
+	});
+}
+
+void JointPaletteBuffer::upload(const std::vector<glm::mat4>& palettes) {
+	if (buffer == 0) {
+		glGenBuffers(1, &buffer);
+		glGenTextures(1, &texture);
+		glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+		glBufferData(GL_TEXTURE_BUFFER, sizeof(glm::mat4), NULL, GL_STREAM_DRAW);
+		glBindTexture(GL_TEXTURE_BUFFER, texture);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffer);
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
+	}
+
+	// Orphan the storage the previous frame's draws may still read
+	glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+	glBufferData(GL_TEXTURE_BUFFER, std::max(palettes.size(), (size_t)1) * sizeof(glm::mat4), NULL, GL_STREAM_DRAW);
+	if (!palettes.empty()) {
+		glBufferSubData(GL_TEXTURE_BUFFER, 0, palettes.size() * sizeof(glm::mat4), &palettes[0][0][0]);
+	}
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void JointPaletteBuffer::bind(int textureUnit) const {
+	glActiveTexture(GL_TEXTURE0 + textureUnit);
+	glBindTexture(GL_TEXTURE_BUFFER, texture);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+void JointPaletteBuffer::cleanup() {
+	glDeleteTextures(1, &texture);
+	glDeleteBuffers(1, &buffer);
+	buffer = texture = 0;
+}
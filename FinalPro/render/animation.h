@@ -0,0 +1,113 @@
+#ifndef _ANIMATION_H_
+#define _ANIMATION_H_
+
+#include "headers.h"
+#include "async_loader.h"
+
+#include <glm/gtc/quaternion.hpp>
+
+enum AnimationPath {
+	ANIMATION_TRANSLATION,
+	ANIMATION_ROTATION,
+	ANIMATION_SCALE
+};
+
+enum AnimationInterpolation {
+	ANIMATION_LINEAR,
+	ANIMATION_STEP,
+	ANIMATION_CUBICSPLINE
+};
+
+// Keyframes of one property of one skeleton node. Cubic splines store three values
+// per key, in-tangent, value and out-tangent, as glTF does.
+struct AnimationChannel {
+	int node;
+	AnimationPath path;
+	AnimationInterpolation interpolation;
+	std::vector<float> times;
+	std::vector<glm::vec4> values;		// xyz, or a quaternion as xyzw
+};
+
+struct AnimationClip {
+	std::string name;
+	float duration;
+	std::vector<AnimationChannel> channels;
+};
+
+// Local transform of every node of a skeleton
+struct Pose {
+	std::vector<glm::vec3> translations;
+	std::vector<glm::quat> rotations;
+	std::vector<glm::vec3> scales;
+};
+
+// A skin as bound to one node. joints index the skeleton's nodes, -1 for joints outside
+// the imported scene, which stay at the identity.
+struct SkinBinding {
+	std::vector<int> joints;
+	std::vector<glm::mat4> inverseBindMatrices;
+	glm::mat4 inverseNodeTransform;		// Rest transform of the skinned node, inverted
+	int paletteOffset;					// First palette entry of the skin
+};
+
+// Node hierarchy of an asset in parent-sorted order with its skins and clips. One
+// palette holds the joint matrices of every skin, paletteSize of them.
+struct Skeleton {
+	std::vector<int> parents;
+	Pose restPose;
+	std::vector<SkinBinding> skins;
+	std::vector<AnimationClip> clips;
+	int paletteSize;
+
+	// -1 if no clip has that name
+	int findClip(const std::string& name) const;
+};
+
+// Playback of one instance: clip at time, blended towards blendClip at blendTime by
+// blendWeight, 0 playing clip alone. Clips loop; -1 holds the rest pose.
+struct AnimationState {
+	int clip;
+	float time;
+	int blendClip;
+	float blendTime;
+	float blendWeight;
+	float speed;
+
+	AnimationState();
+};
+
+// Starts clip from its beginning on its own, dropping any blend
+void PlayClip(AnimationState& state, int clip);
+
+// Moves both clips of the state forward, wrapping around their duration
+void AdvanceAnimation(const Skeleton& skeleton, AnimationState& state, float deltaTime);
+
+// Overwrites the nodes the clip animates with their value at time
+void SampleClip(const AnimationClip& clip, float time, Pose& pose);
+
+// out = a blended towards b by weight; out may be a
+void BlendPoses(const Pose& a, const Pose& b, float weight, Pose& out);
+
+// Joint matrices of every skin for the pose, written to palette[0, paletteSize).
+// worlds is scratch space.
+void BuildJointPalette(const Skeleton& skeleton, const Pose& pose, std::vector<glm::mat4>& worlds, glm::mat4* palette);
+
+// One palette per state, states[i] going to palettes[i * paletteSize]. Instances are
+// evaluated in batches spread over the pool.
+void EvaluatePalettes(WorkerPool& workers, const Skeleton& skeleton, const std::vector<AnimationState>& states,
+	std::vector<glm::mat4>& palettes);
+
+// Every instance's palette in one buffer texture, four RGBA32F texels per matrix,
+// replaced by each upload()
+struct JointPaletteBuffer {
+	GLuint buffer;
+	GLuint texture;
+
+	JointPaletteBuffer() : buffer(0), texture(0) {}
+
+	void upload(const std::vector<glm::mat4>& palettes);
+	void bind(int textureUnit) const;
+	void cleanup();
+};
+
+#endif
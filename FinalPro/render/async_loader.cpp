@@ -0,0 +1,443 @@
+#include "async_loader.h"
+#include "shader.h"
+#include "resources.h"
+#include "texture.h"
+#include "texture_streaming.h"
+#include "profiler.h"
+#include "program_cache.h"
+
+#include <chrono>
+
+#define BUFFER_OFFSET(i) ((char *)NULL + (i))
+
+void WorkerPool::start(int threadCount) {
+	stopping = false;
+	for (int i = 0; i < threadCount; ++i) {
+		threads.push_back(std::thread([this]() {
+			for (;;) {
+				std::function<void()> job;
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					wake.wait(lock, [this]() { return stopping || !jobs.empty(); });
+					if (jobs.empty()) {
+						return;
+					}
+					job = jobs.front();
+					jobs.pop_front();
+				}
+				PROFILE_SCOPE("Worker job");
+				job();
+			}
+		}));
+	}
+}
+
+void WorkerPool::submit(const std::function<void()>& job) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		jobs.push_back(job);
+	}
+	wake.notify_one();
+}
+
+// Jobs already queued still run, so nothing is left half done
+void WorkerPool::stop() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (size_t i = 0; i < threads.size(); ++i) {
+		threads[i].join();
+	}
+	threads.clear();
+}
+
+namespace {
+
+struct ParallelBatches {
+	std::atomic<size_t> next;
+	std::atomic<size_t> done;
+	size_t count;
+	size_t batchSize;
+	size_t batchCount;
+	const std::function<void(size_t, size_t)>* body;
+	std::mutex mutex;
+	std::condition_variable finished;
+
+	// Runs batches until none is left to claim. A helper that starts after the caller
+	// returned claims nothing, so body is never used past its lifetime.
+	void drain() {
+		for (;;) {
+			size_t batch = next.fetch_add(1);
+			if (batch >= batchCount) {
+				return;
+			}
+			size_t begin = batch * batchSize;
+			(*body)(begin, std::min(begin + batchSize, count));
+			if (done.fetch_add(1) + 1 == batchCount) {
+				std::lock_guard<std::mutex> lock(mutex);
+				finished.notify_all();
+			}
+		}
+	}
+};
+
+}
+
+void ParallelFor(WorkerPool& pool, size_t count, size_t batchSize, const std::function<void(size_t, size_t)>& body) {
+	batchSize = std::max(batchSize, (size_t)1);
+	size_t batchCount = (count + batchSize - 1) / batchSize;
+	if (batchCount <= 1 || pool.threads.empty()) {
+		if (count > 0) {
+			body(0, count);
+		}
+		return;
+	}
+
+	std::shared_ptr<ParallelBatches> batches(new ParallelBatches());
+	batches->next = 0;
+	batches->done = 0;
+	batches->count = count;
+	batches->batchSize = batchSize;
+	batches->batchCount = batchCount;
+	batches->body = &body;
+
+	size_t helpers = std::min(pool.threads.size(), batchCount - 1);
+	for (size_t h = 0; h < helpers; ++h) {
+		pool.submit([batches]() { batches->drain(); });
+	}
+	batches->drain();
+
+	std::unique_lock<std::mutex> lock(batches->mutex);
+	batches->finished.wait(lock, [&batches]() { return batches->done.load() == batches->batchCount; });
+}
+
+// Pixels travel to the texture through a pixel buffer object in bounded slices. The
+// texture keeps its placeholder until the last slice is in, then a single
+// glTexImage2D sources the buffer so the driver can copy without stalling the CPU.
+// Cooked textures are small and go up in a single step, mip chain included. With
+// streaming on, the worker turns either into a mip chain for the streamer instead.
+struct TextureUpload {
+	GLuint texture;
+	GLuint pbo;
+	std::vector<unsigned char> pixels;
+	int width, height, channels;
+	bool srgb;
+	size_t uploaded;
+	CookedTexture cooked;
+	MipChain streamed;
+
+	// Worker side of a streamed upload
+	void makeMipChain() {
+		if (!cooked.levels.empty()) {
+			MakeMipChain(cooked, streamed);
+		}
+		else if (!pixels.empty()) {
+			MakeMipChain(&pixels[0], width, height, channels, srgb, streamed);
+			std::vector<unsigned char>().swap(pixels);
+		}
+	}
+
+	bool step(size_t chunkBytes) {
+		if (!streamed.levels.empty()) {
+			SharedTextureStreamer().add(texture, streamed);
+			return true;
+		}
+		if (!cooked.levels.empty()) {
+			UploadCookedTexture(cooked, texture);
+			cooked.levels.clear();
+			return true;
+		}
+
+		size_t total = pixels.size();
+		if (pbo == 0) {
+			glGenBuffers(1, &pbo);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, total, NULL, GL_STREAM_DRAW);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			uploaded = 0;
+			return false;
+		}
+
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+		if (uploaded < total) {
+			size_t bytes = std::min(chunkBytes, total - uploaded);
+			glBufferSubData(GL_PIXEL_UNPACK_BUFFER, uploaded, bytes, &pixels[uploaded]);
+			uploaded += bytes;
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			return false;
+		}
+
+		GLenum format;
+		GLint internalFormat;
+		ImageFormat(channels, srgb, format, internalFormat);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, GL_UNSIGNED_BYTE, BUFFER_OFFSET(0));
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glGenerateMipmap(GL_TEXTURE_2D);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		glDeleteBuffers(1, &pbo);
+		pbo = 0;
+		std::vector<unsigned char>().swap(pixels);
+		return true;
+	}
+};
+
+namespace {
+
+GLuint createPlaceholderTexture() {
+	const unsigned char white[4] = { 255, 255, 255, 255 };
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB8_ALPHA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, white);
+	glGenerateMipmap(GL_TEXTURE_2D);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return texture;
+}
+
+}
+
+void AsyncLoader::start(int threadCount) {
+	if (threadCount <= 0) {
+		// Leave one core to the render thread
+		threadCount = std::max(1, (int)std::thread::hardware_concurrency() - 1);
+	}
+	pending = 0;
+	uploadChunkBytes = 1 << 20;
+	workers.start(threadCount);
+}
+
+void AsyncLoader::submit(const std::function<void()>& work, const std::function<void()>& finish) {
+	pending++;
+	workers.submit([this, work, finish]() {
+		work();
+		queueGlStep([this, finish]() {
+			finish();
+			pending--;
+			return true;
+		});
+	});
+}
+
+void AsyncLoader::queueGlStep(const std::function<bool()>& step) {
+	std::lock_guard<std::mutex> lock(glMutex);
+	glSteps.push_back(step);
+}
+
+void AsyncLoader::queueGlPoll(const std::function<bool()>& poll) {
+	std::lock_guard<std::mutex> lock(glMutex);
+	glPolls.push_back(poll);
+}
+
+void AsyncLoader::queueTextureUpload(const std::shared_ptr<TextureUpload>& upload) {
+	size_t chunk = uploadChunkBytes;
+	pending++;
+	queueGlStep([this, upload, chunk]() {
+		if (!upload->step(chunk)) {
+			return false;
+		}
+		pending--;
+		return true;
+	});
+}
+
+GLuint AsyncLoader::loadTexture(const char* texture_file_path, bool srgb) {
+	// A texture already in the cache is shared even if it is still uploading
+	std::string key = TextureKey(texture_file_path, srgb);
+	GLuint texture;
+	if (AcquireCachedTexture(key, texture)) {
+		return texture;
+	}
+	texture = createPlaceholderTexture();
+	InsertCachedTexture(key, texture);
+
+	std::shared_ptr<TextureUpload> upload(new TextureUpload());
+	upload->texture = texture;
+	upload->pbo = 0;
+	upload->srgb = srgb;
+	std::string path(texture_file_path);
+	bool useCooked = CompressedTexturesSupported();
+	bool stream = SharedTextureStreamer().enabled();
+
+	submit([upload, path, useCooked, stream]() {
+		if (useCooked && ReadCookedTexture(CookedTexturePath(path.c_str()).c_str(), upload->cooked)) {
+			if (upload->cooked.srgb == upload->srgb) {
+				if (stream) {
+					upload->makeMipChain();
+				}
+				return;
+			}
+			// Cooked for the other colour space, the image is used instead
+			upload->cooked.levels.clear();
+		}
+
+		// Same decode as LoadTextureTileBox: alpha is kept only when the image has it
+		int w, h, channels;
+		int components = stbi_info(path.c_str(), &w, &h, &channels) && (channels == 2 || channels == 4) ? 4 : 3;
+		uint8_t* img = stbi_load(path.c_str(), &w, &h, &channels, components);
+		if (img) {
+			upload->pixels.assign(img, img + (size_t)w * h * components);
+			upload->width = w;
+			upload->height = h;
+			upload->channels = components;
+			stbi_image_free(img);
+			if (stream) {
+				upload->makeMipChain();
+			}
+		}
+		else {
+			std::cout << "Failed to load texture " << path << std::endl;
+		}
+	}, [this, upload]() {
+		if (!upload->pixels.empty() || !upload->cooked.levels.empty() || !upload->streamed.levels.empty()) {
+			queueTextureUpload(upload);
+		}
+	});
+
+	return texture;
+}
+
+GLuint AsyncLoader::uploadTexture(const unsigned char* pixels, int width, int height, int channels, bool srgb) {
+	std::string key = ContentKey(pixels, (size_t)width * height * channels) + (srgb ? "" : "#linear");
+	GLuint texture;
+	if (AcquireCachedTexture(key, texture)) {
+		return texture;
+	}
+	texture = createPlaceholderTexture();
+	InsertCachedTexture(key, texture);
+
+	std::shared_ptr<TextureUpload> upload(new TextureUpload());
+	upload->texture = texture;
+	upload->pbo = 0;
+	upload->width = width;
+	upload->height = height;
+	upload->channels = channels;
+	upload->srgb = srgb;
+	upload->pixels.assign(pixels, pixels + (size_t)width * height * channels);
+
+	// The mip chain is built on a worker, the pixels are already decoded
+	if (SharedTextureStreamer().enabled()) {
+		submit([upload]() {
+			upload->makeMipChain();
+		}, [this, upload]() {
+			queueTextureUpload(upload);
+		});
+		return texture;
+	}
+	queueTextureUpload(upload);
+	return texture;
+}
+
+void AsyncLoader::loadShaders(const char* vertex_file_path, const char* fragment_file_path,
+	const std::function<void(GLuint)>& onReady) {
+	std::string key = ShaderKey(vertex_file_path, fragment_file_path);
+	GLuint programID;
+	if (AcquireCachedShaders(key, programID)) {
+		pending++;
+		queueGlStep([this, onReady, programID]() {
+			onReady(programID);
+			pending--;
+			return true;
+		});
+		return;
+	}
+
+	std::shared_ptr<ProgramSource> source(new ProgramSource());
+	std::shared_ptr<bool> found(new bool(false));
+	std::string vertexPath(vertex_file_path), fragmentPath(fragment_file_path);
+	source->name = vertexPath + ", " + fragmentPath;
+
+	submit([=]() {
+		*found = ReadShaderFile(vertexPath.c_str(), source->vertex);
+		if (!*found) {
+			printf("Vertex shader not found %s.\n", vertexPath.c_str());
+			return;
+		}
+		*found = ReadShaderFile(fragmentPath.c_str(), source->fragment);
+		if (!*found) {
+			printf("Fragment shader not found %s.\n", fragmentPath.c_str());
+		}
+	}, [=]() {
+		if (!*found) {
+			onReady(0);
+			return;
+		}
+
+		// Status is only queried once the driver reports the link done
+		std::shared_ptr<PendingProgram> program(new PendingProgram());
+		SharedProgramCache().begin(*source, *program);
+		pending++;
+		queueGlPoll([this, program, key, onReady]() {
+			if (!SharedProgramCache().isReady(*program)) {
+				return false;
+			}
+			GLuint programID = SharedProgramCache().finish(*program);
+			if (programID != 0) {
+				programID = InsertCachedShaders(key, programID);
+			}
+			onReady(programID);
+			pending--;
+			return true;
+		});
+	});
+}
+
+void AsyncLoader::pump(double budgetMs) {
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+
+	// Polls are cheap and never block, so they are not counted against the budget
+	std::vector<std::function<bool()> > polls;
+	{
+		std::lock_guard<std::mutex> lock(glMutex);
+		polls.swap(glPolls);
+	}
+	for (size_t i = 0; i < polls.size(); ++i) {
+		if (!polls[i]()) {
+			std::lock_guard<std::mutex> lock(glMutex);
+			glPolls.push_back(polls[i]);
+		}
+	}
+
+	for (;;) {
+		std::function<bool()> step;
+		{
+			std::lock_guard<std::mutex> lock(glMutex);
+			if (glSteps.empty()) {
+				return;
+			}
+			step = glSteps.front();
+			glSteps.pop_front();
+		}
+
+		// Steps may queue more steps, so the lock is not held while one runs
+		if (!step()) {
+			std::lock_guard<std::mutex> lock(glMutex);
+			glSteps.push_front(step);
+		}
+
+		double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+		if (elapsed >= budgetMs) {
+			return;
+		}
+	}
+}
+
+bool AsyncLoader::isIdle() const {
+	return pending == 0;
+}
+
+void AsyncLoader::shutdown() {
+	workers.stop();
+	std::lock_guard<std::mutex> lock(glMutex);
+	glSteps.clear();
+	glPolls.clear();
+}
@@ -0,0 +1,91 @@
+#ifndef _ASYNC_LOADER_H_
+#define _ASYNC_LOADER_H_
+
+#include "headers.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Fixed set of worker threads draining a FIFO of jobs
+struct WorkerPool {
+	std::vector<std::thread> threads;
+	std::deque<std::function<void()> > jobs;
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping;
+
+	void start(int threadCount);
+	void submit(const std::function<void()>& job);
+	void stop();
+};
+
+// Calls body(begin, end) over [0, count) in batches of batchSize. The pool's workers and
+// the calling thread claim batches until none is left; returns once all are done. Meant
+// for short per-frame work on a pool of its own, queued loading jobs would delay it.
+void ParallelFor(WorkerPool& pool, size_t count, size_t batchSize, const std::function<void(size_t, size_t)>& body);
+
+struct TextureUpload;
+
+// Loads assets without blocking the render thread. File I/O, parsing and image
+// decoding run on the worker pool; everything that touches GL is queued back and
+// executed by pump() on the GL thread, a slice of work at a time, until the
+// per-frame budget is used up.
+//
+// Objects referenced by submitted work must outlive the loader or its shutdown().
+struct AsyncLoader {
+	WorkerPool workers;
+
+	// GL-thread steps; a step returns false when it needs to be called again
+	std::deque<std::function<bool()> > glSteps;
+	std::mutex glMutex;
+
+	// GL-thread checks for work the driver finishes on its own, such as parallel
+	// shader compiles. Each runs once per pump() until it returns true.
+	std::vector<std::function<bool()> > glPolls;
+
+	// Jobs submitted but not yet finished on the GL thread
+	std::atomic<int> pending;
+
+	// Bytes copied into a pixel buffer per step, bounds the cost of one slice
+	size_t uploadChunkBytes;
+
+	void start(int threadCount = 0);
+
+	// Runs work() on a worker, then finish() on the GL thread inside pump()
+	void submit(const std::function<void()>& work, const std::function<void()>& finish);
+
+	// Returns a texture that samples as opaque white until the image is resident.
+	// Textures and programs go through the resource cache; release them with
+	// ReleaseTexture() and ReleaseShaders(). When SharedTextureStreamer() is enabled,
+	// the texture is handed to it with its mip chain instead of uploaded whole.
+	// Colour images are sRGB; pass srgb false for data such as normal maps.
+	GLuint loadTexture(const char* texture_file_path, bool srgb = true);
+
+	// Same as loadTexture(), for pixels already decoded (tightly packed, 3 or 4 channels)
+	GLuint uploadTexture(const unsigned char* pixels, int width, int height, int channels, bool srgb = true);
+
+	// Reads both files on a worker and hands the linked program to onReady(). The
+	// compile is started in one pump() and collected in a later one once the driver
+	// is done, so programs requested together compile together.
+	void loadShaders(const char* vertex_file_path, const char* fragment_file_path,
+		const std::function<void(GLuint)>& onReady);
+
+	// Executes queued GL work for at most budgetMs milliseconds (at least one step)
+	void pump(double budgetMs);
+
+	bool isIdle() const;
+
+	// Waits for the workers; GL work still queued is dropped
+	void shutdown();
+
+	void queueGlStep(const std::function<bool()>& step);
+	void queueGlPoll(const std::function<bool()>& poll);
+	void queueTextureUpload(const std::shared_ptr<TextureUpload>& upload);
+};
+
+#endif
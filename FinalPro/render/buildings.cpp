@@ -0,0 +1,205 @@
+#include "buildings.h"
+
+#include <cfloat>
+
+void DefaultCitySettings(CitySettings& settings) {
+	settings.origin = glm::vec2(-114.0f);
+	settings.blocksX = 4;
+	settings.blocksZ = 4;
+	settings.blockSize = 48.0f;
+	settings.streetWidth = 12.0f;
+	settings.minLot = 10.0f;
+	settings.lotGap = 2.0f;
+	settings.emptyLots = 0.1f;
+	settings.minFloors = 3;
+	settings.maxFloors = 25;
+	settings.floorHeight = 3.2f;
+	settings.towerFloors = 12;
+	settings.facadeSize = 16.0f;
+	settings.facadeCount = 6;
+	settings.seed = 1;
+}
+
+void CityBlockArea(const CitySettings& settings, int blockX, int blockZ, glm::vec2& min, glm::vec2& max) {
+	float pitch = settings.blockSize + settings.streetWidth;
+	min = settings.origin + glm::vec2(blockX * pitch, blockZ * pitch);
+	max = min + glm::vec2(settings.blockSize);
+}
+
+namespace {
+
+unsigned int mixBits(unsigned int h) {
+	h ^= h >> 16;
+	h *= 0x7feb352du;
+	h ^= h >> 15;
+	h *= 0x846ca68bu;
+	h ^= h >> 16;
+	return h;
+}
+
+// Sequence of draws seeded per block, so blocks come out the same in any order
+struct BlockRandom {
+	unsigned int state;
+
+	BlockRandom(int blockX, int blockZ, unsigned int seed)
+		: state(mixBits((unsigned int)blockX * 0x8da6b343u ^ (unsigned int)blockZ * 0xd8163841u ^ mixBits(seed))) {}
+
+	// In [0, 1)
+	float next() {
+		state = mixBits(state + 0x9e3779b9u);
+		return (state >> 8) * (1.0f / 16777216.0f);
+	}
+};
+
+struct Lot {
+	glm::vec2 min, max;
+};
+
+// Cuts across the longer side until the pieces would get too narrow, stopping early
+// now and then so lot sizes vary
+void splitLot(const Lot& lot, float minLot, BlockRandom& random, std::vector<Lot>& lots) {
+	glm::vec2 size = lot.max - lot.min;
+	int axis = size.x >= size.y ? 0 : 1;
+	bool stop = size[axis] < 2.0f * minLot || (size[axis] < 3.0f * minLot && random.next() < 0.3f);
+	if (stop) {
+		lots.push_back(lot);
+		return;
+	}
+	float cut = lot.min[axis] + size[axis] * (0.35f + 0.3f * random.next());
+	Lot first = lot, second = lot;
+	first.max[axis] = cut;
+	second.min[axis] = cut;
+	splitLot(first, minLot, random, lots);
+	splitLot(second, minLot, random, lots);
+}
+
+void addQuad(CityBlock& block, const glm::vec3 corners[4], const glm::vec3& normal, const glm::vec2 uvs[4], float layer) {
+	unsigned short base = (unsigned short)block.vertices.size();
+	for (int c = 0; c < 4; ++c) {
+		BuildingVertex vertex;
+		vertex.position = corners[c];
+		vertex.normal = normal;
+		vertex.uv = glm::vec3(uvs[c], layer);
+		block.vertices.push_back(vertex);
+	}
+	const unsigned short quad[6] = { 0, 1, 2, 0, 2, 3 };
+	for (int i = 0; i < 6; ++i) {
+		block.indices.push_back(base + quad[i]);
+	}
+}
+
+// Four walls and a roof. Facades repeat a whole number of times along each wall and
+// start at ground level, so floors line up around the building.
+void addBox(const CitySettings& settings, glm::vec2 min, glm::vec2 max, float bottom, float top, float ground,
+	float layer, CityBlock& block) {
+	// Walls counter-clockwise seen from outside: bottom left and bottom right corners
+	const glm::vec2 walls[4][2] = {
+		{ glm::vec2(min.x, max.y), glm::vec2(max.x, max.y) },	// +z
+		{ glm::vec2(max.x, max.y), glm::vec2(max.x, min.y) },	// +x
+		{ glm::vec2(max.x, min.y), glm::vec2(min.x, min.y) },	// -z
+		{ glm::vec2(min.x, min.y), glm::vec2(min.x, max.y) }	// -x
+	};
+	float vBottom = -(bottom - ground) / settings.facadeSize, vTop = -(top - ground) / settings.facadeSize;
+	for (int w = 0; w < 4; ++w) {
+		glm::vec2 left = walls[w][0], right = walls[w][1];
+		float repeats = std::max(1.0f, floorf(glm::length(right - left) / settings.facadeSize + 0.5f));
+		glm::vec2 along = glm::normalize(right - left);
+		glm::vec3 corners[4] = {
+			glm::vec3(left.x, bottom, left.y), glm::vec3(right.x, bottom, right.y),
+			glm::vec3(right.x, top, right.y), glm::vec3(left.x, top, left.y)
+		};
+		glm::vec2 uvs[4] = {
+			glm::vec2(0.0f, vBottom), glm::vec2(repeats, vBottom), glm::vec2(repeats, vTop), glm::vec2(0.0f, vTop)
+		};
+		addQuad(block, corners, glm::vec3(-along.y, 0.0f, along.x), uvs, layer);
+	}
+
+	glm::vec3 roof[4] = {
+		glm::vec3(min.x, top, max.y), glm::vec3(max.x, top, max.y), glm::vec3(max.x, top, min.y), glm::vec3(min.x, top, min.y)
+	};
+	glm::vec2 roofUvs[4];
+	for (int c = 0; c < 4; ++c) {
+		roofUvs[c] = glm::vec2(roof[c].x, roof[c].z) / settings.facadeSize;
+	}
+	addQuad(block, roof, glm::vec3(0.0f, 1.0f, 0.0f), roofUvs, (float)settings.facadeCount);
+
+	// Occluder: the eight corners, walls and roof
+	unsigned int base = (unsigned int)block.occluder.size();
+	for (int c = 0; c < 8; ++c) {
+		block.occluder.push_back(glm::vec3(c & 1 ? max.x : min.x, c & 2 ? top : bottom, c & 4 ? max.y : min.y));
+	}
+	const unsigned int faces[10][3] = {
+		{ 0, 1, 3 }, { 0, 3, 2 }, { 4, 6, 7 }, { 4, 7, 5 }, { 0, 2, 6 },
+		{ 0, 6, 4 }, { 1, 5, 7 }, { 1, 7, 3 }, { 2, 3, 7 }, { 2, 7, 6 }
+	};
+	for (int f = 0; f < 10; ++f) {
+		for (int i = 0; i < 3; ++i) {
+			block.occluderIndices.push_back(base + faces[f][i]);
+		}
+	}
+}
+
+}
+
+void GenerateCityBlock(const CitySettings& settings, int blockX, int blockZ,
+	const std::function<float(float, float)>& height, CityBlock& block) {
+	block.blockX = blockX;
+	block.blockZ = blockZ;
+	block.buildingCount = 0;
+	block.vertices.clear();
+	block.indices.clear();
+	block.occluder.clear();
+	block.occluderIndices.clear();
+
+	BlockRandom random(blockX, blockZ, settings.seed);
+	Lot area;
+	CityBlockArea(settings, blockX, blockZ, area.min, area.max);
+	std::vector<Lot> lots;
+	splitLot(area, settings.minLot, random, lots);
+
+	glm::vec2 cityMin, cityMax, corner;
+	CityBlockArea(settings, 0, 0, cityMin, corner);
+	CityBlockArea(settings, settings.blocksX - 1, settings.blocksZ - 1, corner, cityMax);
+	glm::vec2 cityCenter = (cityMin + cityMax) * 0.5f;
+	float cityRadius = std::max(glm::length(cityMax - cityCenter), 1.0f);
+
+	// Two boxes of 20 vertices at most per lot
+	for (size_t l = 0; l < lots.size() && block.vertices.size() + 40 <= 65536; ++l) {
+		if (random.next() < settings.emptyLots) {
+			continue;
+		}
+		glm::vec2 min = lots[l].min + glm::vec2(0.5f * settings.lotGap);
+		glm::vec2 max = lots[l].max - glm::vec2(0.5f * settings.lotGap);
+		glm::vec2 center = (min + max) * 0.5f;
+
+		// Footed below the lowest point of the footprint so slopes show no gap
+		float ground = std::min(std::min(height(min.x, min.y), height(max.x, min.y)),
+			std::min(std::min(height(min.x, max.y), height(max.x, max.y)), height(center.x, center.y)));
+		float bottom = ground - 1.0f;
+
+		float centrality = 1.0f - 0.6f * std::min(glm::length(center - cityCenter) / cityRadius, 1.0f);
+		float r = random.next();
+		int floors = settings.minFloors + (int)((settings.maxFloors - settings.minFloors) * r * r * centrality + 0.5f);
+		float layer = (float)std::min((int)(random.next() * settings.facadeCount), settings.facadeCount - 1);
+
+		glm::vec2 size = max - min;
+		if (floors > settings.towerFloors && std::min(size.x, size.y) >= settings.minLot) {
+			int podium = 2 + (int)(random.next() * 3.0f);
+			float podiumTop = ground + podium * settings.floorHeight;
+			addBox(settings, min, max, bottom, podiumTop, ground, layer, block);
+			addBox(settings, min + size * 0.2f, max - size * 0.2f, podiumTop, ground + floors * settings.floorHeight,
+				ground, layer, block);
+		}
+		else {
+			addBox(settings, min, max, bottom, ground + floors * settings.floorHeight, ground, layer, block);
+		}
+		block.buildingCount++;
+	}
+
+	block.bounds.min = glm::vec3(FLT_MAX);
+	block.bounds.max = glm::vec3(-FLT_MAX);
+	for (size_t v = 0; v < block.occluder.size(); ++v) {
+		block.bounds.min = glm::min(block.bounds.min, block.occluder[v]);
+		block.bounds.max = glm::max(block.bounds.max, block.occluder[v]);
+	}
+}
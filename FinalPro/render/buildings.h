@@ -0,0 +1,59 @@
+#ifndef _BUILDINGS_H_
+#define _BUILDINGS_H_
+
+#include "headers.h"
+#include "frustum.h"
+
+#include <functional>
+
+// Procedural city of box buildings on a grid of blocks separated by streets. Every
+// block is split into lots by recursive cuts across its longer side; a lot holds one
+// building of whole floors, the tall ones on a podium with a narrower tower above.
+// All buildings of a block go into one vertex and index batch, so a block is drawn,
+// culled and used as an occluder as a unit.
+struct CitySettings {
+	glm::vec2 origin;			// World x, z of the corner of block (0, 0)
+	int blocksX, blocksZ;
+	float blockSize;			// Edge of a square block
+	float streetWidth;			// Gap between blocks
+	float minLot;				// Lots are not cut below this edge length
+	float lotGap;				// Space left between neighbouring buildings
+	float emptyLots;			// Fraction of lots left without a building
+	int minFloors, maxFloors;	// Taller towards the centre of the city
+	float floorHeight;
+	int towerFloors;			// Buildings with more floors stand on a podium
+	float facadeSize;			// World size of one facade image, a whole number of floors
+	int facadeCount;			// Facade layers to pick from; the roof uses layer facadeCount
+	unsigned int seed;
+};
+
+void DefaultCitySettings(CitySettings& settings);
+
+// World x, z corners of a block, streets excluded
+void CityBlockArea(const CitySettings& settings, int blockX, int blockZ, glm::vec2& min, glm::vec2& max);
+
+// uv.z is the layer of the facade texture array
+struct BuildingVertex {
+	glm::vec3 position;
+	glm::vec3 normal;
+	glm::vec3 uv;
+};
+
+// The buildings of one block, in world space. The occluder is every box drawn, walls
+// and roof, without its vertex attributes.
+struct CityBlock {
+	int blockX, blockZ;
+	int buildingCount;
+	AABB bounds;
+	std::vector<BuildingVertex> vertices;
+	std::vector<unsigned short> indices;	// A block stays below 65536 vertices
+	std::vector<glm::vec3> occluder;
+	std::vector<unsigned int> occluderIndices;
+};
+
+// Builds one block standing on height(x, z). CPU-only and safe to call from any
+// thread as long as height is; the result depends only on the settings and block.
+void GenerateCityBlock(const CitySettings& settings, int blockX, int blockZ,
+	const std::function<float(float, float)>& height, CityBlock& block);
+
+#endif
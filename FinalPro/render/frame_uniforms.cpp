@@ -0,0 +1,103 @@
+#include "frame_uniforms.h"
+
+namespace {
+
+GLuint createBlockBuffer(GLuint binding, GLsizeiptr size) {
+	GLuint buffer;
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+	glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer);
+	return buffer;
+}
+
+// Orphans the previous contents so the upload does not wait for draws still reading them
+void uploadBlock(GLuint buffer, GLsizeiptr size, const void* data) {
+	glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+	glBufferData(GL_UNIFORM_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, size, data);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+}
+
+void BindUniformBlocks(GLuint programID) {
+	const char* names[4] = { "Camera", "Lighting", "Shadows", "Object" };
+	const GLuint bindings[4] = { CAMERA_BLOCK_BINDING, LIGHTING_BLOCK_BINDING, SHADOW_BLOCK_BINDING, OBJECT_BLOCK_BINDING };
+	for (int i = 0; i < 4; ++i) {
+		GLuint index = glGetUniformBlockIndex(programID, names[i]);
+		if (index != GL_INVALID_INDEX) {
+			glUniformBlockBinding(programID, index, bindings[i]);
+		}
+	}
+}
+
+void FrameUniforms::initialize() {
+	cameraBuffer = createBlockBuffer(CAMERA_BLOCK_BINDING, sizeof(CameraBlock));
+	lightingBuffer = createBlockBuffer(LIGHTING_BLOCK_BINDING, sizeof(LightingBlock));
+	shadowBuffer = createBlockBuffer(SHADOW_BLOCK_BINDING, sizeof(ShadowBlock));
+
+	// Nothing is shadowed until the cascades are set
+	setShadows(ShadowBlock());
+}
+
+void FrameUniforms::setCamera(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& eye) {
+	CameraBlock camera;
+	camera.view = view;
+	camera.projection = projection;
+	camera.viewProjection = projection * view;
+	camera.position = glm::vec4(eye, 1.0f);
+
+	// The view looks down -z, its third row is the backward axis in world space
+	camera.forward = glm::vec4(-view[0][2], -view[1][2], -view[2][2], 0.0f);
+	uploadBlock(cameraBuffer, sizeof(camera), &camera);
+}
+
+void FrameUniforms::setLighting(const LightingBlock& lighting) {
+	uploadBlock(lightingBuffer, sizeof(lighting), &lighting);
+}
+
+void FrameUniforms::setShadows(const ShadowBlock& shadows) {
+	uploadBlock(shadowBuffer, sizeof(shadows), &shadows);
+}
+
+void FrameUniforms::cleanup() {
+	glDeleteBuffers(1, &cameraBuffer);
+	glDeleteBuffers(1, &lightingBuffer);
+	glDeleteBuffers(1, &shadowBuffer);
+	cameraBuffer = lightingBuffer = shadowBuffer = 0;
+}
+
+FrameUniforms& SharedFrameUniforms() {
+	static FrameUniforms uniforms;
+	return uniforms;
+}
+
+void ObjectBuffer::upload(const std::vector<ObjectBlock>& objects) {
+	GLint alignment = 256;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+	stride = ((GLsizeiptr)sizeof(ObjectBlock) + alignment - 1) / alignment * alignment;
+	count = objects.size();
+
+	std::vector<unsigned char> packed(count * stride, 0);
+	for (size_t i = 0; i < count; ++i) {
+		memcpy(&packed[i * stride], &objects[i], sizeof(ObjectBlock));
+	}
+	if (buffer == 0) {
+		glGenBuffers(1, &buffer);
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+	glBufferData(GL_UNIFORM_BUFFER, packed.size(), packed.empty() ? NULL : &packed[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void ObjectBuffer::bind(size_t index) const {
+	glBindBufferRange(GL_UNIFORM_BUFFER, OBJECT_BLOCK_BINDING, buffer, index * stride, sizeof(ObjectBlock));
+}
+
+void ObjectBuffer::cleanup() {
+	glDeleteBuffers(1, &buffer);
+	buffer = 0;
+	count = 0;
+}
@@ -0,0 +1,89 @@
+#ifndef _FRAME_UNIFORMS_H_
+#define _FRAME_UNIFORMS_H_
+
+#include "headers.h"
+
+#define MAX_SHADOW_CASCADES 4
+
+// Binding points of the uniform blocks every program shares. The shaders declare the
+// blocks by these names; BindUniformBlocks() points a program's blocks at them.
+enum UniformBlockBinding {
+	CAMERA_BLOCK_BINDING = 0,
+	LIGHTING_BLOCK_BINDING = 1,
+	SHADOW_BLOCK_BINDING = 2,
+	OBJECT_BLOCK_BINDING = 3
+};
+
+// std140 layouts, declared field for field in the shaders. vec3s are padded to vec4
+// or share their last slot with a scalar, as std140 would place them.
+struct CameraBlock {
+	glm::mat4 view;
+	glm::mat4 projection;
+	glm::mat4 viewProjection;
+	glm::vec4 position;			// w unused
+	glm::vec4 forward;			// w unused
+};
+
+struct LightingBlock {
+	glm::vec4 position;			// w unused
+	glm::vec3 intensity;
+	float exposure;
+};
+
+struct ShadowBlock {
+	glm::mat4 lightSpaceMatrices[MAX_SHADOW_CASCADES];
+	glm::vec4 cascadeSplits;	// Far view depth of each cascade
+	GLint cascadeCount;			// 0 disables shadows
+	GLint padding[3];
+};
+
+// Per-draw data, one entry per material or object in an ObjectBuffer. Skinned draws
+// read their joints from the instance's palette, starting at jointOffset. Packed
+// vertices are decoded with the VertexQuantization of their primitive.
+struct ObjectBlock {
+	glm::mat4 modelMatrix;
+	glm::vec4 baseColorFactor;
+	glm::vec4 positionOffset;	// w unused
+	glm::vec4 positionScale;	// w unused
+	glm::vec4 uvTransform;		// Offset in xy, scale in zw
+	GLint isLight;
+	GLint skinned;
+	GLint jointOffset;
+	GLint packedNormals;		// Normals are octahedral-encoded in xy
+};
+
+// Binds the Camera, Lighting, Shadows and Object blocks a program declares to their
+// binding points. Programs built by the program cache already went through this.
+void BindUniformBlocks(GLuint programID);
+
+// The blocks that change at most once per frame, one buffer each, bound at their
+// binding points for good. Each set*() is a single upload.
+struct FrameUniforms {
+	GLuint cameraBuffer;
+	GLuint lightingBuffer;
+	GLuint shadowBuffer;
+
+	void initialize();
+	void setCamera(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& eye);
+	void setLighting(const LightingBlock& lighting);
+	void setShadows(const ShadowBlock& shadows);
+	void cleanup();
+};
+
+FrameUniforms& SharedFrameUniforms();
+
+// ObjectBlocks packed in one buffer at the offset alignment glBindBufferRange needs,
+// so a draw selects its entry with one bind instead of uploading uniforms
+struct ObjectBuffer {
+	GLuint buffer;
+	GLsizeiptr stride;
+	size_t count;
+
+	ObjectBuffer() : buffer(0), stride(0), count(0) {}
+
+	void upload(const std::vector<ObjectBlock>& objects);
+	void bind(size_t index) const;
+	void cleanup();
+};
+
+#endif
@@ -0,0 +1,119 @@
+#include "frustum.h"
+
+void AABBList::clear() {
+	resize(0);
+}
+
+void AABBList::resize(size_t count) {
+	minX.resize(count); minY.resize(count); minZ.resize(count);
+	maxX.resize(count); maxY.resize(count); maxZ.resize(count);
+}
+
+void AABBList::set(size_t i, const AABB& box) {
+	minX[i] = box.min.x; minY[i] = box.min.y; minZ[i] = box.min.z;
+	maxX[i] = box.max.x; maxY[i] = box.max.y; maxZ[i] = box.max.z;
+}
+
+void AABBList::push_back(const AABB& box) {
+	resize(size() + 1);
+	set(size() - 1, box);
+}
+
+Frustum ExtractFrustum(const glm::mat4& viewProjection) {
+	// Gribb-Hartmann: each plane is the fourth row plus or minus one of the others
+	glm::vec4 row0(viewProjection[0][0], viewProjection[1][0], viewProjection[2][0], viewProjection[3][0]);
+	glm::vec4 row1(viewProjection[0][1], viewProjection[1][1], viewProjection[2][1], viewProjection[3][1]);
+	glm::vec4 row2(viewProjection[0][2], viewProjection[1][2], viewProjection[2][2], viewProjection[3][2]);
+	glm::vec4 row3(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+
+	Frustum frustum;
+	frustum.planes[0] = row3 + row0;
+	frustum.planes[1] = row3 - row0;
+	frustum.planes[2] = row3 + row1;
+	frustum.planes[3] = row3 - row1;
+	frustum.planes[4] = row3 + row2;
+	frustum.planes[5] = row3 - row2;
+
+	for (int i = 0; i < 6; ++i) {
+		float length = glm::length(glm::vec3(frustum.planes[i]));
+		frustum.planes[i] /= length;
+	}
+	return frustum;
+}
+
+AABB TransformAABB(const AABB& box, const glm::mat4& transform) {
+	// Arvo's method: project the extents onto each axis of the transform
+	glm::vec3 center = (box.min + box.max) * 0.5f;
+	glm::vec3 extent = (box.max - box.min) * 0.5f;
+
+	glm::vec3 newCenter = glm::vec3(transform * glm::vec4(center, 1.0f));
+	glm::vec3 newExtent(0.0f);
+	for (int column = 0; column < 3; ++column) {
+		newExtent += glm::abs(glm::vec3(transform[column])) * extent[column];
+	}
+
+	AABB result;
+	result.min = newCenter - newExtent;
+	result.max = newCenter + newExtent;
+	return result;
+}
+
+AABB MergeAABB(const AABB& a, const AABB& b) {
+	AABB result;
+	result.min = glm::min(a.min, b.min);
+	result.max = glm::max(a.max, b.max);
+	return result;
+}
+
+bool IsAABBVisible(const Frustum& frustum, const AABB& box) {
+	for (int i = 0; i < 6; ++i) {
+		const glm::vec4& plane = frustum.planes[i];
+		// Test the corner furthest along the plane normal
+		glm::vec3 corner(plane.x > 0.0f ? box.max.x : box.min.x,
+			plane.y > 0.0f ? box.max.y : box.min.y,
+			plane.z > 0.0f ? box.max.z : box.min.z);
+		if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f) {
+			return false;
+		}
+	}
+	return true;
+}
+
+size_t CullAABBs(const Frustum& frustum, const AABBList& boxes, std::vector<unsigned char>& visible) {
+	size_t count = boxes.size();
+	visible.assign(count, 1);
+	if (count == 0) {
+		return 0;
+	}
+
+	unsigned char* out = &visible[0];
+	for (int p = 0; p < 6; ++p) {
+		const glm::vec4& plane = frustum.planes[p];
+
+		// Choosing the arrays once per plane leaves a branch-free inner loop the
+		// compiler can turn into packed multiply-adds
+		const float* cx = plane.x > 0.0f ? &boxes.maxX[0] : &boxes.minX[0];
+		const float* cy = plane.y > 0.0f ? &boxes.maxY[0] : &boxes.minY[0];
+		const float* cz = plane.z > 0.0f ? &boxes.maxZ[0] : &boxes.minZ[0];
+		const float nx = plane.x, ny = plane.y, nz = plane.z, d = plane.w;
+
+		for (size_t i = 0; i < count; ++i) {
+			float distance = nx * cx[i] + ny * cy[i] + nz * cz[i] + d;
+			out[i] &= (unsigned char)(distance >= 0.0f);
+		}
+	}
+
+	size_t visibleCount = 0;
+	for (size_t i = 0; i < count; ++i) {
+		visibleCount += out[i];
+	}
+	return visibleCount;
+}
+
+void ResetCullStats(CullStats& stats) {
+	stats.instancesVisible = 0;
+	stats.instancesCulled = 0;
+	stats.instancesOccluded = 0;
+	stats.primitivesVisible = 0;
+	stats.primitivesCulled = 0;
+}
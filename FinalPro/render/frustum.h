@@ -0,0 +1,52 @@
+#ifndef _FRUSTUM_H_
+#define _FRUSTUM_H_
+
+#include "headers.h"
+
+// Axis-aligned bounding box
+struct AABB {
+	glm::vec3 min;
+	glm::vec3 max;
+};
+
+// Boxes stored as separate component arrays so the plane tests vectorize
+struct AABBList {
+	std::vector<float> minX, minY, minZ;
+	std::vector<float> maxX, maxY, maxZ;
+
+	size_t size() const { return minX.size(); }
+	void clear();
+	void resize(size_t count);
+	void set(size_t i, const AABB& box);
+	void push_back(const AABB& box);
+};
+
+// Six planes (left, right, bottom, top, near, far) as (normal, distance), pointing inwards
+struct Frustum {
+	glm::vec4 planes[6];
+};
+
+// What the last culling pass kept and rejected, cleared by ResetCullStats()
+struct CullStats {
+	int instancesVisible;
+	int instancesCulled;
+	int instancesOccluded;		// In the frustum but hidden, counted in instancesCulled
+	int primitivesVisible;
+	int primitivesCulled;
+};
+
+Frustum ExtractFrustum(const glm::mat4& viewProjection);
+
+AABB TransformAABB(const AABB& box, const glm::mat4& transform);
+
+AABB MergeAABB(const AABB& a, const AABB& b);
+
+bool IsAABBVisible(const Frustum& frustum, const AABB& box);
+
+// Writes 1 into visible[i] for every box that intersects the frustum, 0 otherwise.
+// Returns the number of visible boxes.
+size_t CullAABBs(const Frustum& frustum, const AABBList& boxes, std::vector<unsigned char>& visible);
+
+void ResetCullStats(CullStats& stats);
+
+#endif
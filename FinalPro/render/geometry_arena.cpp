@@ -0,0 +1,229 @@
+#include "geometry_arena.h"
+
+#define BUFFER_OFFSET(i) ((char *)NULL + (i))
+
+void RangeAllocator::reset(size_t capacity) {
+	this->capacity = capacity;
+	freeRanges.clear();
+	freeRanges.push_back(std::make_pair((size_t)0, capacity));
+}
+
+bool RangeAllocator::allocate(size_t size, size_t& offset) {
+	for (size_t i = 0; i < freeRanges.size(); ++i) {
+		if (freeRanges[i].second < size) {
+			continue;
+		}
+		offset = freeRanges[i].first;
+		freeRanges[i].first += size;
+		freeRanges[i].second -= size;
+		if (freeRanges[i].second == 0) {
+			freeRanges.erase(freeRanges.begin() + i);
+		}
+		return true;
+	}
+	return false;
+}
+
+void RangeAllocator::release(size_t offset, size_t size) {
+	size_t i = 0;
+	while (i < freeRanges.size() && freeRanges[i].first < offset) {
+		++i;
+	}
+	freeRanges.insert(freeRanges.begin() + i, std::make_pair(offset, size));
+
+	// Merge with the following range, then with the preceding one
+	if (i + 1 < freeRanges.size() && freeRanges[i].first + freeRanges[i].second == freeRanges[i + 1].first) {
+		freeRanges[i].second += freeRanges[i + 1].second;
+		freeRanges.erase(freeRanges.begin() + i + 1);
+	}
+	if (i > 0 && freeRanges[i - 1].first + freeRanges[i - 1].second == freeRanges[i].first) {
+		freeRanges[i - 1].second += freeRanges[i].second;
+		freeRanges.erase(freeRanges.begin() + i);
+	}
+}
+
+GeometryArena::GeometryArena() {
+	// 8 MB of vertices and 4 MB of indices per block
+	blockVertexBytes = 8 << 20;
+	blockIndexBytes = 4 << 20;
+}
+
+bool GeometryArena::allocate(const std::vector<MeshVertex>& vertices, const std::vector<unsigned int>& indices, GeometryRange& range) {
+	return !vertices.empty() && allocate(VERTEX_FLOAT, &vertices[0], vertices.size(), indices, range);
+}
+
+bool GeometryArena::allocate(const std::vector<PackedVertex>& vertices, const std::vector<unsigned int>& indices, GeometryRange& range) {
+	return !vertices.empty() && allocate(VERTEX_PACKED, &vertices[0], vertices.size(), indices, range);
+}
+
+// Attributes 0 to 2 of the bound VAO, read from the bound array buffer
+static void setVertexLayout(VertexFormat format) {
+	if (format == VERTEX_PACKED) {
+		// Normalized, the vertex shaders scale them back with the Object block
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex), BUFFER_OFFSET(offsetof(PackedVertex, position)));
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(PackedVertex), BUFFER_OFFSET(offsetof(PackedVertex, normal)));
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex), BUFFER_OFFSET(offsetof(PackedVertex, uv)));
+	}
+	else {
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), BUFFER_OFFSET(offsetof(MeshVertex, position)));
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), BUFFER_OFFSET(offsetof(MeshVertex, normal)));
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), BUFFER_OFFSET(offsetof(MeshVertex, uv)));
+	}
+}
+
+bool GeometryArena::allocate(VertexFormat format, const void* vertices, size_t vertexCount, const std::vector<unsigned int>& indices,
+	GeometryRange& range) {
+	if (indices.empty()) {
+		return false;
+	}
+
+	// Indices are relative to the mesh, so its vertex count alone decides
+	GLenum indexType = vertexCount <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+	size_t indexSize = IndexSize(indexType);
+	size_t vertexSize = VertexSize(format);
+
+	size_t vertexOffset = 0, indexOffset = 0;
+	int block = -1;
+	for (size_t b = 0; b < blocks.size() && block < 0; ++b) {
+		if (blocks[b].format != format || blocks[b].indexType != indexType) {
+			continue;
+		}
+		if (!blocks[b].vertices.allocate(vertexCount, vertexOffset)) {
+			continue;
+		}
+		if (!blocks[b].indices.allocate(indices.size(), indexOffset)) {
+			blocks[b].vertices.release(vertexOffset, vertexCount);
+			continue;
+		}
+		block = (int)b;
+	}
+
+	if (block < 0) {
+		// Oversized meshes get a block of their own size
+		GeometryBlock created;
+		created.skinVbo = 0;
+		created.format = format;
+		created.indexType = indexType;
+		created.vertices.reset(std::max(blockVertexBytes / vertexSize, vertexCount));
+		created.indices.reset(std::max(blockIndexBytes / indexSize, indices.size()));
+
+		glGenVertexArrays(1, &created.vao);
+		glBindVertexArray(created.vao);
+
+		glGenBuffers(1, &created.vbo);
+		glBindBuffer(GL_ARRAY_BUFFER, created.vbo);
+		glBufferData(GL_ARRAY_BUFFER, created.vertices.capacity * vertexSize, NULL, GL_STATIC_DRAW);
+		setVertexLayout(format);
+
+		glGenBuffers(1, &created.ebo);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, created.ebo);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, created.indices.capacity * indexSize, NULL, GL_STATIC_DRAW);
+
+		glBindVertexArray(0);
+
+		created.vertices.allocate(vertexCount, vertexOffset);
+		created.indices.allocate(indices.size(), indexOffset);
+		blocks.push_back(created);
+		block = (int)blocks.size() - 1;
+	}
+
+	const GeometryBlock& target = blocks[block];
+	glBindBuffer(GL_ARRAY_BUFFER, target.vbo);
+	glBufferSubData(GL_ARRAY_BUFFER, vertexOffset * vertexSize, vertexCount * vertexSize, vertices);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	// The element buffer binding is VAO state, so upload through the copy target
+	glBindBuffer(GL_COPY_WRITE_BUFFER, target.ebo);
+	if (indexType == GL_UNSIGNED_SHORT) {
+		std::vector<unsigned short> narrow(indices.begin(), indices.end());
+		glBufferSubData(GL_COPY_WRITE_BUFFER, indexOffset * indexSize, narrow.size() * indexSize, &narrow[0]);
+	}
+	else {
+		glBufferSubData(GL_COPY_WRITE_BUFFER, indexOffset * indexSize, indices.size() * indexSize, &indices[0]);
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+	range.block = block;
+	range.baseVertex = (GLint)vertexOffset;
+	range.firstIndex = (GLuint)indexOffset;
+	range.indexType = indexType;
+	range.format = format;
+	range.vertexCount = (GLsizei)vertexCount;
+	range.indexCount = (GLsizei)indices.size();
+	return true;
+}
+
+void GeometryArena::uploadSkin(const GeometryRange& range, const std::vector<SkinVertex>& skin) {
+	GeometryBlock& target = blocks[range.block];
+	if (target.skinVbo == 0) {
+		glBindVertexArray(target.vao);
+		glGenBuffers(1, &target.skinVbo);
+		glBindBuffer(GL_ARRAY_BUFFER, target.skinVbo);
+		glBufferData(GL_ARRAY_BUFFER, target.vertices.capacity * sizeof(SkinVertex), NULL, GL_STATIC_DRAW);
+
+		glEnableVertexAttribArray(8);
+		glVertexAttribIPointer(8, 4, GL_UNSIGNED_SHORT, sizeof(SkinVertex), BUFFER_OFFSET(offsetof(SkinVertex, joints)));
+		glEnableVertexAttribArray(9);
+		glVertexAttribPointer(9, 4, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(SkinVertex), BUFFER_OFFSET(offsetof(SkinVertex, weights)));
+		glBindVertexArray(0);
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, target.skinVbo);
+	glBufferSubData(GL_ARRAY_BUFFER, range.baseVertex * sizeof(SkinVertex), skin.size() * sizeof(SkinVertex), &skin[0]);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void GeometryArena::release(const GeometryRange& range) {
+	if (range.block < 0 || range.block >= (int)blocks.size()) {
+		return;
+	}
+	blocks[range.block].vertices.release(range.baseVertex, range.vertexCount);
+	blocks[range.block].indices.release(range.firstIndex, range.indexCount);
+}
+
+size_t GeometryArena::usedBytes() const {
+	size_t used = 0;
+	for (size_t b = 0; b < blocks.size(); ++b) {
+		size_t freeVertices = 0, freeIndices = 0;
+		for (size_t i = 0; i < blocks[b].vertices.freeRanges.size(); ++i) {
+			freeVertices += blocks[b].vertices.freeRanges[i].second;
+		}
+		for (size_t i = 0; i < blocks[b].indices.freeRanges.size(); ++i) {
+			freeIndices += blocks[b].indices.freeRanges[i].second;
+		}
+		size_t vertexBytes = VertexSize(blocks[b].format) + (blocks[b].skinVbo != 0 ? sizeof(SkinVertex) : 0);
+		used += (blocks[b].vertices.capacity - freeVertices) * vertexBytes +
+			(blocks[b].indices.capacity - freeIndices) * IndexSize(blocks[b].indexType);
+	}
+	return used;
+}
+
+size_t GeometryArena::capacityBytes() const {
+	size_t capacity = 0;
+	for (size_t b = 0; b < blocks.size(); ++b) {
+		size_t vertexBytes = VertexSize(blocks[b].format) + (blocks[b].skinVbo != 0 ? sizeof(SkinVertex) : 0);
+		capacity += blocks[b].vertices.capacity * vertexBytes + blocks[b].indices.capacity * IndexSize(blocks[b].indexType);
+	}
+	return capacity;
+}
+
+void GeometryArena::cleanup() {
+	for (size_t b = 0; b < blocks.size(); ++b) {
+		glDeleteVertexArrays(1, &blocks[b].vao);
+		glDeleteBuffers(1, &blocks[b].vbo);
+		glDeleteBuffers(1, &blocks[b].ebo);
+		glDeleteBuffers(1, &blocks[b].skinVbo);
+	}
+	blocks.clear();
+}
+
+GeometryArena& SharedGeometryArena() {
+	static GeometryArena arena;
+	return arena;
+}
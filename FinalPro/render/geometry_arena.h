@@ -0,0 +1,84 @@
+#ifndef _GEOMETRY_ARENA_H_
+#define _GEOMETRY_ARENA_H_
+
+#include "headers.h"
+#include "mesh.h"
+
+// First-fit allocator over [0, capacity), free ranges kept sorted and coalesced
+struct RangeAllocator {
+	std::vector<std::pair<size_t, size_t> > freeRanges;	// (offset, size)
+	size_t capacity;
+
+	void reset(size_t capacity);
+	bool allocate(size_t size, size_t& offset);
+	void release(size_t offset, size_t size);
+};
+
+// Bytes per index of GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+inline size_t IndexSize(GLenum indexType) {
+	return indexType == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+}
+
+// One pair of large vertex and index buffers and the VAO reading them. All vertices
+// of a block have the same format and all indices the same type, so a multi-draw
+// over the block can use one.
+struct GeometryBlock {
+	GLuint vao;
+	GLuint vbo;
+	GLuint ebo;
+	GLuint skinVbo;		// SkinVertex per vertex, 0 until a skinned mesh lands in the block
+	VertexFormat format;
+	GLenum indexType;
+	RangeAllocator vertices;
+	RangeAllocator indices;
+};
+
+// Where a mesh lives inside the arena. Indices are stored relative to the mesh, draws
+// add baseVertex (glDrawElementsBaseVertex) and start at firstIndex, counted in
+// indices of indexType.
+struct GeometryRange {
+	int block;
+	GLint baseVertex;
+	GLuint firstIndex;
+	GLenum indexType;
+	VertexFormat format;
+	GLsizei vertexCount;
+	GLsizei indexCount;
+};
+
+// Shared storage for every imported mesh. Meshes are packed into a few big blocks,
+// so drawing any of them only needs the VAO of its block; a new block is opened when
+// none has room left. Meshes of up to 65536 vertices store 16-bit indices, and packed
+// vertices go to blocks of their own as well.
+struct GeometryArena {
+	std::vector<GeometryBlock> blocks;
+	size_t blockVertexBytes;
+	size_t blockIndexBytes;
+
+	GeometryArena();
+
+	bool allocate(const std::vector<MeshVertex>& vertices, const std::vector<unsigned int>& indices, GeometryRange& range);
+	bool allocate(const std::vector<PackedVertex>& vertices, const std::vector<unsigned int>& indices, GeometryRange& range);
+
+	// vertexCount vertices of the given format at vertices
+	bool allocate(VertexFormat format, const void* vertices, size_t vertexCount, const std::vector<unsigned int>& indices,
+		GeometryRange& range);
+	void release(const GeometryRange& range);
+
+	// Stores a skinned mesh's joints and weights next to its vertices, in a second
+	// buffer of the block read at locations 8 and 9. skin has one entry per vertex.
+	void uploadSkin(const GeometryRange& range, const std::vector<SkinVertex>& skin);
+
+	GLuint vertexArray(const GeometryRange& range) const { return blocks[range.block].vao; }
+
+	// Bytes handed out, and bytes reserved across all blocks
+	size_t usedBytes() const;
+	size_t capacityBytes() const;
+
+	void cleanup();
+};
+
+// The arena every Model allocates from
+GeometryArena& SharedGeometryArena();
+
+#endif
@@ -0,0 +1,295 @@
+#include "gpu_culling.h"
+#include "resources.h"
+
+#define BUFFER_OFFSET(i) ((char *)NULL + (i))
+
+// GL 4.3 enums missing from the 3.3 headers
+#ifndef GL_COMPUTE_SHADER
+#define GL_COMPUTE_SHADER 0x91B9
+#endif
+#ifndef GL_SHADER_STORAGE_BUFFER
+#define GL_SHADER_STORAGE_BUFFER 0x90D2
+#endif
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+#ifndef GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT
+#define GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT 0x00000001
+#endif
+#ifndef GL_COMMAND_BARRIER_BIT
+#define GL_COMMAND_BARRIER_BIT 0x00000040
+#endif
+#ifndef GL_SHADER_STORAGE_BARRIER_BIT
+#define GL_SHADER_STORAGE_BARRIER_BIT 0x00002000
+#endif
+#ifndef GL_BUFFER_UPDATE_BARRIER_BIT
+#define GL_BUFFER_UPDATE_BARRIER_BIT 0x00000200
+#endif
+
+namespace {
+
+typedef void (GLAD_API_PTR *DispatchComputeProc)(GLuint x, GLuint y, GLuint z);
+typedef void (GLAD_API_PTR *MemoryBarrierProc)(GLbitfield barriers);
+typedef void (GLAD_API_PTR *MultiDrawElementsIndirectProc)(GLenum mode, GLenum type, const void* indirect,
+	GLsizei drawcount, GLsizei stride);
+
+DispatchComputeProc dispatchCompute = NULL;
+MemoryBarrierProc memoryBarrier = NULL;
+MultiDrawElementsIndirectProc multiDrawElementsIndirect = NULL;
+
+GLuint compileComputeProgram(const char* compute_file_path) {
+	std::ifstream stream(compute_file_path, std::ios::in);
+	if (!stream.is_open()) {
+		printf("Compute shader not found %s.\n", compute_file_path);
+		return 0;
+	}
+	std::stringstream sstr;
+	sstr << stream.rdbuf();
+	std::string code = sstr.str();
+
+	printf("Compiling compute shader : %s\n", compute_file_path);
+	GLuint shaderID = glCreateShader(GL_COMPUTE_SHADER);
+	const char* source = code.c_str();
+	glShaderSource(shaderID, 1, &source, NULL);
+	glCompileShader(shaderID);
+
+	GLint result = GL_FALSE;
+	int infoLogLength;
+	glGetShaderiv(shaderID, GL_COMPILE_STATUS, &result);
+	if (!result) {
+		printf("Error compiling compute shader : %s\n", compute_file_path);
+		glGetShaderiv(shaderID, GL_INFO_LOG_LENGTH, &infoLogLength);
+		if (infoLogLength > 0) {
+			std::vector<char> message(infoLogLength + 1);
+			glGetShaderInfoLog(shaderID, infoLogLength, NULL, &message[0]);
+			printf("%s\n", &message[0]);
+		}
+		glDeleteShader(shaderID);
+		return 0;
+	}
+
+	GLuint programID = glCreateProgram();
+	glAttachShader(programID, shaderID);
+	glLinkProgram(programID);
+	glGetProgramiv(programID, GL_LINK_STATUS, &result);
+	glDetachShader(programID, shaderID);
+	glDeleteShader(shaderID);
+	if (!result) {
+		printf("Error linking compute program : %s\n", compute_file_path);
+		glDeleteProgram(programID);
+		return 0;
+	}
+	return programID;
+}
+
+}
+
+bool LoadGpuCullingFunctions(GLADloadfunc load) {
+	GLint major = 0, minor = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	glGetIntegerv(GL_MINOR_VERSION, &minor);
+	if (major < 4 || (major == 4 && minor < 3)) {
+		return false;
+	}
+	dispatchCompute = (DispatchComputeProc)load("glDispatchCompute");
+	memoryBarrier = (MemoryBarrierProc)load("glMemoryBarrier");
+	multiDrawElementsIndirect = (MultiDrawElementsIndirectProc)load("glMultiDrawElementsIndirect");
+	return GpuCullingSupported();
+}
+
+bool GpuCullingSupported() {
+	return dispatchCompute && memoryBarrier && multiDrawElementsIndirect;
+}
+
+bool GpuCuller::initialize() {
+	instanceCount = 0;
+	primitiveCount = 0;
+
+	// The program is shared by every culler through the shader cache
+	const char* path = "../FinalPro/shaders/cull.comp";
+	std::string key = CanonicalPath(path);
+	if (!AcquireCachedShaders(key, program)) {
+		program = compileComputeProgram(path);
+		if (program == 0) {
+			return false;
+		}
+		program = InsertCachedShaders(key, program);
+	}
+
+	stageID = glGetUniformLocation(program, "stage");
+	instanceCountID = glGetUniformLocation(program, "instanceCount");
+	primitiveCountID = glGetUniformLocation(program, "primitiveCount");
+	planesID = glGetUniformLocation(program, "planes");
+	depthRowID = glGetUniformLocation(program, "depthRow");
+	yScaleID = glGetUniformLocation(program, "yScale");
+	lodScreenSizesID = glGetUniformLocation(program, "lodScreenSizes");
+	lodHysteresisID = glGetUniformLocation(program, "lodHysteresis");
+	commandCountID = glGetUniformLocation(program, "commandCount");
+	impostorScreenSizeID = glGetUniformLocation(program, "impostorScreenSize");
+	occlusionMatrixID = glGetUniformLocation(program, "occlusionMatrix");
+	occlusionSizeID = glGetUniformLocation(program, "occlusionSize");
+	occlusionLevelsID = glGetUniformLocation(program, "occlusionLevels");
+
+	glGenBuffers(1, &instanceBuffer);
+	glGenBuffers(1, &boundsBuffer);
+	glGenBuffers(1, &lodBuffer);
+	glGenBuffers(1, &visibleBuffer);
+	glGenBuffers(1, &commandBuffer);
+	glGenBuffers(1, &countersBuffer);
+	GLuint counters[3] = { 0, 0, 0 };
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, countersBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(counters), counters, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	return true;
+}
+
+void GpuCuller::setInstances(const std::vector<glm::mat4>& matrices, const AABBList& instanceBounds,
+	const std::vector<const AABBList*>& slotBounds) {
+	instanceCount = (GLuint)matrices.size();
+	primitiveCount = (GLuint)slotBounds.size();
+
+	std::vector<glm::vec4> bounds;
+	bounds.reserve((size_t)instanceCount * (primitiveCount + 1) * 2);
+	for (GLuint s = 0; s <= primitiveCount; ++s) {
+		const AABBList& boxes = s == 0 ? instanceBounds : *slotBounds[s - 1];
+		for (GLuint i = 0; i < instanceCount; ++i) {
+			bounds.push_back(glm::vec4(boxes.minX[i], boxes.minY[i], boxes.minZ[i], 0.0f));
+			bounds.push_back(glm::vec4(boxes.maxX[i], boxes.maxY[i], boxes.maxZ[i], 0.0f));
+		}
+	}
+	std::vector<GLuint> lods(instanceCount, 0);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, instanceBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, matrices.size() * sizeof(glm::mat4), matrices.empty() ? NULL : &matrices[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, boundsBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, bounds.size() * sizeof(glm::vec4), bounds.empty() ? NULL : &bounds[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, lodBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, lods.size() * sizeof(GLuint), lods.empty() ? NULL : &lods[0], GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, visibleBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, (size_t)instanceCount * (primitiveCount + 1) * sizeof(glm::mat4), NULL, GL_DYNAMIC_COPY);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void GpuCuller::setCommands(const std::vector<DrawElementsIndirectCommand>& commands) {
+	this->commands = commands;
+	for (size_t c = 0; c < this->commands.size(); ++c) {
+		this->commands[c].instanceCount = 0;
+		this->commands[c].baseInstance = 0;
+	}
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, this->commands.size() * sizeof(DrawElementsIndirectCommand),
+		this->commands.empty() ? NULL : &this->commands[0], GL_DYNAMIC_COPY);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+void GpuCuller::cull(const glm::mat4& viewProjection, const float* lodScreenSizes, float lodHysteresis, float impostorScreenSize,
+	OcclusionBuffer* occlusion) {
+	if (instanceCount == 0 || commands.empty()) {
+		return;
+	}
+
+	// Counts restart from zero every frame
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+	glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, commands.size() * sizeof(DrawElementsIndirectCommand), &commands[0]);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	GLuint counters[3] = { 0, 0, 0 };
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, countersBuffer);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(counters), counters);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	Frustum frustum = ExtractFrustum(viewProjection);
+	glm::vec3 row1(viewProjection[0][1], viewProjection[1][1], viewProjection[2][1]);
+	glm::vec4 row3(viewProjection[0][3], viewProjection[1][3], viewProjection[2][3], viewProjection[3][3]);
+
+	glUseProgram(program);
+	glUniform1ui(instanceCountID, instanceCount);
+	glUniform1ui(primitiveCountID, primitiveCount);
+	glUniform4fv(planesID, 6, &frustum.planes[0][0]);
+	glUniform4fv(depthRowID, 1, &row3[0]);
+	glUniform1f(yScaleID, glm::length(row1));
+	glUniform1fv(lodScreenSizesID, GPU_CULL_LOD_COUNT - 1, lodScreenSizes);
+	glUniform1f(lodHysteresisID, lodHysteresis);
+	glUniform1ui(commandCountID, (GLuint)commands.size());
+	glUniform1f(impostorScreenSizeID, commands.size() > (size_t)primitiveCount * GPU_CULL_LOD_COUNT ? impostorScreenSize : 0.0f);
+	if (occlusion) {
+		occlusion->bindTexture(5);
+		glUniformMatrix4fv(occlusionMatrixID, 1, GL_FALSE, &occlusion->viewProjection[0][0]);
+		glUniform2i(occlusionSizeID, occlusion->width, occlusion->height);
+	}
+	glUniform1i(occlusionLevelsID, occlusion ? (GLint)occlusion->levels.size() : 0);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, instanceBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, boundsBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, lodBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, visibleBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, commandBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, countersBuffer);
+
+	GLuint groups = (instanceCount + 63) / 64;
+	glUniform1ui(stageID, 0);
+	dispatchCompute(groups, 1, 1);
+	memoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	glUniform1ui(stageID, 1);
+	dispatchCompute(1, 1, 1);
+	memoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+	glUniform1ui(stageID, 2);
+	dispatchCompute(groups, 1, 1);
+
+	// The draws read the commands and the matrices as vertex attributes
+	memoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+	glUseProgram(0);
+}
+
+void GpuCuller::readOcclusionStats(OcclusionStats& stats) const {
+	GLuint counters[2] = { 0, 0 };
+	memoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, countersBuffer);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(counters), counters);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	stats.tested += (int)counters[0];
+	stats.occluded += (int)counters[1];
+}
+
+void GpuCuller::readCullStats(CullStats& stats) const {
+	GLuint counters[3] = { 0, 0, 0 };
+	std::vector<DrawElementsIndirectCommand> counted(commands.size());
+	memoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, countersBuffer);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(counters), counters);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+	if (!counted.empty()) {
+		glGetBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, counted.size() * sizeof(DrawElementsIndirectCommand), &counted[0]);
+	}
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+	ResetCullStats(stats);
+	stats.instancesVisible = (int)counters[2];
+	stats.instancesCulled = (int)instanceCount - stats.instancesVisible;
+	stats.instancesOccluded = (int)counters[1];
+	for (GLuint slot = 0; slot < primitiveCount && slot * GPU_CULL_LOD_COUNT < counted.size(); ++slot) {
+		bool drawn = false;
+		for (int lod = 0; lod < GPU_CULL_LOD_COUNT; ++lod) {
+			drawn = drawn || counted[slot * GPU_CULL_LOD_COUNT + lod].instanceCount > 0;
+		}
+		stats.primitivesVisible += drawn ? 1 : 0;
+	}
+	stats.primitivesCulled = (int)primitiveCount - stats.primitivesVisible;
+}
+
+void GpuCuller::draw(GLuint firstCommand, GLsizei commandCount, GLenum indexType) const {
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+	multiDrawElementsIndirect(GL_TRIANGLES, indexType, BUFFER_OFFSET(firstCommand * sizeof(DrawElementsIndirectCommand)),
+		commandCount, 0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+void GpuCuller::cleanup() {
+	glDeleteBuffers(1, &instanceBuffer);
+	glDeleteBuffers(1, &boundsBuffer);
+	glDeleteBuffers(1, &lodBuffer);
+	glDeleteBuffers(1, &visibleBuffer);
+	glDeleteBuffers(1, &commandBuffer);
+	glDeleteBuffers(1, &countersBuffer);
+	ReleaseShaders(program);
+}
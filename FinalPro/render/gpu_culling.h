@@ -0,0 +1,85 @@
+#ifndef _GPU_CULLING_H_
+#define _GPU_CULLING_H_
+
+#include "headers.h"
+#include "frustum.h"
+#include "occlusion.h"
+
+// Detail levels per draw command group, matches MODEL_LOD_COUNT and cull.comp
+#define GPU_CULL_LOD_COUNT 4
+
+// Layout read by glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand {
+	GLuint count;
+	GLuint instanceCount;
+	GLuint firstIndex;
+	GLint baseVertex;
+	GLuint baseInstance;
+};
+
+// The GL 3.3 loader does not know the 4.3 entry points this path needs. Loads them
+// with the same function the context was loaded with; returns false when the
+// context is older than 4.3 or an entry point is missing.
+bool LoadGpuCullingFunctions(GLADloadfunc load);
+bool GpuCullingSupported();
+
+// All instances of one model, their bounds and draw commands, kept in GPU buffers.
+// cull() frustum-culls every instance and primitive and picks LODs in a compute
+// shader, leaving the visible matrices in visibleBuffer and the instance counts in
+// commandBuffer, so the CPU cost does not grow with the number of instances.
+//
+// Commands are grouped per primitive slot, GPU_CULL_LOD_COUNT consecutive commands
+// each. Draws read the instance matrix from visibleBuffer at baseInstance. A command
+// after the last slot, when there is one, collects the instances that fall below the
+// impostor screen size instead, once per instance rather than per primitive.
+//
+// With an occlusion buffer, instances are also tested against its depth pyramid,
+// uploaded as a texture on unit 5, the same way OcclusionBuffer::isVisible() does.
+struct GpuCuller {
+	GLuint program;
+	GLuint instanceBuffer;		// mat4 per instance
+	GLuint boundsBuffer;		// Instance boxes, then every slot's boxes, as (min, max) vec4 pairs
+	GLuint lodBuffer;			// Current LOD per instance, kept for hysteresis
+	GLuint visibleBuffer;		// Culled matrices, instanceCount * (primitiveCount + 1) at most
+	GLuint commandBuffer;
+	GLuint countersBuffer;		// Instances tested against the occlusion pyramid, hidden by it and drawn
+	std::vector<DrawElementsIndirectCommand> commands;
+
+	GLuint instanceCount;
+	GLuint primitiveCount;
+
+	// Uniform locations
+	GLint stageID, instanceCountID, primitiveCountID, planesID, depthRowID, yScaleID;
+	GLint lodScreenSizesID, lodHysteresisID, commandCountID, impostorScreenSizeID;
+	GLint occlusionMatrixID, occlusionSizeID, occlusionLevelsID;
+
+	bool initialize();
+
+	// slotBounds[s] are the boxes of primitive slot s for every instance
+	void setInstances(const std::vector<glm::mat4>& matrices, const AABBList& instanceBounds,
+		const std::vector<const AABBList*>& slotBounds);
+
+	// count, firstIndex and baseVertex of every command; instance fields are ignored
+	void setCommands(const std::vector<DrawElementsIndirectCommand>& commands);
+
+	// impostorScreenSize 0 keeps every instance on its meshes. occlusion must be finished
+	// for this frame, or NULL to skip the occlusion test.
+	void cull(const glm::mat4& viewProjection, const float* lodScreenSizes, float lodHysteresis, float impostorScreenSize = 0.0f,
+		OcclusionBuffer* occlusion = NULL);
+
+	// Adds the occlusion counts of the last cull() to stats. Waits for the GPU, so it is
+	// meant for reports rather than every frame.
+	void readOcclusionStats(OcclusionStats& stats) const;
+
+	// What the last cull() kept, instances drawn as impostors included; primitives count
+	// as visible when any instance draws them. Waits for the GPU like readOcclusionStats().
+	void readCullStats(CullStats& stats) const;
+
+	// One glMultiDrawElementsIndirect over commands [firstCommand, firstCommand + commandCount),
+	// whose indices all have indexType
+	void draw(GLuint firstCommand, GLsizei commandCount, GLenum indexType) const;
+
+	void cleanup();
+};
+
+#endif
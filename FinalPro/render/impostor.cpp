@@ -0,0 +1,312 @@
+#include "impostor.h"
+#include "resources.h"
+
+#define BUFFER_OFFSET(i) ((char *)NULL + (i))
+
+namespace {
+
+const int atlasSize = IMPOSTOR_GRID * IMPOSTOR_FRAME_SIZE;
+
+// Mip levels stop at 8x8 frames, below that neighbouring frames would bleed together
+const int atlasMaxLevel = 4;
+
+// Transparent texels take the average colour of their covered neighbours, a few texels
+// deep, so filtering at silhouettes does not pull in the clear colour. Neighbours in
+// other frames are ignored.
+void dilate(ImpostorImages& images, int passes) {
+	int size = images.size;
+	std::vector<unsigned char> filled(size * size);
+	for (int i = 0; i < size * size; ++i) {
+		filled[i] = images.albedo[i * 4 + 3] > 0 ? 1 : 0;
+	}
+
+	std::vector<unsigned char> next;
+	for (int pass = 0; pass < passes; ++pass) {
+		next = filled;
+		for (int y = 0; y < size; ++y) {
+			for (int x = 0; x < size; ++x) {
+				int i = y * size + x;
+				if (filled[i]) {
+					continue;
+				}
+				int sums[7] = { 0 };
+				int count = 0;
+				const int offsets[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+				for (int o = 0; o < 4; ++o) {
+					int nx = x + offsets[o][0], ny = y + offsets[o][1];
+					if (nx < 0 || ny < 0 || nx >= size || ny >= size ||
+						nx / IMPOSTOR_FRAME_SIZE != x / IMPOSTOR_FRAME_SIZE || ny / IMPOSTOR_FRAME_SIZE != y / IMPOSTOR_FRAME_SIZE) {
+						continue;
+					}
+					int n = ny * size + nx;
+					if (!filled[n]) {
+						continue;
+					}
+					for (int c = 0; c < 3; ++c) {
+						sums[c] += images.albedo[n * 4 + c];
+					}
+					for (int c = 0; c < 4; ++c) {
+						sums[3 + c] += images.normalDepth[n * 4 + c];
+					}
+					count++;
+				}
+				if (count == 0) {
+					continue;
+				}
+				for (int c = 0; c < 3; ++c) {
+					images.albedo[i * 4 + c] = (unsigned char)(sums[c] / count);
+				}
+				for (int c = 0; c < 4; ++c) {
+					images.normalDepth[i * 4 + c] = (unsigned char)(sums[3 + c] / count);
+				}
+				next[i] = 1;
+			}
+		}
+		filled.swap(next);
+	}
+}
+
+void flipRows(std::vector<unsigned char>& pixels, int size) {
+	size_t row = (size_t)size * 4;
+	std::vector<unsigned char> swap(row);
+	for (int y = 0; y < size / 2; ++y) {
+		unsigned char* a = &pixels[y * row];
+		unsigned char* b = &pixels[(size - 1 - y) * row];
+		memcpy(&swap[0], a, row);
+		memcpy(a, b, row);
+		memcpy(b, &swap[0], row);
+	}
+}
+
+bool writeImage(const std::string& path, const std::vector<unsigned char>& pixels, int size) {
+	std::vector<unsigned char> upright(pixels);
+	flipRows(upright, size);
+	if (!stbi_write_png(path.c_str(), size, size, 4, &upright[0], size * 4)) {
+		std::cout << "Failed to write " << path << std::endl;
+		return false;
+	}
+	return true;
+}
+
+bool readImage(const std::string& path, std::vector<unsigned char>& pixels, int size) {
+	int width, height, channels;
+	unsigned char* data = stbi_load(path.c_str(), &width, &height, &channels, 4);
+	if (data == NULL) {
+		return false;
+	}
+	bool matches = width == size && height == size;
+	if (matches) {
+		pixels.assign(data, data + (size_t)size * size * 4);
+		flipRows(pixels, size);
+	}
+	stbi_image_free(data);
+	return matches;
+}
+
+// The images sit next to the description, named after it
+std::string imagePath(const std::string& impostorPath, const char* suffix) {
+	return impostorPath.substr(0, impostorPath.size() - 4) + suffix;
+}
+
+GLuint uploadAtlas(const std::vector<unsigned char>& pixels, int size, GLint internalFormat) {
+	GLuint texture;
+	glGenTextures(1, &texture);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, atlasMaxLevel);
+	glGenerateMipmap(GL_TEXTURE_2D);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return texture;
+}
+
+}
+
+glm::vec3 ImpostorDirection(const glm::vec2& grid) {
+	glm::vec2 p((grid.x + grid.y) * 0.5f, (grid.x - grid.y) * 0.5f);
+	return glm::normalize(glm::vec3(p.x, 1.0f - fabsf(p.x) - fabsf(p.y), p.y));
+}
+
+glm::vec2 ImpostorGrid(const glm::vec3& direction) {
+	glm::vec3 d(direction.x, std::max(direction.y, 0.0f), direction.z);
+	d /= std::max(fabsf(d.x) + d.y + fabsf(d.z), 1e-6f);
+	return glm::vec2(d.x + d.z, d.x - d.z);
+}
+
+glm::vec3 ImpostorFrameDirection(int x, int y) {
+	return ImpostorDirection(glm::vec2(x, y) * (2.0f / (IMPOSTOR_GRID - 1)) - 1.0f);
+}
+
+void ImpostorFrameBasis(const glm::vec3& direction, glm::vec3& right, glm::vec3& up) {
+	glm::vec3 reference = fabsf(direction.y) < 0.999f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(0.0f, 0.0f, -1.0f);
+	right = glm::normalize(glm::cross(reference, direction));
+	up = glm::cross(direction, right);
+}
+
+bool BakeImpostor(const glm::vec3& center, float radius, const std::function<void()>& drawAsset, ImpostorImages& images) {
+	GLuint programID = AcquireShaders("../FinalPro/shaders/impostor_bake.vert", "../FinalPro/shaders/impostor_bake.frag");
+	if (programID == 0) {
+		return false;
+	}
+
+	GLint previousFramebuffer = 0;
+	GLint previousViewport[4];
+	glGetIntegerv(GL_FRAMEBUFFER_BINDING, &previousFramebuffer);
+	glGetIntegerv(GL_VIEWPORT, previousViewport);
+
+	// Albedo is sRGB-encoded by the shader, so both targets read back as stored
+	GLuint targets[2], depthBuffer, framebuffer;
+	glGenTextures(2, targets);
+	for (int t = 0; t < 2; ++t) {
+		glBindTexture(GL_TEXTURE_2D, targets[t]);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, atlasSize, atlasSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glGenRenderbuffers(1, &depthBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, atlasSize, atlasSize);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+	glGenFramebuffers(1, &framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, targets[0], 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, targets[1], 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+	const GLenum drawBuffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+	glDrawBuffers(2, drawBuffers);
+
+	bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+	if (!complete) {
+		std::cout << "Impostor framebuffer is incomplete" << std::endl;
+	}
+	else {
+		// Empty texels have no coverage and lie at the far side of the sphere
+		const GLfloat clearAlbedo[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		const GLfloat clearNormalDepth[4] = { 0.5f, 0.5f, 1.0f, 1.0f };
+		const GLfloat clearDepth = 1.0f;
+		glClearBufferfv(GL_COLOR, 0, clearAlbedo);
+		glClearBufferfv(GL_COLOR, 1, clearNormalDepth);
+		glClearBufferfv(GL_DEPTH, 0, &clearDepth);
+
+		GLboolean blending = glIsEnabled(GL_BLEND);
+		glDisable(GL_BLEND);
+		glEnable(GL_DEPTH_TEST);
+		glUseProgram(programID);
+		glUniform1i(glGetUniformLocation(programID, "textureSampler"), 0);
+		GLint viewProjectionID = glGetUniformLocation(programID, "VP");
+
+		// Orthographic views of the bounding sphere, the camera one radius outside it
+		for (int y = 0; y < IMPOSTOR_GRID; ++y) {
+			for (int x = 0; x < IMPOSTOR_GRID; ++x) {
+				glm::vec3 direction = ImpostorFrameDirection(x, y);
+				glm::vec3 right, up;
+				ImpostorFrameBasis(direction, right, up);
+				glm::mat4 view = glm::lookAt(center + direction * (2.0f * radius), center, up);
+				glm::mat4 projection = glm::ortho(-radius, radius, -radius, radius, radius, 3.0f * radius);
+				glm::mat4 viewProjection = projection * view;
+
+				glViewport(x * IMPOSTOR_FRAME_SIZE, y * IMPOSTOR_FRAME_SIZE, IMPOSTOR_FRAME_SIZE, IMPOSTOR_FRAME_SIZE);
+				glUniformMatrix4fv(viewProjectionID, 1, GL_FALSE, &viewProjection[0][0]);
+				drawAsset();
+			}
+		}
+		glUseProgram(0);
+		if (blending) {
+			glEnable(GL_BLEND);
+		}
+
+		images.size = atlasSize;
+		images.center = center;
+		images.radius = radius;
+		images.albedo.resize((size_t)atlasSize * atlasSize * 4);
+		images.normalDepth.resize((size_t)atlasSize * atlasSize * 4);
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glReadBuffer(GL_COLOR_ATTACHMENT0);
+		glReadPixels(0, 0, atlasSize, atlasSize, GL_RGBA, GL_UNSIGNED_BYTE, &images.albedo[0]);
+		glReadBuffer(GL_COLOR_ATTACHMENT1);
+		glReadPixels(0, 0, atlasSize, atlasSize, GL_RGBA, GL_UNSIGNED_BYTE, &images.normalDepth[0]);
+		dilate(images, 4);
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+	glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+	glDeleteFramebuffers(1, &framebuffer);
+	glDeleteRenderbuffers(1, &depthBuffer);
+	glDeleteTextures(2, targets);
+	ReleaseShaders(programID);
+	return complete;
+}
+
+std::string ImpostorPath(const char* asset_file_path) {
+	std::string path(asset_file_path);
+	size_t dot = path.find_last_of('.');
+	size_t slash = path.find_last_of("/\\");
+	if (dot != std::string::npos && (slash == std::string::npos || dot > slash)) {
+		path.erase(dot);
+	}
+	return path + "_impostor.txt";
+}
+
+bool WriteImpostor(const char* impostor_file_path, const ImpostorImages& images) {
+	std::string path(impostor_file_path);
+	std::ofstream stream(impostor_file_path);
+	stream << "grid " << IMPOSTOR_GRID << " " << IMPOSTOR_FRAME_SIZE << "\n"
+		<< "sphere " << images.center.x << " " << images.center.y << " " << images.center.z << " " << images.radius << "\n";
+	if (!stream) {
+		std::cout << "Failed to write " << path << std::endl;
+		return false;
+	}
+	return writeImage(imagePath(path, "_albedo.png"), images.albedo, images.size) &&
+		writeImage(imagePath(path, "_normal_depth.png"), images.normalDepth, images.size);
+}
+
+bool ReadImpostor(const char* impostor_file_path, ImpostorImages& images) {
+	std::string path(impostor_file_path);
+	std::ifstream stream(impostor_file_path);
+	std::string gridLabel, sphereLabel;
+	int grid = 0, frameSize = 0;
+	stream >> gridLabel >> grid >> frameSize >> sphereLabel >> images.center.x >> images.center.y >> images.center.z >> images.radius;
+	if (!stream || gridLabel != "grid" || sphereLabel != "sphere" || grid != IMPOSTOR_GRID || frameSize != IMPOSTOR_FRAME_SIZE) {
+		return false;
+	}
+	images.size = atlasSize;
+	return readImage(imagePath(path, "_albedo.png"), images.albedo, atlasSize) &&
+		readImage(imagePath(path, "_normal_depth.png"), images.normalDepth, atlasSize);
+}
+
+void ImpostorAtlas::upload(const ImpostorImages& images) {
+	cleanup();
+	center = images.center;
+	radius = images.radius;
+	albedoTexture = uploadAtlas(images.albedo, images.size, GL_SRGB8_ALPHA8);
+	normalDepthTexture = uploadAtlas(images.normalDepth, images.size, GL_RGBA8);
+
+	// Counter-clockwise seen from the camera, with the corners along the frame basis
+	const GLfloat corners[8] = { -1.0f, -1.0f, 1.0f, -1.0f, 1.0f, 1.0f, -1.0f, 1.0f };
+	const GLushort indices[6] = { 0, 1, 2, 0, 2, 3 };
+	glGenVertexArrays(1, &vertexArray);
+	glBindVertexArray(vertexArray);
+	glGenBuffers(1, &vertexBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
+	glGenBuffers(1, &indexBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void ImpostorAtlas::cleanup() {
+	glDeleteTextures(1, &albedoTexture);
+	glDeleteTextures(1, &normalDepthTexture);
+	glDeleteVertexArrays(1, &vertexArray);
+	glDeleteBuffers(1, &vertexBuffer);
+	glDeleteBuffers(1, &indexBuffer);
+	albedoTexture = normalDepthTexture = vertexArray = vertexBuffer = indexBuffer = 0;
+}
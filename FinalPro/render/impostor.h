@@ -0,0 +1,80 @@
+#ifndef _IMPOSTOR_H_
+#define _IMPOSTOR_H_
+
+#include "headers.h"
+
+#include <functional>
+
+// Octahedral impostors. An asset is rendered from IMPOSTOR_GRID x IMPOSTOR_GRID view
+// directions over the upper hemisphere, laid out on a hemi-octahedral map so that
+// neighbouring frames are neighbouring directions. Far instances draw as one
+// camera-facing quad that blends the four frames nearest to the view direction.
+//
+// Frames are orthographic views of the asset's bounding sphere, each IMPOSTOR_FRAME_SIZE
+// pixels square. Frame (x, y) sits at pixel (x, y) * IMPOSTOR_FRAME_SIZE of the atlas,
+// rows bottom-up as in GL. Must match impostor.vert.
+#define IMPOSTOR_GRID 8
+#define IMPOSTOR_FRAME_SIZE 128
+
+// Direction towards the camera of a point on the hemi-octahedral map, and back. grid is
+// in [-1, 1]^2, y is up; directions below the horizon map to the horizon.
+glm::vec3 ImpostorDirection(const glm::vec2& grid);
+glm::vec2 ImpostorGrid(const glm::vec3& direction);
+
+// Direction frame (x, y) was baked from
+glm::vec3 ImpostorFrameDirection(int x, int y);
+
+// Right and up axes of a view along -direction, also used for the quads
+void ImpostorFrameBasis(const glm::vec3& direction, glm::vec3& right, glm::vec3& up);
+
+// CPU copy of a baked atlas. albedo is linear colour stored sRGB-encoded with coverage
+// in alpha; normalDepth holds the normal (* 0.5 + 0.5) in rgb and in alpha the depth
+// across the sphere, 0 at the side facing the frame's camera. Both are size x size,
+// rows bottom-up. center and radius are the bounding sphere in the asset's space.
+struct ImpostorImages {
+	int size;
+	glm::vec3 center;
+	float radius;
+	std::vector<unsigned char> albedo;
+	std::vector<unsigned char> normalDepth;
+
+	ImpostorImages() : size(0), center(0.0f), radius(0.0f) {}
+};
+
+// Renders every frame into an offscreen framebuffer and reads the atlas back, so it
+// needs a current context but no window. drawAsset draws the asset in its own space
+// with the bake program bound, which reads the same attributes and Object block as
+// model.vert; the frame's view-projection is already set. The previous framebuffer
+// and viewport are restored. Returns false if the program or framebuffer fails.
+bool BakeImpostor(const glm::vec3& center, float radius, const std::function<void()>& drawAsset, ImpostorImages& images);
+
+// Baked atlases are stored next to the asset: <stem>_impostor.txt with the sphere and
+// the two atlases as PNG, upright
+std::string ImpostorPath(const char* asset_file_path);
+bool WriteImpostor(const char* impostor_file_path, const ImpostorImages& images);
+
+// Fails when the file is missing or was baked with another grid or frame size
+bool ReadImpostor(const char* impostor_file_path, ImpostorImages& images);
+
+// GPU side of an atlas, and the quad its instances are drawn with: four corners at
+// (+-1, +-1) in attribute 0, indices as GL_UNSIGNED_SHORT. Instance matrices go to
+// attributes 3-6 like the meshes'.
+struct ImpostorAtlas {
+	GLuint albedoTexture;
+	GLuint normalDepthTexture;
+	GLuint vertexArray;
+	GLuint vertexBuffer;
+	GLuint indexBuffer;
+	glm::vec3 center;
+	float radius;
+
+	ImpostorAtlas() : albedoTexture(0), normalDepthTexture(0), vertexArray(0), vertexBuffer(0), indexBuffer(0),
+		center(0.0f), radius(0.0f) {}
+
+	bool ready() const { return albedoTexture != 0; }
+
+	void upload(const ImpostorImages& images);
+	void cleanup();
+};
+
+#endif
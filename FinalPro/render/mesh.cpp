@@ -0,0 +1,146 @@
+#include "mesh.h"
+
+AABB ComputeMeshBounds(const std::vector<MeshVertex>& vertices) {
+	AABB box;
+	box.min = glm::vec3(FLT_MAX);
+	box.max = glm::vec3(-FLT_MAX);
+	for (size_t i = 0; i < vertices.size(); ++i) {
+		box.min = glm::min(box.min, vertices[i].position);
+		box.max = glm::max(box.max, vertices[i].position);
+	}
+	return box;
+}
+
+float ComputeUvDensity(const std::vector<MeshVertex>& vertices, const std::vector<unsigned int>& indices, size_t indexCount) {
+	double area = 0.0, uvArea = 0.0;
+	for (size_t i = 0; i + 2 < indexCount; i += 3) {
+		const MeshVertex& a = vertices[indices[i]];
+		const MeshVertex& b = vertices[indices[i + 1]];
+		const MeshVertex& c = vertices[indices[i + 2]];
+		area += glm::length(glm::cross(b.position - a.position, c.position - a.position));
+		glm::vec2 u = b.uv - a.uv, v = c.uv - a.uv;
+		uvArea += fabs(u.x * v.y - u.y * v.x);
+	}
+	return area > 0.0 ? (float)sqrt(uvArea / area) : 0.0f;
+}
+
+namespace {
+
+// Largest value of a signed 10-bit normalized component
+const int SNORM10_MAX = 511;
+
+glm::vec2 signNotZero(const glm::vec2& v) {
+	return glm::vec2(v.x >= 0.0f ? 1.0f : -1.0f, v.y >= 0.0f ? 1.0f : -1.0f);
+}
+
+// Unit vector to the [-1, 1] square: projected on the octahedron, the lower half
+// folded over the upper one
+glm::vec2 octEncode(const glm::vec3& n) {
+	float sum = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+	if (sum == 0.0f) {
+		return glm::vec2(0.0f);
+	}
+	glm::vec2 e(n.x / sum, n.y / sum);
+	if (n.z < 0.0f) {
+		e = (1.0f - glm::abs(glm::vec2(e.y, e.x))) * signNotZero(e);
+	}
+	return e;
+}
+
+// Same as the vertex shaders
+glm::vec3 octDecode(const glm::vec2& e) {
+	glm::vec3 n(e.x, e.y, 1.0f - fabsf(e.x) - fabsf(e.y));
+	if (n.z < 0.0f) {
+		glm::vec2 folded = (1.0f - glm::abs(glm::vec2(n.y, n.x))) * signNotZero(glm::vec2(n));
+		n.x = folded.x;
+		n.y = folded.y;
+	}
+	return glm::normalize(n);
+}
+
+glm::vec3 decodeSnorm10(int x, int y) {
+	return octDecode(glm::vec2(std::max(x / (float)SNORM10_MAX, -1.0f), std::max(y / (float)SNORM10_MAX, -1.0f)));
+}
+
+// Rounds both coordinates up or down, whichever of the four decodes closest to n
+GLuint packNormal(const glm::vec3& n, float& error) {
+	glm::vec2 e = octEncode(n) * (float)SNORM10_MAX;
+	int baseX = (int)floorf(e.x), baseY = (int)floorf(e.y);
+	int bestX = 0, bestY = 0;
+	float bestDot = -2.0f;
+	for (int dy = 0; dy <= 1; ++dy) {
+		for (int dx = 0; dx <= 1; ++dx) {
+			int x = std::min(std::max(baseX + dx, -SNORM10_MAX), SNORM10_MAX);
+			int y = std::min(std::max(baseY + dy, -SNORM10_MAX), SNORM10_MAX);
+			float dot = glm::dot(decodeSnorm10(x, y), n);
+			if (dot > bestDot) {
+				bestDot = dot;
+				bestX = x;
+				bestY = y;
+			}
+		}
+	}
+	error = acosf(std::min(bestDot, 1.0f)) * (180.0f / (float)M_PI);
+	return ((GLuint)bestX & 0x3ffu) | (((GLuint)bestY & 0x3ffu) << 10);
+}
+
+unsigned short quantizeUnorm16(float value, float offset, float scale) {
+	if (scale <= 0.0f) {
+		return 0;
+	}
+	float fraction = std::min(std::max((value - offset) / scale, 0.0f), 1.0f);
+	return (unsigned short)(fraction * 65535.0f + 0.5f);
+}
+
+}
+
+QuantizationError QuantizeMesh(MeshPrimitive& primitive) {
+	QuantizationError error = { 0.0f, 0.0f, 0.0f };
+	const std::vector<MeshVertex>& vertices = primitive.vertices;
+	primitive.packed.resize(vertices.size());
+	if (vertices.empty()) {
+		return error;
+	}
+
+	// Own box rather than primitive.bounds, which may be left unbounded
+	AABB box = ComputeMeshBounds(vertices);
+	glm::vec2 uvMin(FLT_MAX), uvMax(-FLT_MAX);
+	for (size_t v = 0; v < vertices.size(); ++v) {
+		uvMin = glm::min(uvMin, vertices[v].uv);
+		uvMax = glm::max(uvMax, vertices[v].uv);
+	}
+	VertexQuantization& q = primitive.quantization;
+	q.positionOffset = box.min;
+	q.positionScale = box.max - box.min;
+	q.uvOffset = uvMin;
+	q.uvScale = uvMax - uvMin;
+
+	for (size_t v = 0; v < vertices.size(); ++v) {
+		const MeshVertex& vertex = vertices[v];
+		PackedVertex& packed = primitive.packed[v];
+		glm::vec3 position;
+		for (int k = 0; k < 3; ++k) {
+			packed.position[k] = quantizeUnorm16(vertex.position[k], q.positionOffset[k], q.positionScale[k]);
+			position[k] = q.positionOffset[k] + q.positionScale[k] * (packed.position[k] / 65535.0f);
+		}
+		packed.position[3] = 0;
+		error.position = std::max(error.position, glm::length(position - vertex.position));
+
+		float normalLength = glm::length(vertex.normal);
+		float normalError = 0.0f;
+		packed.normal = packNormal(normalLength > 0.0f ? vertex.normal / normalLength : glm::vec3(0.0f, 0.0f, 1.0f), normalError);
+		error.normalDegrees = std::max(error.normalDegrees, normalError);
+
+		for (int k = 0; k < 2; ++k) {
+			packed.uv[k] = quantizeUnorm16(vertex.uv[k], q.uvOffset[k], q.uvScale[k]);
+			float uv = q.uvOffset[k] + q.uvScale[k] * (packed.uv[k] / 65535.0f);
+			error.uv = std::max(error.uv, fabsf(uv - vertex.uv[k]));
+		}
+	}
+	return error;
+}
+
+bool QuantizationAcceptable(const QuantizationError& error, const VertexQuantization& quantization) {
+	return error.position <= 1e-4f * glm::length(quantization.positionScale) && error.normalDegrees <= 1.0f &&
+		error.uv <= 1.0f / 4096.0f;
+}
@@ -0,0 +1,92 @@
+#ifndef _MESH_H_
+#define _MESH_H_
+
+#include "headers.h"
+#include "frustum.h"
+
+// Interleaved vertex layout shared by every imported mesh
+struct MeshVertex {
+	glm::vec3 position;
+	glm::vec3 normal;
+	glm::vec2 uv;
+};
+
+// Vertex layouts the geometry arena can store
+enum VertexFormat {
+	VERTEX_FLOAT,		// MeshVertex, 32 bytes
+	VERTEX_PACKED		// PackedVertex, 16 bytes
+};
+
+// MeshVertex in half the space: position as 16-bit fractions of the primitive's box,
+// the normal octahedral-encoded in x and y of a signed GL_INT_2_10_10_10_REV word, uv
+// as 16-bit fractions of the primitive's uv range. A VertexQuantization maps them back.
+struct PackedVertex {
+	unsigned short position[4];		// w unused
+	GLuint normal;
+	unsigned short uv[2];
+};
+
+inline size_t VertexSize(VertexFormat format) {
+	return format == VERTEX_PACKED ? sizeof(PackedVertex) : sizeof(MeshVertex);
+}
+
+// Object-space attribute = offset + scale * normalized value; the identity for float
+// vertices
+struct VertexQuantization {
+	glm::vec3 positionOffset;
+	glm::vec3 positionScale;
+	glm::vec2 uvOffset;
+	glm::vec2 uvScale;
+
+	VertexQuantization() : positionOffset(0.0f), positionScale(1.0f), uvOffset(0.0f), uvScale(1.0f) {}
+};
+
+// Largest difference between a primitive's vertices and what its packed ones decode to
+struct QuantizationError {
+	float position;			// Object units
+	float normalDegrees;
+	float uv;
+};
+
+// Up to four joints per vertex of a skinned mesh. Weights are normalized to 65535 and
+// sum to it; joints index the skin's joint list.
+struct SkinVertex {
+	unsigned short joints[4];
+	unsigned short weights[4];
+};
+
+// Range of one detail level inside a primitive's index array
+struct MeshLod {
+	unsigned int indexOffset;
+	unsigned int indexCount;
+	float error;		// Largest RMS distance of a collapsed vertex to its original planes, in object units
+};
+
+// CPU copy of one primitive as produced by the importers, before upload
+struct MeshPrimitive {
+	std::vector<MeshVertex> vertices;
+	std::vector<unsigned int> indices;	// Every LOD, back to back
+	std::vector<MeshLod> lods;
+	std::vector<SkinVertex> skin;		// Empty unless skinned, else one per vertex
+	std::vector<PackedVertex> packed;	// Uploaded instead of vertices when not empty
+	VertexQuantization quantization;	// How packed decodes
+	AABB bounds;
+	float uvDensity;					// See ComputeUvDensity()
+	int material;
+};
+
+AABB ComputeMeshBounds(const std::vector<MeshVertex>& vertices);
+
+// Texture coordinates per object unit over the first indexCount indices, as the square
+// root of the uv area over the surface area; 0 when the mesh has no area or no uvs
+float ComputeUvDensity(const std::vector<MeshVertex>& vertices, const std::vector<unsigned int>& indices, size_t indexCount);
+
+// Fills packed and quantization from the primitive's vertices and returns how far the
+// decoded vertices are from them
+QuantizationError QuantizeMesh(MeshPrimitive& primitive);
+
+// Whether packed vertices are close enough to draw in place of the floats: positions
+// within 1/10000 of the box diagonal, normals within a degree, uvs within 1/4096
+bool QuantizationAcceptable(const QuantizationError& error, const VertexQuantization& quantization);
+
+#endif
@@ -0,0 +1,272 @@
+#include "mesh_optimize.h"
+
+#include <algorithm>
+
+namespace {
+
+// FIFO cache through timestamps: a vertex is cached while fewer than
+// VERTEX_CACHE_SIZE misses happened since it was loaded
+struct VertexCache {
+	std::vector<unsigned int> stamps;
+	unsigned int time;
+
+	VertexCache(size_t vertexCount) : stamps(vertexCount, 0), time(VERTEX_CACHE_SIZE + 1) {}
+
+	bool access(unsigned int v) {
+		if (time - stamps[v] > VERTEX_CACHE_SIZE) {
+			stamps[v] = time++;
+			return true;
+		}
+		return false;
+	}
+
+	void flush() {
+		time += VERTEX_CACHE_SIZE + 1;
+	}
+};
+
+// Tipsify (Sander, Nehab and Barczak, "Fast Triangle Reordering for Vertex Locality
+// and Reduced Overdraw", 2007): emits every remaining triangle around a fanning vertex,
+// then moves to the neighbour that will still be in the cache once its own triangles
+// are emitted, falling back on recently used vertices when there is none
+void tipsify(unsigned int* indices, size_t indexCount, size_t vertexCount) {
+	size_t triangleCount = indexCount / 3;
+
+	// Triangles around every vertex
+	std::vector<unsigned int> offsets(vertexCount + 1, 0);
+	for (size_t i = 0; i < indexCount; ++i) {
+		offsets[indices[i] + 1]++;
+	}
+	for (size_t v = 0; v < vertexCount; ++v) {
+		offsets[v + 1] += offsets[v];
+	}
+	std::vector<unsigned int> adjacency(indexCount);
+	std::vector<unsigned int> live(vertexCount);
+	for (size_t v = 0; v < vertexCount; ++v) {
+		live[v] = offsets[v + 1] - offsets[v];
+	}
+	std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+	for (size_t i = 0; i < indexCount; ++i) {
+		adjacency[fill[indices[i]]++] = (unsigned int)(i / 3);
+	}
+
+	VertexCache cache(vertexCount);
+	std::vector<unsigned char> emitted(triangleCount, 0);
+	std::vector<unsigned int> deadEnds, candidates, result;
+	deadEnds.reserve(indexCount);
+	result.reserve(indexCount);
+	size_t cursor = 0;		// Vertices before it have no triangle left
+
+	int fanning = indexCount > 0 ? (int)indices[0] : -1;
+	while (fanning >= 0) {
+		candidates.clear();
+		for (unsigned int a = offsets[fanning]; a < offsets[fanning + 1]; ++a) {
+			unsigned int t = adjacency[a];
+			if (emitted[t]) {
+				continue;
+			}
+			emitted[t] = 1;
+			for (int k = 0; k < 3; ++k) {
+				unsigned int v = indices[t * 3 + k];
+				result.push_back(v);
+				deadEnds.push_back(v);
+				candidates.push_back(v);
+				live[v]--;
+				cache.access(v);
+			}
+		}
+
+		// Oldest candidate that stays cached while its remaining triangles go out
+		int best = -1, bestPriority = -1;
+		for (size_t c = 0; c < candidates.size(); ++c) {
+			unsigned int v = candidates[c];
+			if (live[v] == 0) {
+				continue;
+			}
+			int age = (int)(cache.time - cache.stamps[v]);
+			int priority = age + 2 * (int)live[v] <= VERTEX_CACHE_SIZE ? age : 0;
+			if (priority > bestPriority) {
+				best = (int)v;
+				bestPriority = priority;
+			}
+		}
+		while (best < 0 && !deadEnds.empty()) {
+			unsigned int v = deadEnds.back();
+			deadEnds.pop_back();
+			if (live[v] > 0) {
+				best = (int)v;
+			}
+		}
+		while (best < 0 && cursor < vertexCount) {
+			if (live[cursor] > 0) {
+				best = (int)cursor;
+			}
+			cursor++;
+		}
+		fanning = best;
+	}
+
+	std::copy(result.begin(), result.end(), indices);
+}
+
+// Splits the cache-ordered triangles into clusters and draws the ones facing away from
+// the mesh centre first. Clusters start where the cache restarts (a triangle with
+// three misses), and are split further wherever the part so far is already within
+// threshold of the cluster's ACMR, so reordering them costs little cache efficiency.
+// A threshold of 0 keeps the clusters whole.
+void optimizeOverdraw(unsigned int* indices, size_t indexCount, const std::vector<MeshVertex>& vertices, float threshold) {
+	size_t triangleCount = indexCount / 3;
+	VertexCache cache(vertices.size());
+
+	std::vector<unsigned int> hardStarts;
+	std::vector<unsigned char> misses(triangleCount);
+	for (size_t t = 0; t < triangleCount; ++t) {
+		misses[t] = (unsigned char)(cache.access(indices[t * 3]) + cache.access(indices[t * 3 + 1]) + cache.access(indices[t * 3 + 2]));
+		if (t == 0 || misses[t] == 3) {
+			hardStarts.push_back((unsigned int)t);
+		}
+	}
+	hardStarts.push_back((unsigned int)triangleCount);
+
+	std::vector<unsigned int> starts;
+	for (size_t h = 0; h + 1 < hardStarts.size(); ++h) {
+		size_t begin = hardStarts[h], end = hardStarts[h + 1];
+		size_t clusterMisses = 0;
+		for (size_t t = begin; t < end; ++t) {
+			clusterMisses += misses[t];
+		}
+		float clusterAcmr = (float)clusterMisses / (end - begin);
+
+		cache.flush();
+		starts.push_back((unsigned int)begin);
+		size_t partBegin = begin, partMisses = 0;
+		for (size_t t = begin; t + 1 < end; ++t) {
+			partMisses += cache.access(indices[t * 3]) + cache.access(indices[t * 3 + 1]) + cache.access(indices[t * 3 + 2]);
+			if (partMisses <= threshold * clusterAcmr * (t + 1 - partBegin)) {
+				cache.flush();
+				starts.push_back((unsigned int)(t + 1));
+				partBegin = t + 1;
+				partMisses = 0;
+			}
+		}
+	}
+	starts.push_back((unsigned int)triangleCount);
+	size_t clusterCount = starts.size() - 1;
+
+	// Area-weighted centre and normal of every cluster, and of the whole mesh
+	std::vector<glm::vec3> centres(clusterCount), normals(clusterCount);
+	glm::vec3 meshCentre(0.0f);
+	float meshArea = 0.0f;
+	for (size_t c = 0; c < clusterCount; ++c) {
+		glm::vec3 centre(0.0f), normal(0.0f), average(0.0f);
+		float area = 0.0f;
+		for (size_t t = starts[c]; t < starts[c + 1]; ++t) {
+			const glm::vec3& a = vertices[indices[t * 3]].position;
+			const glm::vec3& b = vertices[indices[t * 3 + 1]].position;
+			const glm::vec3& d = vertices[indices[t * 3 + 2]].position;
+			glm::vec3 cross = glm::cross(b - a, d - a);
+			float triangleArea = glm::length(cross);
+			centre += (a + b + d) * (triangleArea / 3.0f);
+			average += (a + b + d) / 3.0f;
+			normal += cross;
+			area += triangleArea;
+		}
+		meshCentre += centre;
+		meshArea += area;
+		centres[c] = area > 0.0f ? centre / area : average / (float)(starts[c + 1] - starts[c]);
+		normals[c] = normal;
+	}
+	if (meshArea > 0.0f) {
+		meshCentre /= meshArea;
+	}
+
+	std::vector<float> keys(clusterCount);
+	std::vector<unsigned int> order(clusterCount);
+	for (size_t c = 0; c < clusterCount; ++c) {
+		float length = glm::length(normals[c]);
+		keys[c] = length > 0.0f ? glm::dot(centres[c] - meshCentre, normals[c] / length) : 0.0f;
+		order[c] = (unsigned int)c;
+	}
+	std::stable_sort(order.begin(), order.end(), [&keys](unsigned int a, unsigned int b) {
+		return keys[a] > keys[b];
+	});
+
+	std::vector<unsigned int> result;
+	result.reserve(indexCount);
+	for (size_t c = 0; c < clusterCount; ++c) {
+		result.insert(result.end(), indices + starts[order[c]] * 3, indices + starts[order[c] + 1] * 3);
+	}
+	std::copy(result.begin(), result.end(), indices);
+}
+
+}
+
+VertexCacheStats AnalyzeVertexCache(const unsigned int* indices, size_t indexCount, size_t vertexCount) {
+	VertexCacheStats stats;
+	VertexCache cache(vertexCount);
+	std::vector<unsigned char> used(vertexCount, 0);
+	stats.triangles = indexCount / 3;
+	for (size_t i = 0; i < stats.triangles * 3; ++i) {
+		stats.misses += cache.access(indices[i]);
+		if (!used[indices[i]]) {
+			used[indices[i]] = 1;
+			stats.vertices++;
+		}
+	}
+	return stats;
+}
+
+void OptimizeMesh(MeshPrimitive& primitive, float overdrawThreshold) {
+	if (primitive.indices.empty()) {
+		return;
+	}
+
+	std::vector<std::pair<size_t, size_t> > ranges;
+	for (size_t l = 0; l < primitive.lods.size(); ++l) {
+		ranges.push_back(std::make_pair((size_t)primitive.lods[l].indexOffset, (size_t)primitive.lods[l].indexCount));
+	}
+	if (ranges.empty()) {
+		ranges.push_back(std::make_pair((size_t)0, primitive.indices.size()));
+	}
+	for (size_t r = 0; r < ranges.size(); ++r) {
+		// A LOD the simplifier could not reduce repeats the range before it
+		if (r > 0 && ranges[r] == ranges[r - 1]) {
+			continue;
+		}
+		unsigned int* indices = &primitive.indices[ranges[r].first];
+		size_t indexCount = ranges[r].second - ranges[r].second % 3;
+		if (indexCount == 0) {
+			continue;
+		}
+		tipsify(indices, indexCount, primitive.vertices.size());
+
+		// The soft splits only estimate what reordering costs; past the threshold, only
+		// clusters the cache restarts at anyway are moved
+		size_t cacheOrderMisses = AnalyzeVertexCache(indices, indexCount, primitive.vertices.size()).misses;
+		std::vector<unsigned int> cacheOrder(indices, indices + indexCount);
+		optimizeOverdraw(indices, indexCount, primitive.vertices, overdrawThreshold);
+		if (AnalyzeVertexCache(indices, indexCount, primitive.vertices.size()).misses > overdrawThreshold * cacheOrderMisses) {
+			std::copy(cacheOrder.begin(), cacheOrder.end(), indices);
+			optimizeOverdraw(indices, indexCount, primitive.vertices, 0.0f);
+		}
+	}
+
+	// Vertex fetch: renumber in order of first use so the draws read memory in order
+	std::vector<unsigned int> remap(primitive.vertices.size(), 0xffffffffu);
+	std::vector<MeshVertex> vertices;
+	std::vector<SkinVertex> skin;
+	vertices.reserve(primitive.vertices.size());
+	for (size_t i = 0; i < primitive.indices.size(); ++i) {
+		unsigned int& index = primitive.indices[i];
+		if (remap[index] == 0xffffffffu) {
+			remap[index] = (unsigned int)vertices.size();
+			vertices.push_back(primitive.vertices[index]);
+			if (!primitive.skin.empty()) {
+				skin.push_back(primitive.skin[index]);
+			}
+		}
+		index = remap[index];
+	}
+	primitive.vertices.swap(vertices);
+	primitive.skin.swap(skin);
+}
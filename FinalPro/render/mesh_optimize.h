@@ -0,0 +1,37 @@
+#ifndef _MESH_OPTIMIZE_H_
+#define _MESH_OPTIMIZE_H_
+
+#include "mesh.h"
+
+// Post-transform cache behaviour of a triangle list, simulated on a FIFO cache of
+// VERTEX_CACHE_SIZE entries. ACMR is misses per triangle (0.5 is ideal for a large
+// regular grid, 3 the worst), ATVR misses per vertex used (1 is ideal).
+#define VERTEX_CACHE_SIZE 16
+
+struct VertexCacheStats {
+	size_t triangles;
+	size_t vertices;
+	size_t misses;
+
+	VertexCacheStats() : triangles(0), vertices(0), misses(0) {}
+
+	float acmr() const { return triangles ? (float)misses / triangles : 0.0f; }
+	float atvr() const { return vertices ? (float)misses / vertices : 0.0f; }
+
+	void add(const VertexCacheStats& other) {
+		triangles += other.triangles;
+		vertices += other.vertices;
+		misses += other.misses;
+	}
+};
+
+VertexCacheStats AnalyzeVertexCache(const unsigned int* indices, size_t indexCount, size_t vertexCount);
+
+// Reorders the triangles of every LOD for the vertex cache (Tipsify), then moves
+// clusters facing away from the mesh centre first so they occlude what follows,
+// giving up at most overdrawThreshold times the cache efficiency. Vertices are
+// finally renumbered in the order the indices first use them, and vertices no LOD
+// uses are dropped; skin follows the vertices. Winding and LOD ranges are kept.
+void OptimizeMesh(MeshPrimitive& primitive, float overdrawThreshold = 1.05f);
+
+#endif
@@ -0,0 +1,589 @@
+#include "obj_loader.h"
+#include "profiler.h"
+
+#include <cstring>
+#include <map>
+#include <unordered_map>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// OBJ text handed to one parse job
+const size_t OBJ_CHUNK_BYTES = 1 << 20;
+
+// Read-only view of a whole file
+struct MappedFile {
+	const char* data;
+	size_t size;
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+
+	MappedFile() : data(NULL), size(0), file(INVALID_HANDLE_VALUE), mapping(NULL) {}
+
+	bool open(const char* path) {
+		file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+		LARGE_INTEGER length;
+		if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &length)) {
+			return false;
+		}
+		size = (size_t)length.QuadPart;
+		if (size == 0) {
+			return true;
+		}
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		data = mapping ? (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+		return data != NULL;
+	}
+
+	~MappedFile() {
+		if (data) {
+			UnmapViewOfFile(data);
+		}
+		if (mapping) {
+			CloseHandle(mapping);
+		}
+		if (file != INVALID_HANDLE_VALUE) {
+			CloseHandle(file);
+		}
+	}
+#else
+	int file;
+
+	MappedFile() : data(NULL), size(0), file(-1) {}
+
+	bool open(const char* path) {
+		file = ::open(path, O_RDONLY);
+		struct stat status;
+		if (file < 0 || fstat(file, &status) != 0) {
+			return false;
+		}
+		size = (size_t)status.st_size;
+		if (size == 0) {
+			return true;
+		}
+		void* view = mmap(NULL, size, PROT_READ, MAP_PRIVATE, file, 0);
+		if (view == MAP_FAILED) {
+			return false;
+		}
+		madvise(view, size, MADV_SEQUENTIAL);
+		data = (const char*)view;
+		return true;
+	}
+
+	~MappedFile() {
+		if (data) {
+			munmap((void*)data, size);
+		}
+		if (file >= 0) {
+			::close(file);
+		}
+	}
+#endif
+};
+
+// One corner of a face: position, texcoord and normal index, -1 when absent. Indices are
+// absolute and 0-based, except those flagged in relative (bit k for index[k]), which
+// count from the start of the chunk until the chunk offsets are known.
+struct ObjCorner {
+	int index[3];
+	unsigned char relative;
+};
+
+struct ObjChunk {
+	const char* begin;
+	const char* end;
+
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec2> texcoords;
+	std::vector<glm::vec3> normals;
+	std::vector<ObjCorner> corners;
+	std::vector<unsigned int> faceEnds;		// One past the last corner of every face
+
+	// usemtl lines as (first face, name); faces before the first use the material
+	// active at the end of the previous chunk
+	std::vector<std::pair<size_t, std::string> > materialNames;
+	std::vector<std::string> libraries;
+
+	// Filled once every chunk is parsed
+	int counts[3];							// Positions, texcoords, normals in earlier chunks
+	std::vector<std::pair<size_t, int> > materialRuns;	// (first face, material), starting at face 0
+};
+
+inline bool isSpace(char c) {
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline const char* skipSpaces(const char* p, const char* end) {
+	while (p < end && isSpace(*p)) {
+		++p;
+	}
+	return p;
+}
+
+// Decimal number with optional sign, fraction and exponent. Digits are gathered as
+// integers and scaled once, so the result is as exact as a float can hold.
+const char* parseFloat(const char* p, const char* end, float& value) {
+	static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9,
+		1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18 };
+
+	p = skipSpaces(p, end);
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+')) {
+		negative = *p == '-';
+		++p;
+	}
+
+	double result = 0.0;
+	while (p < end && *p >= '0' && *p <= '9') {
+		result = result * 10.0 + (*p - '0');
+		++p;
+	}
+	if (p < end && *p == '.') {
+		++p;
+		unsigned long long fraction = 0;
+		int digits = 0;
+		while (p < end && *p >= '0' && *p <= '9') {
+			if (digits < 18) {
+				fraction = fraction * 10 + (*p - '0');
+				digits++;
+			}
+			++p;
+		}
+		result += fraction / powers[digits];
+	}
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		++p;
+		bool negativeExponent = false;
+		if (p < end && (*p == '-' || *p == '+')) {
+			negativeExponent = *p == '-';
+			++p;
+		}
+		int exponent = 0;
+		while (p < end && *p >= '0' && *p <= '9') {
+			exponent = std::min(exponent * 10 + (*p - '0'), 400);
+			++p;
+		}
+		double scale = exponent <= 18 ? powers[exponent] : std::pow(10.0, exponent);
+		result = negativeExponent ? result / scale : result * scale;
+	}
+	value = (float)(negative ? -result : result);
+	return p;
+}
+
+const char* parseInt(const char* p, const char* end, int& value) {
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+')) {
+		negative = *p == '-';
+		++p;
+	}
+	int result = 0;
+	while (p < end && *p >= '0' && *p <= '9') {
+		result = result * 10 + (*p - '0');
+		++p;
+	}
+	value = negative ? -result : result;
+	return p;
+}
+
+// Rest of the line without surrounding blanks
+std::string restOfLine(const char* p, const char* end) {
+	p = skipSpaces(p, end);
+	while (end > p && isSpace(end[-1])) {
+		--end;
+	}
+	return std::string(p, end);
+}
+
+// "v", "v/vt", "v//vn" or "v/vt/vn"; counts are the chunk's elements so far
+const char* parseCorner(const char* p, const char* end, const int counts[3], ObjCorner& corner) {
+	corner.relative = 0;
+	for (int k = 0; k < 3; ++k) {
+		corner.index[k] = -1;
+		if (k > 0) {
+			if (p >= end || *p != '/') {
+				continue;
+			}
+			++p;
+		}
+		if (p >= end || *p == '/' || isSpace(*p)) {
+			continue;
+		}
+		int index;
+		p = parseInt(p, end, index);
+		if (index > 0) {
+			corner.index[k] = index - 1;
+		}
+		else if (index < 0) {
+			corner.index[k] = counts[k] + index;
+			corner.relative |= 1 << k;
+		}
+	}
+	return p;
+}
+
+void parseChunk(ObjChunk& chunk) {
+	PROFILE_SCOPE("ParseObjChunk");
+	// Rough sizes for the common case of one element per 30 bytes
+	size_t estimate = (chunk.end - chunk.begin) / 30;
+	chunk.positions.reserve(estimate / 2);
+	chunk.corners.reserve(estimate);
+	chunk.faceEnds.reserve(estimate / 3);
+
+	const char* line = chunk.begin;
+	while (line < chunk.end) {
+		const char* eol = (const char*)memchr(line, '\n', chunk.end - line);
+		if (eol == NULL) {
+			eol = chunk.end;
+		}
+		const char* p = skipSpaces(line, eol);
+		size_t length = eol - p;
+
+		if (length >= 2 && p[0] == 'v' && isSpace(p[1])) {
+			glm::vec3 position;
+			p = parseFloat(p + 1, eol, position.x);
+			p = parseFloat(p, eol, position.y);
+			parseFloat(p, eol, position.z);
+			chunk.positions.push_back(position);
+		}
+		else if (length >= 3 && p[0] == 'v' && p[1] == 't' && isSpace(p[2])) {
+			glm::vec2 texcoord(0.0f);
+			p = parseFloat(p + 2, eol, texcoord.x);
+			parseFloat(p, eol, texcoord.y);
+			chunk.texcoords.push_back(texcoord);
+		}
+		else if (length >= 3 && p[0] == 'v' && p[1] == 'n' && isSpace(p[2])) {
+			glm::vec3 normal;
+			p = parseFloat(p + 2, eol, normal.x);
+			p = parseFloat(p, eol, normal.y);
+			parseFloat(p, eol, normal.z);
+			chunk.normals.push_back(normal);
+		}
+		else if (length >= 2 && p[0] == 'f' && isSpace(p[1])) {
+			int counts[3] = { (int)chunk.positions.size(), (int)chunk.texcoords.size(), (int)chunk.normals.size() };
+			p = skipSpaces(p + 1, eol);
+			while (p < eol) {
+				ObjCorner corner;
+				const char* next = parseCorner(p, eol, counts, corner);
+				if (next == p) {
+					break;
+				}
+				chunk.corners.push_back(corner);
+				p = skipSpaces(next, eol);
+			}
+			chunk.faceEnds.push_back((unsigned int)chunk.corners.size());
+		}
+		else if (length > 7 && strncmp(p, "usemtl", 6) == 0 && isSpace(p[6])) {
+			chunk.materialNames.push_back(std::make_pair(chunk.faceEnds.size(), restOfLine(p + 6, eol)));
+		}
+		else if (length > 7 && strncmp(p, "mtllib", 6) == 0 && isSpace(p[6])) {
+			chunk.libraries.push_back(restOfLine(p + 6, eol));
+		}
+		line = eol + 1;
+	}
+}
+
+void loadMaterials(const std::string& path, const std::string& directory, std::vector<ObjMaterial>& materials) {
+	std::ifstream stream(path.c_str());
+	if (!stream.is_open()) {
+		printf("Impossible to open %s, its materials are left out\n", path.c_str());
+		return;
+	}
+
+	std::string line;
+	while (std::getline(stream, line)) {
+		const char* p = skipSpaces(line.c_str(), line.c_str() + line.size());
+		const char* end = line.c_str() + line.size();
+		std::string keyword;
+		while (p < end && !isSpace(*p)) {
+			keyword += *p++;
+		}
+
+		if (keyword == "newmtl") {
+			ObjMaterial material;
+			material.name = restOfLine(p, end);
+			material.diffuse = glm::vec4(1.0f);
+			materials.push_back(material);
+		}
+		else if (materials.empty()) {
+			continue;
+		}
+		else if (keyword == "Kd") {
+			glm::vec4& diffuse = materials.back().diffuse;
+			p = parseFloat(p, end, diffuse.r);
+			p = parseFloat(p, end, diffuse.g);
+			parseFloat(p, end, diffuse.b);
+		}
+		else if (keyword == "d") {
+			parseFloat(p, end, materials.back().diffuse.a);
+		}
+		else if (keyword == "Tr") {
+			float transparency = 0.0f;
+			parseFloat(p, end, transparency);
+			materials.back().diffuse.a = 1.0f - transparency;
+		}
+		else if (keyword == "map_Kd") {
+			// Options such as "-bm 1" come first, the file name is then the last word
+			std::string file = restOfLine(p, end);
+			if (!file.empty() && file[0] == '-') {
+				size_t space = file.find_last_of(" \t");
+				file = space == std::string::npos ? "" : file.substr(space + 1);
+			}
+			if (!file.empty()) {
+				materials.back().texturePath = directory + file;
+			}
+		}
+	}
+}
+
+struct CornerKey {
+	int position;
+	int texcoord;
+	int normal;
+
+	bool operator==(const CornerKey& other) const {
+		return position == other.position && texcoord == other.texcoord && normal == other.normal;
+	}
+};
+
+struct CornerHash {
+	size_t operator()(const CornerKey& key) const {
+		return ((size_t)key.position * 73856093u) ^ ((size_t)key.texcoord * 19349663u) ^ ((size_t)key.normal * 83492791u);
+	}
+};
+
+struct ObjElements {
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec2> texcoords;
+	std::vector<glm::vec3> normals;
+};
+
+// Triangulates every face of one material into a primitive, sharing vertices with equal
+// corners, then fills in the normals the file left out
+void buildPrimitive(const std::vector<ObjChunk>& chunks, const ObjElements& elements, int material, MeshPrimitive& primitive) {
+	PROFILE_SCOPE("BuildObjPrimitive");
+	primitive.material = material;
+
+	std::unordered_map<CornerKey, unsigned int, CornerHash> vertexIndex;
+	std::vector<int> vertexPositions;		// Position of every vertex lacking a normal, else -1
+	std::vector<unsigned int> faceVertices;
+	bool missingNormals = false;
+	int sizes[3] = { (int)elements.positions.size(), (int)elements.texcoords.size(), (int)elements.normals.size() };
+
+	for (size_t c = 0; c < chunks.size(); ++c) {
+		const ObjChunk& chunk = chunks[c];
+		for (size_t r = 0; r < chunk.materialRuns.size(); ++r) {
+			if (chunk.materialRuns[r].second != material) {
+				continue;
+			}
+			size_t firstFace = chunk.materialRuns[r].first;
+			size_t lastFace = r + 1 < chunk.materialRuns.size() ? chunk.materialRuns[r + 1].first : chunk.faceEnds.size();
+
+			for (size_t f = firstFace; f < lastFace; ++f) {
+				size_t begin = f > 0 ? chunk.faceEnds[f - 1] : 0;
+				size_t end = chunk.faceEnds[f];
+				faceVertices.clear();
+
+				for (size_t i = begin; i < end; ++i) {
+					const ObjCorner& corner = chunk.corners[i];
+					int index[3];
+					bool valid = true;
+					for (int k = 0; k < 3; ++k) {
+						index[k] = corner.index[k];
+						if (corner.relative & (1 << k)) {
+							index[k] += chunk.counts[k];
+						}
+						if (index[k] >= sizes[k] || (index[k] < 0 && (k == 0 || corner.relative & (1 << k)))) {
+							valid = false;
+						}
+					}
+					if (!valid) {
+						break;
+					}
+
+					CornerKey key = { index[0], index[1], index[2] };
+					std::pair<std::unordered_map<CornerKey, unsigned int, CornerHash>::iterator, bool> inserted =
+						vertexIndex.insert(std::make_pair(key, (unsigned int)primitive.vertices.size()));
+					if (inserted.second) {
+						MeshVertex vertex;
+						vertex.position = elements.positions[index[0]];
+						vertex.uv = index[1] >= 0 ? glm::vec2(elements.texcoords[index[1]].x, 1.0f - elements.texcoords[index[1]].y) : glm::vec2(0.0f);
+						vertex.normal = index[2] >= 0 ? elements.normals[index[2]] : glm::vec3(0.0f);
+						primitive.vertices.push_back(vertex);
+						vertexPositions.push_back(index[2] >= 0 ? -1 : index[0]);
+						missingNormals |= index[2] < 0;
+					}
+					faceVertices.push_back(inserted.first->second);
+				}
+
+				// Faces with a bad index are dropped whole
+				if (faceVertices.size() != end - begin) {
+					continue;
+				}
+				for (size_t i = 2; i < faceVertices.size(); ++i) {
+					primitive.indices.push_back(faceVertices[0]);
+					primitive.indices.push_back(faceVertices[i - 1]);
+					primitive.indices.push_back(faceVertices[i]);
+				}
+			}
+		}
+	}
+
+	// Area-weighted face normals summed per position, so vertices that only differ in
+	// their uv still get the same normal
+	if (missingNormals) {
+		std::unordered_map<int, glm::vec3> smooth;
+		for (size_t i = 0; i + 2 < primitive.indices.size(); i += 3) {
+			const unsigned int* triangle = &primitive.indices[i];
+			glm::vec3 normal = glm::cross(primitive.vertices[triangle[1]].position - primitive.vertices[triangle[0]].position,
+				primitive.vertices[triangle[2]].position - primitive.vertices[triangle[0]].position);
+			for (int k = 0; k < 3; ++k) {
+				if (vertexPositions[triangle[k]] >= 0) {
+					smooth[vertexPositions[triangle[k]]] += normal;
+				}
+			}
+		}
+		for (size_t v = 0; v < primitive.vertices.size(); ++v) {
+			if (vertexPositions[v] < 0) {
+				continue;
+			}
+			glm::vec3 normal = smooth[vertexPositions[v]];
+			float length = glm::length(normal);
+			primitive.vertices[v].normal = length > 0.0f ? normal / length : glm::vec3(0.0f, 1.0f, 0.0f);
+		}
+	}
+
+	primitive.bounds = ComputeMeshBounds(primitive.vertices);
+}
+
+}
+
+bool LoadObj(const char* path, std::vector<MeshPrimitive>& meshes, std::vector<ObjMaterial>& materials,
+	WorkerPool* workers) {
+	PROFILE_SCOPE("LoadObj");
+	MappedFile file;
+	if (!file.open(path)) {
+		printf("Impossible to open %s\n", path);
+		return false;
+	}
+
+	// Chunks end right after a newline, so no line is split between two of them
+	std::vector<ObjChunk> chunks;
+	const char* cursor = file.data;
+	const char* end = file.data + file.size;
+	while (cursor < end) {
+		const char* chunkEnd = end - cursor > (ptrdiff_t)OBJ_CHUNK_BYTES ? cursor + OBJ_CHUNK_BYTES : end;
+		if (chunkEnd < end) {
+			const char* newline = (const char*)memchr(chunkEnd, '\n', end - chunkEnd);
+			chunkEnd = newline ? newline + 1 : end;
+		}
+		chunks.push_back(ObjChunk());
+		chunks.back().begin = cursor;
+		chunks.back().end = chunkEnd;
+		cursor = chunkEnd;
+	}
+
+	std::function<void(size_t, size_t)> parse = [&chunks](size_t begin, size_t end) {
+		for (size_t c = begin; c < end; ++c) {
+			parseChunk(chunks[c]);
+		}
+	};
+	if (workers) {
+		ParallelFor(*workers, chunks.size(), 1, parse);
+	}
+	else {
+		parse(0, chunks.size());
+	}
+
+	// Material libraries are relative to the OBJ
+	std::string directory(path);
+	size_t slash = directory.find_last_of("/\\");
+	directory = slash == std::string::npos ? "" : directory.substr(0, slash + 1);
+	for (size_t c = 0; c < chunks.size(); ++c) {
+		for (size_t l = 0; l < chunks[c].libraries.size(); ++l) {
+			loadMaterials(directory + chunks[c].libraries[l], directory, materials);
+		}
+	}
+	std::map<std::string, int> materialIndex;
+	for (size_t m = 0; m < materials.size(); ++m) {
+		materialIndex.insert(std::make_pair(materials[m].name, (int)m));
+	}
+
+	// Offsets of every chunk's elements, and the material each of its faces uses
+	ObjElements elements;
+	int counts[3] = { 0, 0, 0 };
+	int material = -1;
+	std::vector<unsigned char> materialUsed(materials.size() + 1, 0);
+	for (size_t c = 0; c < chunks.size(); ++c) {
+		ObjChunk& chunk = chunks[c];
+		chunk.counts[0] = counts[0];
+		chunk.counts[1] = counts[1];
+		chunk.counts[2] = counts[2];
+		counts[0] += (int)chunk.positions.size();
+		counts[1] += (int)chunk.texcoords.size();
+		counts[2] += (int)chunk.normals.size();
+
+		chunk.materialRuns.push_back(std::make_pair((size_t)0, material));
+		for (size_t n = 0; n < chunk.materialNames.size(); ++n) {
+			std::map<std::string, int>::const_iterator found = materialIndex.find(chunk.materialNames[n].second);
+			material = found == materialIndex.end() ? -1 : found->second;
+			chunk.materialRuns.push_back(std::make_pair(chunk.materialNames[n].first, material));
+		}
+		for (size_t r = 0; r < chunk.materialRuns.size(); ++r) {
+			size_t last = r + 1 < chunk.materialRuns.size() ? chunk.materialRuns[r + 1].first : chunk.faceEnds.size();
+			if (last > chunk.materialRuns[r].first) {
+				materialUsed[chunk.materialRuns[r].second + 1] = 1;
+			}
+		}
+	}
+
+	elements.positions.reserve(counts[0]);
+	elements.texcoords.reserve(counts[1]);
+	elements.normals.reserve(counts[2]);
+	for (size_t c = 0; c < chunks.size(); ++c) {
+		ObjChunk& chunk = chunks[c];
+		elements.positions.insert(elements.positions.end(), chunk.positions.begin(), chunk.positions.end());
+		elements.texcoords.insert(elements.texcoords.end(), chunk.texcoords.begin(), chunk.texcoords.end());
+		elements.normals.insert(elements.normals.end(), chunk.normals.begin(), chunk.normals.end());
+		std::vector<glm::vec3>().swap(chunk.positions);
+		std::vector<glm::vec2>().swap(chunk.texcoords);
+		std::vector<glm::vec3>().swap(chunk.normals);
+	}
+
+	// One primitive per material that has faces, built in parallel
+	std::vector<int> groups;
+	for (int m = -1; m < (int)materials.size(); ++m) {
+		if (materialUsed[m + 1]) {
+			groups.push_back(m);
+		}
+	}
+	std::vector<MeshPrimitive> primitives(groups.size());
+	std::function<void(size_t, size_t)> build = [&](size_t begin, size_t end) {
+		for (size_t g = begin; g < end; ++g) {
+			buildPrimitive(chunks, elements, groups[g], primitives[g]);
+		}
+	};
+	if (workers) {
+		ParallelFor(*workers, groups.size(), 1, build);
+	}
+	else {
+		build(0, groups.size());
+	}
+
+	for (size_t g = 0; g < primitives.size(); ++g) {
+		if (!primitives[g].indices.empty()) {
+			meshes.push_back(MeshPrimitive());
+			std::swap(meshes.back(), primitives[g]);
+		}
+	}
+	return true;
+}
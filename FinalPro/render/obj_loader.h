@@ -0,0 +1,24 @@
+#ifndef _OBJ_LOADER_H_
+#define _OBJ_LOADER_H_
+
+#include "headers.h"
+#include "mesh.h"
+#include "async_loader.h"
+
+// Surface of one MTL material
+struct ObjMaterial {
+	std::string name;
+	glm::vec4 diffuse;			// Kd, alpha from d (or 1 - Tr)
+	std::string texturePath;	// map_Kd next to the OBJ, empty if none
+};
+
+// Reads a Wavefront OBJ and the MTL libraries it names. The file is memory-mapped and
+// cut into chunks at line ends; with a pool the chunks are parsed in parallel on it,
+// and so are the materials' meshes. Faces are triangulated as fans and grouped into
+// one primitive per material (material -1 for faces without one), vertices shared
+// through their position/uv/normal triple. Missing normals are smoothed from the
+// faces around each position and v is flipped to match the glTF path.
+bool LoadObj(const char* path, std::vector<MeshPrimitive>& meshes, std::vector<ObjMaterial>& materials,
+	WorkerPool* workers);
+
+#endif
@@ -0,0 +1,330 @@
+#include "occlusion.h"
+
+#include <chrono>
+#include <thread>
+
+namespace {
+
+// A triangle ready for scan conversion. Each edge is a function A x + B y + C of the
+// pixel centre, positive inside; depth is a plane over the screen.
+struct TriangleSetup {
+	float edgeA[3], edgeB[3], edgeC[3];
+	float depthX, depthY, depthC;
+	float depthBias;			// Half a pixel of depth slope, towards the far side
+	float maxDepth;
+	int minX, maxX, minY, maxY;
+};
+
+bool setupTriangle(const glm::vec3& a, glm::vec3 b, glm::vec3 c, int width, int height, TriangleSetup& t) {
+	float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+	if (fabsf(area) < 1e-8f) {
+		return false;
+	}
+	// Occluders are drawn from both sides, so the winding only decides the edge signs
+	if (area < 0.0f) {
+		std::swap(b, c);
+		area = -area;
+	}
+
+	float minX = std::min(a.x, std::min(b.x, c.x)), maxX = std::max(a.x, std::max(b.x, c.x));
+	float minY = std::min(a.y, std::min(b.y, c.y)), maxY = std::max(a.y, std::max(b.y, c.y));
+	t.minX = (int)std::max(floorf(minX), 0.0f);
+	t.maxX = (int)std::min(floorf(maxX), (float)(width - 1));
+	t.minY = (int)std::max(floorf(minY), 0.0f);
+	t.maxY = (int)std::min(floorf(maxY), (float)(height - 1));
+	if (t.minX > t.maxX || t.minY > t.maxY) {
+		return false;
+	}
+
+	const glm::vec3* corners[3] = { &a, &b, &c };
+	for (int e = 0; e < 3; ++e) {
+		const glm::vec3& p = *corners[e];
+		const glm::vec3& q = *corners[(e + 1) % 3];
+		t.edgeA[e] = p.y - q.y;
+		t.edgeB[e] = q.x - p.x;
+		t.edgeC[e] = (q.y - p.y) * p.x - (q.x - p.x) * p.y;
+	}
+
+	t.depthX = ((b.z - a.z) * (c.y - a.y) - (c.z - a.z) * (b.y - a.y)) / area;
+	t.depthY = ((c.z - a.z) * (b.x - a.x) - (b.z - a.z) * (c.x - a.x)) / area;
+	t.depthC = a.z - t.depthX * a.x - t.depthY * a.y;
+	t.depthBias = 0.5f * (fabsf(t.depthX) + fabsf(t.depthY));
+	t.maxDepth = std::max(a.z, std::max(b.z, c.z));
+	return true;
+}
+
+// Rows [rowBegin, rowEnd) of the triangle. The covered pixels of a row are found from
+// the edges up front, leaving a branch-free span loop the compiler can vectorize. The span
+// bounds get a thousandth of a pixel of slack: a pixel centre on an edge shared by two
+// triangles must not round out of both, or the crack leaks the far plane up the pyramid.
+void rasterizeRows(const TriangleSetup& t, int rowBegin, int rowEnd, float* depth, int width) {
+	int y0 = std::max(rowBegin, t.minY), y1 = std::min(rowEnd - 1, t.maxY);
+	for (int y = y0; y <= y1; ++y) {
+		float py = y + 0.5f;
+		float first = (float)t.minX, last = (float)t.maxX;
+		for (int e = 0; e < 3; ++e) {
+			float k = t.edgeB[e] * py + t.edgeC[e];
+			if (t.edgeA[e] > 0.0f) {
+				first = std::max(first, ceilf(-k / t.edgeA[e] - 0.5f - 1e-3f));
+			}
+			else if (t.edgeA[e] < 0.0f) {
+				last = std::min(last, floorf(-k / t.edgeA[e] - 0.5f + 1e-3f));
+			}
+			else if (k < 0.0f) {
+				last = first - 1.0f;
+			}
+		}
+		if (first > last) {
+			continue;
+		}
+
+		float* row = depth + y * width;
+		float rowDepth = t.depthY * py + t.depthC + t.depthBias + 0.5f * t.depthX;
+		for (int x = (int)first; x <= (int)last; ++x) {
+			float z = std::min(t.depthX * x + rowDepth, t.maxDepth);
+			row[x] = std::min(row[x], z);
+		}
+	}
+}
+
+// Keeps the part of a clip-space polygon in front of the near plane (z >= -w)
+int clipNear(const glm::vec4* input, int count, glm::vec4* output) {
+	int written = 0;
+	for (int i = 0; i < count; ++i) {
+		const glm::vec4& p = input[i];
+		const glm::vec4& q = input[(i + 1) % count];
+		float dp = p.z + p.w, dq = q.z + q.w;
+		if (dp >= 0.0f) {
+			output[written++] = p;
+		}
+		if ((dp >= 0.0f) != (dq >= 0.0f)) {
+			output[written++] = p + (q - p) * (dp / (dp - dq));
+		}
+	}
+	return written;
+}
+
+}
+
+void OcclusionBuffer::initialize(int width, int height, int threadCount) {
+	this->width = width;
+	this->height = height;
+	if (threadCount <= 0) {
+		threadCount = std::max(1, (int)std::thread::hardware_concurrency());
+	}
+	this->threadCount = threadCount;
+	workers.start(threadCount - 1);
+	viewProjection = glm::mat4(1.0f);
+
+	levels.clear();
+	levelSizes.clear();
+	glm::ivec2 size(width, height);
+	while (true) {
+		levels.push_back(std::vector<float>((size_t)size.x * size.y, 1.0f));
+		levelSizes.push_back(size);
+		if (size.x == 1 && size.y == 1) {
+			break;
+		}
+		// Halved and rounded down like GL mip sizes, so the pyramid is a complete texture
+		size = glm::max(size / 2, glm::ivec2(1));
+	}
+
+	texture = 0;
+	textureCurrent = false;
+	begin(viewProjection);
+}
+
+void OcclusionBuffer::begin(const glm::mat4& viewProjection) {
+	this->viewProjection = viewProjection;
+	triangles.clear();
+	std::fill(levels[0].begin(), levels[0].end(), 1.0f);
+	stats.occluderTriangles = 0;
+	stats.tested = 0;
+	stats.occluded = 0;
+	stats.rasterMs = 0.0;
+}
+
+void OcclusionBuffer::addOccluder(const glm::vec3* positions, const unsigned int* indices, size_t indexCount) {
+	glm::vec2 scale(0.5f * width, 0.5f * height);
+	for (size_t i = 0; i + 2 < indexCount; i += 3) {
+		glm::vec4 clip[3];
+		int inFront = 0;
+		for (int k = 0; k < 3; ++k) {
+			clip[k] = viewProjection * glm::vec4(positions[indices[i + k]], 1.0f);
+			inFront += clip[k].z + clip[k].w >= 0.0f;
+		}
+		if (inFront == 0) {
+			continue;
+		}
+
+		glm::vec4 polygon[4];
+		int count = inFront == 3 ? 3 : clipNear(clip, 3, polygon);
+		const glm::vec4* vertices = inFront == 3 ? clip : polygon;
+		glm::vec3 screen[4];
+		for (int k = 0; k < count; ++k) {
+			float w = std::max(vertices[k].w, 1e-6f);
+			screen[k] = glm::vec3((vertices[k].x / w + 1.0f) * scale.x, (vertices[k].y / w + 1.0f) * scale.y, vertices[k].z / w);
+		}
+		for (int k = 1; k + 1 < count; ++k) {
+			triangles.push_back(screen[0]);
+			triangles.push_back(screen[k]);
+			triangles.push_back(screen[k + 1]);
+		}
+	}
+}
+
+void OcclusionBuffer::finish() {
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+
+	std::vector<TriangleSetup> setups;
+	setups.reserve(triangles.size() / 3);
+	for (size_t i = 0; i + 2 < triangles.size(); i += 3) {
+		TriangleSetup setup;
+		if (setupTriangle(triangles[i], triangles[i + 1], triangles[i + 2], width, height, setup)) {
+			setups.push_back(setup);
+		}
+	}
+	stats.occluderTriangles = (int)setups.size();
+
+	// Bands of rows are independent, every worker walks all triangles for its band
+	float* depth = &levels[0][0];
+	int bandCount = (height + OCCLUSION_BAND_HEIGHT - 1) / OCCLUSION_BAND_HEIGHT;
+	ParallelFor(workers, setups.empty() ? 0 : bandCount, 1, [&](size_t begin, size_t end) {
+		for (size_t band = begin; band < end; ++band) {
+			int rowBegin = (int)band * OCCLUSION_BAND_HEIGHT;
+			int rowEnd = std::min(rowBegin + OCCLUSION_BAND_HEIGHT, height);
+			for (size_t t = 0; t < setups.size(); ++t) {
+				if (setups[t].maxY >= rowBegin && setups[t].minY < rowEnd) {
+					rasterizeRows(setups[t], rowBegin, rowEnd, depth, width);
+				}
+			}
+		}
+	});
+
+	// A texel covers the 2x2 below it; on odd sizes the last one also takes the row or
+	// column left over
+	for (size_t l = 1; l < levels.size(); ++l) {
+		const std::vector<float>& below = levels[l - 1];
+		glm::ivec2 belowSize = levelSizes[l - 1];
+		glm::ivec2 size = levelSizes[l];
+		for (int y = 0; y < size.y; ++y) {
+			int rowEnd = y + 1 < size.y ? y * 2 + 2 : belowSize.y;
+			float* out = &levels[l][(size_t)y * size.x];
+			for (int x = 0; x < size.x; ++x) {
+				out[x] = 0.0f;
+			}
+			for (int r = std::min(y * 2, belowSize.y - 1); r < rowEnd; ++r) {
+				const float* row = &below[(size_t)r * belowSize.x];
+				for (int x = 0; x < size.x; ++x) {
+					int x0 = std::min(x * 2, belowSize.x - 1), x1 = std::min(x * 2 + 1, belowSize.x - 1);
+					out[x] = std::max(out[x], std::max(row[x0], row[x1]));
+				}
+				if (belowSize.x > 1 && (belowSize.x & 1)) {
+					out[size.x - 1] = std::max(out[size.x - 1], row[belowSize.x - 1]);
+				}
+			}
+		}
+	}
+
+	textureCurrent = false;
+	stats.rasterMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+}
+
+bool OcclusionBuffer::isVisible(const AABB& box) const {
+	// Corners as sums of the matrix columns scaled by either bound
+	glm::vec4 xs[2] = { viewProjection[0] * box.min.x, viewProjection[0] * box.max.x };
+	glm::vec4 ys[2] = { viewProjection[1] * box.min.y, viewProjection[1] * box.max.y };
+	glm::vec4 zs[2] = { viewProjection[2] * box.min.z + viewProjection[3], viewProjection[2] * box.max.z + viewProjection[3] };
+
+	float minX = FLT_MAX, maxX = -FLT_MAX, minY = FLT_MAX, maxY = -FLT_MAX, minDepth = FLT_MAX;
+	for (int c = 0; c < 8; ++c) {
+		glm::vec4 clip = xs[c & 1] + ys[(c >> 1) & 1] + zs[c >> 2];
+		// Boxes reaching the near plane are left alone
+		if (clip.z < -clip.w || clip.w <= 1e-6f) {
+			return true;
+		}
+		float x = (clip.x / clip.w + 1.0f) * 0.5f * width;
+		float y = (clip.y / clip.w + 1.0f) * 0.5f * height;
+		minX = std::min(minX, x);
+		maxX = std::max(maxX, x);
+		minY = std::min(minY, y);
+		maxY = std::max(maxY, y);
+		minDepth = std::min(minDepth, clip.z / clip.w);
+	}
+
+	// Off screen is for the frustum test to decide
+	if (maxX < 0.0f || maxY < 0.0f || minX >= (float)width || minY >= (float)height) {
+		return true;
+	}
+	int x0 = (int)std::max(floorf(minX), 0.0f), x1 = (int)std::min(floorf(maxX), (float)(width - 1));
+	int y0 = (int)std::max(floorf(minY), 0.0f), y1 = (int)std::min(floorf(maxY), (float)(height - 1));
+
+	// Coarsest level first where the rectangle spans at most two texels per axis
+	size_t level = 0;
+	while (level + 1 < levels.size() && ((x1 >> level) - (x0 >> level) > 1 || (y1 >> level) - (y0 >> level) > 1)) {
+		level++;
+	}
+	// The last texel of a level also covers what rounding its size down left over
+	const std::vector<float>& depth = levels[level];
+	glm::ivec2 size = levelSizes[level];
+	float farthest = 0.0f;
+	for (int y = std::min(y0 >> level, size.y - 1); y <= std::min(y1 >> level, size.y - 1); ++y) {
+		for (int x = std::min(x0 >> level, size.x - 1); x <= std::min(x1 >> level, size.x - 1); ++x) {
+			farthest = std::max(farthest, depth[(size_t)y * size.x + x]);
+		}
+	}
+	return minDepth <= farthest;
+}
+
+size_t OcclusionBuffer::cullAABBs(const AABBList& boxes, std::vector<unsigned char>& visible) {
+	size_t visibleCount = 0;
+	for (size_t i = 0; i < boxes.size(); ++i) {
+		if (!visible[i]) {
+			continue;
+		}
+		AABB box;
+		box.min = glm::vec3(boxes.minX[i], boxes.minY[i], boxes.minZ[i]);
+		box.max = glm::vec3(boxes.maxX[i], boxes.maxY[i], boxes.maxZ[i]);
+		stats.tested++;
+		if (isVisible(box)) {
+			visibleCount++;
+		}
+		else {
+			visible[i] = 0;
+			stats.occluded++;
+		}
+	}
+	return visibleCount;
+}
+
+void OcclusionBuffer::bindTexture(int textureUnit) {
+	glActiveTexture(GL_TEXTURE0 + textureUnit);
+	if (texture == 0) {
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		for (size_t l = 0; l < levels.size(); ++l) {
+			glTexImage2D(GL_TEXTURE_2D, (GLint)l, GL_R32F, levelSizes[l].x, levelSizes[l].y, 0, GL_RED, GL_FLOAT, NULL);
+		}
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)levels.size() - 1);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+	else {
+		glBindTexture(GL_TEXTURE_2D, texture);
+	}
+	if (!textureCurrent) {
+		for (size_t l = 0; l < levels.size(); ++l) {
+			glTexSubImage2D(GL_TEXTURE_2D, (GLint)l, 0, 0, levelSizes[l].x, levelSizes[l].y, GL_RED, GL_FLOAT, &levels[l][0]);
+		}
+		textureCurrent = true;
+	}
+	glActiveTexture(GL_TEXTURE0);
+}
+
+void OcclusionBuffer::cleanup() {
+	workers.stop();
+	glDeleteTextures(1, &texture);
+	texture = 0;
+}
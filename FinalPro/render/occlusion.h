@@ -0,0 +1,77 @@
+#ifndef _OCCLUSION_H_
+#define _OCCLUSION_H_
+
+#include "headers.h"
+#include "frustum.h"
+#include "async_loader.h"
+
+// Rows of the depth buffer a worker rasterizes at a time
+#define OCCLUSION_BAND_HEIGHT 8
+
+// What the occlusion test did this frame, summed over every model that used it
+struct OcclusionStats {
+	int occluderTriangles;		// Drawn after near-plane clipping
+	int tested;					// Boxes tested against the pyramid
+	int occluded;
+	double rasterMs;
+
+	float occludedPercent() const { return tested > 0 ? 100.0f * occluded / tested : 0.0f; }
+};
+
+// Software occlusion culling. A few occluder meshes are rasterized on the CPU into a
+// small depth buffer from the camera, which is reduced into a hierarchical-Z pyramid
+// (every texel holds the farthest depth of the four below it). Boxes are then tested
+// against the level where they cover at most 2x2 texels: a box whose nearest point is
+// behind the farthest occluder depth over its screen rectangle is hidden. Nothing is
+// read back from the GPU, so the result is ready before the frame is submitted.
+//
+// Occluders must lie inside what is drawn for them, the test is only as conservative
+// as they are. Depth is NDC z; pixels are covered when their centre is, and take the
+// farthest depth of the triangle plane over the pixel.
+struct OcclusionBuffer {
+	int width, height;
+	int threadCount;
+	glm::mat4 viewProjection;
+
+	// Rasterizes with the calling thread, kept across frames so finish() starts no threads
+	WorkerPool workers;
+
+	// levels[0] is width x height, each next level half the size rounded down
+	std::vector<std::vector<float> > levels;
+	std::vector<glm::ivec2> levelSizes;
+
+	// Screen-space occluder triangles of this frame, 3 vertices (x, y, depth) each
+	std::vector<glm::vec3> triangles;
+
+	// Pyramid as an R32F texture with one mip per level, for cull.comp; uploaded once
+	// per frame on first use
+	GLuint texture;
+	bool textureCurrent;
+
+	OcclusionStats stats;
+
+	// threadCount 0 uses every core; the calling thread counts as one of them
+	void initialize(int width, int height, int threadCount = 0);
+
+	// Starts a frame seen through viewProjection and clears the occluders and stats
+	void begin(const glm::mat4& viewProjection);
+
+	// Occluder triangles in world space, indices into positions
+	void addOccluder(const glm::vec3* positions, const unsigned int* indices, size_t indexCount);
+
+	// Rasterizes the occluders in bands of rows across the workers and builds the pyramid
+	void finish();
+
+	bool isVisible(const AABB& box) const;
+
+	// Clears visible[i] for every visible box that is occluded and counts the tests in
+	// stats. Returns the number of boxes still visible.
+	size_t cullAABBs(const AABBList& boxes, std::vector<unsigned char>& visible);
+
+	// Binds the pyramid texture on textureUnit
+	void bindTexture(int textureUnit);
+
+	void cleanup();
+};
+
+#endif
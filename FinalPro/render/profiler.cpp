@@ -0,0 +1,214 @@
+#include "profiler.h"
+
+namespace {
+
+thread_local int scopeDepth = 0;
+thread_local int threadSlot = -1;
+
+}
+
+Profiler::Profiler() {
+	capacity = 1 << 16;
+	slots.reset(new Slot[capacity]);
+	for (size_t i = 0; i < capacity; ++i) {
+		slots[i].sequence.store(0);
+	}
+	writeIndex.store(0);
+	threadCount.store(0);
+	frame.store(0);
+	epoch = std::chrono::steady_clock::now();
+	enabled = true;
+
+	gpuActive = false;
+	gpuInitialized = false;
+	renderThread = -1;
+	gpuFramesDropped = 0;
+	for (int f = 0; f < PROFILE_GPU_FRAMES; ++f) {
+		gpuScopeCount[f] = 0;
+		gpuScopesRead[f] = 0;
+		gpuFrame[f] = 0;
+	}
+}
+
+void Profiler::initializeGpu() {
+	for (int f = 0; f < PROFILE_GPU_FRAMES; ++f) {
+		glGenQueries(PROFILE_MAX_GPU_SCOPES, queries[f]);
+	}
+	gpuInitialized = true;
+	renderThread = threadIndex();
+}
+
+double Profiler::now() const {
+	return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+int Profiler::threadIndex() {
+	if (threadSlot < 0) {
+		threadSlot = threadCount.fetch_add(1);
+	}
+	return threadSlot;
+}
+
+void Profiler::record(const char* name, double start, double duration, int thread, int depth, unsigned int frame) {
+	unsigned long long ticket = writeIndex.fetch_add(1, std::memory_order_relaxed);
+	Slot& slot = slots[ticket % capacity];
+
+	// Mark the slot as being written before touching the event
+	slot.sequence.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	slot.event.name = name;
+	slot.event.start = start;
+	slot.event.duration = duration;
+	slot.event.frame = frame;
+	slot.event.thread = thread;
+	slot.event.depth = depth;
+	slot.sequence.store(ticket + 1, std::memory_order_release);
+}
+
+void Profiler::beginFrame() {
+	unsigned int current = ++frame;
+	if (!gpuInitialized) {
+		return;
+	}
+
+	// The slot this frame reuses had its last chance to be read above
+	collectGpuResults();
+	int slot = current % PROFILE_GPU_FRAMES;
+	if (gpuScopesRead[slot] < gpuScopeCount[slot]) {
+		gpuFramesDropped++;
+	}
+	gpuScopeCount[slot] = 0;
+	gpuScopesRead[slot] = 0;
+	gpuFrame[slot] = current;
+}
+
+bool Profiler::beginGpu(const char* name) {
+	int slot = frame.load() % PROFILE_GPU_FRAMES;
+	if (!gpuInitialized || !enabled || gpuActive || gpuScopeCount[slot] >= PROFILE_MAX_GPU_SCOPES) {
+		return false;
+	}
+	GpuScope& scope = gpuScopes[slot][gpuScopeCount[slot]];
+	scope.name = name;
+	scope.start = now();
+	glBeginQuery(GL_TIME_ELAPSED, queries[slot][gpuScopeCount[slot]]);
+	gpuActive = true;
+	return true;
+}
+
+void Profiler::endGpu() {
+	int slot = frame.load() % PROFILE_GPU_FRAMES;
+	glEndQuery(GL_TIME_ELAPSED);
+	gpuScopeCount[slot]++;
+	gpuActive = false;
+}
+
+// Queries finish in order, so each frame is read up to its first pending query.
+// GPU scopes are placed on the timeline where the CPU issued them.
+void Profiler::collectGpuResults() {
+	// A scope still being recorded is not counted yet, so it is never waited on
+	for (int f = 0; f < PROFILE_GPU_FRAMES; ++f) {
+		while (gpuScopesRead[f] < gpuScopeCount[f]) {
+			GLuint query = queries[f][gpuScopesRead[f]];
+			GLint available = 0;
+			glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available) {
+				break;
+			}
+			GLuint64 elapsed = 0;
+			glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+			const GpuScope& scope = gpuScopes[f][gpuScopesRead[f]];
+			record(scope.name, scope.start, elapsed / 1000.0, PROFILE_GPU_THREAD, 0, gpuFrame[f]);
+			gpuScopesRead[f]++;
+		}
+	}
+}
+
+void Profiler::snapshot(std::vector<ProfileEvent>& events) const {
+	events.clear();
+	unsigned long long end = writeIndex.load(std::memory_order_acquire);
+	unsigned long long begin = end > capacity ? end - capacity : 0;
+	for (unsigned long long ticket = begin; ticket < end; ++ticket) {
+		const Slot& slot = slots[ticket % capacity];
+		if (slot.sequence.load(std::memory_order_acquire) != ticket + 1) {
+			continue;
+		}
+		ProfileEvent event = slot.event;
+
+		// Skip the event if a writer claimed the slot while it was copied
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (slot.sequence.load(std::memory_order_relaxed) != ticket + 1) {
+			continue;
+		}
+		events.push_back(event);
+	}
+}
+
+bool Profiler::writeChromeTrace(const char* path) const {
+	std::vector<ProfileEvent> events;
+	snapshot(events);
+
+	std::ofstream stream(path, std::ios::out | std::ios::trunc);
+	if (!stream.is_open()) {
+		printf("Could not write profile %s.\n", path);
+		return false;
+	}
+
+	stream << std::fixed << std::setprecision(3);
+	stream << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	stream << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << PROFILE_GPU_THREAD
+		<< ",\"args\":{\"name\":\"GPU\"}}";
+	int threads = threadCount.load();
+	for (int t = 0; t < threads; ++t) {
+		stream << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << t << ",\"args\":{\"name\":\"";
+		if (t == renderThread) {
+			stream << "Render thread";
+		}
+		else {
+			stream << "Thread " << t;
+		}
+		stream << "\"}}";
+	}
+	for (size_t i = 0; i < events.size(); ++i) {
+		const ProfileEvent& event = events[i];
+		stream << ",\n{\"name\":\"" << event.name << "\",\"cat\":\"" << (event.thread == PROFILE_GPU_THREAD ? "gpu" : "cpu")
+			<< "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.thread << ",\"ts\":" << event.start
+			<< ",\"dur\":" << event.duration << ",\"args\":{\"frame\":" << event.frame << "}}";
+	}
+	stream << "\n]}\n";
+
+	printf("Wrote %d profile events to %s.\n", (int)events.size(), path);
+	return true;
+}
+
+void Profiler::cleanup() {
+	if (gpuInitialized) {
+		for (int f = 0; f < PROFILE_GPU_FRAMES; ++f) {
+			glDeleteQueries(PROFILE_MAX_GPU_SCOPES, queries[f]);
+		}
+		gpuInitialized = false;
+	}
+}
+
+Profiler& SharedProfiler() {
+	static Profiler profiler;
+	return profiler;
+}
+
+ProfileScope::ProfileScope(const char* name, bool gpu) {
+	this->name = name;
+	depth = scopeDepth++;
+	this->gpu = gpu && SharedProfiler().beginGpu(name);
+	start = SharedProfiler().now();
+}
+
+ProfileScope::~ProfileScope() {
+	Profiler& profiler = SharedProfiler();
+	double end = profiler.now();
+	if (gpu) {
+		profiler.endGpu();
+	}
+	scopeDepth--;
+	if (profiler.enabled) {
+		profiler.record(name, start, end - start, profiler.threadIndex(), depth, profiler.frame.load());
+	}
+}
@@ -0,0 +1,111 @@
+#ifndef _PROFILER_H_
+#define _PROFILER_H_
+
+#include "headers.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+
+// Frames whose GPU timings can be in flight, and timed GPU scopes per frame
+#define PROFILE_GPU_FRAMES 4
+#define PROFILE_MAX_GPU_SCOPES 32
+
+// Thread id the GPU timings are reported under in the trace
+#define PROFILE_GPU_THREAD 1000
+
+// One finished scope. Names are not copied, they must outlive the profiler
+// (string literals normally).
+struct ProfileEvent {
+	const char* name;
+	double start;			// Microseconds since the profiler started
+	double duration;		// Microseconds
+	unsigned int frame;
+	int thread;
+	int depth;				// Nesting level on its thread
+};
+
+// Collects CPU scopes from any thread and GPU pass timings from the GL thread into
+// a fixed ring of the most recent events, and writes them as Chrome trace JSON
+// (load in about:tracing or Perfetto).
+//
+// Writers claim a slot with one atomic increment and publish it with a sequence
+// number, so recording never takes a lock; the writer of the trace skips slots
+// that were being overwritten while it read them.
+//
+// GPU scopes use GL_TIME_ELAPSED queries from a ring of PROFILE_GPU_FRAMES frames.
+// Results are picked up once the driver reports them available, so reading them
+// never stalls; a frame still pending when its queries are reused is dropped.
+// These queries cannot nest, an inner GPU scope is only timed on the CPU.
+struct Profiler {
+	struct Slot {
+		std::atomic<unsigned long long> sequence;	// Index + 1 once written, 0 while writing
+		ProfileEvent event;
+	};
+	std::unique_ptr<Slot[]> slots;
+	size_t capacity;
+	std::atomic<unsigned long long> writeIndex;
+	std::atomic<int> threadCount;
+	std::atomic<unsigned int> frame;
+	std::chrono::steady_clock::time_point epoch;
+	bool enabled;
+
+	// GPU side, only touched on the GL thread
+	struct GpuScope {
+		const char* name;
+		double start;
+	};
+	GLuint queries[PROFILE_GPU_FRAMES][PROFILE_MAX_GPU_SCOPES];
+	GpuScope gpuScopes[PROFILE_GPU_FRAMES][PROFILE_MAX_GPU_SCOPES];
+	int gpuScopeCount[PROFILE_GPU_FRAMES];
+	int gpuScopesRead[PROFILE_GPU_FRAMES];
+	unsigned int gpuFrame[PROFILE_GPU_FRAMES];
+	bool gpuActive;
+	bool gpuInitialized;
+	int renderThread;		// Thread index of the GL thread, -1 until initializeGpu()
+	unsigned int gpuFramesDropped;
+
+	Profiler();
+
+	// Creates the GL queries on the calling (GL) thread; without it only CPU scopes
+	// are recorded
+	void initializeGpu();
+
+	// Starts a frame on the GL thread and collects GPU results that are ready
+	void beginFrame();
+
+	double now() const;
+	int threadIndex();
+	void record(const char* name, double start, double duration, int thread, int depth, unsigned int frame);
+
+	// Returns false when the GPU scope is not timed (nested, or out of queries)
+	bool beginGpu(const char* name);
+	void endGpu();
+	void collectGpuResults();
+
+	// Events of every frame still in the ring
+	void snapshot(std::vector<ProfileEvent>& events) const;
+	bool writeChromeTrace(const char* path) const;
+
+	void cleanup();
+};
+
+Profiler& SharedProfiler();
+
+// Times the enclosing block on the CPU, and on the GPU when gpu is set
+struct ProfileScope {
+	const char* name;
+	double start;
+	int depth;
+	bool gpu;
+
+	ProfileScope(const char* name, bool gpu = false);
+	~ProfileScope();
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_GPU_SCOPE(name) ProfileScope PROFILE_CONCAT(profileScope, __LINE__)(name, true)
+
+#endif
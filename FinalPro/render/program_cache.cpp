@@ -0,0 +1,330 @@
+#include "program_cache.h"
+#include "resources.h"
+#include "frame_uniforms.h"
+
+// Program binary and parallel compile enums missing from the 3.3 headers
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+namespace {
+
+typedef void (GLAD_API_PTR *GetProgramBinaryProc)(GLuint program, GLsizei bufSize, GLsizei* length,
+	GLenum* binaryFormat, void* binary);
+typedef void (GLAD_API_PTR *ProgramBinaryProc)(GLuint program, GLenum binaryFormat, const void* binary, GLsizei length);
+typedef void (GLAD_API_PTR *ProgramParameteriProc)(GLuint program, GLenum pname, GLint value);
+typedef void (GLAD_API_PTR *MaxShaderCompilerThreadsProc)(GLuint count);
+
+GetProgramBinaryProc getProgramBinary = NULL;
+ProgramBinaryProc programBinary = NULL;
+ProgramParameteriProc programParameteri = NULL;
+
+const unsigned int BINARY_FILE_MAGIC = 0x4e494250;		// "PBIN"
+const unsigned int BINARY_FILE_VERSION = 1;
+
+const GLenum stageTypes[3] = { GL_VERTEX_SHADER, GL_GEOMETRY_SHADER, GL_FRAGMENT_SHADER };
+const char* stageNames[3] = { "vertex", "geometry", "fragment" };
+
+bool hasExtension(const char* name) {
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; ++i) {
+		const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+		if (extension && strcmp(extension, name) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+std::string glString(GLenum name) {
+	const char* value = (const char*)glGetString(name);
+	return value ? value : "";
+}
+
+// Defines go on the line after #version, which has to stay first
+std::string insertDefines(const std::string& code, const std::string& defines) {
+	if (defines.empty()) {
+		return code;
+	}
+	size_t version = code.find("#version");
+	if (version == std::string::npos) {
+		return defines + code;
+	}
+	size_t lineEnd = code.find('\n', version);
+	if (lineEnd == std::string::npos) {
+		return code + "\n" + defines;
+	}
+	return code.substr(0, lineEnd + 1) + defines + code.substr(lineEnd + 1);
+}
+
+const std::string& stageCode(const ProgramSource& source, int stage) {
+	return stage == 0 ? source.vertex : (stage == 1 ? source.geometry : source.fragment);
+}
+
+template <typename T>
+void writeValue(std::ofstream& stream, const T& value) {
+	stream.write((const char*)&value, sizeof(value));
+}
+
+template <typename T>
+bool readValue(std::ifstream& stream, T& value) {
+	return (bool)stream.read((char*)&value, sizeof(value));
+}
+
+}
+
+ProgramCache::ProgramCache() : binariesSupported(false), parallelCompile(false), dirty(false) {
+	memset(&stats, 0, sizeof(stats));
+}
+
+void ProgramCache::initialize(GLADloadfunc load, const char* binary_file_path) {
+	GLint major = 0, minor = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	glGetIntegerv(GL_MINOR_VERSION, &minor);
+
+	// Compiles are handed to driver threads; completion is polled with isReady()
+	parallelCompile = false;
+	const char* threadsEntry = hasExtension("GL_KHR_parallel_shader_compile") ? "glMaxShaderCompilerThreadsKHR" :
+		(hasExtension("GL_ARB_parallel_shader_compile") ? "glMaxShaderCompilerThreadsARB" : NULL);
+	if (threadsEntry) {
+		MaxShaderCompilerThreadsProc maxShaderCompilerThreads = (MaxShaderCompilerThreadsProc)load(threadsEntry);
+		if (maxShaderCompilerThreads) {
+			maxShaderCompilerThreads(0xFFFFFFFF);
+			parallelCompile = true;
+		}
+	}
+
+	binariesSupported = false;
+	if ((major > 4 || (major == 4 && minor >= 1)) || hasExtension("GL_ARB_get_program_binary")) {
+		getProgramBinary = (GetProgramBinaryProc)load("glGetProgramBinary");
+		programBinary = (ProgramBinaryProc)load("glProgramBinary");
+		programParameteri = (ProgramParameteriProc)load("glProgramParameteri");
+		GLint formats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		binariesSupported = getProgramBinary && programBinary && programParameteri && formats > 0;
+	}
+
+	// A binary is only valid for the driver that produced it
+	driver = glString(GL_VENDOR) + "|" + glString(GL_RENDERER) + "|" + glString(GL_VERSION);
+	path = binary_file_path ? binary_file_path : "";
+	binaries.clear();
+	dirty = false;
+	if (!binariesSupported || path.empty()) {
+		return;
+	}
+
+	std::ifstream stream(path.c_str(), std::ios::in | std::ios::binary);
+	if (!stream.is_open()) {
+		return;
+	}
+	unsigned int magic = 0, version = 0, count = 0;
+	if (!readValue(stream, magic) || !readValue(stream, version) || !readValue(stream, count) ||
+		magic != BINARY_FILE_MAGIC || version != BINARY_FILE_VERSION) {
+		printf("Ignoring program binaries in %s, unknown format.\n", path.c_str());
+		return;
+	}
+	for (unsigned int i = 0; i < count; ++i) {
+		unsigned int keySize = 0, dataSize = 0;
+		GLenum format = 0;
+		if (!readValue(stream, keySize) || keySize > 256) {
+			break;
+		}
+		std::string key(keySize, '\0');
+		if (!stream.read(&key[0], keySize) || !readValue(stream, format) || !readValue(stream, dataSize)) {
+			break;
+		}
+		Binary& binary = binaries[key];
+		binary.format = format;
+		binary.data.resize(dataSize);
+		binary.used = false;
+		if (dataSize == 0 || !stream.read((char*)&binary.data[0], dataSize)) {
+			binaries.erase(key);
+			break;
+		}
+	}
+}
+
+void ProgramCache::begin(const ProgramSource& source, PendingProgram& pending) {
+	pending.source = source;
+	pending.shaderCount = 0;
+	pending.fromBinary = false;
+
+	std::string combined = driver;
+	for (int stage = 0; stage < 3; ++stage) {
+		combined += '\0';
+		combined += stageCode(source, stage);
+	}
+	combined += '\0';
+	combined += source.defines;
+	pending.key = ContentKey(combined.data(), combined.size());
+
+	pending.programID = glCreateProgram();
+	std::map<std::string, Binary>::iterator it = binaries.find(pending.key);
+	if (binariesSupported && it != binaries.end()) {
+		programBinary(pending.programID, it->second.format, &it->second.data[0], (GLsizei)it->second.data.size());
+		pending.fromBinary = true;
+		return;
+	}
+
+	// Every stage is compiled and the program linked before any status is queried,
+	// so the driver is free to overlap the work
+	for (int stage = 0; stage < 3; ++stage) {
+		const std::string& code = stageCode(source, stage);
+		if (code.empty()) {
+			continue;
+		}
+		std::string full = insertDefines(code, source.defines);
+		const char* pointer = full.c_str();
+		GLuint shaderID = glCreateShader(stageTypes[stage]);
+		glShaderSource(shaderID, 1, &pointer, NULL);
+		glCompileShader(shaderID);
+		glAttachShader(pending.programID, shaderID);
+		pending.shaderIDs[pending.shaderCount++] = shaderID;
+	}
+	if (binariesSupported) {
+		programParameteri(pending.programID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
+	glLinkProgram(pending.programID);
+}
+
+bool ProgramCache::isReady(const PendingProgram& pending) const {
+	if (!parallelCompile) {
+		return true;
+	}
+	GLint complete = GL_TRUE;
+	glGetProgramiv(pending.programID, GL_COMPLETION_STATUS_KHR, &complete);
+	return complete == GL_TRUE;
+}
+
+GLuint ProgramCache::finish(PendingProgram& pending) {
+	GLint linked = GL_FALSE;
+	glGetProgramiv(pending.programID, GL_LINK_STATUS, &linked);
+
+	if (pending.fromBinary) {
+		if (linked) {
+			binaries[pending.key].used = true;
+			stats.binaryHits++;
+			BindUniformBlocks(pending.programID);
+			return pending.programID;
+		}
+
+		// The driver changed since the binary was stored
+		glDeleteProgram(pending.programID);
+		binaries.erase(pending.key);
+		dirty = true;
+		stats.stale++;
+		ProgramSource source = pending.source;
+		begin(source, pending);
+		return finish(pending);
+	}
+
+	if (!linked) {
+		const char* name = pending.source.name.empty() ? "program" : pending.source.name.c_str();
+		int infoLogLength;
+		for (int i = 0; i < pending.shaderCount; ++i) {
+			GLint compiled = GL_FALSE;
+			glGetShaderiv(pending.shaderIDs[i], GL_COMPILE_STATUS, &compiled);
+			if (compiled) {
+				continue;
+			}
+			GLint type = 0;
+			glGetShaderiv(pending.shaderIDs[i], GL_SHADER_TYPE, &type);
+			int stage = type == GL_VERTEX_SHADER ? 0 : (type == GL_GEOMETRY_SHADER ? 1 : 2);
+			printf("Error compiling %s shader : %s\n", stageNames[stage], name);
+			glGetShaderiv(pending.shaderIDs[i], GL_INFO_LOG_LENGTH, &infoLogLength);
+			if (infoLogLength > 0) {
+				std::vector<char> message(infoLogLength + 1);
+				glGetShaderInfoLog(pending.shaderIDs[i], infoLogLength, NULL, &message[0]);
+				printf("%s\n", &message[0]);
+			}
+		}
+		printf("Error linking program : %s\n", name);
+		glGetProgramiv(pending.programID, GL_INFO_LOG_LENGTH, &infoLogLength);
+		if (infoLogLength > 0) {
+			std::vector<char> message(infoLogLength + 1);
+			glGetProgramInfoLog(pending.programID, infoLogLength, NULL, &message[0]);
+			printf("%s\n", &message[0]);
+		}
+	}
+
+	for (int i = 0; i < pending.shaderCount; ++i) {
+		glDetachShader(pending.programID, pending.shaderIDs[i]);
+		glDeleteShader(pending.shaderIDs[i]);
+	}
+	pending.shaderCount = 0;
+
+	if (!linked) {
+		glDeleteProgram(pending.programID);
+		pending.programID = 0;
+		stats.failed++;
+		return 0;
+	}
+	stats.compiled++;
+	BindUniformBlocks(pending.programID);
+
+	if (binariesSupported) {
+		GLint length = 0;
+		glGetProgramiv(pending.programID, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length > 0) {
+			Binary& binary = binaries[pending.key];
+			binary.data.resize(length);
+			binary.used = true;
+			getProgramBinary(pending.programID, length, &length, &binary.format, &binary.data[0]);
+			binary.data.resize(length);
+			dirty = true;
+		}
+	}
+	return pending.programID;
+}
+
+GLuint ProgramCache::build(const ProgramSource& source) {
+	PendingProgram pending;
+	begin(source, pending);
+	return finish(pending);
+}
+
+bool ProgramCache::save() {
+	size_t unused = 0;
+	for (std::map<std::string, Binary>::iterator it = binaries.begin(); it != binaries.end(); ++it) {
+		unused += it->second.used ? 0 : 1;
+	}
+	if (path.empty() || !binariesSupported || (!dirty && unused == 0)) {
+		return true;
+	}
+
+	std::ofstream stream(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!stream.is_open()) {
+		printf("Failed to write program binaries to %s.\n", path.c_str());
+		return false;
+	}
+	writeValue(stream, BINARY_FILE_MAGIC);
+	writeValue(stream, BINARY_FILE_VERSION);
+	writeValue(stream, (unsigned int)(binaries.size() - unused));
+	for (std::map<std::string, Binary>::iterator it = binaries.begin(); it != binaries.end(); ++it) {
+		if (!it->second.used) {
+			continue;
+		}
+		writeValue(stream, (unsigned int)it->first.size());
+		stream.write(it->first.data(), it->first.size());
+		writeValue(stream, it->second.format);
+		writeValue(stream, (unsigned int)it->second.data.size());
+		stream.write((const char*)&it->second.data[0], it->second.data.size());
+	}
+	dirty = false;
+	return (bool)stream;
+}
+
+ProgramCache& SharedProgramCache() {
+	static ProgramCache cache;
+	return cache;
+}
@@ -0,0 +1,82 @@
+#ifndef _PROGRAM_CACHE_H_
+#define _PROGRAM_CACHE_H_
+
+#include "headers.h"
+
+#include <map>
+
+// Sources of one program. geometry may be empty. defines are lines such as
+// "#define SHADOWS 1\n", inserted after the #version line of every stage. name only
+// labels error messages.
+struct ProgramSource {
+	std::string vertex;
+	std::string geometry;
+	std::string fragment;
+	std::string defines;
+	std::string name;
+};
+
+// A program between begin() and finish(): compiling, linking or loading its binary
+struct PendingProgram {
+	GLuint programID;
+	GLuint shaderIDs[3];
+	int shaderCount;
+	bool fromBinary;
+	std::string key;
+	ProgramSource source;
+};
+
+// Programs loaded from a stored driver binary versus compiled from source
+struct ProgramCacheStats {
+	unsigned int binaryHits;
+	unsigned int compiled;
+	unsigned int failed;
+	unsigned int stale;			// Binaries the driver refused, compiled again
+};
+
+// Builds shader programs, their shared uniform blocks bound (BindUniformBlocks).
+// Sources are hashed together with their defines and the driver's identity; with
+// program binaries available (GL 4.1 or GL_ARB_get_program_binary) a linked program
+// is stored under that hash and later runs load it back instead of compiling. The
+// binaries live in memory and are written to one file by save().
+//
+// begin() only issues the compiles and the link, nothing waits on the driver until
+// finish(). Starting several programs before finishing any lets the driver compile
+// them in parallel, and with GL_KHR_parallel_shader_compile isReady() tells when
+// finish() will not block. GL thread only.
+struct ProgramCache {
+	struct Binary {
+		GLenum format;
+		std::vector<unsigned char> data;
+		bool used;
+	};
+	std::map<std::string, Binary> binaries;
+	std::string path;
+	std::string driver;
+	bool binariesSupported;
+	bool parallelCompile;
+	bool dirty;
+	ProgramCacheStats stats;
+
+	ProgramCache();
+
+	// Loads the entry points with the function the context was loaded with and reads
+	// the binaries stored at path. Without it programs are always compiled.
+	void initialize(GLADloadfunc load, const char* binary_file_path);
+
+	void begin(const ProgramSource& source, PendingProgram& pending);
+	bool isReady(const PendingProgram& pending) const;
+
+	// Returns the linked program, 0 on error (logs are printed)
+	GLuint finish(PendingProgram& pending);
+
+	// begin() and finish() in one go
+	GLuint build(const ProgramSource& source);
+
+	// Writes the binaries used or created this run, dropping ones no longer needed
+	bool save();
+};
+
+ProgramCache& SharedProgramCache();
+
+#endif
@@ -0,0 +1,159 @@
+#include "render_queue.h"
+#include "profiler.h"
+
+#include <cstring>
+
+#define BUFFER_OFFSET(i) ((char *)NULL + (i))
+
+// Key layout, most significant first
+//   opaque, sky:  pass:2 blend:1 program:10 texture:12 vao:8 depth:24 (near first)
+//   transparent:  pass:2 depth:24 (far first) blend:1 program:10 texture:12 vao:8
+// GL names are truncated to their field; a collision only weakens the grouping, the
+// submitter still compares the real names.
+#define KEY_PROGRAM_BITS 10
+#define KEY_TEXTURE_BITS 12
+#define KEY_VAO_BITS 8
+#define KEY_DEPTH_BITS 24
+
+static const char* passNames[4] = { "Opaque", "Sky", "Transparent", "Unused" };
+
+RenderQueue::RenderQueue() {
+	depthRange = 1000.0f;
+	memset(&stats, 0, sizeof(stats));
+}
+
+unsigned long long RenderQueue::makeKey(int pass, bool blend, GLuint program, GLuint texture, GLuint vertexArray, float depth) const {
+	const unsigned long long depthMax = (1ULL << KEY_DEPTH_BITS) - 1;
+	float normalized = std::min(std::max(depth / depthRange, 0.0f), 1.0f);
+	unsigned long long quantized = (unsigned long long)(normalized * depthMax);
+
+	unsigned long long state = blend ? 1 : 0;
+	state = (state << KEY_PROGRAM_BITS) | (program & ((1u << KEY_PROGRAM_BITS) - 1));
+	state = (state << KEY_TEXTURE_BITS) | (texture & ((1u << KEY_TEXTURE_BITS) - 1));
+	state = (state << KEY_VAO_BITS) | (vertexArray & ((1u << KEY_VAO_BITS) - 1));
+
+	unsigned long long key = (unsigned long long)pass << 62;
+	if (pass == PASS_TRANSPARENT) {
+		key |= (depthMax - quantized) << 38;
+		key |= state << 7;
+	}
+	else {
+		key |= state << KEY_DEPTH_BITS;
+		key |= quantized;
+	}
+	return key;
+}
+
+void RenderQueue::submit(const DrawItem& item) {
+	items.push_back(item);
+}
+
+// LSD radix sort of (key, index), one byte per pass; bytes that are equal across all
+// keys are skipped, which is most of them for a typical frame
+void RenderQueue::sort() {
+	size_t count = items.size();
+	sortKeys.resize(count);
+	order.resize(count);
+	scratchKeys.resize(count);
+	scratchOrder.resize(count);
+	for (size_t i = 0; i < count; ++i) {
+		sortKeys[i] = items[i].key;
+		order[i] = (unsigned int)i;
+	}
+
+	for (int shift = 0; shift < 64; shift += 8) {
+		size_t histogram[257] = { 0 };
+		for (size_t i = 0; i < count; ++i) {
+			histogram[((sortKeys[i] >> shift) & 0xff) + 1]++;
+		}
+		if (count == 0 || histogram[((sortKeys[0] >> shift) & 0xff) + 1] == count) {
+			continue;
+		}
+		for (int b = 0; b < 256; ++b) {
+			histogram[b + 1] += histogram[b];
+		}
+		for (size_t i = 0; i < count; ++i) {
+			size_t slot = histogram[(sortKeys[i] >> shift) & 0xff]++;
+			scratchKeys[slot] = sortKeys[i];
+			scratchOrder[slot] = order[i];
+		}
+		sortKeys.swap(scratchKeys);
+		order.swap(scratchOrder);
+	}
+}
+
+void RenderQueue::flush() {
+	sort();
+	memset(&stats, 0, sizeof(stats));
+
+	GLuint boundProgram = 0, boundTexture = 0, boundVertexArray = 0;
+	bool blending = false;
+	glDisable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glActiveTexture(GL_TEXTURE0);
+
+	// Passes are contiguous after the sort; each is timed as one profiler scope
+	size_t i = 0;
+	while (i < order.size()) {
+		int pass = (int)(sortKeys[i] >> 62);
+		PROFILE_GPU_SCOPE(passNames[pass]);
+
+		for (; i < order.size() && (int)(sortKeys[i] >> 62) == pass; ++i) {
+			const DrawItem& item = items[order[i]];
+
+			if (item.blend != blending) {
+				if (item.blend) {
+					glEnable(GL_BLEND);
+				}
+				else {
+					glDisable(GL_BLEND);
+				}
+				blending = item.blend;
+				stats.blendChanges++;
+			}
+			if (item.program != boundProgram) {
+				glUseProgram(item.program);
+				boundProgram = item.program;
+				stats.programChanges++;
+			}
+			if (item.texture != boundTexture) {
+				glBindTexture(GL_TEXTURE_2D, item.texture);
+				boundTexture = item.texture;
+				stats.textureChanges++;
+			}
+			if (item.vertexArray != boundVertexArray) {
+				glBindVertexArray(item.vertexArray);
+				boundVertexArray = item.vertexArray;
+				stats.vertexArrayChanges++;
+			}
+
+			if (item.apply) {
+				item.apply(item);
+			}
+			if (item.draw) {
+				item.draw(item);
+			}
+			else {
+				size_t indexSize = item.indexType == GL_UNSIGNED_SHORT ? sizeof(unsigned short) : sizeof(unsigned int);
+				glDrawElementsInstancedBaseVertex(GL_TRIANGLES, item.indexCount, item.indexType,
+					BUFFER_OFFSET(item.firstIndex * indexSize), item.instanceCount, item.baseVertex);
+			}
+			stats.draws++;
+		}
+	}
+
+	unsigned int changes = stats.programChanges + stats.textureChanges + stats.vertexArrayChanges + stats.blendChanges;
+	stats.avoidedChanges = stats.draws * 4 - changes;
+
+	// Reset state
+	glDisable(GL_BLEND);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindVertexArray(0);
+	glUseProgram(0);
+
+	clear();
+}
+
+void RenderQueue::clear() {
+	items.clear();
+}
@@ -0,0 +1,72 @@
+#ifndef _RENDER_QUEUE_H_
+#define _RENDER_QUEUE_H_
+
+#include "headers.h"
+
+// Passes in submission order: opaque geometry front to back, then the sky, then
+// transparent geometry back to front
+enum RenderPass {
+	PASS_OPAQUE = 0,
+	PASS_SKY = 1,
+	PASS_TRANSPARENT = 2
+};
+
+// One indexed draw (GL_TRIANGLES) and the state it needs
+struct DrawItem {
+	unsigned long long key;
+	GLuint program;
+	GLuint texture;			// Bound to unit 0, may be 0
+	GLuint vertexArray;
+	bool blend;
+	GLsizei indexCount;
+	GLuint firstIndex;		// In indices of indexType
+	GLenum indexType;		// GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+	GLint baseVertex;
+	GLsizei instanceCount;
+
+	// Per-draw uniforms and attributes; called once program, texture and VAO are bound
+	void (*apply)(const DrawItem& item);
+
+	// Issues the draw instead of the indexed draw above when set (indirect draws)
+	void (*draw)(const DrawItem& item);
+	const void* owner;
+	int userData[2];
+};
+
+// What the last flush() did, and the binds it skipped compared to binding program,
+// texture, VAO and blend state for every draw
+struct RenderQueueStats {
+	unsigned int draws;
+	unsigned int programChanges;
+	unsigned int textureChanges;
+	unsigned int vertexArrayChanges;
+	unsigned int blendChanges;
+	unsigned int avoidedChanges;
+};
+
+// Frame-level list of draws. Items are radix-sorted on a 64-bit key (pass, blend,
+// program, texture, VAO, depth; depth first for the transparent pass) and submitted
+// in that order, touching GL state only when it differs from what is bound.
+struct RenderQueue {
+	std::vector<DrawItem> items;
+	std::vector<unsigned long long> sortKeys, scratchKeys;
+	std::vector<unsigned int> order, scratchOrder;
+
+	// View depth mapped to the full depth field of the key, normally the far plane
+	float depthRange;
+	RenderQueueStats stats;
+
+	RenderQueue();
+
+	// depth is the view-space distance of the item, used for ordering within a pass
+	unsigned long long makeKey(int pass, bool blend, GLuint program, GLuint texture, GLuint vertexArray, float depth) const;
+
+	void submit(const DrawItem& item);
+	void sort();
+
+	// Sorts, draws and empties the queue, leaving program, VAO, texture and blend unbound
+	void flush();
+	void clear();
+};
+
+#endif
@@ -0,0 +1,155 @@
+#include "resources.h"
+#include "texture.h"
+#include "texture_streaming.h"
+#include "shader.h"
+
+namespace {
+
+ResourceCache<GLuint> textureCache;
+ResourceCache<GLuint> shaderCache;
+
+// Handles back to their keys, so callers only need to keep the GL name
+std::map<GLuint, std::string> textureKeys;
+std::map<GLuint, std::string> shaderKeys;
+
+}
+
+std::string CanonicalPath(const std::string& path) {
+	std::string unified(path);
+	std::replace(unified.begin(), unified.end(), '\\', '/');
+	bool absolute = !unified.empty() && unified[0] == '/';
+
+	std::vector<std::string> segments;
+	std::stringstream stream(unified);
+	std::string segment;
+	while (std::getline(stream, segment, '/')) {
+		if (segment.empty() || segment == ".") {
+			continue;
+		}
+		if (segment == ".." && !segments.empty() && segments.back() != "..") {
+			segments.pop_back();
+			continue;
+		}
+		segments.push_back(segment);
+	}
+
+	std::string canonical = absolute ? "/" : "";
+	for (size_t i = 0; i < segments.size(); ++i) {
+		if (i > 0) {
+			canonical += '/';
+		}
+		canonical += segments[i];
+	}
+	return canonical;
+}
+
+std::string ContentKey(const void* data, size_t size) {
+	const unsigned char* bytes = (const unsigned char*)data;
+	unsigned long long hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < size; ++i) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ULL;
+	}
+	std::stringstream key;
+	key << "#" << std::hex << std::setw(16) << std::setfill('0') << hash << "-" << std::dec << size;
+	return key.str();
+}
+
+std::string TextureKey(const char* texture_file_path, bool srgb) {
+	return CanonicalPath(texture_file_path) + (srgb ? "" : "#linear");
+}
+
+GLuint AcquireTexture(const char* texture_file_path, bool srgb) {
+	std::string key = TextureKey(texture_file_path, srgb);
+	GLuint texture;
+	if (!AcquireCachedTexture(key, texture)) {
+		texture = LoadTexture(texture_file_path, srgb);
+		InsertCachedTexture(key, texture);
+	}
+	return texture;
+}
+
+bool AcquireCachedTexture(const std::string& key, GLuint& texture) {
+	return textureCache.acquire(key, texture);
+}
+
+void InsertCachedTexture(const std::string& key, GLuint texture) {
+	textureCache.insert(key, texture);
+	textureKeys[texture] = key;
+}
+
+// Textures the cache does not know about are owned by the caller and deleted directly
+void ReleaseTexture(GLuint texture) {
+	std::map<GLuint, std::string>::iterator it = textureKeys.find(texture);
+	if (it != textureKeys.end()) {
+		GLuint released;
+		if (!textureCache.release(it->second, released)) {
+			return;
+		}
+		textureKeys.erase(it);
+	}
+	SharedTextureStreamer().remove(texture);
+	glDeleteTextures(1, &texture);
+}
+
+std::string ShaderKey(const char* vertex_file_path, const char* fragment_file_path) {
+	return CanonicalPath(vertex_file_path) + "|" + CanonicalPath(fragment_file_path);
+}
+
+GLuint AcquireShaders(const char* vertex_file_path, const char* fragment_file_path) {
+	std::string key = ShaderKey(vertex_file_path, fragment_file_path);
+	GLuint programID;
+	if (!AcquireCachedShaders(key, programID)) {
+		programID = LoadShadersFromFile(vertex_file_path, fragment_file_path);
+		// Failed compiles are not cached so a fixed shader is picked up next time
+		if (programID != 0) {
+			InsertCachedShaders(key, programID);
+		}
+	}
+	return programID;
+}
+
+bool AcquireCachedShaders(const std::string& key, GLuint& programID) {
+	return shaderCache.acquire(key, programID);
+}
+
+// Two asynchronous loads of the same program can both miss; the one finishing
+// second throws its program away and shares the first
+GLuint InsertCachedShaders(const std::string& key, GLuint programID) {
+	GLuint live;
+	if (shaderCache.share(key, live)) {
+		glDeleteProgram(programID);
+		return live;
+	}
+	shaderCache.insert(key, programID);
+	shaderKeys[programID] = key;
+	return programID;
+}
+
+void ReleaseShaders(GLuint programID) {
+	if (programID == 0) {
+		return;
+	}
+	std::map<GLuint, std::string>::iterator it = shaderKeys.find(programID);
+	if (it != shaderKeys.end()) {
+		GLuint released;
+		if (!shaderCache.release(it->second, released)) {
+			return;
+		}
+		shaderKeys.erase(it);
+	}
+	glDeleteProgram(programID);
+}
+
+ResourceStats GetTextureStats() {
+	return textureCache.stats();
+}
+
+ResourceStats GetShaderStats() {
+	return shaderCache.stats();
+}
+
+void PrintResourceStats(const char* label, const ResourceStats& stats) {
+	std::cout << label << ": " << stats.hits << " hits, " << stats.misses << " misses, "
+		<< stats.live << " live" << std::endl;
+}
@@ -0,0 +1,101 @@
+#ifndef _RESOURCES_H_
+#define _RESOURCES_H_
+
+#include "headers.h"
+
+#include <map>
+
+// Lookups served from a live resource versus ones that had to load it
+struct ResourceStats {
+	unsigned int hits;
+	unsigned int misses;
+	unsigned int live;
+};
+
+// Reference-counted values keyed by string. acquire() on a live key shares the value
+// and counts a hit; on a miss the caller loads the value and insert()s it. release()
+// returns true once the last reference is gone and the value should be freed.
+template <typename T>
+struct ResourceCache {
+	struct Entry {
+		T value;
+		int references;
+	};
+	std::map<std::string, Entry> entries;
+	unsigned int hits;
+	unsigned int misses;
+
+	ResourceCache() : hits(0), misses(0) {}
+
+	bool acquire(const std::string& key, T& value) {
+		if (share(key, value)) {
+			hits++;
+			return true;
+		}
+		misses++;
+		return false;
+	}
+
+	// Like acquire() without touching the counters
+	bool share(const std::string& key, T& value) {
+		typename std::map<std::string, Entry>::iterator it = entries.find(key);
+		if (it == entries.end()) {
+			return false;
+		}
+		it->second.references++;
+		value = it->second.value;
+		return true;
+	}
+
+	void insert(const std::string& key, const T& value) {
+		Entry& entry = entries[key];
+		entry.value = value;
+		entry.references = 1;
+	}
+
+	bool release(const std::string& key, T& value) {
+		typename std::map<std::string, Entry>::iterator it = entries.find(key);
+		if (it == entries.end() || --it->second.references > 0) {
+			return false;
+		}
+		value = it->second.value;
+		entries.erase(it);
+		return true;
+	}
+
+	ResourceStats stats() const {
+		ResourceStats result;
+		result.hits = hits;
+		result.misses = misses;
+		result.live = (unsigned int)entries.size();
+		return result;
+	}
+};
+
+// Key for a file: separators unified, "." and "dir/.." segments folded away
+std::string CanonicalPath(const std::string& path);
+
+// Key for in-memory data such as embedded glTF images (64-bit FNV-1a)
+std::string ContentKey(const void* data, size_t size);
+
+// Shared textures and shader programs. Every acquire must be paired with a release;
+// GL objects are deleted when their last reference drops. GL thread only.
+GLuint AcquireTexture(const char* texture_file_path, bool srgb = true);
+
+// Cache key of an image file loaded as colour (srgb) or as data
+std::string TextureKey(const char* texture_file_path, bool srgb);
+bool AcquireCachedTexture(const std::string& key, GLuint& texture);
+void InsertCachedTexture(const std::string& key, GLuint texture);
+void ReleaseTexture(GLuint texture);
+
+GLuint AcquireShaders(const char* vertex_file_path, const char* fragment_file_path);
+std::string ShaderKey(const char* vertex_file_path, const char* fragment_file_path);
+bool AcquireCachedShaders(const std::string& key, GLuint& programID);
+GLuint InsertCachedShaders(const std::string& key, GLuint programID);
+void ReleaseShaders(GLuint programID);
+
+ResourceStats GetTextureStats();
+ResourceStats GetShaderStats();
+void PrintResourceStats(const char* label, const ResourceStats& stats);
+
+#endif
@@ -0,0 +1,197 @@
+#include "scatter.h"
+
+#include <cfloat>
+#include <atomic>
+#include <thread>
+
+void DefaultScatterSpecies(ScatterSpecies& species) {
+	species.spacing = 10.0f;
+	species.density = 1.0f;
+	species.maxSlope = FLT_MAX;
+	species.minHeight = -FLT_MAX;
+	species.maxHeight = FLT_MAX;
+	species.minScale = 1.0f;
+	species.maxScale = 1.0f;
+	species.seed = 1;
+}
+
+namespace {
+
+unsigned int mixBits(unsigned int h) {
+	h ^= h >> 16;
+	h *= 0x7feb352du;
+	h ^= h >> 15;
+	h *= 0x846ca68bu;
+	h ^= h >> 16;
+	return h;
+}
+
+// Seed of a grid cell, and the independent draws made from it
+unsigned int cellHash(int x, int z, unsigned int seed) {
+	return mixBits((unsigned int)x * 0x8da6b343u ^ (unsigned int)z * 0xd8163841u ^ seed);
+}
+
+float cellRandom(unsigned int hash, unsigned int draw) {
+	return (mixBits(hash + draw * 0x9e3779b9u) >> 8) * (1.0f / 16777216.0f);
+}
+
+struct Candidate {
+	float x, z;
+	unsigned int priority;
+};
+
+// Equal priorities only happen by chance and then remove both candidates, which
+// keeps the decision the same from either side
+int covers(const Candidate& other, const Candidate& candidate, float spacing2) {
+	float dx = other.x - candidate.x, dz = other.z - candidate.z;
+	return (other.priority >= candidate.priority) & (dx * dx + dz * dz < spacing2);
+}
+
+// window is scratch space kept between the cells a thread generates
+int scatterCell(const ScatterRegion& region, const ScatterSpecies& species, int cellX, int cellZ,
+	std::vector<Candidate>& window, std::vector<glm::mat4>& transforms) {
+	float x0 = std::max(cellX * region.cellSize, region.min.x), x1 = std::min((cellX + 1) * region.cellSize, region.max.x);
+	float z0 = std::max(cellZ * region.cellSize, region.min.y), z1 = std::min((cellZ + 1) * region.cellSize, region.max.y);
+	if (x0 >= x1 || z0 >= z1 || species.spacing <= 0.0f) {
+		return 0;
+	}
+
+	// Grid cells whose candidate may fall in this cell, and two more on every side:
+	// at spacing / sqrt(2) per grid cell, any candidate within spacing is among those
+	float grid = species.spacing / sqrtf(2.0f);
+	int gx0 = (int)floorf(x0 / grid), gx1 = (int)floorf(x1 / grid);
+	int gz0 = (int)floorf(z0 / grid), gz1 = (int)floorf(z1 / grid);
+	int width = gx1 - gx0 + 5, depth = gz1 - gz0 + 5;
+	window.resize((size_t)width * depth);
+	unsigned int seed = mixBits(species.seed);
+	for (int j = 0; j < depth; ++j) {
+		for (int i = 0; i < width; ++i) {
+			int gx = gx0 - 2 + i, gz = gz0 - 2 + j;
+			unsigned int hash = cellHash(gx, gz, seed);
+			Candidate& candidate = window[j * width + i];
+			candidate.x = (gx + cellRandom(hash, 0)) * grid;
+			candidate.z = (gz + cellRandom(hash, 1)) * grid;
+			candidate.priority = hash;
+		}
+	}
+
+	// The eight closest grid cells first, they settle most candidates
+	int neighbours[20], neighbourCount = 0;
+	for (int ring = 1; ring <= 2; ++ring) {
+		for (int dz = -ring; dz <= ring; ++dz) {
+			for (int dx = -ring; dx <= ring; ++dx) {
+				if (std::max(abs(dx), abs(dz)) == ring && !(abs(dx) == 2 && abs(dz) == 2)) {
+					neighbours[neighbourCount++] = dz * width + dx;
+				}
+			}
+		}
+	}
+
+	float spacing2 = species.spacing * species.spacing;
+	float slopeStep = 0.25f * species.spacing;
+	int added = 0;
+	for (int j = 2; j < depth - 2; ++j) {
+		for (int i = 2; i < width - 2; ++i) {
+			const Candidate& candidate = window[j * width + i];
+			if (candidate.x < x0 || candidate.x >= x1 || candidate.z < z0 || candidate.z >= z1) {
+				continue;
+			}
+
+			// Two grid cells apart on both axes is already spacing away. The tests are
+			// branchless as each outcome is a coin flip, and the outer ring is only
+			// looked at when the inner one left the candidate standing.
+			const Candidate* around = &window[j * width + i];
+			int covered = 0;
+			for (int n = 0; n < 8; ++n) {
+				covered |= covers(around[neighbours[n]], candidate, spacing2);
+			}
+			for (int n = 8; n < 20 && !covered; ++n) {
+				covered |= covers(around[neighbours[n]], candidate, spacing2);
+			}
+			if (covered) {
+				continue;
+			}
+
+			// Masks, cheapest first
+			float y = region.height(candidate.x, candidate.z);
+			if (y < species.minHeight || y > species.maxHeight) {
+				continue;
+			}
+			float keep = species.density;
+			if (region.density) {
+				keep *= glm::clamp(region.density(candidate.x, candidate.z), 0.0f, 1.0f);
+			}
+			unsigned int hash = candidate.priority;
+			if (cellRandom(hash, 2) >= keep) {
+				continue;
+			}
+			if (species.maxSlope < FLT_MAX) {
+				float sx = region.height(candidate.x + slopeStep, candidate.z) - y;
+				float sz = region.height(candidate.x, candidate.z + slopeStep) - y;
+				if (sx * sx + sz * sz > species.maxSlope * species.maxSlope * slopeStep * slopeStep) {
+					continue;
+				}
+			}
+
+			float angle = cellRandom(hash, 3) * 2.0f * (float)M_PI;
+			float scale = species.minScale + (species.maxScale - species.minScale) * cellRandom(hash, 4);
+			float c = cosf(angle) * scale, s = sinf(angle) * scale;
+			transforms.push_back(glm::mat4(
+				c, 0.0f, -s, 0.0f,
+				0.0f, scale, 0.0f, 0.0f,
+				s, 0.0f, c, 0.0f,
+				candidate.x, y, candidate.z, 1.0f));
+			added++;
+		}
+	}
+	return added;
+}
+
+}
+
+int ScatterCell(const ScatterRegion& region, const ScatterSpecies& species, int cellX, int cellZ, std::vector<glm::mat4>& transforms) {
+	std::vector<Candidate> window;
+	return scatterCell(region, species, cellX, cellZ, window, transforms);
+}
+
+void Scatter(const ScatterRegion& region, const ScatterSpecies& species, std::vector<glm::mat4>& transforms, int threadCount) {
+	if (region.cellSize <= 0.0f || region.min.x >= region.max.x || region.min.y >= region.max.y) {
+		return;
+	}
+	int cellX0 = (int)floorf(region.min.x / region.cellSize), cellX1 = (int)ceilf(region.max.x / region.cellSize);
+	int cellZ0 = (int)floorf(region.min.y / region.cellSize), cellZ1 = (int)ceilf(region.max.y / region.cellSize);
+	int columns = cellX1 - cellX0;
+	int cellCount = columns * (cellZ1 - cellZ0);
+
+	// Cells on flat ground hold more than cells the masks clear, so threads take the
+	// next cell as they go rather than fixed ranges
+	std::vector<std::vector<glm::mat4> > cells(cellCount);
+	std::atomic<int> next(0);
+	std::function<void()> worker = [&]() {
+		std::vector<Candidate> window;
+		for (int c = next++; c < cellCount; c = next++) {
+			scatterCell(region, species, cellX0 + c % columns, cellZ0 + c / columns, window, cells[c]);
+		}
+	};
+	if (threadCount <= 0) {
+		threadCount = std::max(1, (int)std::thread::hardware_concurrency());
+	}
+	threadCount = std::min(threadCount, cellCount);
+	std::vector<std::thread> threads;
+	for (int t = 1; t < threadCount; ++t) {
+		threads.push_back(std::thread(worker));
+	}
+	worker();
+	for (size_t t = 0; t < threads.size(); ++t) {
+		threads[t].join();
+	}
+
+	size_t total = transforms.size();
+	for (int c = 0; c < cellCount; ++c) {
+		total += cells[c].size();
+	}
+	transforms.reserve(total);
+	for (int c = 0; c < cellCount; ++c) {
+		transforms.insert(transforms.end(), cells[c].begin(), cells[c].end());
+	}
+}
@@ -0,0 +1,46 @@
+#ifndef _SCATTER_H_
+#define _SCATTER_H_
+
+#include "headers.h"
+
+#include <functional>
+
+// Procedural placement of instanced plants over the ground. Points come from a
+// hard-core process on a uniform hash grid: every grid cell, spacing / sqrt(2) wide,
+// holds one jittered candidate with a random priority, and a candidate survives when
+// no candidate within spacing has a higher priority. Each decision only looks at the
+// grid cells around it, so any area can be generated on its own, on any thread, and
+// comes out the same every time; the result is blue noise with no two points closer
+// than spacing. The masks then thin the surviving points.
+
+// One kind of plant, and so one instanced model
+struct ScatterSpecies {
+	float spacing;				// Smallest distance between two instances
+	float density;				// Fraction of the blue-noise points kept where the mask is 1
+	float maxSlope;				// Steepest ground an instance stands on, as rise over run
+	float minHeight, maxHeight;	// Ground height band
+	float minScale, maxScale;	// Uniform scale, picked per instance
+	unsigned int seed;
+};
+
+void DefaultScatterSpecies(ScatterSpecies& species);
+
+// Area to cover and the ground under it. The area is generated in square cells of
+// cellSize aligned to the world origin; cell (x, z) covers [x, x + 1) * cellSize.
+struct ScatterRegion {
+	glm::vec2 min, max;			// World x, z bounds
+	float cellSize;
+	std::function<float(float, float)> height;		// Ground height at x, z
+	std::function<float(float, float)> density;		// Optional mask in [0, 1] at x, z
+};
+
+// Instances of one cell, appended to transforms as translate * rotate about y * scale,
+// ready for Model::setInstances(). Returns how many were added. CPU-only and safe to
+// call from any thread as long as the region's functions are.
+int ScatterCell(const ScatterRegion& region, const ScatterSpecies& species, int cellX, int cellZ, std::vector<glm::mat4>& transforms);
+
+// Every cell of the region, generated in parallel and appended in cell order, so the
+// result does not depend on threadCount. threadCount 0 uses every core.
+void Scatter(const ScatterRegion& region, const ScatterSpecies& species, std::vector<glm::mat4>& transforms, int threadCount = 0);
+
+#endif
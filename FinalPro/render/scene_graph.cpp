@@ -0,0 +1,137 @@
+#include "scene_graph.h"
+
+#if GLM_ARCH & GLM_ARCH_SSE2
+#include <glm/gtx/simd_mat4.hpp>
+#endif
+
+glm::mat4 ComposeTransform(const glm::vec3& translation, const glm::quat& rotation, const glm::vec3& scale) {
+	glm::mat4 matrix = glm::mat4_cast(rotation);
+	matrix[0] *= scale.x;
+	matrix[1] *= scale.y;
+	matrix[2] *= scale.z;
+	matrix[3] = glm::vec4(translation, 1.0f);
+	return matrix;
+}
+
+namespace {
+
+// The one product per recomputed node, through SSE when the compiler targets it
+glm::mat4 multiplyWorld(const glm::mat4& parent, const glm::mat4& local) {
+#if GLM_ARCH & GLM_ARCH_SSE2
+	return glm::mat4_cast(glm::simdMat4(parent) * glm::simdMat4(local));
+#else
+	return parent * local;
+#endif
+}
+
+}
+
+SceneGraph::SceneGraph() : firstDirty(0), version(0) {
+}
+
+SceneNode SceneGraph::create(SceneNode parent) {
+	SceneNode node;
+	if (!freeHandles.empty()) {
+		node = freeHandles.back();
+		freeHandles.pop_back();
+	}
+	else {
+		node = (SceneNode)indices.size();
+		indices.push_back(-1);
+	}
+
+	// The parent already has a slot, so appending keeps the arrays parent-sorted
+	int index = (int)handles.size();
+	indices[node] = index;
+	handles.push_back(node);
+	parents.push_back(parent == NO_SCENE_NODE ? -1 : indices[parent]);
+	translations.push_back(glm::vec3(0.0f));
+	rotations.push_back(glm::quat(1.0f, 0.0f, 0.0f, 0.0f));
+	scales.push_back(glm::vec3(1.0f));
+	worldMatrices.push_back(glm::mat4(1.0f));
+	dirty.push_back(1);
+	worldVersions.push_back(0);
+	firstDirty = std::min(firstDirty, (size_t)index);
+	return node;
+}
+
+void SceneGraph::destroy(SceneNode node) {
+	// Descendants come after the node; one of them is removed when its parent is
+	size_t first = indices[node];
+	std::vector<unsigned char> removed(handles.size() - first, 0);
+	std::vector<int> remap(handles.size(), -1);
+	for (size_t i = 0; i < first; ++i) {
+		remap[i] = (int)i;
+	}
+	removed[0] = 1;
+
+	size_t kept = first;
+	for (size_t i = first; i < handles.size(); ++i) {
+		if (i > first && parents[i] >= (int)first && removed[parents[i] - first]) {
+			removed[i - first] = 1;
+		}
+		if (removed[i - first]) {
+			indices[handles[i]] = -1;
+			freeHandles.push_back(handles[i]);
+			continue;
+		}
+
+		// Compact in place, keeping the order and so the parent-sorting
+		remap[i] = (int)kept;
+		parents[kept] = parents[i] < 0 ? -1 : remap[parents[i]];
+		translations[kept] = translations[i];
+		rotations[kept] = rotations[i];
+		scales[kept] = scales[i];
+		worldMatrices[kept] = worldMatrices[i];
+		dirty[kept] = dirty[i];
+		worldVersions[kept] = worldVersions[i];
+		handles[kept] = handles[i];
+		indices[handles[kept]] = (int)kept;
+		kept++;
+	}
+
+	parents.resize(kept);
+	translations.resize(kept);
+	rotations.resize(kept);
+	scales.resize(kept);
+	worldMatrices.resize(kept);
+	dirty.resize(kept);
+	worldVersions.resize(kept);
+	handles.resize(kept);
+	firstDirty = std::min(firstDirty, first);
+}
+
+void SceneGraph::setLocal(SceneNode node, const glm::vec3& translation, const glm::quat& rotation, const glm::vec3& scale) {
+	int index = indices[node];
+	translations[index] = translation;
+	rotations[index] = rotation;
+	scales[index] = scale;
+	dirty[index] = 1;
+	firstDirty = std::min(firstDirty, (size_t)index);
+}
+
+void SceneGraph::update() {
+	if (firstDirty >= handles.size()) {
+		return;
+	}
+	version++;
+
+	for (size_t i = firstDirty; i < handles.size(); ++i) {
+		int parent = parents[i];
+		bool parentMoved = parent >= 0 && worldVersions[parent] == version;
+		if (!dirty[i] && !parentMoved) {
+			continue;
+		}
+
+		glm::mat4 local = ComposeTransform(translations[i], rotations[i], scales[i]);
+		worldMatrices[i] = parent >= 0 ? multiplyWorld(worldMatrices[parent], local) : local;
+		worldVersions[i] = version;
+		dirty[i] = 0;
+	}
+	firstDirty = handles.size();
+}
+
+SceneGraph& SharedSceneGraph() {
+	static SceneGraph graph;
+	return graph;
+}
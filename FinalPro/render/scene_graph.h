@@ -0,0 +1,63 @@
+#ifndef _SCENE_GRAPH_H_
+#define _SCENE_GRAPH_H_
+
+#include "headers.h"
+
+#include <glm/gtc/quaternion.hpp>
+
+// translate * rotate * scale, without going through three matrix products
+glm::mat4 ComposeTransform(const glm::vec3& translation, const glm::quat& rotation, const glm::vec3& scale);
+
+// Handle of a scene graph node. It stays valid until the node is destroyed, unlike
+// the node's position in the arrays, which moves as other nodes go away.
+typedef unsigned int SceneNode;
+#define NO_SCENE_NODE 0xffffffffu
+
+// Transform hierarchy stored as parallel arrays sorted so that every parent comes
+// before its children. update() then recomputes world matrices in one pass from the
+// first dirty node on: a node is recomputed when its own transform was set or its
+// parent's world matrix changed in the same pass, so only dirty subtrees are touched
+// and a frame where nothing moved costs a single flag test.
+struct SceneGraph {
+	std::vector<int> parents;					// Array index of the parent, -1 for roots
+	std::vector<glm::vec3> translations;
+	std::vector<glm::quat> rotations;
+	std::vector<glm::vec3> scales;
+	std::vector<glm::mat4> worldMatrices;
+	std::vector<unsigned char> dirty;			// Local transform set since the last update()
+	std::vector<unsigned int> worldVersions;	// version at which the world matrix last changed
+
+	// Handle <-> array index
+	std::vector<SceneNode> handles;
+	std::vector<int> indices;					// -1 for free handles
+	std::vector<SceneNode> freeHandles;
+
+	size_t firstDirty;							// Nodes before it are up to date
+	unsigned int version;						// Bumped by every update() that had work to do
+
+	SceneGraph();
+
+	// New node with an identity transform, appended after everything already in the
+	// graph and so after its parent. Pass NO_SCENE_NODE for a root.
+	SceneNode create(SceneNode parent);
+
+	// Removes the node and its whole subtree
+	void destroy(SceneNode node);
+
+	void setLocal(SceneNode node, const glm::vec3& translation, const glm::quat& rotation, const glm::vec3& scale);
+
+	// Valid after update()
+	const glm::mat4& world(SceneNode node) const { return worldMatrices[indices[node]]; }
+
+	// Whether the node's world matrix changed in an update() after the given version
+	bool movedSince(SceneNode node, unsigned int seenVersion) const { return worldVersions[indices[node]] > seenVersion; }
+
+	void update();
+
+	size_t size() const { return handles.size(); }
+};
+
+// The graph every Model places its nodes in
+SceneGraph& SharedSceneGraph();
+
+#endif
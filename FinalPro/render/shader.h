@@ -3,9 +3,13 @@
 
 #include "headers.h"
 
-GLuint LoadShadersFromFile(const char *vertex_file_path, const char *fragment_file_path);
+// Both go through SharedProgramCache(), so a program whose binary is stored is not
+// compiled again. geometry_file_path may be NULL, GeometryShaderCode empty.
+GLuint LoadShadersFromFile(const char *vertex_file_path, const char *fragment_file_path, const char *geometry_file_path = NULL);
 
 GLuint LoadShadersFromString(std::string VertexShaderCode, std::string FragmentShaderCode, std::string GeometryShaderCode = "");
 
-#endif
+// Reads a whole shader file, false if it cannot be opened
+bool ReadShaderFile(const char *file_path, std::string &code);
 
+#endif
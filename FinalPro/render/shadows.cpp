@@ -0,0 +1,143 @@
+#include "shadows.h"
+
+void ShadowCascades::initialize(int cascadeCount, int resolution) {
+	this->cascadeCount = std::min(std::max(cascadeCount, 1), MAX_SHADOW_CASCADES);
+	this->resolution = resolution;
+	shadowDistance = 300.0f;
+	splitLambda = 0.75f;
+	cacheStep = 0.125f;
+	casterDistance = 200.0f;
+	cascadesRendered = 0;
+	cascadesCached = 0;
+	for (int i = 0; i < MAX_SHADOW_CASCADES; ++i) {
+		cascades[i].rendered = false;
+		cascades[i].needsRender = true;
+		cascades[i].renderedVersion = 0;
+	}
+
+	glGenTextures(1, &depthTexture);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, depthTexture);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, resolution, resolution, this->cascadeCount, 0,
+		GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	// Hardware depth comparison; with linear filtering every lookup is a 2x2 PCF
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	glGenFramebuffers(1, &framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTexture, 0, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		std::cout << "Shadow framebuffer is incomplete" << std::endl;
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void ShadowCascades::update(const glm::mat4& viewMatrix, float fovY, float aspect, float zNear,
+	const glm::vec3& lightDirection, unsigned int casterVersion) {
+	this->lightDirection = glm::normalize(lightDirection);
+
+	glm::mat4 cameraToWorld = glm::inverse(viewMatrix);
+	cameraPosition = glm::vec3(cameraToWorld[3]);
+	cameraForward = -glm::vec3(cameraToWorld[2]);
+
+	// Rotation-only light view; cascades are placed by their ortho window
+	glm::vec3 up = fabsf(this->lightDirection.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+	glm::mat4 lightView = glm::lookAt(glm::vec3(0.0f), this->lightDirection, up);
+
+	float tanHalfY = tanf(fovY * 0.5f);
+	float tanHalfX = tanHalfY * aspect;
+	float splitNear = zNear;
+
+	for (int i = 0; i < cascadeCount; ++i) {
+		ShadowCascade& cascade = cascades[i];
+
+		// Practical split scheme, a blend of logarithmic and uniform
+		float t = (float)(i + 1) / cascadeCount;
+		float logSplit = zNear * powf(shadowDistance / zNear, t);
+		float uniformSplit = zNear + (shadowDistance - zNear) * t;
+		cascade.splitFar = splitLambda * logSplit + (1.0f - splitLambda) * uniformSplit;
+
+		// The slice's bounding sphere only depends on the lens, so its size (and the
+		// texel size) stays constant as the camera turns
+		float centerDepth = (splitNear + cascade.splitFar) * 0.5f;
+		glm::vec3 farCorner(tanHalfX * cascade.splitFar, tanHalfY * cascade.splitFar, -cascade.splitFar);
+		glm::vec3 nearCorner(tanHalfX * splitNear, tanHalfY * splitNear, -splitNear);
+		glm::vec3 center(0.0f, 0.0f, -centerDepth);
+		float radius = std::max(glm::length(farCorner - center), glm::length(nearCorner - center));
+		radius = ceilf(radius * 16.0f) / 16.0f;
+		cascade.radius = radius;
+
+		// Window step: whole texels for the first cascade, coarser for the cached ones
+		float texel = 2.0f * radius / resolution;
+		float step = i == 0 ? texel : std::max(texel, ceilf(radius * cacheStep / texel) * texel);
+		float extent = i == 0 ? radius : radius + step;
+
+		glm::vec3 lightCenter = glm::vec3(lightView * (cameraToWorld * glm::vec4(center, 1.0f)));
+		lightCenter = glm::floor(lightCenter / step + 0.5f) * step;
+
+		glm::mat4 lightProjection = glm::ortho(lightCenter.x - extent, lightCenter.x + extent,
+			lightCenter.y - extent, lightCenter.y + extent,
+			-lightCenter.z - extent - casterDistance, -lightCenter.z + extent);
+		cascade.lightSpaceMatrix = lightProjection * lightView;
+
+		cascade.needsRender = !cascade.rendered || cascade.renderedVersion != casterVersion ||
+			cascade.renderedMatrix != cascade.lightSpaceMatrix;
+		if (cascade.needsRender) {
+			cascade.rendered = true;
+			cascade.renderedVersion = casterVersion;
+			cascade.renderedMatrix = cascade.lightSpaceMatrix;
+			cascadesRendered++;
+		}
+		else {
+			cascadesCached++;
+		}
+
+		splitNear = cascade.splitFar;
+	}
+}
+
+void ShadowCascades::beginCascade(int cascade) {
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTexture, 0, cascade);
+	glViewport(0, 0, resolution, resolution);
+	glClear(GL_DEPTH_BUFFER_BIT);
+
+	// Slope-scaled bias against acne, applied while rendering rather than sampling
+	glEnable(GL_POLYGON_OFFSET_FILL);
+	glPolygonOffset(2.0f, 4.0f);
+}
+
+void ShadowCascades::end(GLuint targetFramebuffer, int viewportWidth, int viewportHeight) {
+	glDisable(GL_POLYGON_OFFSET_FILL);
+	glBindFramebuffer(GL_FRAMEBUFFER, targetFramebuffer);
+	glViewport(0, 0, viewportWidth, viewportHeight);
+}
+
+void ShadowCascades::apply(int textureUnit) const {
+	// Cascades are selected in the shader by view depth along the Camera block's
+	// forward axis, the same one the splits were computed with
+	ShadowBlock block = ShadowBlock();
+	for (int i = 0; i < cascadeCount; ++i) {
+		block.lightSpaceMatrices[i] = cascades[i].lightSpaceMatrix;
+		block.cascadeSplits[i] = cascades[i].splitFar;
+	}
+	block.cascadeCount = cascadeCount;
+	SharedFrameUniforms().setShadows(block);
+
+	glActiveTexture(GL_TEXTURE0 + textureUnit);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, depthTexture);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+void ShadowCascades::cleanup() {
+	glDeleteFramebuffers(1, &framebuffer);
+	glDeleteTextures(1, &depthTexture);
+}
@@ -0,0 +1,66 @@
+#ifndef _SHADOWS_H_
+#define _SHADOWS_H_
+
+#include "headers.h"
+#include "frame_uniforms.h"
+
+// One slice of the camera frustum and the light projection covering it
+struct ShadowCascade {
+	float splitFar;				// View depth where the cascade ends
+	float radius;				// Bounding sphere of the slice, fixed for a given lens
+	glm::mat4 lightSpaceMatrix;
+
+	// Cache state: the matrix and caster version the layer was last rendered with
+	glm::mat4 renderedMatrix;
+	unsigned int renderedVersion;
+	bool rendered;
+	bool needsRender;
+};
+
+// Cascaded shadow maps for a directional light, stored as layers of one depth texture
+// array with hardware comparison (sampler2DArrayShadow).
+//
+// Cascade windows move in steps of cacheStep * radius rather than every texel, and
+// are padded by one step, so a cascade keeps its light matrix while the camera moves
+// inside that step. A layer is only re-rendered when its matrix or the caster version
+// changed; the caster version is bumped by whoever moves static casters.
+struct ShadowCascades {
+	GLuint depthTexture;
+	GLuint framebuffer;
+	int resolution;
+	int cascadeCount;
+	ShadowCascade cascades[MAX_SHADOW_CASCADES];
+
+	float shadowDistance;		// Shadows end this far from the camera
+	float splitLambda;			// 0 uniform splits, 1 logarithmic
+	float cacheStep;			// Window step for cascades 1+, as a fraction of the radius
+	float casterDistance;		// Casters this far towards the light still cast
+
+	glm::vec3 lightDirection;	// Direction the light travels
+	glm::vec3 cameraPosition;
+	glm::vec3 cameraForward;
+
+	unsigned int cascadesRendered;
+	unsigned int cascadesCached;
+
+	void initialize(int cascadeCount, int resolution);
+
+	// Fits the cascades to the camera frustum and decides which layers are stale
+	void update(const glm::mat4& viewMatrix, float fovY, float aspect, float zNear,
+		const glm::vec3& lightDirection, unsigned int casterVersion);
+
+	// Binds the layer for depth rendering; the caller draws casters with
+	// cascades[cascade].lightSpaceMatrix
+	void beginCascade(int cascade);
+
+	// Rebinds the framebuffer the frame is drawn into (0 for the window) and its viewport
+	void end(GLuint targetFramebuffer, int viewportWidth, int viewportHeight);
+
+	// Uploads the Shadows block shared by every program and binds the map on
+	// textureUnit, where the programs' shadowMap samplers point
+	void apply(int textureUnit) const;
+
+	void cleanup();
+};
+
+#endif
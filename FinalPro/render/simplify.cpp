@@ -0,0 +1,361 @@
+#include "simplify.h"
+
+#include <queue>
+#include <unordered_map>
+
+// Quadric error metric simplification (Garland & Heckbert) restricted to half-edge
+// collapses: a vertex always moves onto one of its neighbours, so every LOD indexes
+// into the original vertex array.
+
+namespace {
+
+// Symmetric 4x4 matrix stored as its upper triangle, and the summed weight of its
+// planes so the error can be turned back into a distance
+struct Quadric {
+	double a00, a01, a02, a03;
+	double a11, a12, a13;
+	double a22, a23;
+	double a33;
+	double weight;
+};
+
+void quadricClear(Quadric& q) {
+	q.a00 = q.a01 = q.a02 = q.a03 = 0.0;
+	q.a11 = q.a12 = q.a13 = 0.0;
+	q.a22 = q.a23 = 0.0;
+	q.a33 = 0.0;
+	q.weight = 0.0;
+}
+
+void quadricAddPlane(Quadric& q, const glm::dvec3& n, double d, double weight) {
+	q.a00 += weight * n.x * n.x; q.a01 += weight * n.x * n.y; q.a02 += weight * n.x * n.z; q.a03 += weight * n.x * d;
+	q.a11 += weight * n.y * n.y; q.a12 += weight * n.y * n.z; q.a13 += weight * n.y * d;
+	q.a22 += weight * n.z * n.z; q.a23 += weight * n.z * d;
+	q.a33 += weight * d * d;
+	q.weight += weight;
+}
+
+void quadricAdd(Quadric& q, const Quadric& r) {
+	q.a00 += r.a00; q.a01 += r.a01; q.a02 += r.a02; q.a03 += r.a03;
+	q.a11 += r.a11; q.a12 += r.a12; q.a13 += r.a13;
+	q.a22 += r.a22; q.a23 += r.a23;
+	q.a33 += r.a33;
+	q.weight += r.weight;
+}
+
+double quadricError(const Quadric& q, const glm::dvec3& p) {
+	double rx = q.a00 * p.x + q.a01 * p.y + q.a02 * p.z + q.a03;
+	double ry = q.a01 * p.x + q.a11 * p.y + q.a12 * p.z + q.a13;
+	double rz = q.a02 * p.x + q.a12 * p.y + q.a22 * p.z + q.a23;
+	double r = rx * p.x + ry * p.y + rz * p.z + q.a03 * p.x + q.a13 * p.y + q.a23 * p.z + q.a33;
+	return r > 0.0 ? r : 0.0;
+}
+
+// Root mean square distance from p to the quadric's planes
+double quadricDistance(const Quadric& q, const glm::dvec3& p) {
+	return q.weight > 0.0 ? sqrt(quadricError(q, p) / q.weight) : 0.0;
+}
+
+struct Collapse {
+	double cost;
+	double distance;
+	unsigned int from, to;
+	unsigned int fromStamp, toStamp;
+
+	bool operator<(const Collapse& other) const {
+		return cost > other.cost;	// Cheapest first in std::priority_queue
+	}
+};
+
+struct PositionKey {
+	float x, y, z;
+	bool operator==(const PositionKey& other) const {
+		return x == other.x && y == other.y && z == other.z;
+	}
+};
+
+struct PositionKeyHash {
+	size_t operator()(const PositionKey& key) const {
+		size_t h = std::hash<float>()(key.x);
+		h = h * 31 + std::hash<float>()(key.y);
+		h = h * 31 + std::hash<float>()(key.z);
+		return h;
+	}
+};
+
+// Relative weight of the planes that keep open borders in place
+const double kBorderWeight = 10.0;
+
+// Vertices at one position are one collapse node when their normals are within about
+// 8 degrees and their uvs within this fraction of a texture apart
+const float kWeldNormalDot = 0.99f;
+const float kWeldUv = 1.0f / 1024.0f;
+
+// A level that removes less than this fraction of the triangles of the level before
+// it reuses that level
+const float kMinLodReduction = 0.1f;
+
+bool sameAttributes(const MeshVertex& a, const MeshVertex& b) {
+	glm::vec2 uv = glm::abs(a.uv - b.uv);
+	return glm::dot(a.normal, b.normal) >= kWeldNormalDot * glm::length(a.normal) * glm::length(b.normal) &&
+		uv.x <= kWeldUv && uv.y <= kWeldUv;
+}
+
+void pushCollapse(std::priority_queue<Collapse>& heap, const std::vector<Quadric>& quadrics,
+	const std::vector<glm::dvec3>& positions, const std::vector<unsigned int>& stamps,
+	unsigned int from, unsigned int to) {
+	Quadric q = quadrics[from];
+	quadricAdd(q, quadrics[to]);
+	Collapse c;
+	c.cost = quadricError(q, positions[to]);
+	c.distance = quadricDistance(q, positions[to]);
+	c.from = from;
+	c.to = to;
+	c.fromStamp = stamps[from];
+	c.toStamp = stamps[to];
+	heap.push(c);
+}
+
+// Copies the surviving triangles into a new LOD at the end of the index array. Too
+// small a reduction repeats the previous level's range instead, costing no memory.
+void appendLod(MeshPrimitive& primitive, const std::vector<unsigned int>& triangles,
+	const std::vector<unsigned char>& alive, size_t aliveCount, double error) {
+	MeshLod lod = primitive.lods.back();
+	if (aliveCount * 3 > lod.indexCount * (1.0f - kMinLodReduction)) {
+		primitive.lods.push_back(lod);
+		return;
+	}
+	lod.indexOffset = (unsigned int)primitive.indices.size();
+	for (size_t t = 0; t < alive.size(); ++t) {
+		if (alive[t]) {
+			primitive.indices.push_back(triangles[t * 3]);
+			primitive.indices.push_back(triangles[t * 3 + 1]);
+			primitive.indices.push_back(triangles[t * 3 + 2]);
+		}
+	}
+	lod.indexCount = (unsigned int)primitive.indices.size() - lod.indexOffset;
+	lod.error = (float)error;
+	primitive.lods.push_back(lod);
+}
+
+}
+
+void BuildMeshLods(MeshPrimitive& primitive, const std::vector<float>& targetRatios) {
+	if (primitive.lods.empty()) {
+		MeshLod base;
+		base.indexOffset = 0;
+		base.indexCount = (unsigned int)primitive.indices.size();
+		base.error = 0.0f;
+		primitive.lods.push_back(base);
+	}
+
+	const MeshLod base = primitive.lods[0];
+	std::vector<unsigned int> triangles(primitive.indices.begin() + base.indexOffset,
+		primitive.indices.begin() + base.indexOffset + base.indexCount);
+	size_t triangleCount = triangles.size() / 3;
+
+	// Vertices that share a position are welded into one collapse node. Only nodes
+	// whose vertices all carry the same attributes may move, which keeps UV and normal
+	// seams intact; vertices split apart by the exporter alone do not count as seams.
+	std::unordered_map<PositionKey, unsigned int, PositionKeyHash> positionToNode;
+	std::vector<unsigned int> vertexNode(primitive.vertices.size());
+	std::vector<glm::dvec3> nodePosition;
+	std::vector<unsigned int> nodeFirstVertex;
+	std::vector<unsigned char> nodeSeam;
+	for (size_t v = 0; v < primitive.vertices.size(); ++v) {
+		const glm::vec3& p = primitive.vertices[v].position;
+		PositionKey key = { p.x, p.y, p.z };
+		std::unordered_map<PositionKey, unsigned int, PositionKeyHash>::iterator it = positionToNode.find(key);
+		if (it == positionToNode.end()) {
+			unsigned int node = (unsigned int)nodePosition.size();
+			positionToNode[key] = node;
+			nodePosition.push_back(glm::dvec3(p));
+			nodeFirstVertex.push_back((unsigned int)v);
+			nodeSeam.push_back(0);
+			vertexNode[v] = node;
+		}
+		else {
+			vertexNode[v] = it->second;
+			if (!sameAttributes(primitive.vertices[nodeFirstVertex[it->second]], primitive.vertices[v])) {
+				nodeSeam[it->second] = 1;
+			}
+		}
+	}
+	size_t nodeCount = nodePosition.size();
+
+	// Face quadrics, area weighted, and the list of triangles touching each node
+	std::vector<Quadric> quadrics(nodeCount);
+	for (size_t n = 0; n < nodeCount; ++n) {
+		quadricClear(quadrics[n]);
+	}
+	std::vector<std::vector<unsigned int> > nodeTriangles(nodeCount);
+	std::unordered_map<unsigned long long, int> edgeUse;
+
+	for (size_t t = 0; t < triangleCount; ++t) {
+		unsigned int n[3] = { vertexNode[triangles[t * 3]], vertexNode[triangles[t * 3 + 1]], vertexNode[triangles[t * 3 + 2]] };
+		glm::dvec3 normal = glm::cross(nodePosition[n[1]] - nodePosition[n[0]], nodePosition[n[2]] - nodePosition[n[0]]);
+		double length = glm::length(normal);
+		if (length > 0.0) {
+			glm::dvec3 unit = normal / length;
+			double d = -glm::dot(unit, nodePosition[n[0]]);
+			for (int k = 0; k < 3; ++k) {
+				quadricAddPlane(quadrics[n[k]], unit, d, length * 0.5);
+			}
+		}
+		for (int k = 0; k < 3; ++k) {
+			nodeTriangles[n[k]].push_back((unsigned int)t);
+			unsigned int a = n[k], b = n[(k + 1) % 3];
+			unsigned long long key = a < b ? ((unsigned long long)a << 32) | b : ((unsigned long long)b << 32) | a;
+			edgeUse[key]++;
+		}
+	}
+
+	// Edges used by a single triangle are open borders (leaf cards, holes). Add a plane
+	// through the edge, perpendicular to the face, so the silhouette does not shrink.
+	for (size_t t = 0; t < triangleCount; ++t) {
+		unsigned int n[3] = { vertexNode[triangles[t * 3]], vertexNode[triangles[t * 3 + 1]], vertexNode[triangles[t * 3 + 2]] };
+		glm::dvec3 faceNormal = glm::cross(nodePosition[n[1]] - nodePosition[n[0]], nodePosition[n[2]] - nodePosition[n[0]]);
+		if (glm::length(faceNormal) == 0.0) {
+			continue;
+		}
+		for (int k = 0; k < 3; ++k) {
+			unsigned int a = n[k], b = n[(k + 1) % 3];
+			unsigned long long key = a < b ? ((unsigned long long)a << 32) | b : ((unsigned long long)b << 32) | a;
+			if (edgeUse[key] != 1) {
+				continue;
+			}
+			glm::dvec3 edge = nodePosition[b] - nodePosition[a];
+			glm::dvec3 normal = glm::cross(edge, faceNormal);
+			double length = glm::length(normal);
+			if (length == 0.0) {
+				continue;
+			}
+			normal /= length;
+			double d = -glm::dot(normal, nodePosition[a]);
+			double weight = kBorderWeight * glm::dot(edge, edge);
+			quadricAddPlane(quadrics[a], normal, d, weight);
+			quadricAddPlane(quadrics[b], normal, d, weight);
+		}
+	}
+
+	std::vector<unsigned char> triangleAlive(triangleCount, 1);
+	std::vector<unsigned char> nodeRemoved(nodeCount, 0);
+	std::vector<unsigned int> stamps(nodeCount, 0);
+	std::priority_queue<Collapse> heap;
+
+	for (size_t t = 0; t < triangleCount; ++t) {
+		for (int k = 0; k < 3; ++k) {
+			unsigned int a = vertexNode[triangles[t * 3 + k]];
+			unsigned int b = vertexNode[triangles[t * 3 + (k + 1) % 3]];
+			if (a == b) {
+				continue;
+			}
+			if (!nodeSeam[a]) pushCollapse(heap, quadrics, nodePosition, stamps, a, b);
+			if (!nodeSeam[b]) pushCollapse(heap, quadrics, nodePosition, stamps, b, a);
+		}
+	}
+
+	size_t aliveCount = triangleCount;
+	size_t nextLod = 0;
+	double maxError = 0.0;
+
+	std::vector<unsigned int> lodTargets;
+	for (size_t i = 0; i < targetRatios.size(); ++i) {
+		lodTargets.push_back((unsigned int)(triangleCount * targetRatios[i]));
+	}
+
+	while (nextLod < lodTargets.size()) {
+		if (aliveCount <= lodTargets[nextLod] || heap.empty()) {
+			appendLod(primitive, triangles, triangleAlive, aliveCount, maxError);
+			nextLod++;
+			continue;
+		}
+
+		Collapse c = heap.top();
+		heap.pop();
+		unsigned int a = c.from, b = c.to;
+		if (nodeRemoved[a] || nodeRemoved[b] || stamps[a] != c.fromStamp || stamps[b] != c.toStamp) {
+			continue;
+		}
+
+		// The edge must still exist; it also tells us which of b's vertices to use
+		// for a's triangles when b sits on a seam
+		unsigned int targetVertex = (unsigned int)-1;
+		for (size_t i = 0; i < nodeTriangles[a].size() && targetVertex == (unsigned int)-1; ++i) {
+			unsigned int t = nodeTriangles[a][i];
+			if (!triangleAlive[t]) continue;
+			for (int k = 0; k < 3; ++k) {
+				if (vertexNode[triangles[t * 3 + k]] == b) {
+					targetVertex = triangles[t * 3 + k];
+					break;
+				}
+			}
+		}
+		if (targetVertex == (unsigned int)-1) {
+			continue;
+		}
+
+		// Reject collapses that would flip a surviving triangle
+		bool flips = false;
+		for (size_t i = 0; i < nodeTriangles[a].size() && !flips; ++i) {
+			unsigned int t = nodeTriangles[a][i];
+			if (!triangleAlive[t]) continue;
+			unsigned int n[3] = { vertexNode[triangles[t * 3]], vertexNode[triangles[t * 3 + 1]], vertexNode[triangles[t * 3 + 2]] };
+			if (n[0] == b || n[1] == b || n[2] == b) continue;
+
+			glm::dvec3 p[3], q[3];
+			for (int k = 0; k < 3; ++k) {
+				p[k] = nodePosition[n[k]];
+				q[k] = n[k] == a ? nodePosition[b] : p[k];
+			}
+			glm::dvec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+			glm::dvec3 after = glm::cross(q[1] - q[0], q[2] - q[0]);
+			if (glm::dot(before, after) <= 0.0) {
+				flips = true;
+			}
+		}
+		if (flips) {
+			continue;
+		}
+
+		// Collapse a onto b
+		for (size_t i = 0; i < nodeTriangles[a].size(); ++i) {
+			unsigned int t = nodeTriangles[a][i];
+			if (!triangleAlive[t]) continue;
+			bool hasB = false;
+			for (int k = 0; k < 3; ++k) {
+				if (vertexNode[triangles[t * 3 + k]] == b) hasB = true;
+			}
+			if (hasB) {
+				triangleAlive[t] = 0;
+				aliveCount--;
+				continue;
+			}
+			for (int k = 0; k < 3; ++k) {
+				if (vertexNode[triangles[t * 3 + k]] == a) triangles[t * 3 + k] = targetVertex;
+			}
+			nodeTriangles[b].push_back(t);
+		}
+		nodeTriangles[a].clear();
+		nodeRemoved[a] = 1;
+		quadricAdd(quadrics[b], quadrics[a]);
+		stamps[b]++;
+		maxError = std::max(maxError, c.distance);
+
+		// Drop dead triangles from b's list and requeue the edges around it
+		std::vector<unsigned int>& around = nodeTriangles[b];
+		size_t write = 0;
+		for (size_t i = 0; i < around.size(); ++i) {
+			unsigned int t = around[i];
+			if (!triangleAlive[t]) continue;
+			around[write++] = t;
+			for (int k = 0; k < 3; ++k) {
+				unsigned int other = vertexNode[triangles[t * 3 + k]];
+				if (other == b) continue;
+				if (!nodeSeam[b]) pushCollapse(heap, quadrics, nodePosition, stamps, b, other);
+				if (!nodeSeam[other]) pushCollapse(heap, quadrics, nodePosition, stamps, other, b);
+			}
+		}
+		around.resize(write);
+	}
+}
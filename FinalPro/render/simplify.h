@@ -0,0 +1,13 @@
+#ifndef _SIMPLIFY_H_
+#define _SIMPLIFY_H_
+
+#include "mesh.h"
+
+// Appends one simplified level per entry of targetRatios (fractions of the LOD 0
+// triangle count, decreasing) to primitive.indices and primitive.lods. The levels
+// reuse the existing vertices, so all of them can share one vertex buffer. A level
+// the simplifier cannot make meaningfully smaller than the one before, held back by
+// seams or borders, repeats that level's index range rather than copying it.
+void BuildMeshLods(MeshPrimitive& primitive, const std::vector<float>& targetRatios);
+
+#endif
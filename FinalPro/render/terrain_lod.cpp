@@ -0,0 +1,215 @@
+#include "terrain_lod.h"
+
+#include <cfloat>
+
+void DefaultTerrainSettings(TerrainSettings& settings) {
+	settings.tileSize = 256.0f;
+	settings.tileResolution = 256;
+	settings.lodCount = 4;
+	settings.gridSize = 32;
+	settings.lodDistance = 80.0f;
+	settings.morphStart = 0.7f;
+	settings.streamRadius = 1000.0f;
+	settings.heightScale = 80.0f;
+	settings.featureSize = 600.0f;
+	settings.flatRadius = 150.0f;
+	settings.seed = 1337;
+}
+
+namespace {
+
+float latticeValue(int x, int z, unsigned int seed) {
+	unsigned int h = (unsigned int)x * 374761393u + (unsigned int)z * 668265263u + seed * 2246822519u;
+	h = (h ^ (h >> 13)) * 1274126177u;
+	h ^= h >> 16;
+	return (h & 0xffffff) / (float)0xffffff;
+}
+
+// Smoothly interpolated lattice noise in [0, 1]
+float valueNoise(float x, float z, unsigned int seed) {
+	float fx = floorf(x), fz = floorf(z);
+	int ix = (int)fx, iz = (int)fz;
+	float tx = x - fx, tz = z - fz;
+	tx = tx * tx * (3.0f - 2.0f * tx);
+	tz = tz * tz * (3.0f - 2.0f * tz);
+
+	float a = latticeValue(ix, iz, seed), b = latticeValue(ix + 1, iz, seed);
+	float c = latticeValue(ix, iz + 1, seed), d = latticeValue(ix + 1, iz + 1, seed);
+	return (a + (b - a) * tx) + ((c + (d - c) * tx) - (a + (b - a) * tx)) * tz;
+}
+
+}
+
+float SampleTerrainHeight(const TerrainSettings& settings, float x, float z) {
+	float frequency = 1.0f / settings.featureSize;
+	float amplitude = 0.5f;
+	float height = 0.0f;
+	for (int octave = 0; octave < 6; ++octave) {
+		height += amplitude * valueNoise(x * frequency, z * frequency, settings.seed + octave);
+		frequency *= 2.0f;
+		amplitude *= 0.5f;
+	}
+	height /= 1.0f - amplitude * 2.0f;
+
+	// Fade the hills in beyond the flat area around the origin
+	float distance = sqrtf(x * x + z * z);
+	float t = glm::clamp((distance - settings.flatRadius) / settings.flatRadius, 0.0f, 1.0f);
+	return height * settings.heightScale * t * t * (3.0f - 2.0f * t);
+}
+
+void BuildHeightTile(const TerrainSettings& settings, int tileX, int tileZ, HeightTile& tile) {
+	int resolution = settings.tileResolution;
+	float spacing = settings.tileSize / resolution;
+	float originX = tileX * settings.tileSize, originZ = tileZ * settings.tileSize;
+
+	tile.tileX = tileX;
+	tile.tileZ = tileZ;
+	tile.stride = resolution + 3;
+	tile.heights.resize((size_t)tile.stride * tile.stride);
+
+	std::vector<float> heights(tile.heights.size());
+	for (int z = 0; z < tile.stride; ++z) {
+		for (int x = 0; x < tile.stride; ++x) {
+			float h = SampleTerrainHeight(settings, originX + (x - 1) * spacing, originZ + (z - 1) * spacing);
+			heights[z * tile.stride + x] = h;
+			float normalized = glm::clamp(h / settings.heightScale, 0.0f, 1.0f);
+			tile.heights[z * tile.stride + x] = (unsigned short)(normalized * 65535.0f + 0.5f);
+		}
+	}
+
+	// Leaf ranges from the samples, every parent from its four children
+	int depthCount = settings.lodCount;
+	tile.nodeMin.assign(depthCount, std::vector<float>());
+	tile.nodeMax.assign(depthCount, std::vector<float>());
+	int leafCount = 1 << (depthCount - 1);
+	int leafSamples = resolution / leafCount;
+	tile.nodeMin[depthCount - 1].resize(leafCount * leafCount);
+	tile.nodeMax[depthCount - 1].resize(leafCount * leafCount);
+	for (int nz = 0; nz < leafCount; ++nz) {
+		for (int nx = 0; nx < leafCount; ++nx) {
+			float lo = FLT_MAX, hi = -FLT_MAX;
+			for (int z = nz * leafSamples; z <= (nz + 1) * leafSamples; ++z) {
+				for (int x = nx * leafSamples; x <= (nx + 1) * leafSamples; ++x) {
+					float h = heights[(z + 1) * tile.stride + x + 1];
+					lo = std::min(lo, h);
+					hi = std::max(hi, h);
+				}
+			}
+			tile.nodeMin[depthCount - 1][nz * leafCount + nx] = lo;
+			tile.nodeMax[depthCount - 1][nz * leafCount + nx] = hi;
+		}
+	}
+	for (int depth = depthCount - 2; depth >= 0; --depth) {
+		int count = 1 << depth;
+		const std::vector<float>& childMin = tile.nodeMin[depth + 1];
+		const std::vector<float>& childMax = tile.nodeMax[depth + 1];
+		tile.nodeMin[depth].resize(count * count);
+		tile.nodeMax[depth].resize(count * count);
+		for (int nz = 0; nz < count; ++nz) {
+			for (int nx = 0; nx < count; ++nx) {
+				int c = (nz * 2) * (count * 2) + nx * 2;
+				int below = c + count * 2;
+				tile.nodeMin[depth][nz * count + nx] = std::min(std::min(childMin[c], childMin[c + 1]), std::min(childMin[below], childMin[below + 1]));
+				tile.nodeMax[depth][nz * count + nx] = std::max(std::max(childMax[c], childMax[c + 1]), std::max(childMax[below], childMax[below + 1]));
+			}
+		}
+	}
+}
+
+void ComputeTerrainLodRanges(const TerrainSettings& settings, TerrainLodRanges& ranges) {
+	float previous = 0.0f;
+	for (int lod = 0; lod < settings.lodCount; ++lod) {
+		ranges.range[lod] = settings.lodDistance * (float)(1 << lod);
+
+		// The root level covers everything that is streamed in
+		if (lod == settings.lodCount - 1) {
+			ranges.range[lod] = std::max(ranges.range[lod], settings.streamRadius + settings.tileSize);
+		}
+		ranges.morphEnd[lod] = ranges.range[lod];
+		ranges.morphStart[lod] = previous + (ranges.range[lod] - previous) * settings.morphStart;
+		previous = ranges.range[lod];
+	}
+}
+
+namespace {
+
+struct ChunkSelection {
+	const TerrainSettings* settings;
+	const TerrainLodRanges* ranges;
+	const HeightTile* tile;
+	float tileY;
+	int layer;
+	glm::vec3 cameraPosition;
+	const Frustum* frustum;
+	std::vector<TerrainChunk>* chunks;
+	int added;
+
+	AABB nodeBox(int depth, int nx, int nz) const {
+		float size = settings->tileSize / (float)(1 << depth);
+		int index = nz * (1 << depth) + nx;
+		AABB box;
+		box.min = glm::vec3(tile->tileX * settings->tileSize + nx * size, tileY + tile->nodeMin[depth][index],
+			tile->tileZ * settings->tileSize + nz * size);
+		box.max = glm::vec3(box.min.x + size, tileY + tile->nodeMax[depth][index], box.min.z + size);
+		return box;
+	}
+
+	bool inRange(const AABB& box, float range) const {
+		glm::vec3 closest = glm::clamp(cameraPosition, box.min, box.max);
+		glm::vec3 delta = closest - cameraPosition;
+		return glm::dot(delta, delta) < range * range;
+	}
+
+	void add(const AABB& box, int lod, float step) {
+		TerrainChunk chunk;
+		chunk.area = glm::vec4(box.min.x, box.min.z, box.max.x - box.min.x, (float)lod);
+		chunk.tile = glm::vec4(tile->tileX * settings->tileSize, tile->tileZ * settings->tileSize, (float)layer, step);
+		chunks->push_back(chunk);
+		added++;
+	}
+
+	// Returns false when the node is out of its LOD range and the parent must cover it
+	bool select(int depth, int nx, int nz) {
+		int lod = settings->lodCount - 1 - depth;
+		AABB box = nodeBox(depth, nx, nz);
+		if (depth > 0 && !inRange(box, ranges->range[lod])) {
+			return false;
+		}
+		if (!IsAABBVisible(*frustum, box)) {
+			return true;
+		}
+		if (lod == 0 || !inRange(box, ranges->range[lod - 1])) {
+			add(box, lod, 1.0f);
+			return true;
+		}
+
+		for (int child = 0; child < 4; ++child) {
+			int cx = nx * 2 + (child & 1), cz = nz * 2 + (child >> 1);
+			if (!select(depth + 1, cx, cz)) {
+				AABB childBox = nodeBox(depth + 1, cx, cz);
+				if (IsAABBVisible(*frustum, childBox)) {
+					add(childBox, lod, 2.0f);
+				}
+			}
+		}
+		return true;
+	}
+};
+
+}
+
+int SelectTerrainChunks(const TerrainSettings& settings, const TerrainLodRanges& ranges, const HeightTile& tile,
+	float tileY, int layer, const glm::vec3& cameraPosition, const Frustum& frustum, std::vector<TerrainChunk>& chunks) {
+	ChunkSelection selection;
+	selection.settings = &settings;
+	selection.ranges = &ranges;
+	selection.tile = &tile;
+	selection.tileY = tileY;
+	selection.layer = layer;
+	selection.cameraPosition = cameraPosition;
+	selection.frustum = &frustum;
+	selection.chunks = &chunks;
+	selection.added = 0;
+	selection.select(0, 0, 0);
+	return selection.added;
+}
@@ -0,0 +1,66 @@
+#ifndef _TERRAIN_LOD_H_
+#define _TERRAIN_LOD_H_
+
+#include "headers.h"
+#include "frustum.h"
+
+#define TERRAIN_MAX_LODS 8
+
+// Shape and level-of-detail layout of a streamed heightmap terrain. The ground is
+// cut into square tiles of tileSize, each the root of a quadtree lodCount levels
+// deep; every selected node is drawn with the same gridSize x gridSize mesh.
+struct TerrainSettings {
+	float tileSize;			// World size of a streamed tile and quadtree root
+	int tileResolution;		// Height samples per tile edge (plus one shared edge)
+	int lodCount;			// Quadtree depth, LOD 0 is the leaf level
+	int gridSize;			// Quads per edge of the shared chunk mesh
+	float lodDistance;		// Camera distance where LOD 0 ends; doubles per level
+	float morphStart;		// Fraction of a LOD range after which vertices morph to the next
+	float streamRadius;		// Tiles closer than this are kept resident
+	float heightScale;		// Height of the highest possible peak
+	float featureSize;		// Wavelength of the largest hills
+	float flatRadius;		// Ground stays at height 0 this close to the origin
+	unsigned int seed;
+};
+
+void DefaultTerrainSettings(TerrainSettings& settings);
+
+// Procedural ground height at a world position (fBm of value noise)
+float SampleTerrainHeight(const TerrainSettings& settings, float x, float z);
+
+// Heights of one tile, with a one-sample apron on every side so normals can be taken
+// across tile edges, and the height range of every quadtree node
+struct HeightTile {
+	int tileX, tileZ;
+	int stride;							// tileResolution + 3
+	std::vector<unsigned short> heights;	// Normalized to heightScale, stride * stride
+	std::vector<std::vector<float> > nodeMin, nodeMax;	// [depth][z * (1 << depth) + x]
+};
+
+// CPU-only, safe to call on a worker thread
+void BuildHeightTile(const TerrainSettings& settings, int tileX, int tileZ, HeightTile& tile);
+
+// One selected area, laid out as the per-instance vertex attributes. Nodes partly
+// handed to their children draw their remaining quarters at the node's own LOD,
+// which is the chunk mesh over the quarter at every other vertex (grid step 2).
+struct TerrainChunk {
+	glm::vec4 area;		// x, z of the area corner, area size, LOD
+	glm::vec4 tile;		// x, z of the tile corner, texture layer, grid step
+};
+
+// Distances where each LOD ends and where its vertices start morphing
+struct TerrainLodRanges {
+	float range[TERRAIN_MAX_LODS];
+	float morphStart[TERRAIN_MAX_LODS];
+	float morphEnd[TERRAIN_MAX_LODS];
+};
+
+void ComputeTerrainLodRanges(const TerrainSettings& settings, TerrainLodRanges& ranges);
+
+// CDLOD selection for one tile: walks the quadtree from the root, keeping the
+// coarsest nodes whose LOD range covers them and skipping nodes outside the frustum.
+// Appends to chunks and returns how many were added.
+int SelectTerrainChunks(const TerrainSettings& settings, const TerrainLodRanges& ranges, const HeightTile& tile,
+	float tileY, int layer, const glm::vec3& cameraPosition, const Frustum& frustum, std::vector<TerrainChunk>& chunks);
+
+#endif
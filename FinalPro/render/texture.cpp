@@ -7,10 +7,29 @@
 #define STB_IMAGE_IMPLEMENTATION
 #endif
 #include <stb/stb_image.h>
+// tinygltf decodes images through the stb implementation above
+#ifndef TINYGLTF_IMPLEMENTATION
+#define TINYGLTF_IMPLEMENTATION
+#endif
+#define TINYGLTF_NO_INCLUDE_STB_IMAGE
+#define TINYGLTF_NO_INCLUDE_STB_IMAGE_WRITE
+#include <tiny_gltf.h>
+
+// S3TC enums are extensions and not part of the GL 3.3 core loader
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
 
-GLuint LoadTextureTileBox(const char* texture_file_path) {
+GLuint LoadTextureTileBox(const char* texture_file_path, bool srgb) {
+	// Keep the alpha channel of images that have one (leaves), drop it otherwise
 	int w, h, channels;
-	uint8_t* img = stbi_load(texture_file_path, &w, &h, &channels, 3);
+	int components = stbi_info(texture_file_path, &w, &h, &channels) && (channels == 2 || channels == 4) ? 4 : 3;
+	uint8_t* img = stbi_load(texture_file_path, &w, &h, &channels, components);
 	GLuint texture;
 	glGenTextures(1, &texture);
 	glBindTexture(GL_TEXTURE_2D, texture);
@@ -21,7 +40,12 @@ GLuint LoadTextureTileBox(const char* texture_file_path) {
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
 	if (img) {
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, GL_RGB, GL_UNSIGNED_BYTE, img);
+		GLenum format;
+		GLint internalFormat;
+		ImageFormat(components, srgb, format, internalFormat);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, w, h, 0, format, GL_UNSIGNED_BYTE, img);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 		glGenerateMipmap(GL_TEXTURE_2D);
 	}
 	else {
@@ -30,4 +54,78 @@ GLuint LoadTextureTileBox(const char* texture_file_path) {
 	stbi_image_free(img);
 
 	return texture;
-}
\ No newline at end of file
+}
+
+void ImageFormat(int channels, bool srgb, GLenum& format, GLint& internalFormat) {
+	switch (channels) {
+	case 1: format = GL_RED; internalFormat = GL_R8; break;
+	case 2: format = GL_RG; internalFormat = GL_RG8; break;
+	case 3: format = GL_RGB; internalFormat = srgb ? GL_SRGB8 : GL_RGB8; break;
+	default: format = GL_RGBA; internalFormat = srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8; break;
+	}
+}
+
+bool CompressedTexturesSupported() {
+	static int supported = -1;
+	if (supported < 0) {
+		bool s3tc = false, srgb = false;
+		GLint count = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+		for (GLint i = 0; i < count; ++i) {
+			std::string name((const char*)glGetStringi(GL_EXTENSIONS, i));
+			s3tc = s3tc || name == "GL_EXT_texture_compression_s3tc";
+			srgb = srgb || name == "GL_EXT_texture_sRGB" || name == "GL_EXT_texture_compression_s3tc_srgb";
+		}
+		supported = s3tc && srgb ? 1 : 0;
+	}
+	return supported == 1;
+}
+
+GLenum CookedInternalFormat(const CookedTexture& cooked) {
+	if (cooked.format == COOKED_BC3) {
+		return cooked.srgb ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	}
+	return cooked.srgb ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+}
+
+GLuint UploadCookedTexture(const CookedTexture& cooked, GLuint texture) {
+	if (!CompressedTexturesSupported() || cooked.levels.empty()) {
+		return 0;
+	}
+
+	GLenum internalFormat = CookedInternalFormat(cooked);
+
+	if (texture == 0) {
+		glGenTextures(1, &texture);
+	}
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)cooked.levels.size() - 1);
+
+	// The mip chain comes precomputed, no glGenerateMipmap
+	int width = cooked.width, height = cooked.height;
+	for (size_t level = 0; level < cooked.levels.size(); ++level) {
+		glCompressedTexImage2D(GL_TEXTURE_2D, (GLint)level, internalFormat, width, height, 0,
+			(GLsizei)cooked.levels[level].size(), &cooked.levels[level][0]);
+		width = std::max(1, width / 2);
+		height = std::max(1, height / 2);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return texture;
+}
+
+GLuint LoadTexture(const char* texture_file_path, bool srgb) {
+	CookedTexture cooked;
+	if (CompressedTexturesSupported() && ReadCookedTexture(CookedTexturePath(texture_file_path).c_str(), cooked) &&
+		cooked.srgb == srgb) {
+		GLuint texture = UploadCookedTexture(cooked);
+		if (texture != 0) {
+			return texture;
+		}
+	}
+	return LoadTextureTileBox(texture_file_path, srgb);
+}
@@ -2,7 +2,28 @@
 #define _TEXTURE_H_
 
 #include "headers.h"
+#include "texture_cook.h"
 
-GLuint LoadTextureTileBox(const char* texture_file_path);
+// Colour images are uploaded as sRGB so shading happens in linear space. Data such as
+// normal maps (srgb false) is sampled as stored.
+GLuint LoadTextureTileBox(const char* texture_file_path, bool srgb = true);
+
+// Pixel format of a tightly packed 8-bit image with 1-4 channels, and the internal
+// format it is stored in; colour (3 and 4 channels) is sRGB when srgb
+void ImageFormat(int channels, bool srgb, GLenum& format, GLint& internalFormat);
+
+// True when the driver takes sRGB BC1/BC3 (S3TC) textures
+bool CompressedTexturesSupported();
+
+// GL internal format of a cooked texture's levels
+GLenum CookedInternalFormat(const CookedTexture& cooked);
+
+// Uploads every cooked level into texture, or a new texture when it is 0. Returns 0
+// when compressed textures are unsupported.
+GLuint UploadCookedTexture(const CookedTexture& cooked, GLuint texture = 0);
+
+// The cooked .ctex next to the image when there is one cooked for the same colour
+// space, the image itself otherwise
+GLuint LoadTexture(const char* texture_file_path, bool srgb = true);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,475 @@
+#include "texture_cook.h"
+
+#include <cstdio>
+#include <cstring>
+#include <climits>
+#include <functional>
+#include <thread>
+
+// .ctex layout: this header, then every level from largest to smallest with its
+// size implied by the format and the level dimensions
+struct CookedTextureHeader {
+	char magic[4];
+	unsigned int version;
+	unsigned int format;
+	unsigned int flags;
+	unsigned int width;
+	unsigned int height;
+	unsigned int levelCount;
+};
+
+#define COOKED_TEXTURE_VERSION 1
+#define COOKED_FLAG_SRGB 1
+#define MAX_COOKED_SIZE 16384
+
+namespace {
+
+// Levels in a full mip chain down to 1x1
+unsigned int FullChainLength(unsigned int width, unsigned int height) {
+	unsigned int levels = 1;
+	for (unsigned int size = std::max(width, height); size > 1; size /= 2) {
+		++levels;
+	}
+	return levels;
+}
+
+// Splits [0, count) into contiguous ranges, one per thread
+void parallelFor(int count, int threadCount, const std::function<void(int, int)>& body) {
+	threadCount = std::max(1, std::min(threadCount, count));
+	if (threadCount == 1) {
+		body(0, count);
+		return;
+	}
+	std::vector<std::thread> threads;
+	for (int t = 0; t < threadCount; ++t) {
+		int begin = count * t / threadCount;
+		int end = count * (t + 1) / threadCount;
+		threads.push_back(std::thread(body, begin, end));
+	}
+	for (size_t t = 0; t < threads.size(); ++t) {
+		threads[t].join();
+	}
+}
+
+struct ColorTables {
+	float toLinear[256];
+	unsigned char toSrgb[4096];
+
+	ColorTables() {
+		for (int i = 0; i < 256; ++i) {
+			float c = i / 255.0f;
+			toLinear[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+		}
+		for (int i = 0; i < 4096; ++i) {
+			float c = i / 4095.0f;
+			float s = c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+			toSrgb[i] = (unsigned char)(s * 255.0f + 0.5f);
+		}
+	}
+};
+
+const ColorTables& colorTables() {
+	static ColorTables tables;
+	return tables;
+}
+
+// One mip level as floats, RGBA interleaved; colour is linear when the image is sRGB
+struct FloatImage {
+	int width, height;
+	std::vector<float> texels;
+};
+
+// 2x2 box filter. Colour is weighted by alpha so that fully transparent texels (the
+// background around leaves) do not bleed into the visible ones.
+void downsample(const FloatImage& source, FloatImage& target, int threadCount) {
+	target.width = std::max(1, source.width / 2);
+	target.height = std::max(1, source.height / 2);
+	target.texels.resize((size_t)target.width * target.height * 4);
+
+	parallelFor(target.height, threadCount, [&](int begin, int end) {
+		for (int y = begin; y < end; ++y) {
+			int y0 = std::min(2 * y, source.height - 1);
+			int y1 = std::min(2 * y + 1, source.height - 1);
+			const float* row0 = &source.texels[(size_t)y0 * source.width * 4];
+			const float* row1 = &source.texels[(size_t)y1 * source.width * 4];
+			float* out = &target.texels[(size_t)y * target.width * 4];
+
+			for (int x = 0; x < target.width; ++x) {
+				int x0 = std::min(2 * x, source.width - 1) * 4;
+				int x1 = std::min(2 * x + 1, source.width - 1) * 4;
+				float a00 = row0[x0 + 3], a01 = row0[x1 + 3], a10 = row1[x0 + 3], a11 = row1[x1 + 3];
+				float alpha = a00 + a01 + a10 + a11;
+				float w00 = 0.25f, w01 = 0.25f, w10 = 0.25f, w11 = 0.25f;
+				if (alpha > 0.0f) {
+					w00 = a00 / alpha; w01 = a01 / alpha; w10 = a10 / alpha; w11 = a11 / alpha;
+				}
+				for (int c = 0; c < 3; ++c) {
+					out[x * 4 + c] = row0[x0 + c] * w00 + row0[x1 + c] * w01 + row1[x0 + c] * w10 + row1[x1 + c] * w11;
+				}
+				out[x * 4 + 3] = alpha * 0.25f;
+			}
+		}
+	});
+}
+
+void toBytes(const FloatImage& image, bool srgb, std::vector<unsigned char>& rgba, int threadCount) {
+	rgba.resize(image.texels.size());
+	const ColorTables& tables = colorTables();
+	parallelFor(image.height, threadCount, [&](int begin, int end) {
+		size_t first = (size_t)begin * image.width * 4;
+		size_t last = (size_t)end * image.width * 4;
+		for (size_t i = first; i < last; ++i) {
+			float v = std::min(std::max(image.texels[i], 0.0f), 1.0f);
+			bool color = (i & 3) != 3;
+			rgba[i] = srgb && color ? tables.toSrgb[(int)(v * 4095.0f + 0.5f)] : (unsigned char)(v * 255.0f + 0.5f);
+		}
+	});
+}
+
+unsigned short packColor(const float c[3]) {
+	int r = (int)(std::min(std::max(c[0], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+	int g = (int)(std::min(std::max(c[1], 0.0f), 255.0f) * 63.0f / 255.0f + 0.5f);
+	int b = (int)(std::min(std::max(c[2], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+	return (unsigned short)((r << 11) | (g << 5) | b);
+}
+
+void unpackColor(unsigned short c, int rgb[3]) {
+	int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+	rgb[0] = (r << 3) | (r >> 2);
+	rgb[1] = (g << 2) | (g >> 4);
+	rgb[2] = (b << 3) | (b >> 2);
+}
+
+// Nearest entry of the four-colour palette between c0 > c1 for every pixel; returns
+// the squared error. Equal endpoints use index 0 throughout.
+int pickColorIndices(const unsigned char block[64], unsigned short c0, unsigned short c1, unsigned int& indices) {
+	int palette[4][3];
+	unpackColor(c0, palette[0]);
+	unpackColor(c1, palette[1]);
+	for (int c = 0; c < 3; ++c) {
+		palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+		palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+	}
+
+	indices = 0;
+	int total = 0;
+	int candidates = c0 == c1 ? 1 : 4;
+	for (int i = 0; i < 16; ++i) {
+		int best = 0, bestError = INT_MAX;
+		for (int p = 0; p < candidates; ++p) {
+			int dr = block[i * 4] - palette[p][0], dg = block[i * 4 + 1] - palette[p][1], db = block[i * 4 + 2] - palette[p][2];
+			int error = dr * dr + dg * dg + db * db;
+			if (error < bestError) {
+				bestError = error;
+				best = p;
+			}
+		}
+		indices |= (unsigned int)best << (2 * i);
+		total += bestError;
+	}
+	return total;
+}
+
+// Endpoints on the principal axis of the block colours, inset slightly to reduce the
+// error at the extremes, indices by nearest palette entry
+void encodeColorBlock(const unsigned char block[64], unsigned char out[8]) {
+	float mean[3] = { 0.0f, 0.0f, 0.0f };
+	for (int i = 0; i < 16; ++i) {
+		for (int c = 0; c < 3; ++c) {
+			mean[c] += block[i * 4 + c];
+		}
+	}
+	for (int c = 0; c < 3; ++c) {
+		mean[c] /= 16.0f;
+	}
+
+	float cov[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+	for (int i = 0; i < 16; ++i) {
+		float r = block[i * 4] - mean[0], g = block[i * 4 + 1] - mean[1], b = block[i * 4 + 2] - mean[2];
+		cov[0] += r * r; cov[1] += r * g; cov[2] += r * b;
+		cov[3] += g * g; cov[4] += g * b; cov[5] += b * b;
+	}
+
+	// Power iteration for the dominant eigenvector
+	float axis[3] = { 1.0f, 1.0f, 1.0f };
+	for (int iteration = 0; iteration < 8; ++iteration) {
+		float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+		float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+		float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+		float length = std::max(std::max(fabsf(x), fabsf(y)), fabsf(z));
+		if (length < 1e-6f) {
+			break;
+		}
+		axis[0] = x / length; axis[1] = y / length; axis[2] = z / length;
+	}
+	float axisLength = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+
+	float minT = 0.0f, maxT = 0.0f;
+	for (int i = 0; i < 16; ++i) {
+		float t = ((block[i * 4] - mean[0]) * axis[0] + (block[i * 4 + 1] - mean[1]) * axis[1] +
+			(block[i * 4 + 2] - mean[2]) * axis[2]) / axisLength;
+		minT = std::min(minT, t);
+		maxT = std::max(maxT, t);
+	}
+	float inset = (maxT - minT) / 16.0f;
+	minT += inset;
+	maxT -= inset;
+
+	float high[3], low[3];
+	for (int c = 0; c < 3; ++c) {
+		high[c] = mean[c] + axis[c] * maxT;
+		low[c] = mean[c] + axis[c] * minT;
+	}
+	unsigned short c0 = packColor(high);
+	unsigned short c1 = packColor(low);
+	if (c0 < c1) {
+		std::swap(c0, c1);
+	}
+	unsigned int indices;
+	int error = pickColorIndices(block, c0, c1, indices);
+
+	// One least-squares pass: the endpoints that best fit the chosen indices
+	if (error > 0 && c0 != c1) {
+		static const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+		float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+		float ax[3] = { 0.0f, 0.0f, 0.0f }, bx[3] = { 0.0f, 0.0f, 0.0f };
+		for (int i = 0; i < 16; ++i) {
+			float a = weights[(indices >> (2 * i)) & 3], b = 1.0f - a;
+			aa += a * a; ab += a * b; bb += b * b;
+			for (int c = 0; c < 3; ++c) {
+				ax[c] += a * block[i * 4 + c];
+				bx[c] += b * block[i * 4 + c];
+			}
+		}
+		float determinant = aa * bb - ab * ab;
+		if (fabsf(determinant) > 1e-6f) {
+			for (int c = 0; c < 3; ++c) {
+				high[c] = (ax[c] * bb - bx[c] * ab) / determinant;
+				low[c] = (bx[c] * aa - ax[c] * ab) / determinant;
+			}
+			unsigned short r0 = packColor(high);
+			unsigned short r1 = packColor(low);
+			if (r0 < r1) {
+				std::swap(r0, r1);
+			}
+			unsigned int refinedIndices;
+			if (r0 != r1 && pickColorIndices(block, r0, r1, refinedIndices) < error) {
+				c0 = r0;
+				c1 = r1;
+				indices = refinedIndices;
+			}
+		}
+	}
+
+	out[0] = (unsigned char)(c0 & 0xff); out[1] = (unsigned char)(c0 >> 8);
+	out[2] = (unsigned char)(c1 & 0xff); out[3] = (unsigned char)(c1 >> 8);
+	for (int b = 0; b < 4; ++b) {
+		out[4 + b] = (unsigned char)(indices >> (8 * b));
+	}
+}
+
+// BC3 alpha: 8-value mode between the block's extremes, 3-bit indices
+void encodeAlphaBlock(const unsigned char block[64], unsigned char out[8]) {
+	int a0 = 0, a1 = 255;
+	for (int i = 0; i < 16; ++i) {
+		a0 = std::max(a0, (int)block[i * 4 + 3]);
+		a1 = std::min(a1, (int)block[i * 4 + 3]);
+	}
+
+	unsigned long long indices = 0;
+	if (a0 != a1) {
+		int palette[8];
+		palette[0] = a0;
+		palette[1] = a1;
+		for (int p = 2; p < 8; ++p) {
+			palette[p] = ((8 - p) * a0 + (p - 1) * a1) / 7;
+		}
+		for (int i = 0; i < 16; ++i) {
+			int alpha = block[i * 4 + 3];
+			int best = 0, bestError = INT_MAX;
+			for (int p = 0; p < 8; ++p) {
+				int error = abs(alpha - palette[p]);
+				if (error < bestError) {
+					bestError = error;
+					best = p;
+				}
+			}
+			indices |= (unsigned long long)best << (3 * i);
+		}
+	}
+
+	out[0] = (unsigned char)a0;
+	out[1] = (unsigned char)a1;
+	for (int b = 0; b < 6; ++b) {
+		out[2 + b] = (unsigned char)(indices >> (8 * b));
+	}
+}
+
+void compressLevel(const std::vector<unsigned char>& rgba, int width, int height, int format,
+	std::vector<unsigned char>& blocks, int threadCount) {
+	int blocksX = (width + 3) / 4;
+	int blocksY = (height + 3) / 4;
+	int blockBytes = format == COOKED_BC3 ? 16 : 8;
+	blocks.resize((size_t)blocksX * blocksY * blockBytes);
+
+	parallelFor(blocksY, threadCount, [&](int begin, int end) {
+		unsigned char block[64];
+		for (int by = begin; by < end; ++by) {
+			for (int bx = 0; bx < blocksX; ++bx) {
+				// Edge blocks repeat the last row and column
+				for (int i = 0; i < 16; ++i) {
+					int x = std::min(bx * 4 + (i & 3), width - 1);
+					int y = std::min(by * 4 + (i >> 2), height - 1);
+					memcpy(&block[i * 4], &rgba[((size_t)y * width + x) * 4], 4);
+				}
+				unsigned char* out = &blocks[((size_t)by * blocksX + bx) * blockBytes];
+				if (format == COOKED_BC3) {
+					encodeAlphaBlock(block, out);
+					out += 8;
+				}
+				encodeColorBlock(block, out);
+			}
+		}
+	});
+}
+
+}
+
+size_t CookedLevelSize(int format, int width, int height) {
+	return (size_t)((width + 3) / 4) * ((height + 3) / 4) * (format == COOKED_BC3 ? 16 : 8);
+}
+
+void BuildMipChain(const unsigned char* rgba, int width, int height, bool srgb, int threadCount,
+	std::vector<std::vector<unsigned char> >& levels) {
+	if (threadCount <= 0) {
+		threadCount = std::max(1, (int)std::thread::hardware_concurrency());
+	}
+
+	size_t texelCount = (size_t)width * height;
+	FloatImage level;
+	level.width = width;
+	level.height = height;
+	level.texels.resize(texelCount * 4);
+	const ColorTables& tables = colorTables();
+	for (size_t i = 0; i < texelCount * 4; ++i) {
+		bool color = (i & 3) != 3;
+		level.texels[i] = srgb && color ? tables.toLinear[rgba[i]] : rgba[i] / 255.0f;
+	}
+
+	levels.clear();
+	levels.push_back(std::vector<unsigned char>(rgba, rgba + texelCount * 4));
+	while (level.width > 1 || level.height > 1) {
+		FloatImage next;
+		downsample(level, next, threadCount);
+		std::swap(level, next);
+		levels.push_back(std::vector<unsigned char>());
+		toBytes(level, srgb, levels.back(), threadCount);
+	}
+}
+
+void CookTexture(const unsigned char* rgba, int width, int height, bool srgb, int threadCount, CookedTexture& cooked) {
+	if (threadCount <= 0) {
+		threadCount = std::max(1, (int)std::thread::hardware_concurrency());
+	}
+
+	size_t texelCount = (size_t)width * height;
+	bool opaque = true;
+	for (size_t i = 0; i < texelCount && opaque; ++i) {
+		opaque = rgba[i * 4 + 3] == 255;
+	}
+
+	cooked.format = opaque ? COOKED_BC1 : COOKED_BC3;
+	cooked.srgb = srgb;
+	cooked.width = width;
+	cooked.height = height;
+
+	std::vector<std::vector<unsigned char> > levels;
+	BuildMipChain(rgba, width, height, srgb, threadCount, levels);
+	cooked.levels.resize(levels.size());
+	int levelWidth = width, levelHeight = height;
+	for (size_t l = 0; l < levels.size(); ++l) {
+		compressLevel(levels[l], levelWidth, levelHeight, cooked.format, cooked.levels[l], threadCount);
+		levelWidth = std::max(1, levelWidth / 2);
+		levelHeight = std::max(1, levelHeight / 2);
+	}
+}
+
+bool WriteCookedTexture(const char* path, const CookedTexture& cooked) {
+	FILE* file = fopen(path, "wb");
+	if (file == NULL) {
+		std::cout << "Failed to write cooked texture " << path << std::endl;
+		return false;
+	}
+
+	CookedTextureHeader header;
+	memcpy(header.magic, "CTEX", 4);
+	header.version = COOKED_TEXTURE_VERSION;
+	header.format = cooked.format;
+	header.flags = cooked.srgb ? COOKED_FLAG_SRGB : 0;
+	header.width = cooked.width;
+	header.height = cooked.height;
+	header.levelCount = (unsigned int)cooked.levels.size();
+
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	for (size_t i = 0; i < cooked.levels.size() && ok; ++i) {
+		ok = fwrite(&cooked.levels[i][0], 1, cooked.levels[i].size(), file) == cooked.levels[i].size();
+	}
+	fclose(file);
+	return ok;
+}
+
+bool ReadCookedTexture(const char* path, CookedTexture& cooked) {
+	FILE* file = fopen(path, "rb");
+	if (file == NULL) {
+		return false;
+	}
+
+	CookedTextureHeader header;
+	bool ok = fread(&header, sizeof(header), 1, file) == 1 && memcmp(header.magic, "CTEX", 4) == 0 &&
+		header.version == COOKED_TEXTURE_VERSION && header.format <= COOKED_BC3 &&
+		header.width >= 1 && header.width <= MAX_COOKED_SIZE && header.height >= 1 && header.height <= MAX_COOKED_SIZE &&
+		header.levelCount >= 1 && header.levelCount <= FullChainLength(header.width, header.height);
+
+	// The levels the header describes must be exactly what follows it, so a truncated
+	// or padded file is rejected before anything is read into the levels
+	std::vector<size_t> levelSizes;
+	if (ok) {
+		size_t expected = sizeof(header);
+		int width = header.width, height = header.height;
+		for (unsigned int i = 0; i < header.levelCount; ++i) {
+			levelSizes.push_back(CookedLevelSize(header.format, width, height));
+			expected += levelSizes.back();
+			width = std::max(1, width / 2);
+			height = std::max(1, height / 2);
+		}
+		long end = fseek(file, 0, SEEK_END) == 0 ? ftell(file) : -1;
+		ok = end >= 0 && (size_t)end == expected && fseek(file, sizeof(header), SEEK_SET) == 0;
+	}
+	if (ok) {
+		cooked.format = header.format;
+		cooked.srgb = (header.flags & COOKED_FLAG_SRGB) != 0;
+		cooked.width = header.width;
+		cooked.height = header.height;
+		cooked.levels.resize(header.levelCount);
+		for (size_t i = 0; i < cooked.levels.size() && ok; ++i) {
+			cooked.levels[i].resize(levelSizes[i]);
+			ok = fread(&cooked.levels[i][0], 1, cooked.levels[i].size(), file) == cooked.levels[i].size();
+		}
+	}
+	fclose(file);
+
+	if (!ok) {
+		std::cout << "Invalid cooked texture " << path << std::endl;
+	}
+	return ok;
+}
+
+std::string CookedTexturePath(const char* texture_file_path) {
+	std::string path(texture_file_path);
+	size_t dot = path.find_last_of('.');
+	size_t slash = path.find_last_of("/\\");
+	if (dot != std::string::npos && (slash == std::string::npos || dot > slash)) {
+		path.erase(dot);
+	}
+	return path + ".ctex";
+}
@@ -0,0 +1,42 @@
+#ifndef _TEXTURE_COOK_H_
+#define _TEXTURE_COOK_H_
+
+#include "headers.h"
+
+// Block-compressed formats a cooked texture can hold
+enum CookedFormat {
+	COOKED_BC1 = 0,		// RGB, 8 bytes per 4x4 block
+	COOKED_BC3 = 1		// RGBA, 16 bytes per 4x4 block
+};
+
+// A texture with its whole mip chain already compressed, as stored in a .ctex file
+struct CookedTexture {
+	int format;
+	bool srgb;
+	int width;
+	int height;
+	std::vector<std::vector<unsigned char> > levels;
+};
+
+// Every mip level of an RGBA8 image down to 1x1, levels[0] being the image itself.
+// Colour images (srgb) are filtered in linear space, and colour is weighted by alpha.
+// threadCount 0 uses every core.
+void BuildMipChain(const unsigned char* rgba, int width, int height, bool srgb, int threadCount,
+	std::vector<std::vector<unsigned char> >& levels);
+
+// Builds the mip chain of an RGBA8 image and compresses every level. Colour images
+// (srgb) are filtered in linear space. Images with any non-opaque pixel become BC3,
+// the rest BC1. threadCount 0 uses every core.
+void CookTexture(const unsigned char* rgba, int width, int height, bool srgb, int threadCount, CookedTexture& cooked);
+
+bool WriteCookedTexture(const char* path, const CookedTexture& cooked);
+// Rejects files whose header does not match their size, so a truncated file is never
+// read past its end
+bool ReadCookedTexture(const char* path, CookedTexture& cooked);
+
+// Where the cooked version of an image is looked for: same name, .ctex extension
+std::string CookedTexturePath(const char* texture_file_path);
+
+size_t CookedLevelSize(int format, int width, int height);
+
+#endif
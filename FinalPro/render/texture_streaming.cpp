@@ -0,0 +1,357 @@
+#include "texture_streaming.h"
+#include "texture.h"
+
+void MakeMipChain(const unsigned char* pixels, int width, int height, int channels, bool srgb, MipChain& chain) {
+	// Channels fill RGBA in order, the rest is 0 and alpha opaque
+	size_t texelCount = (size_t)width * height;
+	std::vector<unsigned char> rgba(texelCount * 4);
+	for (size_t i = 0; i < texelCount; ++i) {
+		for (int c = 0; c < 4; ++c) {
+			rgba[i * 4 + c] = c < channels ? pixels[i * channels + c] : (c == 3 ? 255 : 0);
+		}
+	}
+
+	GLenum format;
+	GLint internalFormat;
+	ImageFormat(channels, srgb, format, internalFormat);
+	chain.target = GL_TEXTURE_2D;
+	chain.width = width;
+	chain.height = height;
+	chain.layers = 1;
+	chain.internalFormat = internalFormat;
+	chain.format = GL_RGBA;
+	BuildMipChain(&rgba[0], width, height, srgb && channels >= 3, 1, chain.levels);
+}
+
+void MakeMipChain(CookedTexture& cooked, MipChain& chain) {
+	chain.target = GL_TEXTURE_2D;
+	chain.width = cooked.width;
+	chain.height = cooked.height;
+	chain.layers = 1;
+	chain.internalFormat = CookedInternalFormat(cooked);
+	chain.format = 0;
+	chain.levels.swap(cooked.levels);
+	cooked.levels.clear();
+}
+
+void StackMipChains(const std::vector<MipChain>& layers, MipChain& array) {
+	array = MipChain();
+	if (layers.empty()) {
+		return;
+	}
+	array.target = GL_TEXTURE_2D_ARRAY;
+	array.width = layers[0].width;
+	array.height = layers[0].height;
+	array.layers = (int)layers.size();
+	array.internalFormat = layers[0].internalFormat;
+	array.format = layers[0].format;
+	array.levels.resize(layers[0].levels.size());
+	for (size_t level = 0; level < array.levels.size(); ++level) {
+		for (size_t layer = 0; layer < layers.size(); ++layer) {
+			const std::vector<unsigned char>& pixels = layers[layer].levels[level];
+			array.levels[level].insert(array.levels[level].end(), pixels.begin(), pixels.end());
+		}
+	}
+}
+
+namespace {
+
+// Defines one level of texture, which must be bound; NULL pixels with a 0 size leave
+// it empty
+void specifyLevel(const MipChain& chain, int level, int width, int height, const std::vector<unsigned char>* pixels) {
+	const void* data = pixels ? &(*pixels)[0] : NULL;
+	GLsizei size = pixels ? (GLsizei)pixels->size() : 0;
+	int layers = width > 0 ? chain.layers : 0;
+	if (chain.target == GL_TEXTURE_2D_ARRAY) {
+		if (chain.format == 0) {
+			glCompressedTexImage3D(chain.target, level, chain.internalFormat, width, height, layers, 0, size, data);
+		}
+		else {
+			glTexImage3D(chain.target, level, chain.internalFormat, width, height, layers, 0, chain.format, GL_UNSIGNED_BYTE, data);
+		}
+	}
+	else if (chain.format == 0) {
+		glCompressedTexImage2D(chain.target, level, chain.internalFormat, width, height, 0, size, data);
+	}
+	else {
+		glTexImage2D(chain.target, level, chain.internalFormat, width, height, 0, chain.format, GL_UNSIGNED_BYTE, data);
+	}
+}
+
+void uploadLevel(const MipChain& chain, int level) {
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	specifyLevel(chain, level, chain.levelWidth(level), chain.levelHeight(level), &chain.levels[level]);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+void clearLevel(const MipChain& chain, int level) {
+	specifyLevel(chain, level, 0, 0, NULL);
+}
+
+}
+
+void TextureStreamer::initialize(size_t budgetBytes) {
+	this->budgetBytes = budgetBytes;
+	updateBytes = 4 << 20;
+	tailSize = 64;
+	stats = TextureStreamStats();
+	stats.budgetBytes = budgetBytes;
+}
+
+GLuint TextureStreamer::add(GLuint texture, MipChain& chain) {
+	if (chain.levels.empty()) {
+		return texture;
+	}
+	bool existing = texture != 0;
+	if (!existing) {
+		glGenTextures(1, &texture);
+	}
+	glBindTexture(chain.target, texture);
+	if (!existing) {
+		glTexParameteri(chain.target, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(chain.target, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(chain.target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(chain.target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	}
+	int lastLevel = (int)chain.levels.size() - 1;
+	glTexParameteri(chain.target, GL_TEXTURE_MAX_LEVEL, lastLevel);
+
+	if (!enabled()) {
+		for (int level = lastLevel; level >= 0; --level) {
+			uploadLevel(chain, level);
+		}
+		glTexParameteri(chain.target, GL_TEXTURE_BASE_LEVEL, 0);
+		glBindTexture(chain.target, 0);
+		std::vector<std::vector<unsigned char> >().swap(chain.levels);
+		return texture;
+	}
+
+	remove(texture);
+	indices[texture] = textures.size();
+	textures.push_back(StreamedTexture());
+	StreamedTexture& streamed = textures.back();
+	streamed.texture = texture;
+	std::swap(streamed.chain, chain);
+
+	streamed.bytesFrom.assign(lastLevel + 2, 0);
+	for (int level = lastLevel; level >= 0; --level) {
+		streamed.bytesFrom[level] = streamed.bytesFrom[level + 1] + streamed.chain.levels[level].size();
+	}
+	streamed.tailLevel = 0;
+	while (streamed.tailLevel < lastLevel && std::max(streamed.chain.levelWidth(streamed.tailLevel),
+		streamed.chain.levelHeight(streamed.tailLevel)) > tailSize) {
+		streamed.tailLevel++;
+	}
+
+	// Whatever the texture held above the tail goes, the placeholder's level 0 included
+	for (int level = 0; level < streamed.tailLevel && existing; ++level) {
+		clearLevel(streamed.chain, level);
+	}
+	for (int level = lastLevel; level >= streamed.tailLevel; --level) {
+		uploadLevel(streamed.chain, level);
+	}
+	glTexParameteri(streamed.chain.target, GL_TEXTURE_BASE_LEVEL, streamed.tailLevel);
+	glBindTexture(streamed.chain.target, 0);
+
+	streamed.residentLevel = streamed.tailLevel;
+	streamed.neededLevel = streamed.tailLevel;
+	streamed.targetLevel = streamed.tailLevel;
+	streamed.lastNeeded = 0;
+	residentBytes += streamed.bytesFrom[streamed.tailLevel];
+	return texture;
+}
+
+void TextureStreamer::remove(GLuint texture) {
+	std::map<GLuint, size_t>::iterator it = indices.find(texture);
+	if (it == indices.end()) {
+		return;
+	}
+	size_t index = it->second;
+	indices.erase(it);
+	residentBytes -= textures[index].bytesFrom[textures[index].residentLevel];
+	if (index + 1 != textures.size()) {
+		std::swap(textures[index], textures.back());
+		indices[textures[index].texture] = index;
+	}
+	textures.pop_back();
+}
+
+void TextureStreamer::beginFrame(const glm::mat4& projectionMatrix, int viewportHeight) {
+	frame++;
+	pixelsPerUnitAtOne = 0.5f * projectionMatrix[1][1] * viewportHeight;
+	for (size_t t = 0; t < textures.size(); ++t) {
+		textures[t].neededLevel = textures[t].tailLevel;
+	}
+}
+
+void TextureStreamer::request(GLuint texture, float uvPerUnit, float pixelsPerUnit) {
+	std::map<GLuint, size_t>::iterator it = indices.find(texture);
+	if (it == indices.end() || uvPerUnit <= 0.0f) {
+		return;
+	}
+	StreamedTexture& streamed = textures[it->second];
+
+	// Texels of level 0 on a pixel along the longer side; each level halves them
+	float texelsPerPixel = std::max(streamed.chain.width, streamed.chain.height) * uvPerUnit / std::max(pixelsPerUnit, 1e-6f);
+	int level = texelsPerPixel > 1.0f ? (int)floorf(log2f(texelsPerPixel)) : 0;
+	level = std::min(level, streamed.tailLevel);
+	streamed.neededLevel = std::min(streamed.neededLevel, level);
+	streamed.lastNeeded = frame;
+	if (std::min(level + stats.budgetBias, streamed.tailLevel) < streamed.residentLevel) {
+		pending = true;
+	}
+}
+
+void TextureStreamer::loadLevel(StreamedTexture& streamed) {
+	int level = streamed.residentLevel - 1;
+	glBindTexture(streamed.chain.target, streamed.texture);
+	uploadLevel(streamed.chain, level);
+	glTexParameteri(streamed.chain.target, GL_TEXTURE_BASE_LEVEL, level);
+	glBindTexture(streamed.chain.target, 0);
+	streamed.residentLevel = level;
+	residentBytes += streamed.chain.levels[level].size();
+	stats.levelsLoaded++;
+}
+
+void TextureStreamer::dropLevel(StreamedTexture& streamed) {
+	int level = streamed.residentLevel;
+	glBindTexture(streamed.chain.target, streamed.texture);
+	glTexParameteri(streamed.chain.target, GL_TEXTURE_BASE_LEVEL, level + 1);
+	clearLevel(streamed.chain, level);
+	glBindTexture(streamed.chain.target, 0);
+	streamed.residentLevel = level + 1;
+	residentBytes -= streamed.chain.levels[level].size();
+	stats.levelsDropped++;
+}
+
+bool TextureStreamer::evict() {
+	StreamedTexture* victim = NULL;
+	for (size_t t = 0; t < textures.size(); ++t) {
+		StreamedTexture& streamed = textures[t];
+		if (streamed.residentLevel >= streamed.targetLevel) {
+			continue;
+		}
+		if (!victim || streamed.lastNeeded < victim->lastNeeded || (streamed.lastNeeded == victim->lastNeeded &&
+			streamed.chain.levels[streamed.residentLevel].size() > victim->chain.levels[victim->residentLevel].size())) {
+			victim = &streamed;
+		}
+	}
+	if (!victim) {
+		return false;
+	}
+	dropLevel(*victim);
+	return true;
+}
+
+void TextureStreamer::update() {
+	stats.levelsLoaded = 0;
+	stats.levelsDropped = 0;
+	if (!enabled()) {
+		return;
+	}
+
+	// The smallest bias under which the needs fit the budget; the tails always stay
+	int maxBias = 0;
+	for (size_t t = 0; t < textures.size(); ++t) {
+		maxBias = std::max(maxBias, textures[t].tailLevel);
+	}
+	int bias = 0;
+	size_t targetBytes = 0;
+	for (;; ++bias) {
+		targetBytes = 0;
+		for (size_t t = 0; t < textures.size(); ++t) {
+			const StreamedTexture& streamed = textures[t];
+			targetBytes += streamed.bytesFrom[std::min(streamed.neededLevel + bias, streamed.tailLevel)];
+		}
+		if (bias == 0) {
+			stats.wantedBytes = targetBytes;
+		}
+		if (targetBytes <= budgetBytes || bias >= maxBias) {
+			break;
+		}
+	}
+	stats.budgetBias = bias;
+	for (size_t t = 0; t < textures.size(); ++t) {
+		textures[t].targetLevel = std::min(textures[t].neededLevel + bias, textures[t].tailLevel);
+	}
+
+	// Room the bias leaves goes back a level at a time, to the textures furthest from
+	// their need first
+	for (;;) {
+		StreamedTexture* furthest = NULL;
+		for (size_t t = 0; t < textures.size(); ++t) {
+			StreamedTexture& streamed = textures[t];
+			int gap = streamed.targetLevel - streamed.neededLevel;
+			if (gap > 0 && targetBytes + streamed.chain.levels[streamed.targetLevel - 1].size() <= budgetBytes &&
+				(!furthest || gap > furthest->targetLevel - furthest->neededLevel)) {
+				furthest = &streamed;
+			}
+		}
+		if (!furthest) {
+			break;
+		}
+		furthest->targetLevel--;
+		targetBytes += furthest->chain.levels[furthest->targetLevel].size();
+	}
+
+	// The texture furthest from its target gets the next finer level, making room when
+	// the budget is short. Targets fit the budget, so dropping what is above them always
+	// makes enough.
+	size_t uploaded = 0;
+	for (;;) {
+		StreamedTexture* neediest = NULL;
+		for (size_t t = 0; t < textures.size(); ++t) {
+			StreamedTexture& streamed = textures[t];
+			int gap = streamed.residentLevel - streamed.targetLevel;
+			if (gap > 0 && (!neediest || gap > neediest->residentLevel - neediest->targetLevel)) {
+				neediest = &streamed;
+			}
+		}
+		if (!neediest) {
+			break;
+		}
+		size_t bytes = neediest->chain.levels[neediest->residentLevel - 1].size();
+		if (uploaded > 0 && uploaded + bytes > updateBytes) {
+			break;
+		}
+		while (residentBytes + bytes > budgetBytes && evict()) {
+		}
+		if (residentBytes + bytes > budgetBytes) {
+			break;
+		}
+		loadLevel(*neediest);
+		uploaded += bytes;
+	}
+	// A budget lowered at run time
+	while (residentBytes > budgetBytes && evict()) {
+	}
+
+	pending = false;
+	stats.textures = (int)textures.size();
+	stats.visible = 0;
+	stats.sharp = 0;
+	stats.fullBytes = 0;
+	for (size_t t = 0; t < textures.size(); ++t) {
+		const StreamedTexture& streamed = textures[t];
+		pending = pending || streamed.residentLevel > streamed.targetLevel;
+		stats.fullBytes += streamed.bytesFrom[0];
+		if (streamed.lastNeeded == frame) {
+			stats.visible++;
+			stats.sharp += streamed.residentLevel <= streamed.neededLevel ? 1 : 0;
+		}
+	}
+	stats.budgetBytes = budgetBytes;
+	stats.residentBytes = residentBytes;
+}
+
+void TextureStreamer::cleanup() {
+	textures.clear();
+	indices.clear();
+	residentBytes = 0;
+	pending = false;
+}
+
+TextureStreamer& SharedTextureStreamer() {
+	static TextureStreamer streamer;
+	return streamer;
+}
@@ -0,0 +1,132 @@
+#ifndef _TEXTURE_STREAMING_H_
+#define _TEXTURE_STREAMING_H_
+
+#include "headers.h"
+#include "texture_cook.h"
+
+#include <map>
+
+// Every mip level of a texture in system memory, finest first. A level of an array
+// texture holds all of its layers back to back. format is 0 for block-compressed
+// levels, which go up with glCompressedTexImage*.
+struct MipChain {
+	GLenum target;			// GL_TEXTURE_2D or GL_TEXTURE_2D_ARRAY
+	int width, height, layers;
+	GLint internalFormat;
+	GLenum format;
+	std::vector<std::vector<unsigned char> > levels;
+
+	MipChain() : target(GL_TEXTURE_2D), width(0), height(0), layers(1), internalFormat(0), format(0) {}
+
+	int levelWidth(int level) const { return std::max(1, width >> level); }
+	int levelHeight(int level) const { return std::max(1, height >> level); }
+};
+
+// Builds the chain of a tightly packed 8-bit image with 1-4 channels, stored as RGBA
+// and uploaded in the internal format ImageFormat() picks. Colour (srgb) is filtered
+// in linear space. Meant for worker threads.
+void MakeMipChain(const unsigned char* pixels, int width, int height, int channels, bool srgb, MipChain& chain);
+
+// Takes the levels of a cooked texture, leaving it empty
+void MakeMipChain(CookedTexture& cooked, MipChain& chain);
+
+// Stacks same-sized 2D chains into the chain of an array texture, one layer each
+void StackMipChains(const std::vector<MipChain>& layers, MipChain& array);
+
+// What the last update() left resident, and how hard the budget pressed
+struct TextureStreamStats {
+	int textures;
+	int visible;				// Requested in the last frame
+	int sharp;					// Visible with the level they need resident
+	size_t budgetBytes;
+	size_t residentBytes;
+	size_t wantedBytes;			// Resident if every visible texture had the level it needs
+	size_t fullBytes;			// Every level of every texture
+	int budgetBias;				// Levels visible textures are held above their need to fit, at most
+	int levelsLoaded;
+	int levelsDropped;
+};
+
+// Mip streaming under a fixed budget of texture memory. Textures are handed over with
+// their whole chain in system memory; the small levels at the end of the chain go up
+// at once and stay, so every texture samples something right away. Finer levels come
+// and go through GL_TEXTURE_BASE_LEVEL: the levels from the base to the last one are
+// defined, those above it are respecified empty so the driver can free them.
+//
+// Users ask every frame for the level they need, from how many texels of the texture
+// fall on a pixel where it is nearest to the camera. update() then works out one
+// budget bias, the number of levels every visible texture gives up so that their
+// needs fit, and hands what room that leaves back to the textures furthest from their
+// need. It loads missing levels, furthest from the target first, and drops levels no
+// longer needed, those of the textures unseen the longest first, only when room is
+// short.
+//
+// A budget of 0 disables streaming: add() uploads every level and keeps no copy.
+struct TextureStreamer {
+	struct StreamedTexture {
+		GLuint texture;
+		MipChain chain;
+		std::vector<size_t> bytesFrom;	// Size of levels l to the last, at index l
+		int tailLevel;					// Resident for good from this level down
+		int residentLevel;				// Finest level defined on the GPU
+		int neededLevel;				// Finest level asked for this frame, tailLevel if none
+		int targetLevel;				// What the last update() aimed for
+		unsigned int lastNeeded;		// Frame of the last request
+	};
+	std::vector<StreamedTexture> textures;
+	std::map<GLuint, size_t> indices;
+
+	size_t budgetBytes;
+	size_t updateBytes;			// Uploaded at most per update(), at least one level
+	int tailSize;				// Levels no larger than this go up with the texture
+
+	float pixelsPerUnitAtOne;	// Pixels one world unit spans at view depth 1
+	unsigned int frame;
+	size_t residentBytes;
+	bool pending;				// Some texture is short of the level it was last asked for
+	TextureStreamStats stats;
+
+	TextureStreamer() : budgetBytes(0), updateBytes(0), tailSize(64), pixelsPerUnitAtOne(1.0f), frame(0),
+		residentBytes(0), pending(false), stats() {}
+
+	void initialize(size_t budgetBytes);
+	bool enabled() const { return budgetBytes > 0; }
+
+	// Takes over chain and uploads its tail into texture, or into a new texture with
+	// repeat wrapping and trilinear filtering when it is 0. Other levels texture may
+	// have, such as a placeholder's, are dropped. Returns the texture.
+	GLuint add(GLuint texture, MipChain& chain);
+
+	// Forgets texture; call before deleting it
+	void remove(GLuint texture);
+
+	// Starts a frame drawn with this projection into a viewport viewportHeight pixels high
+	void beginFrame(const glm::mat4& projectionMatrix, int viewportHeight);
+
+	float pixelsPerUnit(float viewDepth) const { return pixelsPerUnitAtOne / std::max(viewDepth, 1e-4f); }
+
+	// A user of texture needs it sharp where uvPerUnit texture coordinates span one world
+	// unit and one world unit covers pixelsPerUnit pixels. Textures not streamed are ignored.
+	void request(GLuint texture, float uvPerUnit, float pixelsPerUnit);
+
+	// Loads and drops levels for this frame's requests, on the GL thread
+	void update();
+
+	// True once every texture has the level last asked for, budget allowing
+	bool settled() const { return !pending; }
+
+	void cleanup();
+
+	// One level finer or coarser than the resident one
+	void loadLevel(StreamedTexture& streamed);
+	void dropLevel(StreamedTexture& streamed);
+
+	// Drops a level of the texture unseen the longest among those holding more than
+	// their target; false when none does
+	bool evict();
+};
+
+// The streamer every texture loader and user goes through
+TextureStreamer& SharedTextureStreamer();
+
+#endif
@@ -0,0 +1,277 @@
+#include <render/shadows.h>
+#include <render/frame_uniforms.h>
+#include <render/profiler.h>
+#include <render/scene_graph.h>
+#include <render/scatter.h>
+#include <render/occlusion.h>
+#include <render/texture_streaming.h>
+
+#include <chrono>
+
+#include "model.cpp"
+#include "terrain.cpp"
+#include "city.cpp"
+#include "skybox.cpp"
+
+// The demo scene, shared by the viewer and the benchmark: a procedural city on the
+// flat ground at the origin and instanced trees scattered over the streamed terrain
+// around it, lit by a sun with cascaded shadows under a sky box. Buildings and hills occlude what is
+// behind them. Assets come in through the caller's loader and render() draws
+// whatever is resident so far; textures stream their mip levels through
+// SharedTextureStreamer(), within whatever budget the caller gave it.
+struct Scene {
+	Model tree;
+	Terrain terrain;
+	City city;
+	Skybox sky;
+	glm::vec3 lightPosition;
+
+	GLuint modelProgramID;
+	GLuint depthProgramID;
+	GLuint depthVPID;
+	GLuint impostorProgramID;
+
+	AsyncLoader* loader;
+
+	ShadowCascades shadows;
+
+	// Low-resolution depth of the occluders from the camera, redrawn every frame
+	OcclusionBuffer occlusion;
+
+	// Everything drawn in a frame goes through one queue, sorted to minimise state changes
+	RenderQueue renderQueue;
+
+	// Shadow depth draws of the last frame, which bypass the queue
+	int shadowDraws;
+
+	// When not 0, GL_PRIMITIVES_GENERATED queries around the shadow passes and around the
+	// queue flush of each frame, for tools that count triangles
+	GLuint shadowPrimitivesQuery;
+	GLuint primitivesQuery;
+
+	// Callbacks keep a pointer to the scene, it must not move after this
+	void initialize(AsyncLoader& loader, bool gpuDriven, float zFar) {
+		lightPosition = glm::vec3(200.0f, 400.0f, 200.0f);
+		modelProgramID = 0;
+		depthProgramID = 0;
+		depthVPID = 0;
+		impostorProgramID = 0;
+		this->loader = &loader;
+		shadowDraws = 0;
+		shadowPrimitivesQuery = 0;
+		primitivesQuery = 0;
+
+		// Camera, light and shadows reach every program through the shared blocks
+		SharedFrameUniforms().initialize();
+		LightingBlock lighting;
+		lighting.position = glm::vec4(lightPosition, 1.0f);
+		lighting.intensity = glm::vec3(3.0f, 3.0f, 3.0f);
+		lighting.exposure = 1.0f;
+		SharedFrameUniforms().setLighting(lighting);
+
+		// One instanced tree model with packed vertices, LODs are built on import
+		tree.initializeAsync(loader, 0, glm::vec3(0.0f), glm::vec3(5.0f), "../FinalPro/assets/Tree 02/Tree.obj", VERTEX_PACKED);
+		if (gpuDriven) {
+			tree.enableGpuDriven();
+		}
+
+		// Trees covering less than a tenth of the screen height draw as impostors
+		tree.enableImpostors(0.1f);
+		loader.loadShaders("../FinalPro/shaders/impostor.vert", "../FinalPro/shaders/impostor.frag", [this](GLuint programID) {
+			impostorProgramID = programID;
+			if (programID != 0) {
+				tree.setImpostorProgram(programID);
+			}
+		});
+
+		loader.loadShaders("../FinalPro/shaders/model.vert", "../FinalPro/shaders/model.frag", [this](GLuint programID) {
+			if (programID == 0) {
+				std::cerr << "Failed to load shaders." << std::endl;
+				return;
+			}
+			modelProgramID = programID;
+			tree.setProgram(modelProgramID);
+		});
+
+		// Casters are drawn into the shadow cascades with a depth-only program
+		loader.loadShaders("../FinalPro/shaders/depth.vert", "../FinalPro/shaders/depth.frag", [this](GLuint programID) {
+			depthProgramID = programID;
+			depthVPID = glGetUniformLocation(programID, "VP");
+
+			// Skinned casters read their joints on the same unit as in the model program
+			glUseProgram(programID);
+			glUniform1i(glGetUniformLocation(programID, "jointPalettes"), 3);
+			glUseProgram(0);
+		});
+
+		// Streamed heightmap ground, flat around the origin
+		TerrainSettings terrainSettings;
+		DefaultTerrainSettings(terrainSettings);
+		terrain.initialize(&loader, 0.0f, terrainSettings);
+
+		// Blocks of buildings inside the flat area
+		CitySettings citySettings;
+		DefaultCitySettings(citySettings);
+		city.initialize(&loader, citySettings, [this](float x, float z) { return terrain.heightAt(x, z); });
+
+		// Trees scattered over the ground around the city, off the steep slopes
+		ScatterSpecies trees;
+		DefaultScatterSpecies(trees);
+		trees.spacing = 25.0f;
+		trees.maxSlope = 0.6f;
+		trees.minScale = 0.8f;
+		trees.maxScale = 1.2f;
+		ScatterRegion forest;
+		forest.min = glm::vec2(-400.0f);
+		forest.max = glm::vec2(400.0f);
+		forest.cellSize = 100.0f;
+		forest.height = [this](float x, float z) { return terrain.heightAt(x, z); };
+		forest.density = [this](float x, float z) { return city.covers(x, z, 10.0f) ? 0.0f : 1.0f; };
+
+		std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+		std::vector<glm::mat4> treeTransforms;
+		Scatter(forest, trees, treeTransforms);
+		tree.setInstances(treeTransforms);
+		std::cout << "Scattered " << treeTransforms.size() << " trees in "
+			<< std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count() << " ms" << std::endl;
+
+		renderQueue.depthRange = zFar;
+
+		// Sun shadows from the light position towards the origin
+		shadows.initialize(4, 2048);
+
+		occlusion.initialize(256, 192);
+
+		// Follows the camera; half the far distance keeps its corners inside the frustum
+		sky.initialize(glm::vec3(0.0f), glm::vec3(zFar * 0.5f));
+	}
+
+	// Draws one frame into framebuffer (0 for the window), which is width x height,
+	// bound and already cleared. Animations move on by deltaTime seconds.
+	void render(const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix, const glm::vec3& eye,
+		float fovY, float aspect, float zNear, GLuint framebuffer, int width, int height, float deltaTime) {
+		glm::mat4 vp = projectionMatrix * viewMatrix;
+		SharedFrameUniforms().setCamera(viewMatrix, projectionMatrix, eye);
+		SharedTextureStreamer().beginFrame(projectionMatrix, height);
+
+		// Nodes moved since the last frame reach the casters before the shadow caches
+		// compare caster versions
+		SharedSceneGraph().update();
+		tree.updateTransforms();
+		tree.animate(loader->workers, deltaTime);
+
+		// The impostor is baked from the textures, so it waits until they are resident
+		// down to the level its frames need
+		if (tree.needsImpostor() && loader->isIdle()) {
+			tree.requestImpostorTextures();
+			if (SharedTextureStreamer().settled()) {
+				tree.loadImpostor();
+			}
+		}
+
+		// Only cascades whose window moved or whose casters changed are redrawn
+		shadowDraws = 0;
+		if (shadowPrimitivesQuery != 0) {
+			glBeginQuery(GL_PRIMITIVES_GENERATED, shadowPrimitivesQuery);
+		}
+		if (depthProgramID != 0 && modelProgramID != 0) {
+			PROFILE_GPU_SCOPE("Shadow depth");
+			glm::vec3 lightDirection = glm::normalize(-lightPosition);
+			shadows.update(viewMatrix, fovY, aspect, zNear, lightDirection, tree.casterVersion + city.casterVersion);
+			for (int i = 0; i < shadows.cascadeCount; ++i) {
+				if (shadows.cascades[i].needsRender) {
+					shadows.beginCascade(i);
+					shadowDraws += tree.renderDepth(depthProgramID, depthVPID, shadows.cascades[i].lightSpaceMatrix);
+					shadowDraws += city.renderDepth(depthProgramID, depthVPID, shadows.cascades[i].lightSpaceMatrix);
+				}
+			}
+			shadows.end(framebuffer, width, height);
+			shadows.apply(1);
+		}
+		if (shadowPrimitivesQuery != 0) {
+			glEndQuery(GL_PRIMITIVES_GENERATED);
+		}
+
+		Frustum frustum = ExtractFrustum(vp);
+		{
+			PROFILE_SCOPE("Occlusion");
+			occlusion.begin(vp);
+			city.addOccluders(occlusion, frustum);
+			terrain.addOccluders(occlusion, frustum);
+			occlusion.finish();
+		}
+
+		{
+			PROFILE_SCOPE("Submit");
+			tree.submit(renderQueue, vp, frustum, &occlusion);
+			city.submit(renderQueue, frustum, eye, &occlusion);
+			terrain.submit(renderQueue, vp, eye);
+			sky.updatePosition(eye - glm::vec3(0.0f, sky.scale.y, 0.0f));
+			sky.submit(renderQueue);
+		}
+		if (primitivesQuery != 0) {
+			glBeginQuery(GL_PRIMITIVES_GENERATED, primitivesQuery);
+		}
+		renderQueue.flush();
+		if (primitivesQuery != 0) {
+			glEndQuery(GL_PRIMITIVES_GENERATED);
+		}
+
+		// Levels loaded now are sampled from the next frame
+		{
+			PROFILE_SCOPE("Texture streaming");
+			SharedTextureStreamer().update();
+		}
+	}
+
+	// The loader must be shut down first so no callback runs on a released scene
+	void cleanup() {
+		tree.cleanup();
+		terrain.cleanup();
+		city.cleanup();
+		sky.cleanup();
+		SharedGeometryArena().cleanup();
+		ReleaseShaders(modelProgramID);
+		ReleaseShaders(depthProgramID);
+		ReleaseShaders(impostorProgramID);
+		shadows.cleanup();
+		occlusion.cleanup();
+		SharedFrameUniforms().cleanup();
+		SharedTextureStreamer().cleanup();
+	}
+
+	// Occlusion counts of the last frame, including those made on the GPU
+	OcclusionStats occlusionStats() const {
+		OcclusionStats stats = occlusion.stats;
+		tree.readOcclusionStats(stats);
+		return stats;
+	}
+
+	void printStats() {
+		std::cout << "Render queue, last frame: " << renderQueue.stats.draws << " draws, "
+			<< renderQueue.stats.avoidedChanges << " state changes avoided" << std::endl;
+		CullStats culled;
+		tree.readCullStats(culled);
+		std::cout << "Trees, last frame: " << culled.instancesVisible << " of " << culled.instancesVisible + culled.instancesCulled
+			<< " instances drawn (" << culled.instancesOccluded << " occluded), " << culled.primitivesVisible << " of "
+			<< culled.primitivesVisible + culled.primitivesCulled << " primitives" << std::endl;
+		std::cout << "City, last frame: " << city.stats.blocksDrawn << " of " << city.stats.blocks << " blocks, "
+			<< city.stats.buildingsDrawn << " of " << city.stats.buildings << " buildings drawn" << std::endl;
+		std::cout << "Terrain, last frame: " << terrain.stats.chunks << " chunks, " << terrain.stats.triangles
+			<< " triangles, " << terrain.stats.tilesResident << " tiles resident" << std::endl;
+		OcclusionStats occluded = occlusionStats();
+		std::cout << "Occlusion culling, last frame: " << occluded.occluded << " of " << occluded.tested << " instances hidden ("
+			<< occluded.occludedPercent() << "%), " << occluded.occluderTriangles << " occluder triangles in "
+			<< occluded.rasterMs << " ms" << std::endl;
+		std::cout << "Shadow cascades: " << shadows.cascadesRendered << " rendered, "
+			<< shadows.cascadesCached << " reused from cache, " << shadowDraws << " draws" << std::endl;
+		const TextureStreamStats& streamed = SharedTextureStreamer().stats;
+		if (SharedTextureStreamer().enabled()) {
+			const double mb = 1.0 / (1 << 20);
+			std::cout << "Texture streaming, last frame: " << streamed.residentBytes * mb << " of " << streamed.budgetBytes * mb
+				<< " MB budget resident, " << streamed.wantedBytes * mb << " MB wanted, " << streamed.fullBytes * mb
+				<< " MB with every level; " << streamed.sharp << " of " << streamed.visible << " visible textures sharp, budget bias "
+				<< streamed.budgetBias << " levels" << std::endl;
+		}
+	}
+};
@@ -0,0 +1,86 @@
+#version 330 core
+
+in vec3 worldPosition;
+in vec3 worldNormal;
+in vec2 uv;
+flat in float layer;
+
+// Every facade, and the roof, as layers of one array
+uniform sampler2DArray facades;
+
+out vec4 finalColor;
+
+// Shared by every program, uploaded once per frame (see FrameUniforms)
+layout(std140) uniform Camera {
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec4 cameraPosition;
+    vec4 cameraForward;
+};
+
+layout(std140) uniform Lighting {
+    vec4 lightPosition;
+    vec3 lightIntensity;
+    float exposure;
+};
+
+// Cascaded shadow maps, as in model.frag
+#define MAX_CASCADES 4
+uniform sampler2DArrayShadow shadowMap;
+layout(std140) uniform Shadows {
+    mat4 lightSpaceMatrices[MAX_CASCADES];
+    vec4 cascadeSplits;
+    int cascadeCount;
+};
+
+float shadowFactor(vec3 position)
+{
+    float viewDepth = dot(position - cameraPosition.xyz, cameraForward.xyz);
+    int cascade = 0;
+    while (cascade < cascadeCount && viewDepth > cascadeSplits[cascade]) {
+        cascade++;
+    }
+    if (cascade >= cascadeCount) {
+        return 1.0;
+    }
+
+    vec4 lightCoords = lightSpaceMatrices[cascade] * vec4(position, 1.0);
+    lightCoords.xyz = lightCoords.xyz / lightCoords.w * 0.5 + 0.5;
+    if (lightCoords.z > 1.0) {
+        return 1.0;
+    }
+
+    vec2 texelSize = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+    float lit = 0.0;
+    for (int x = -1; x <= 1; ++x) {
+        for (int y = -1; y <= 1; ++y) {
+            vec2 offset = vec2(x, y) * texelSize;
+            lit += texture(shadowMap, vec4(lightCoords.xy + offset, float(cascade), lightCoords.z));
+        }
+    }
+    return lit / 9.0;
+}
+
+void main()
+{
+    // Lit like model.frag
+    vec3 normal = normalize(worldNormal);
+    vec3 lightDirection = normalize(lightPosition.xyz - worldPosition);
+    float distance = length(lightPosition.xyz - worldPosition);
+    float attenuation = 1.0;
+    float threshold = 300.0;
+    if (distance > threshold) {
+        float k1 = 0.001;
+        float k2 = 0.0002;
+        attenuation = 1.0 / (1.0 + k1 * (distance - threshold) + k2 * pow(distance - threshold, 2));
+    }
+    float diff = max(dot(normal, lightDirection), 0.0);
+    vec3 diffuse = diff * lightIntensity * attenuation * mix(0.2, 1.0, shadowFactor(worldPosition));
+    vec3 exposedColor = diffuse * exposure;
+    vec3 toneMappedColor = exposedColor / (exposedColor + vec3(1.0));
+
+    // The facades are sRGB, the sample is linear
+    vec3 albedo = texture(facades, vec3(uv, layer)).rgb;
+    finalColor = vec4(pow(albedo * toneMappedColor, vec3(1.0 / 2.2)), 1.0);
+}
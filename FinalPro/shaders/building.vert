@@ -0,0 +1,29 @@
+#version 330 core
+
+// BuildingVertex, already in world space
+layout(location = 0) in vec3 vertexPosition;
+layout(location = 1) in vec3 vertexNormal;
+layout(location = 2) in vec3 vertexUV;      // u, v, facade layer
+
+// Same outputs as model.vert, plus the layer
+out vec3 worldPosition;
+out vec3 worldNormal;
+out vec2 uv;
+flat out float layer;
+
+// Shared by every program, uploaded once per frame (see FrameUniforms)
+layout(std140) uniform Camera {
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec4 cameraPosition;
+    vec4 cameraForward;
+};
+
+void main() {
+    worldPosition = vertexPosition;
+    worldNormal = vertexNormal;
+    uv = vertexUV.xy;
+    layer = vertexUV.z;
+    gl_Position = viewProjection * vec4(vertexPosition, 1.0);
+}
@@ -0,0 +1,6 @@
+#version 330 core
+
+// Depth only, the rasterizer writes gl_FragCoord.z
+void main()
+{
+}
@@ -0,0 +1,50 @@
+#version 330 core
+
+// Input, same locations as model.vert
+layout(location = 0) in vec3 vertexPosition;
+
+// Per-instance model matrix, occupies locations 3 to 6
+layout(location = 3) in mat4 instanceMatrix;
+
+// Light view-projection of the cascade being rendered
+uniform mat4 VP;
+
+// Same block as model.vert, only the node transform, skinning and position
+// dequantization are read
+layout(std140) uniform Object {
+    mat4 modelMatrix;
+    vec4 baseColorFactor;
+    vec4 positionOffset;
+    vec4 positionScale;
+    vec4 uvTransform;
+    int isLight;
+    int skinned;
+    int jointOffset;
+    int packedNormals;
+};
+
+// Skinning, as in model.vert. The instance's palette starts at instancePalette in a
+// buffer of joint matrices, four texels each; vertices blend up to four joints.
+layout(location = 7) in int instancePalette;
+layout(location = 8) in uvec4 vertexJoints;
+layout(location = 9) in vec4 vertexWeights;
+uniform samplerBuffer jointPalettes;
+
+mat4 jointMatrix(int joint) {
+    int texel = (instancePalette + jointOffset + joint) * 4;
+    return mat4(texelFetch(jointPalettes, texel), texelFetch(jointPalettes, texel + 1),
+        texelFetch(jointPalettes, texel + 2), texelFetch(jointPalettes, texel + 3));
+}
+
+mat4 skinMatrix() {
+    return vertexWeights.x * jointMatrix(int(vertexJoints.x)) + vertexWeights.y * jointMatrix(int(vertexJoints.y)) +
+        vertexWeights.z * jointMatrix(int(vertexJoints.z)) + vertexWeights.w * jointMatrix(int(vertexJoints.w));
+}
+
+void main() {
+    mat4 worldMatrix = instanceMatrix * modelMatrix;
+    if (skinned != 0) {
+        worldMatrix = worldMatrix * skinMatrix();
+    }
+    gl_Position = VP * worldMatrix * vec4(positionOffset.xyz + positionScale.xyz * vertexPosition, 1);
+}
@@ -0,0 +1,118 @@
+#version 330 core
+
+#define GRID 8
+
+in vec3 worldPosition;
+in vec4 frameUV01;
+in vec4 frameUV23;
+flat in vec4 frameOrigin01;
+flat in vec4 frameOrigin23;
+flat in vec4 frameWeights;
+flat in mat3 normalMatrix;
+flat in float worldRadius;
+
+// Baked atlases, see ImpostorImages
+uniform sampler2D albedoAtlas;
+uniform sampler2D normalDepthAtlas;
+
+out vec4 finalColor;
+
+// Shared by every program, uploaded once per frame (see FrameUniforms)
+layout(std140) uniform Camera {
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec4 cameraPosition;
+    vec4 cameraForward;
+};
+
+layout(std140) uniform Lighting {
+    vec4 lightPosition;
+    vec3 lightIntensity;
+    float exposure;
+};
+
+// Cascaded shadow maps, as in model.frag. Impostors are far away, a single filtered
+// lookup stands in for the PCF kernel.
+#define MAX_CASCADES 4
+uniform sampler2DArrayShadow shadowMap;
+layout(std140) uniform Shadows {
+    mat4 lightSpaceMatrices[MAX_CASCADES];
+    vec4 cascadeSplits;
+    int cascadeCount;
+};
+
+float shadowFactor(vec3 position)
+{
+    float viewDepth = dot(position - cameraPosition.xyz, cameraForward.xyz);
+    int cascade = 0;
+    while (cascade < cascadeCount && viewDepth > cascadeSplits[cascade]) {
+        cascade++;
+    }
+    if (cascade >= cascadeCount) {
+        return 1.0;
+    }
+
+    vec4 lightCoords = lightSpaceMatrices[cascade] * vec4(position, 1.0);
+    lightCoords.xyz = lightCoords.xyz / lightCoords.w * 0.5 + 0.5;
+    if (lightCoords.z > 1.0) {
+        return 1.0;
+    }
+    return texture(shadowMap, vec4(lightCoords.xy, float(cascade), lightCoords.z));
+}
+
+// Adds one frame's sample, weighted by its coverage. Every frame is sampled so the
+// lookups stay in uniform control flow; rays missing the frame weigh nothing.
+void addFrame(vec2 uv, vec2 origin, float weight, inout vec3 albedo, inout vec4 normalDepth, inout float coverage)
+{
+    vec2 atlasUV = origin + clamp(uv, 0.0, 1.0) / float(GRID);
+    vec4 color = texture(albedoAtlas, atlasUV);
+    vec4 surface = texture(normalDepthAtlas, atlasUV);
+    float inside = uv == clamp(uv, 0.0, 1.0) ? 1.0 : 0.0;
+    float w = weight * color.a * inside;
+    albedo += color.rgb * w;
+    normalDepth += surface * w;
+    coverage += w;
+}
+
+void main()
+{
+    vec3 albedo = vec3(0.0);
+    vec4 normalDepth = vec4(0.0);
+    float coverage = 0.0;
+    addFrame(frameUV01.xy, frameOrigin01.xy, frameWeights.x, albedo, normalDepth, coverage);
+    addFrame(frameUV01.zw, frameOrigin01.zw, frameWeights.y, albedo, normalDepth, coverage);
+    addFrame(frameUV23.xy, frameOrigin23.xy, frameWeights.z, albedo, normalDepth, coverage);
+    addFrame(frameUV23.zw, frameOrigin23.zw, frameWeights.w, albedo, normalDepth, coverage);
+    if (coverage < 0.5) {
+        discard;
+    }
+    albedo /= coverage;
+    normalDepth /= coverage;
+
+    // The baked depth moves the fragment from the quad, which passes through the
+    // sphere's centre, to the surface, so impostors intersect the scene like meshes
+    float height = (1.0 - 2.0 * normalDepth.w) * worldRadius;
+    vec3 position = worldPosition + normalize(cameraPosition.xyz - worldPosition) * height;
+    vec4 clip = viewProjection * vec4(position, 1.0);
+    gl_FragDepth = clip.z / clip.w * 0.5 + 0.5;
+
+    // Lit like model.frag
+    vec3 normal = normalize(normalMatrix * (normalDepth.xyz * 2.0 - 1.0));
+    vec3 lightDirection = normalize(lightPosition.xyz - position);
+    float distance = length(lightPosition.xyz - position);
+    float attenuation = 1.0;
+    float threshold = 300.0;
+    if (distance > threshold) {
+        float k1 = 0.001;
+        float k2 = 0.0002;
+        attenuation = 1.0 / (1.0 + k1 * (distance - threshold) + k2 * pow(distance - threshold, 2));
+    }
+    float diff = max(dot(normal, lightDirection), 0.0);
+    vec3 diffuse = diff * lightIntensity * attenuation * mix(0.2, 1.0, shadowFactor(position));
+    vec3 exposedColor = diffuse * exposure;
+    vec3 toneMappedColor = exposedColor / (exposedColor + vec3(1.0));
+
+    // The albedo atlas is sRGB, the sample is linear
+    finalColor = vec4(pow(albedo * toneMappedColor, vec3(1.0 / 2.2)), 1.0);
+}
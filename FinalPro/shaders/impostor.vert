@@ -0,0 +1,98 @@
+#version 330 core
+
+// Frames per side of the atlas, IMPOSTOR_GRID in impostor.h
+#define GRID 8
+
+// Quad corner at (+-1, +-1)
+layout(location = 0) in vec2 corner;
+
+// Per-instance model matrix, occupies locations 3 to 6
+layout(location = 3) in mat4 instanceMatrix;
+
+// Shared by every program, uploaded once per frame (see FrameUniforms)
+layout(std140) uniform Camera {
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec4 cameraPosition;
+    vec4 cameraForward;
+};
+
+// Bounding sphere the frames were baked around, in the asset's space: centre in xyz,
+// radius in w. The model's root node places the asset below the instance.
+uniform vec4 impostorSphere;
+uniform mat4 rootMatrix;
+
+// Where the view ray meets the plane of each of the four frames, in frame uv; the
+// frames' corners in the atlas and their blend weights
+out vec3 worldPosition;
+out vec4 frameUV01;
+out vec4 frameUV23;
+flat out vec4 frameOrigin01;
+flat out vec4 frameOrigin23;
+flat out vec4 frameWeights;
+
+// Rotation of the instance for the baked normals, and the sphere radius in the world
+flat out mat3 normalMatrix;
+flat out float worldRadius;
+
+// Hemi-octahedral map, as ImpostorDirection() and ImpostorGrid()
+vec3 impostorDirection(vec2 grid) {
+    vec2 p = vec2(grid.x + grid.y, grid.x - grid.y) * 0.5;
+    return normalize(vec3(p.x, 1.0 - abs(p.x) - abs(p.y), p.y));
+}
+
+vec2 impostorGrid(vec3 direction) {
+    vec3 d = vec3(direction.x, max(direction.y, 0.0), direction.z);
+    d /= max(abs(d.x) + d.y + abs(d.z), 1e-6);
+    return vec2(d.x + d.z, d.x - d.z);
+}
+
+// As ImpostorFrameBasis()
+void frameBasis(vec3 direction, out vec3 right, out vec3 up) {
+    vec3 reference = abs(direction.y) < 0.999 ? vec3(0.0, 1.0, 0.0) : vec3(0.0, 0.0, -1.0);
+    right = normalize(cross(reference, direction));
+    up = cross(direction, right);
+}
+
+// Follows the ray from the camera through point to the plane frame was baked on
+vec2 frameUV(vec2 frame, vec3 point, vec3 ray) {
+    vec3 direction = impostorDirection(frame * (2.0 / float(GRID - 1)) - 1.0);
+    vec3 right, up;
+    frameBasis(direction, right, up);
+    float t = dot(impostorSphere.xyz - point, direction) / min(dot(ray, direction), -1e-3);
+    vec3 local = point + ray * t - impostorSphere.xyz;
+    return vec2(dot(local, right), dot(local, up)) / (2.0 * impostorSphere.w) + 0.5;
+}
+
+void main() {
+    // Camera in the asset's space, where the frames were baked
+    mat4 placement = instanceMatrix * rootMatrix;
+    mat3 axes = mat3(placement);
+    vec3 eye = inverse(axes) * (cameraPosition.xyz - placement[3].xyz);
+    vec3 viewDirection = normalize(eye - impostorSphere.xyz);
+
+    // The quad covers the sphere, facing the camera
+    vec3 right, up;
+    frameBasis(viewDirection, right, up);
+    vec3 point = impostorSphere.xyz + (corner.x * right + corner.y * up) * impostorSphere.w;
+    vec4 position = placement * vec4(point, 1.0);
+    gl_Position = viewProjection * position;
+    worldPosition = position.xyz;
+
+    // The four frames around the view direction, weighted bilinearly. Chosen from the
+    // centre so every corner of the quad agrees.
+    vec2 grid = (impostorGrid(viewDirection) * 0.5 + 0.5) * float(GRID - 1);
+    vec2 base = clamp(floor(grid), 0.0, float(GRID - 2));
+    vec2 f = clamp(grid - base, 0.0, 1.0);
+    frameWeights = vec4((1.0 - f.x) * (1.0 - f.y), f.x * (1.0 - f.y), (1.0 - f.x) * f.y, f.x * f.y);
+
+    vec3 ray = point - eye;
+    frameUV01 = vec4(frameUV(base, point, ray), frameUV(base + vec2(1.0, 0.0), point, ray));
+    frameUV23 = vec4(frameUV(base + vec2(0.0, 1.0), point, ray), frameUV(base + vec2(1.0, 1.0), point, ray));
+    frameOrigin01 = vec4(base, base + vec2(1.0, 0.0)) / float(GRID);
+    frameOrigin23 = vec4(base + vec2(0.0, 1.0), base + vec2(1.0, 1.0)) / float(GRID);
+
+    normalMatrix = axes;
+    worldRadius = impostorSphere.w * length(axes[0]);
+}
@@ -0,0 +1,41 @@
+#version 330 core
+
+in vec3 assetNormal;
+in vec2 uv;
+
+uniform sampler2D textureSampler;
+
+// Albedo with coverage, and the normal with the frame depth (see ImpostorImages)
+layout(location = 0) out vec4 albedo;
+layout(location = 1) out vec4 normalDepth;
+
+layout(std140) uniform Object {
+    mat4 modelMatrix;
+    vec4 baseColorFactor;
+    vec4 positionOffset;
+    vec4 positionScale;
+    vec4 uvTransform;
+    int isLight;
+    int skinned;
+    int jointOffset;
+    int packedNormals;
+};
+
+// The target is plain RGBA8, the atlas is later sampled as sRGB
+vec3 linearToSrgb(vec3 c)
+{
+    return mix(c * 12.92, 1.055 * pow(c, vec3(1.0 / 2.4)) - 0.055, step(vec3(0.0031308), c));
+}
+
+void main()
+{
+    // Blending does not work across frames, coverage is cut at half like the impostor's.
+    // Frames see the asset from afar, where the mipmapped alpha of sparse foliage falls
+    // below the cut, so coverage comes from the full-size level.
+    vec4 color = texture(textureSampler, uv) * baseColorFactor;
+    if (textureLod(textureSampler, uv, 0.0).a * baseColorFactor.a < 0.5) {
+        discard;
+    }
+    albedo = vec4(linearToSrgb(color.rgb), 1.0);
+    normalDepth = vec4(normalize(assetNormal) * 0.5 + 0.5, gl_FragCoord.z);
+}
@@ -0,0 +1,47 @@
+#version 330 core
+
+// Input, same locations as model.vert
+layout(location = 0) in vec3 vertexPosition;
+layout(location = 1) in vec4 vertexNormal;
+layout(location = 2) in vec2 vertexUV;
+
+// Per-instance model matrix, identity while baking
+layout(location = 3) in mat4 instanceMatrix;
+
+// Orthographic view-projection of the frame being baked
+uniform mat4 VP;
+
+out vec3 assetNormal;
+out vec2 uv;
+
+// Same block as model.vert
+layout(std140) uniform Object {
+    mat4 modelMatrix;
+    vec4 baseColorFactor;
+    vec4 positionOffset;
+    vec4 positionScale;
+    vec4 uvTransform;
+    int isLight;
+    int skinned;
+    int jointOffset;
+    int packedNormals;
+};
+
+// Octahedral normal, the lower hemisphere folded over the upper one
+vec3 octDecode(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0) {
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    }
+    return normalize(n);
+}
+
+void main() {
+    mat4 worldMatrix = instanceMatrix * modelMatrix;
+    gl_Position = VP * worldMatrix * vec4(positionOffset.xyz + positionScale.xyz * vertexPosition, 1);
+
+    // Normals in the asset's space, assuming uniform scale like model.vert
+    vec3 normal = packedNormals != 0 ? octDecode(vertexNormal.xy) : vertexNormal.xyz;
+    assetNormal = mat3(worldMatrix) * normal;
+    uv = uvTransform.xy + uvTransform.zw * vertexUV;
+}
@@ -5,19 +5,75 @@ in vec3 worldNormal;
 in vec2 uv;
 
 uniform sampler2D textureSampler;
-uniform vec4 baseColorFactor;
-uniform int isLight;
 
 out vec4 finalColor;
 
-uniform vec3 lightPosition;
-uniform vec3 lightIntensity;
-uniform float exposure;
+// Shared by every program, uploaded once per frame (see FrameUniforms)
+layout(std140) uniform Camera {
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec4 cameraPosition;
+    vec4 cameraForward;
+};
+
+layout(std140) uniform Lighting {
+    vec4 lightPosition;
+    vec3 lightIntensity;
+    float exposure;
+};
+
+// Node transform and material of the draw, selected with a buffer range per draw
+layout(std140) uniform Object {
+    mat4 modelMatrix;
+    vec4 baseColorFactor;
+    vec4 positionOffset;
+    vec4 positionScale;
+    vec4 uvTransform;
+    int isLight;
+    int skinned;
+    int jointOffset;
+    int packedNormals;
+};
+
+// Cascaded shadow maps, one layer per cascade, sampled with hardware comparison
+#define MAX_CASCADES 4
+uniform sampler2DArrayShadow shadowMap;
+layout(std140) uniform Shadows {
+    mat4 lightSpaceMatrices[MAX_CASCADES];
+    vec4 cascadeSplits;     // Far view depth of each cascade
+    int cascadeCount;       // 0 disables shadows
+};
+
+// Fraction of light reaching the fragment, 1 when it is outside every cascade
+float shadowFactor(vec3 position)
+{
+    float viewDepth = dot(position - cameraPosition.xyz, cameraForward.xyz);
+    int cascade = 0;
+    while (cascade < cascadeCount && viewDepth > cascadeSplits[cascade]) {
+        cascade++;
+    }
+    if (cascade >= cascadeCount) {
+        return 1.0;
+    }
+
+    vec4 lightCoords = lightSpaceMatrices[cascade] * vec4(position, 1.0);
+    lightCoords.xyz = lightCoords.xyz / lightCoords.w * 0.5 + 0.5;
+    if (lightCoords.z > 1.0) {
+        return 1.0;
+    }
 
-// Shadow-related uniforms
-uniform sampler2D shadowMap;
-uniform mat4 lightSpaceMatrix;
-uniform mat4 modelMatrix;
+    // Each lookup is already a bilinear 2x2 comparison, 3x3 of them give a wide PCF
+    vec2 texelSize = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+    float lit = 0.0;
+    for (int x = -1; x <= 1; ++x) {
+        for (int y = -1; y <= 1; ++y) {
+            vec2 offset = vec2(x, y) * texelSize;
+            lit += texture(shadowMap, vec4(lightCoords.xy + offset, float(cascade), lightCoords.z));
+        }
+    }
+    return lit / 9.0;
+}
 
 void main()
 {
@@ -25,12 +81,12 @@ void main()
 	    // Normalize the world normal
         vec3 normal = normalize(worldNormal);
 
-        // Calculate the transformed light direction and normalize it
-        vec3 fragPosition = vec3(modelMatrix * vec4(worldPosition, 1.0));
-        vec3 lightDirection = normalize(lightPosition - fragPosition);
+        // Calculate the light direction and normalize it
+        vec3 fragPosition = worldPosition;
+        vec3 lightDirection = normalize(lightPosition.xyz - fragPosition);
 
         // Calculate the length of the light beam
-        float distance = length(lightPosition - fragPosition);
+        float distance = length(lightPosition.xyz - fragPosition);
 
         // Calculate the attenuation of the light
         float attenuation = 1.0f;
@@ -47,40 +103,8 @@ void main()
         // Apply the light intensity
         vec3 diffuse = diff * lightIntensity * attenuation;
     
-        // Transform fragment position to light space
-        vec4 fragPosLightSpace = lightSpaceMatrix * modelMatrix * vec4(worldPosition, 1.0);
-
-        // Perspective divide to transform to normalized device coordinates (NDC)
-        vec3 lightCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
-
-        // Convert to [0, 1] range for texture sampling
-        lightCoords = lightCoords * 0.5 + 0.5;
-
-        float shadow;
-
-        // Check if the fragment is outside the [0, 1] range or above the light
-        if (lightCoords.x < 0.0 || lightCoords.x > 1.0 ||
-            lightCoords.y < 0.0 || lightCoords.y > 1.0 ||
-            lightCoords.z > 1.0) {
-            shadow = 1.0; // Not in shadow
-        } else {
-            // Sample the closest depth from the shadow map
-            float closestDepth = texture(shadowMap, lightCoords.xy).r;
-
-            // Create a dynamic bias to prevent shadow acne
-            float bias = 0; //max(0.05 * (1.0 - dot(normal, lightDirection)), 0.005);
-
-            // PCF for softer shadows
-            vec2 texelSize = 1.0 / textureSize(shadowMap, 0);
-            for(int x = -1; x <= 1; ++x) {
-                for(int y = -1; y <= 1; ++y) {
-                    float pcfDepth = texture(shadowMap, lightCoords.xy + vec2(x, y) * texelSize).r;
-                    // Check if the fragment is in shadow
-                    shadow += lightCoords.z - bias >= pcfDepth ? 0.2 : 1.0;
-                }    
-            }
-            shadow /= 9.0;
-        }
+        // Shadowed surfaces keep a fifth of the direct light
+        float shadow = mix(0.2, 1.0, shadowFactor(worldPosition));
 
         // Apply the shadow factor to the diffuse color
         diffuse *= shadow;
@@ -91,8 +115,9 @@ void main()
         // Apply tone mapping to the lighting
         vec3 toneMappedColor = exposedColor / (exposedColor + vec3(1.0));
 
-        // Gamma correction for accurate color perception
-        finalColor = texture(textureSampler, uv).rgba * baseColorFactor * vec4(pow(toneMappedColor, vec3(1.0 / 2.2)), 1.0);
+        // Textures are sRGB, so the sample is already linear; gamma-encode the lit result
+        vec4 albedo = texture(textureSampler, uv).rgba * baseColorFactor;
+        finalColor = vec4(pow(albedo.rgb * toneMappedColor, vec3(1.0 / 2.2)), albedo.a);
 
         
     }
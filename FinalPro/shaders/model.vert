@@ -2,25 +2,82 @@
 
 // Input
 layout(location = 0) in vec3 vertexPosition;
-layout(location = 1) in vec3 vertexNormal;
+layout(location = 1) in vec4 vertexNormal;
 layout(location = 2) in vec2 vertexUV;
 
+// Per-instance model matrix, occupies locations 3 to 6
+layout(location = 3) in mat4 instanceMatrix;
+
 // Output data, to be interpolated for each fragment
 out vec3 worldPosition;
 out vec3 worldNormal;
 out vec2 uv;
 
-// Matrix for vertex transformation
-uniform mat4 MVP;
+// Shared by every program, uploaded once per frame (see FrameUniforms)
+layout(std140) uniform Camera {
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec4 cameraPosition;
+    vec4 cameraForward;
+};
+
+// Node transform and material of the draw, see model.frag. Packed vertices come in
+// as fractions of the primitive's box and uv range, scaled back here.
+layout(std140) uniform Object {
+    mat4 modelMatrix;
+    vec4 baseColorFactor;
+    vec4 positionOffset;
+    vec4 positionScale;
+    vec4 uvTransform;
+    int isLight;
+    int skinned;
+    int jointOffset;
+    int packedNormals;
+};
+
+// Skinning (Model::animate). The instance's palette starts at instancePalette in a
+// buffer of joint matrices, four texels each; vertices blend up to four joints.
+layout(location = 7) in int instancePalette;
+layout(location = 8) in uvec4 vertexJoints;
+layout(location = 9) in vec4 vertexWeights;
+uniform samplerBuffer jointPalettes;
+
+mat4 jointMatrix(int joint) {
+    int texel = (instancePalette + jointOffset + joint) * 4;
+    return mat4(texelFetch(jointPalettes, texel), texelFetch(jointPalettes, texel + 1),
+        texelFetch(jointPalettes, texel + 2), texelFetch(jointPalettes, texel + 3));
+}
+
+mat4 skinMatrix() {
+    return vertexWeights.x * jointMatrix(int(vertexJoints.x)) + vertexWeights.y * jointMatrix(int(vertexJoints.y)) +
+        vertexWeights.z * jointMatrix(int(vertexJoints.z)) + vertexWeights.w * jointMatrix(int(vertexJoints.w));
+}
+
+// Octahedral normal, the lower hemisphere folded over the upper one
+vec3 octDecode(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0) {
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    }
+    return normalize(n);
+}
 
 void main() {
-    // Transform vertex
-    gl_Position =  MVP * vec4(vertexPosition, 1);
+    // Transform vertex, the instance places the whole model and modelMatrix the node
+    mat4 worldMatrix = instanceMatrix * modelMatrix;
+    if (skinned != 0) {
+        worldMatrix = worldMatrix * skinMatrix();
+    }
+    vec3 objectPosition = positionOffset.xyz + positionScale.xyz * vertexPosition;
+    vec4 position = worldMatrix * vec4(objectPosition, 1);
+    gl_Position =  viewProjection * position;
 
-    // World-space geometry 
-    worldPosition = vertexPosition;
-    worldNormal = vertexNormal;
+    // World-space geometry, normals assume uniform scale
+    vec3 normal = packedNormals != 0 ? octDecode(vertexNormal.xy) : vertexNormal.xyz;
+    worldPosition = position.xyz;
+    worldNormal = mat3(worldMatrix) * normal;
 
     // Pass UV to the fragment shader
-    uv = vertexUV;
-}
\ No newline at end of file
+    uv = uvTransform.xy + uvTransform.zw * vertexUV;
+}
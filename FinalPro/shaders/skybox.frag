@@ -11,6 +11,6 @@ out vec3 finalColor;
 
 void main()
 {
-	// Perform texture lookup.
-	finalColor = texture(textureSampler, uv).rgb;
+	// Perform texture lookup. The sky texture is sRGB, encode it back for display.
+	finalColor = pow(texture(textureSampler, uv).rgb, vec3(1.0 / 2.2));
 }
@@ -11,12 +11,33 @@ out vec3 color;
 // UV output to fragment shader
 out vec2 uv;
 
-// Matrix for vertex transformation
-uniform mat4 MVP;
+// Shared by every program, uploaded once per frame (see FrameUniforms)
+layout(std140) uniform Camera {
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec4 cameraPosition;
+    vec4 cameraForward;
+};
+
+// Placement of the box
+layout(std140) uniform Object {
+    mat4 modelMatrix;
+    vec4 baseColorFactor;
+    vec4 positionOffset;
+    vec4 positionScale;
+    vec4 uvTransform;
+    int isLight;
+    int skinned;
+    int jointOffset;
+    int packedNormals;
+};
 
 void main() {
-    // Transform vertex
-    gl_Position =  MVP * vec4(vertexPosition, 1);
+    // Transform vertex, then push it just in front of the far plane so the box is
+    // drawn behind everything of the opaque pass whatever its size
+    vec4 position = viewProjection * modelMatrix * vec4(vertexPosition, 1);
+    gl_Position = vec4(position.xy, position.w * 0.99999, position.w);
     
     // Pass vertex color to the fragment shader
     color = vertexColor;
@@ -0,0 +1,69 @@
+#version 330 core
+
+// Vertex of the shared chunk grid, in grid units from 0 to gridSize
+layout(location = 0) in vec2 gridPosition;
+
+// Per-chunk attributes, see TerrainChunk
+layout(location = 3) in vec4 chunkArea;     // Corner x, z, size, LOD
+layout(location = 4) in vec4 chunkTile;     // Tile corner x, z, height layer, grid step
+
+// Output data, to be interpolated for each fragment (same as model.vert)
+out vec3 worldPosition;
+out vec3 worldNormal;
+out vec2 uv;
+
+// Shared by every program, uploaded once per frame (see FrameUniforms)
+layout(std140) uniform Camera {
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    vec4 cameraPosition;
+    vec4 cameraForward;
+};
+
+// Heights of every resident tile, one layer each, with a one-sample apron
+uniform sampler2DArray heightMap;
+uniform float tileSize;
+uniform float tileResolution;
+uniform float heightScale;
+uniform float baseHeight;
+uniform float gridSize;
+uniform float uvScale;
+
+// Distances over which each LOD morphs into the next
+uniform float morphStart[8];
+uniform float morphEnd[8];
+
+float heightAt(vec2 world)
+{
+    vec2 texel = (world - chunkTile.xy) / tileSize * tileResolution + 1.5;
+    return texture(heightMap, vec3(texel / (tileResolution + 3.0), chunkTile.z)).r * heightScale + baseHeight;
+}
+
+void main() {
+    float spacing = chunkArea.z / gridSize;
+    float step = chunkTile.w;
+    vec2 world = chunkArea.xy + gridPosition * spacing;
+
+    // CDLOD morph: towards the end of its range every odd vertex of the LOD's grid
+    // slides onto its even neighbour, so the chunk matches the next LOD at the boundary
+    int lod = int(chunkArea.w);
+    float distance = length(cameraPosition.xyz - vec3(world.x, heightAt(world), world.y));
+    float morph = clamp((distance - morphStart[lod]) / (morphEnd[lod] - morphStart[lod]), 0.0, 1.0);
+    vec2 lodPosition = gridPosition / step;
+    lodPosition -= fract(lodPosition * 0.5) * 2.0 * morph;
+    world = chunkArea.xy + lodPosition * step * spacing;
+
+    worldPosition = vec3(world.x, heightAt(world), world.y);
+    gl_Position = viewProjection * vec4(worldPosition, 1.0);
+
+    // Normal from the neighbouring height samples
+    float texelSize = tileSize / tileResolution;
+    float left = heightAt(world - vec2(texelSize, 0.0));
+    float right = heightAt(world + vec2(texelSize, 0.0));
+    float back = heightAt(world - vec2(0.0, texelSize));
+    float front = heightAt(world + vec2(0.0, texelSize));
+    worldNormal = normalize(vec3(left - right, 2.0 * texelSize, back - front));
+
+    uv = world * uvScale;
+}
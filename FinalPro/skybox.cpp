@@ -1,5 +1,8 @@
 #include <render/shader.h>
+#include <render/resources.h>
 #include <render/texture.h>
+#include <render/render_queue.h>
+#include <render/frame_uniforms.h>
 
 struct Skybox {
 	glm::vec3 position;		// Position of the box
@@ -148,10 +151,13 @@ struct Skybox {
 	GLuint textureID;
 
 	// Shader variable IDs
-	GLuint mvpMatrixID;
 	GLuint textureSamplerID;
 	GLuint programID;
 
+	// Box transform in the Object block; the camera comes from the frame's Camera block
+	ObjectBuffer object;
+	RenderQueue renderQueue;
+
 	void initialize(glm::vec3 position, glm::vec3 scale) {
 		// Define scale of the skybox geometry
 		this->position = position;
@@ -165,59 +171,51 @@ struct Skybox {
 		glGenBuffers(1, &vertexBufferID);
 		glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
 		glBufferData(GL_ARRAY_BUFFER, sizeof(vertex_buffer_data), vertex_buffer_data, GL_STATIC_DRAW);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
 
 		// Create a vertex buffer object to store the color data
 		for (int i = 0; i < 72; ++i) color_buffer_data[i] = 1.0f;
 		glGenBuffers(1, &colorBufferID);
 		glBindBuffer(GL_ARRAY_BUFFER, colorBufferID);
 		glBufferData(GL_ARRAY_BUFFER, sizeof(color_buffer_data), color_buffer_data, GL_STATIC_DRAW);
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
 
 		// Create a vertex buffer object to store the UV data
 		for (int i = 0; i < 24; ++i) uv_buffer_data[2 * i + 1] *= 1;
 		glGenBuffers(1, &uvBufferID);
 		glBindBuffer(GL_ARRAY_BUFFER, uvBufferID);
 		glBufferData(GL_ARRAY_BUFFER, sizeof(uv_buffer_data), uv_buffer_data, GL_STATIC_DRAW);
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, 0);
 
 		// Create an index buffer object to store the index data that defines triangle faces
 		glGenBuffers(1, &indexBufferID);
 		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
 		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(index_buffer_data), index_buffer_data, GL_STATIC_DRAW);
 
-		// Create and compile our GLSL program from the shaders
-		programID = LoadShadersFromFile("../FinalPro/shaders/skybox.vert", "../FinalPro/shaders/skybox.frag");
+		// Programs and textures are shared with every other user of the same files
+		programID = AcquireShaders("../FinalPro/shaders/skybox.vert", "../FinalPro/shaders/skybox.frag");
 		if (programID == 0)
 		{
 			std::cerr << "Failed to load shaders." << std::endl;
 		}
 
-		// Get a handle for our "MVP" uniform
-		mvpMatrixID = glGetUniformLocation(programID, "MVP");
-
 		// Load a random texture into the GPU memory
-		textureID = LoadTextureTileBox("../FinalPro/assets/sky.png");
+		textureID = AcquireTexture("../FinalPro/assets/sky.png");
 
 		// Get a handle for our "textureSampler" uniform
 		textureSamplerID = glGetUniformLocation(programID, "textureSampler");
+
+		glBindVertexArray(0);
+
+		updatePosition(position);
 	}
 
+	// The transform only changes here, so it is uploaded here rather than per draw
 	void updatePosition(glm::vec3 position) {
 		this->position = position;
-	}
-
-	void render(glm::mat4 cameraMatrix) {
-		glUseProgram(programID);
-
-		glBindVertexArray(vertexArrayID);
-
-		glEnableVertexAttribArray(0);
-		glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-		glEnableVertexAttribArray(1);
-		glBindBuffer(GL_ARRAY_BUFFER, colorBufferID);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
-
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
 
 		// Model transform
 		glm::mat4 modelMatrix = glm::mat4(1.0f);
@@ -227,31 +225,48 @@ struct Skybox {
 		modelMatrix = glm::scale(modelMatrix, scale);
 		modelMatrix = glm::translate(modelMatrix, glm::vec3(0.0f, 0.5f, 0.0f));
 
-		// Set model-view-projection matrix
-		glm::mat4 mvp = cameraMatrix * modelMatrix;
-		glUniformMatrix4fv(mvpMatrixID, 1, GL_FALSE, &mvp[0][0]);
+		ObjectBlock block = ObjectBlock();
+		block.modelMatrix = modelMatrix;
+		block.baseColorFactor = glm::vec4(1.0f);
+		object.upload(std::vector<ObjectBlock>(1, block));
+	}
 
-		// Enable UV buffer and texture sampler
-		glEnableVertexAttribArray(2);
-		glBindBuffer(GL_ARRAY_BUFFER, uvBufferID);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, 0);
+	// The Camera block must already hold the frame's camera, see FrameUniforms::setCamera()
+	void render() {
+		submit(renderQueue);
+		renderQueue.flush();
+	}
+
+	static void applyDraw(const DrawItem& item) {
+		const Skybox& skybox = *(const Skybox*)item.owner;
+
+		// Select the box transform
+		skybox.object.bind(0);
 
 		// Set textureSampler to use texture unit 0
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glUniform1i(textureSamplerID, 0);
-
-		// Draw the box
-		glDrawElements(
-			GL_TRIANGLES,      // mode
-			36,    			   // number of indices
-			GL_UNSIGNED_INT,   // type
-			(void*)0           // element array buffer offset
-		);
-
-		glDisableVertexAttribArray(0);
-		glDisableVertexAttribArray(1);
-		glDisableVertexAttribArray(2);
+		glUniform1i(skybox.textureSamplerID, 0);
+	}
+
+	void submit(RenderQueue& queue) {
+		if (programID == 0) {
+			return;
+		}
+
+		DrawItem item;
+		item.program = programID;
+		item.texture = textureID;
+		item.vertexArray = vertexArrayID;
+		item.blend = false;
+		item.indexCount = 36;
+		item.firstIndex = 0;
+		item.indexType = GL_UNSIGNED_INT;
+		item.baseVertex = 0;
+		item.instanceCount = 1;
+		item.apply = applyDraw;
+		item.draw = NULL;
+		item.owner = this;
+		item.key = queue.makeKey(PASS_SKY, item.blend, item.program, item.texture, item.vertexArray, 0.0f);
+		queue.submit(item);
 	}
 
 	void cleanup() {
@@ -260,7 +275,8 @@ struct Skybox {
 		glDeleteBuffers(1, &indexBufferID);
 		glDeleteVertexArrays(1, &vertexArrayID);
 		glDeleteBuffers(1, &uvBufferID);
-		glDeleteTextures(1, &textureID);
-		glDeleteProgram(programID);
+		ReleaseTexture(textureID);
+		object.cleanup();
+		ReleaseShaders(programID);
 	}
 };
\ No newline at end of file
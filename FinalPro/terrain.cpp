@@ -1,165 +1,445 @@
 #include <render/texture.h>
 #include <render/shader.h>
-
-struct Terrain {  
-
-    glm::mat4 modelMatrix;
-	glm::vec3 position;
-	glm::vec3 scale;
-
-	GLfloat vertex_buffer_data[12] = {
-		-0.5f, 0.0f, -0.5f, // bottom-left
-		 0.5f, 0.0f, -0.5f, // bottom-right
-		 0.5f, 0.0f,  0.5f, // top-right
-		-0.5f, 0.0f,  0.5f  // top-left
-	};
-
-	GLfloat normal_buffer_data[12] = {
-		0.0f, 1.0f, 0.0f,
-		0.0f, 1.0f, 0.0f,
-		0.0f, 1.0f, 0.0f,
-		0.0f, 1.0f, 0.0f
-	};
-
-	GLuint index_buffer_data[6] = {
-		0, 2, 1,
-		0, 3, 2
+#include <render/resources.h>
+#include <render/render_queue.h>
+#include <render/terrain_lod.h>
+#include <render/async_loader.h>
+#include <render/frame_uniforms.h>
+#include <render/occlusion.h>
+#include <render/texture_streaming.h>
+
+#include <map>
+#include <memory>
+
+// What the last submit() drew and how much of the ground is resident
+struct TerrainStats {
+	int tilesResident;
+	int tilesLoading;
+	int chunks;
+	unsigned int triangles;
+};
+
+// Heightmap terrain drawn with CDLOD. Tiles of height samples stream in and out
+// around the camera into layers of one texture array; every frame each resident
+// tile's quadtree selects chunks by distance, culled against the frustum, and all
+// chunks are drawn instanced from one shared grid mesh displaced in terrain.vert.
+// The triangle count depends on the LOD ranges, not on how much ground is resident.
+//
+// Resident tiles also serve as occluders: a grid over the leaf nodes of the quadtree,
+// every grid point at the lowest height of the nodes around it. A leaf's chunks at any
+// LOD interpolate samples of that leaf, so the grid stays under the drawn ground.
+struct Terrain {
+	TerrainSettings settings;
+	TerrainLodRanges lodRanges;
+	float baseHeight;
+
+	// A tile owns a texture layer from the moment it is requested
+	struct ResidentTile {
+		std::shared_ptr<HeightTile> data;
+		int layer;
+		bool resident;
+		std::vector<glm::vec3> occluder;	// World positions, indexed by occluderIndices
 	};
-
-	GLfloat uv_buffer_data[8] = {
-		0.0f, 0.0f, // bottom-left
-		4.0f, 0.0f, // bottom-right
-		4.0f, 4.0f, // top-right
-		0.0f, 4.0f  // top-left
-	};
-
-	// OpenGL buffers
-	GLuint vertexArrayID;
+	std::map<std::pair<int, int>, ResidentTile> tiles;
+	std::vector<int> freeLayers;
+	AsyncLoader* loader;
+	int loadsInFlight;
+	int maxLoadsInFlight;
+
+	// Shared chunk grid; the second index range only uses every other vertex and
+	// draws quarters of nodes at their parent's LOD (grid step 2)
 	GLuint vertexBufferID;
 	GLuint indexBufferID;
-	GLuint normalBufferID;
-	GLuint uvBufferID;
+	GLsizei indexCount[2];
+	GLuint indexOffset[2];
+
+	// One VAO and instance buffer per grid step
+	GLuint vertexArrayID[2];
+	GLuint instanceBufferID[2];
+	std::vector<TerrainChunk> chunks[2];
+	std::vector<unsigned int> occluderIndices;
+
+	GLuint heightTextureID;
 	GLuint textureID;
-	GLuint modelMatrixID;
-	GLuint baseColorFactorID;
-	GLuint LightID;
+	float uvScale;
 
 	// Shader variable IDs
-	GLuint mvpMatrixID;
-	GLuint textureSamplerID;
 	GLuint programID;
 
-	void initialize(glm::vec3 position, glm::vec3 scale) {
-		// Define scale of the skybox geometry
-		this->position = position;
-		this->scale = scale;
+	// Material in the Object block; the camera comes from the frame's Camera block
+	glm::vec4 baseColorFactor;
+	ObjectBuffer object;
+	TerrainStats stats;
+
+	// Tiles are built on the loader's workers when one is given, otherwise on first use
+	void initialize(AsyncLoader* loader, float baseHeight, const TerrainSettings& settings) {
+		this->loader = loader;
+		this->baseHeight = baseHeight;
+		this->settings = settings;
+		ComputeTerrainLodRanges(settings, lodRanges);
+		loadsInFlight = 0;
+		maxLoadsInFlight = 4;
+		baseColorFactor = glm::vec4(1.0f);
+
+		createGrid();
+
+		int leafCount = 1 << (settings.lodCount - 1);
+		occluderIndices.clear();
+		for (int z = 0; z < leafCount; ++z) {
+			for (int x = 0; x < leafCount; ++x) {
+				unsigned int v00 = z * (leafCount + 1) + x;
+				unsigned int v10 = v00 + 1;
+				unsigned int v01 = v00 + leafCount + 1;
+				unsigned int v11 = v01 + 1;
+				occluderIndices.push_back(v00); occluderIndices.push_back(v01); occluderIndices.push_back(v10);
+				occluderIndices.push_back(v10); occluderIndices.push_back(v01); occluderIndices.push_back(v11);
+			}
+		}
+
+		// Enough layers for every tile that can be resident before it is evicted
+		int side = (int)ceilf(2.0f * (settings.streamRadius + settings.tileSize) / settings.tileSize) + 1;
+		GLint maxLayers;
+		glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+		int layerCount = std::min(side * side, (int)maxLayers);
+		for (int layer = layerCount - 1; layer >= 0; --layer) {
+			freeLayers.push_back(layer);
+		}
+
+		int stride = settings.tileResolution + 3;
+		glGenTextures(1, &heightTextureID);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, heightTextureID);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R16, stride, stride, layerCount, 0, GL_RED, GL_UNSIGNED_SHORT, NULL);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+		// Grass tiled every 1 / uvScale units, shared through the resource cache and
+		// streamed like every other texture
+		uvScale = 0.25f;
+		textureID = loader ? loader->loadTexture("../FinalPro/textures/grass.jpg") : AcquireTexture("../FinalPro/textures/grass.jpg");
+
+		// Lit and shadowed like the models: terrain.vert feeds model.frag
+		programID = AcquireShaders("../FinalPro/shaders/terrain.vert", "../FinalPro/shaders/model.frag");
+		if (programID == 0)
+		{
+			std::cerr << "Failed to load shaders." << std::endl;
+			return;
+		}
+
+		ObjectBlock block = ObjectBlock();
+		block.modelMatrix = glm::mat4(1.0f);
+		block.baseColorFactor = baseColorFactor;
+		object.upload(std::vector<ObjectBlock>(1, block));
 
-		// Model transform
-		modelMatrix = glm::mat4(1.0f);
-		modelMatrix = glm::translate(modelMatrix, position);
-		modelMatrix = glm::scale(modelMatrix, scale);
+		// Uniforms that stay fixed: texture units (albedo 0, shadows 1, heights 2) and the layout
+		glUseProgram(programID);
+		glUniform1i(glGetUniformLocation(programID, "textureSampler"), 0);
+		glUniform1i(glGetUniformLocation(programID, "shadowMap"), 1);
+		glUniform1i(glGetUniformLocation(programID, "heightMap"), 2);
+		glUniform1f(glGetUniformLocation(programID, "tileSize"), settings.tileSize);
+		glUniform1f(glGetUniformLocation(programID, "tileResolution"), (float)settings.tileResolution);
+		glUniform1f(glGetUniformLocation(programID, "heightScale"), settings.heightScale);
+		glUniform1f(glGetUniformLocation(programID, "baseHeight"), baseHeight);
+		glUniform1f(glGetUniformLocation(programID, "gridSize"), (float)settings.gridSize);
+		glUniform1f(glGetUniformLocation(programID, "uvScale"), uvScale);
+		glUniform1fv(glGetUniformLocation(programID, "morphStart"), settings.lodCount, lodRanges.morphStart);
+		glUniform1fv(glGetUniformLocation(programID, "morphEnd"), settings.lodCount, lodRanges.morphEnd);
+		glUseProgram(0);
+	}
 
-		// Create a vertex array object
-		glGenVertexArrays(1, &vertexArrayID);
-		glBindVertexArray(vertexArrayID);
+	void createGrid() {
+		int size = settings.gridSize;
+		std::vector<glm::vec2> vertices;
+		for (int z = 0; z <= size; ++z) {
+			for (int x = 0; x <= size; ++x) {
+				vertices.push_back(glm::vec2((float)x, (float)z));
+			}
+		}
+
+		// Full grid, then the same area at every other vertex; triangles face +y
+		std::vector<unsigned int> indices;
+		for (int pass = 0; pass < 2; ++pass) {
+			int step = pass + 1;
+			indexOffset[pass] = (GLuint)indices.size();
+			for (int z = 0; z < size; z += step) {
+				for (int x = 0; x < size; x += step) {
+					unsigned int v00 = z * (size + 1) + x;
+					unsigned int v10 = v00 + step;
+					unsigned int v01 = v00 + step * (size + 1);
+					unsigned int v11 = v01 + step;
+					indices.push_back(v00); indices.push_back(v01); indices.push_back(v10);
+					indices.push_back(v10); indices.push_back(v01); indices.push_back(v11);
+				}
+			}
+			indexCount[pass] = (GLsizei)(indices.size() - indexOffset[pass]);
+		}
 
-		// Create a vertex buffer object to store the vertex data		
 		glGenBuffers(1, &vertexBufferID);
 		glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(vertex_buffer_data), vertex_buffer_data, GL_STATIC_DRAW);
+		glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec2), &vertices[0], GL_STATIC_DRAW);
+
+		glGenBuffers(1, &indexBufferID);
+		glGenBuffers(2, instanceBufferID);
+		glGenVertexArrays(2, vertexArrayID);
+		for (int pass = 0; pass < 2; ++pass) {
+			glBindVertexArray(vertexArrayID[pass]);
+
+			glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
+			glEnableVertexAttribArray(0);
+			glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, 0);
+
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
+			if (pass == 0) {
+				glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+			}
+
+			// Chunk area and tile, one per instance
+			glBindBuffer(GL_ARRAY_BUFFER, instanceBufferID[pass]);
+			glEnableVertexAttribArray(3);
+			glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(TerrainChunk), (void*)0);
+			glVertexAttribDivisor(3, 1);
+			glEnableVertexAttribArray(4);
+			glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(TerrainChunk), (void*)sizeof(glm::vec4));
+			glVertexAttribDivisor(4, 1);
+		}
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
 
-		// Create a vertex buffer object to store the normal data		
-		glGenBuffers(1, &normalBufferID);
-		glBindBuffer(GL_ARRAY_BUFFER, normalBufferID);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(normal_buffer_data), normal_buffer_data, GL_STATIC_DRAW);
+	// Closest horizontal distance from the camera to a tile
+	float tileDistance(int tileX, int tileZ, const glm::vec3& camera) const {
+		float minX = tileX * settings.tileSize, minZ = tileZ * settings.tileSize;
+		float dx = std::max(std::max(minX - camera.x, camera.x - (minX + settings.tileSize)), 0.0f);
+		float dz = std::max(std::max(minZ - camera.z, camera.z - (minZ + settings.tileSize)), 0.0f);
+		return sqrtf(dx * dx + dz * dz);
+	}
 
-		// Create a vertex buffer object to store the UV data
-		glGenBuffers(1, &uvBufferID);
-		glBindBuffer(GL_ARRAY_BUFFER, uvBufferID);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(uv_buffer_data), uv_buffer_data, GL_STATIC_DRAW);
+	void uploadTile(ResidentTile& tile) {
+		const HeightTile& data = *tile.data;
+		glBindTexture(GL_TEXTURE_2D_ARRAY, heightTextureID);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 2);
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, tile.layer, data.stride, data.stride, 1,
+			GL_RED, GL_UNSIGNED_SHORT, &data.heights[0]);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+		// Only the node height ranges are needed on the CPU from now on
+		std::vector<unsigned short>().swap(tile.data->heights);
+		tile.resident = true;
+		buildOccluder(tile);
+	}
 
-		// Create an index buffer object to store the index data that defines triangle faces
-		glGenBuffers(1, &indexBufferID);
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(index_buffer_data), index_buffer_data, GL_STATIC_DRAW);
+	void buildOccluder(ResidentTile& tile) {
+		const HeightTile& data = *tile.data;
+		int leafCount = 1 << (settings.lodCount - 1);
+		const std::vector<float>& leafMin = data.nodeMin[settings.lodCount - 1];
+		float leafSize = settings.tileSize / leafCount;
+
+		// A little lower still, for the 16-bit heights the ground is drawn from
+		float margin = settings.heightScale / 65535.0f;
+		tile.occluder.resize((leafCount + 1) * (leafCount + 1));
+		for (int z = 0; z <= leafCount; ++z) {
+			for (int x = 0; x <= leafCount; ++x) {
+				float lowest = FLT_MAX;
+				for (int nz = std::max(z - 1, 0); nz <= std::min(z, leafCount - 1); ++nz) {
+					for (int nx = std::max(x - 1, 0); nx <= std::min(x, leafCount - 1); ++nx) {
+						lowest = std::min(lowest, leafMin[nz * leafCount + nx]);
+					}
+				}
+				tile.occluder[z * (leafCount + 1) + x] = glm::vec3(data.tileX * settings.tileSize + x * leafSize,
+					baseHeight + lowest - margin, data.tileZ * settings.tileSize + z * leafSize);
+			}
+		}
+	}
 
-		// Create and compile our GLSL program from the shaders
-		programID = LoadShadersFromFile("../FinalPro/shader/model.vert", "../FinalPro/shader/model.frag");
-		if (programID == 0)
-		{
-			std::cerr << "Failed to load shaders." << std::endl;
+	void requestTile(int tileX, int tileZ) {
+		std::pair<int, int> key(tileX, tileZ);
+		ResidentTile& tile = tiles[key];
+		tile.data = std::shared_ptr<HeightTile>(new HeightTile());
+		tile.layer = freeLayers.back();
+		tile.resident = false;
+		freeLayers.pop_back();
+
+		if (!loader) {
+			BuildHeightTile(settings, tileX, tileZ, *tile.data);
+			uploadTile(tile);
+			return;
 		}
 
-		// Get a handle for our "MVP" uniform
-		mvpMatrixID = glGetUniformLocation(programID, "MVP");
+		std::shared_ptr<HeightTile> data = tile.data;
+		TerrainSettings tileSettings = settings;
+		loadsInFlight++;
+		loader->submit([tileSettings, data, tileX, tileZ]() {
+			BuildHeightTile(tileSettings, tileX, tileZ, *data);
+		}, [this, key]() {
+			loadsInFlight--;
+			std::map<std::pair<int, int>, ResidentTile>::iterator it = tiles.find(key);
+			if (it != tiles.end()) {
+				uploadTile(it->second);
+			}
+		});
+	}
 
-		// Get a handle for our Model Matrix uniform
-		modelMatrixID = glGetUniformLocation(programID, "modelMatrix");
+	// Evict tiles that fell behind the camera, then request missing ones, nearest first
+	void streamTiles(const glm::vec3& camera) {
+		for (std::map<std::pair<int, int>, ResidentTile>::iterator it = tiles.begin(); it != tiles.end();) {
+			// Tiles still loading stay until their upload lands
+			if (it->second.resident &&
+				tileDistance(it->first.first, it->first.second, camera) > settings.streamRadius + settings.tileSize) {
+				freeLayers.push_back(it->second.layer);
+				tiles.erase(it++);
+			}
+			else {
+				++it;
+			}
+		}
 
-		// Load a random texture into the GPU memory
-		textureID = LoadTextureTileBox("../FinalPro/assets/grassy.jpg");
+		int minX = (int)floorf((camera.x - settings.streamRadius) / settings.tileSize);
+		int maxX = (int)floorf((camera.x + settings.streamRadius) / settings.tileSize);
+		int minZ = (int)floorf((camera.z - settings.streamRadius) / settings.tileSize);
+		int maxZ = (int)floorf((camera.z + settings.streamRadius) / settings.tileSize);
+		std::vector<std::pair<float, std::pair<int, int> > > missing;
+		for (int z = minZ; z <= maxZ; ++z) {
+			for (int x = minX; x <= maxX; ++x) {
+				float distance = tileDistance(x, z, camera);
+				if (distance < settings.streamRadius && tiles.find(std::make_pair(x, z)) == tiles.end()) {
+					missing.push_back(std::make_pair(distance, std::make_pair(x, z)));
+				}
+			}
+		}
+		std::sort(missing.begin(), missing.end());
 
-		// Get a handle for our "textureSampler" uniform
-		textureSamplerID = glGetUniformLocation(programID, "textureSampler");
-		baseColorFactorID = glGetUniformLocation(programID, "baseColorFactor");
-		LightID = glGetUniformLocation(programID, "Light");
+		for (size_t i = 0; i < missing.size() && !freeLayers.empty(); ++i) {
+			if (loader && loadsInFlight >= maxLoadsInFlight) {
+				break;
+			}
+			requestTile(missing[i].second.first, missing[i].second.second);
+		}
 	}
 
-	void render(glm::mat4 cameraMatrix) {
-		glUseProgram(programID);
+	// Selects and uploads the chunks to draw from this camera
+	void selectChunks(const glm::vec3& camera, const Frustum& frustum) {
+		std::vector<TerrainChunk>& selected = chunks[0];
+		selected.clear();
+		chunks[1].clear();
+		stats.tilesResident = 0;
+		stats.tilesLoading = 0;
+		for (std::map<std::pair<int, int>, ResidentTile>::iterator it = tiles.begin(); it != tiles.end(); ++it) {
+			if (!it->second.resident) {
+				stats.tilesLoading++;
+				continue;
+			}
+			stats.tilesResident++;
+			SelectTerrainChunks(settings, lodRanges, *it->second.data, baseHeight, it->second.layer, camera, frustum, selected);
+		}
 
-		glBindVertexArray(vertexArrayID);
+		// Quarters drawn at their parent's LOD use the other grid
+		size_t kept = 0;
+		for (size_t i = 0; i < selected.size(); ++i) {
+			if (selected[i].tile.w > 1.0f) {
+				chunks[1].push_back(selected[i]);
+			}
+			else {
+				selected[kept++] = selected[i];
+			}
+		}
+		selected.resize(kept);
+
+		stats.chunks = (int)(chunks[0].size() + chunks[1].size());
+		stats.triangles = 0;
+		for (int pass = 0; pass < 2; ++pass) {
+			stats.triangles += (unsigned int)(chunks[pass].size() * indexCount[pass] / 3);
+
+			// Orphan the previous storage so the driver does not stall on in-flight draws
+			glBindBuffer(GL_ARRAY_BUFFER, instanceBufferID[pass]);
+			glBufferData(GL_ARRAY_BUFFER, chunks[pass].size() * sizeof(TerrainChunk), NULL, GL_STREAM_DRAW);
+			if (!chunks[pass].empty()) {
+				glBufferSubData(GL_ARRAY_BUFFER, 0, chunks[pass].size() * sizeof(TerrainChunk), &chunks[pass][0]);
+			}
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
 
-		glEnableVertexAttribArray(0);
-		glBindBuffer(GL_ARRAY_BUFFER, vertexBufferID);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, 0);
+	// Adds the occluder grid of every resident tile in the frustum
+	void addOccluders(OcclusionBuffer& occlusion, const Frustum& frustum) const {
+		for (std::map<std::pair<int, int>, ResidentTile>::const_iterator it = tiles.begin(); it != tiles.end(); ++it) {
+			const ResidentTile& tile = it->second;
+			if (!tile.resident) {
+				continue;
+			}
+			AABB box;
+			box.min = glm::vec3(it->first.first * settings.tileSize, baseHeight + tile.data->nodeMin[0][0], it->first.second * settings.tileSize);
+			box.max = glm::vec3(box.min.x + settings.tileSize, baseHeight + tile.data->nodeMax[0][0], box.min.z + settings.tileSize);
+			if (IsAABBVisible(frustum, box)) {
+				occlusion.addOccluder(&tile.occluder[0], &occluderIndices[0], occluderIndices.size());
+			}
+		}
+	}
 
-		glEnableVertexAttribArray(1);
-		glBindBuffer(GL_ARRAY_BUFFER, normalBufferID);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, 0);
+	// Ground height at a world position, for placing things on the terrain
+	float heightAt(float x, float z) const {
+		return baseHeight + SampleTerrainHeight(settings, x, z);
+	}
 
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferID);
+	// Material and heights for the queued draws; heights go on unit 2, unit 0 is left active
+	static void applyDraw(const DrawItem& item) {
+		const Terrain& terrain = *(const Terrain*)item.owner;
 
-		// Set model-view-projection matrix
-		glm::mat4 mvp = cameraMatrix * modelMatrix;
-		glUniformMatrix4fv(mvpMatrixID, 1, GL_FALSE, &mvp[0][0]);
-		glUniformMatrix4fv(modelMatrixID, 1, GL_FALSE, &modelMatrix[0][0]);
+		terrain.object.bind(0);
+		glActiveTexture(GL_TEXTURE2);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, terrain.heightTextureID);
+		glActiveTexture(GL_TEXTURE0);
+	}
 
-		// Enable UV buffer and texture sampler
-		glEnableVertexAttribArray(2);
-		glBindBuffer(GL_ARRAY_BUFFER, uvBufferID);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 0, 0);
+	// Streams tiles around the camera position and queues the selected chunks. The
+	// Camera block must already hold this camera, see FrameUniforms::setCamera()
+	void submit(RenderQueue& queue, const glm::mat4& cameraMatrix, const glm::vec3& camera) {
+		if (programID == 0) {
+			return;
+		}
 
-		// Set textureSampler to use texture unit 0
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glUniform1i(textureSamplerID, 0);
-
-		// Set base colour factor to opaque
-		glm::vec4 baseColorFactor = glm::vec4(1.0);
-		glUniform4fv(baseColorFactorID, 1, &baseColorFactor[0]);
-		glUniform1i(LightID, 0);
-
-		// Draw the box
-		glDrawElements(
-			GL_TRIANGLES,      // mode
-			36,    			   // number of indices
-			GL_UNSIGNED_INT,   // type
-			(void*)0           // element array buffer offset
-		);
-
-		glDisableVertexAttribArray(0);
-		glDisableVertexAttribArray(1);
-		glDisableVertexAttribArray(2);
+		streamTiles(camera);
+		selectChunks(camera, ExtractFrustum(cameraMatrix));
+
+		// The ground is nearest straight below the camera
+		TextureStreamer& streamer = SharedTextureStreamer();
+		streamer.request(textureID, uvScale, streamer.pixelsPerUnit(camera.y - heightAt(camera.x, camera.z)));
+
+		for (int pass = 0; pass < 2; ++pass) {
+			if (chunks[pass].empty()) {
+				continue;
+			}
+			DrawItem item;
+			item.program = programID;
+			item.texture = textureID;
+			item.vertexArray = vertexArrayID[pass];
+			item.blend = false;
+			item.indexCount = indexCount[pass];
+			item.firstIndex = indexOffset[pass];
+			item.indexType = GL_UNSIGNED_INT;
+			item.baseVertex = 0;
+			item.instanceCount = (GLsizei)chunks[pass].size();
+			item.apply = applyDraw;
+			item.draw = NULL;
+			item.owner = this;
+
+			// The chunks span the whole view, so there is no single depth to sort by
+			item.key = queue.makeKey(PASS_OPAQUE, item.blend, item.program, item.texture, item.vertexArray, 0.0f);
+			queue.submit(item);
+		}
 	}
 
 	void cleanup() {
 		glDeleteBuffers(1, &vertexBufferID);
-		glDeleteBuffers(1, &normalBufferID);
 		glDeleteBuffers(1, &indexBufferID);
-		glDeleteVertexArrays(1, &vertexArrayID);
-		glDeleteBuffers(1, &uvBufferID);
-		glDeleteTextures(1, &textureID);
-		glDeleteProgram(programID);
+		glDeleteBuffers(2, instanceBufferID);
+		glDeleteVertexArrays(2, vertexArrayID);
+		glDeleteTextures(1, &heightTextureID);
+		ReleaseTexture(textureID);
+		object.cleanup();
+		ReleaseShaders(programID);
+		tiles.clear();
 	}
-};
\ No newline at end of file
+};
@@ -0,0 +1,71 @@
+// Offline impostor baker: loads each asset, renders its octahedral impostor frames into
+// an offscreen framebuffer through a windowless EGL context, and writes the atlases
+// next to the asset (ImpostorPath()), where Model::loadImpostor() picks them up instead
+// of baking at run time.
+//
+//   bake_impostors [asset...]
+//
+// Run it from the build directory like main; without assets it bakes both trees.
+
+#include <glad/gl.h>
+
+#include <render/shader.h>
+#include <render/program_cache.h>
+
+#include <chrono>
+
+#include "model.cpp"
+#include "egl_context.h"
+
+int main(int argc, char* argv[]) {
+	std::vector<std::string> assets;
+	for (int i = 1; i < argc; ++i) {
+		assets.push_back(argv[i]);
+	}
+	if (assets.empty()) {
+		assets.push_back("../FinalPro/assets/Tree/Tree.obj");
+		assets.push_back("../FinalPro/assets/Tree 02/Tree.obj");
+	}
+
+	EGLDisplay display;
+	EGLContext context;
+	if (!createContext(display, context)) {
+		return 1;
+	}
+	if (gladLoadGL((GLADloadfunc)eglGetProcAddress) == 0) {
+		std::cerr << "Failed to initialize OpenGL context." << std::endl;
+		return 1;
+	}
+	SharedProgramCache().initialize((GLADloadfunc)eglGetProcAddress, NULL);
+
+	// Same face culling as the viewer, so the frames show what the meshes would
+	glEnable(GL_DEPTH_TEST);
+	glEnable(GL_CULL_FACE);
+
+	int failures = 0;
+	for (size_t a = 0; a < assets.size(); ++a) {
+		const char* path = assets[a].c_str();
+		std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+
+		Model model;
+		model.initialize(0, glm::vec3(0.0f), glm::vec3(1.0f), path);
+		ImpostorImages images;
+		std::string output = ImpostorPath(path);
+		if (!model.bakeImpostor(images) || !WriteImpostor(output.c_str(), images)) {
+			std::cout << "Failed to bake " << path << std::endl;
+			failures++;
+		}
+		else {
+			double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+			std::cout << output << ": " << IMPOSTOR_GRID << "x" << IMPOSTOR_GRID << " frames of " << IMPOSTOR_FRAME_SIZE
+				<< " px, sphere radius " << images.radius << ", " << ms << " ms" << std::endl;
+		}
+		model.cleanup();
+	}
+
+	SharedGeometryArena().cleanup();
+	eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	eglDestroyContext(display, context);
+	eglTerminate(display);
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,271 @@
+// Headless rendering benchmark: draws the demo scene into an offscreen framebuffer
+// through a windowless EGL context, along a fixed camera path, and prints frame time
+// percentiles, draw calls and triangles (the camera's and the shadow passes' apart),
+// the trees left after culling and the share of instances occlusion culled as JSON,
+// with the texture memory resident at the end.
+// Runs on Mesa llvmpipe, so it works on machines without a GPU.
+//
+//   bench [--frames n] [--width w] [--height h] [--cpu-culling] [--texture-budget mb]
+//         [--render-while-loading] [--output file.json]
+//
+// Textures stream within --texture-budget megabytes (32, as in main); 0 loads every
+// level of every texture.
+// Run it from the build directory like main, assets are found through ../FinalPro.
+// Shader logs also go to stdout, --output writes the JSON alone to a file.
+// Every asset is resident and the camera path has been flown once before timing
+// starts, so runs differ only by the time the frames take. --render-while-loading
+// first draws frames while the assets come in, as main does, until the loader is
+// idle; the JSON gives how many it took.
+
+#include <glad/gl.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <render/shader.h>
+#include <render/program_cache.h>
+
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <chrono>
+#define _USE_MATH_DEFINES
+#include <math.h>
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include "scene.cpp"
+#include "egl_context.h"
+
+// Camera on an orbit around the trees that dips in close and climbs back out,
+// t in [0, 1) is the position along the path
+static glm::vec3 cameraOnPath(float t) {
+	float azimuth = 2.0f * (float)M_PI * t;
+	float distance = 300.0f - 220.0f * sinf((float)M_PI * t);
+	float height = 60.0f + 40.0f * sinf(4.0f * (float)M_PI * t);
+	return glm::vec3(distance * cosf(azimuth), height, distance * sinf(azimuth));
+}
+
+// Nearest-rank percentile of sorted values
+static double percentile(const std::vector<double>& sorted, double p) {
+	size_t rank = (size_t)ceil(p / 100.0 * sorted.size());
+	return sorted[std::max<size_t>(rank, 1) - 1];
+}
+
+// Runs the loader's GL steps until nothing is left in flight
+static void finishLoading(AsyncLoader& loader) {
+	while (!loader.isIdle()) {
+		loader.pump(100.0);
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+int main(int argc, char* argv[]) {
+	int frameCount = 600;
+	int width = 1024, height = 768;
+	bool allowGpuDriven = true;
+	bool renderWhileLoading = false;
+	size_t textureBudgetMB = 32;
+	std::string outputPath;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg(argv[i]);
+		if (arg == "--frames" && i + 1 < argc) {
+			frameCount = std::max(1, atoi(argv[++i]));
+		}
+		else if (arg == "--width" && i + 1 < argc) {
+			width = std::max(1, atoi(argv[++i]));
+		}
+		else if (arg == "--height" && i + 1 < argc) {
+			height = std::max(1, atoi(argv[++i]));
+		}
+		else if (arg == "--cpu-culling") {
+			allowGpuDriven = false;
+		}
+		else if (arg == "--render-while-loading") {
+			renderWhileLoading = true;
+		}
+		else if (arg == "--texture-budget" && i + 1 < argc) {
+			textureBudgetMB = (size_t)std::max(0, atoi(argv[++i]));
+		}
+		else if (arg == "--output" && i + 1 < argc) {
+			outputPath = argv[++i];
+		}
+		else {
+			std::cerr << "Usage: bench [--frames n] [--width w] [--height h] [--cpu-culling] [--texture-budget mb] "
+				"[--render-while-loading] [--output file.json]" << std::endl;
+			return 1;
+		}
+	}
+
+	EGLDisplay display;
+	EGLContext context;
+	if (!createContext(display, context)) {
+		return 1;
+	}
+	if (gladLoadGL((GLADloadfunc)eglGetProcAddress) == 0) {
+		std::cerr << "Failed to initialize OpenGL context." << std::endl;
+		return 1;
+	}
+	bool gpuDriven = LoadGpuCullingFunctions((GLADloadfunc)eglGetProcAddress) && allowGpuDriven;
+	SharedProgramCache().initialize((GLADloadfunc)eglGetProcAddress, NULL);
+
+	GLuint framebuffer, colorBuffer, depthBuffer;
+	glGenFramebuffers(1, &framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glGenRenderbuffers(1, &colorBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+	glGenRenderbuffers(1, &depthBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+	glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		std::cerr << "Offscreen framebuffer is incomplete." << std::endl;
+		return 1;
+	}
+	glViewport(0, 0, width, height);
+
+	glClearColor(0.2f, 0.2f, 0.25f, 0.0f);
+	glEnable(GL_DEPTH_TEST);
+	glEnable(GL_CULL_FACE);
+
+	SharedTextureStreamer().initialize(textureBudgetMB << 20);
+	AsyncLoader loader;
+	loader.start();
+
+	glm::float32 FoV = 45;
+	glm::float32 zNear = 0.1f;
+	glm::float32 zFar = 1000.0f;
+	float aspect = (float)width / height;
+	glm::mat4 projectionMatrix = glm::perspective(glm::radians(FoV), aspect, zNear, zFar);
+	glm::vec3 lookat(0, 0, 0);
+	glm::vec3 up(0, 1, 0);
+
+	// Animations step a fixed 60 Hz frame, so every run poses the same
+	float frameTime = 1.0f / 60.0f;
+
+	Scene scene;
+	scene.initialize(loader, gpuDriven, zFar);
+
+	// Models, textures and programs turn up between these frames, in whatever order
+	// the workers finish them
+	int loadingFrames = 0;
+	for (; renderWhileLoading && !loader.isIdle(); ++loadingFrames) {
+		glm::vec3 eye = cameraOnPath((float)(loadingFrames % frameCount) / frameCount);
+		loader.pump(2.0);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		scene.render(glm::lookAt(eye, lookat, up), projectionMatrix, eye, glm::radians(FoV), aspect, zNear, framebuffer, width, height, frameTime);
+	}
+	finishLoading(loader);
+
+	// Fly the path once untimed so terrain tiles and shadow cascades have settled
+	for (int frame = 0; frame < frameCount; ++frame) {
+		glm::vec3 eye = cameraOnPath((float)frame / frameCount);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		scene.render(glm::lookAt(eye, lookat, up), projectionMatrix, eye, glm::radians(FoV), aspect, zNear, framebuffer, width, height, frameTime);
+		finishLoading(loader);
+	}
+	glFinish();
+
+	// Each frame is timed from its first GL call until the GPU has finished it
+	GLuint primitivesQueries[2];
+	glGenQueries(2, primitivesQueries);
+	scene.primitivesQuery = primitivesQueries[0];
+	scene.shadowPrimitivesQuery = primitivesQueries[1];
+	std::vector<double> frameMs(frameCount);
+	double drawCalls = 0.0, triangles = 0.0, shadowDrawCalls = 0.0, shadowTriangles = 0.0;
+	double occlusionTested = 0.0, occlusionHidden = 0.0, instancesDrawn = 0.0;
+	for (int frame = 0; frame < frameCount; ++frame) {
+		glm::vec3 eye = cameraOnPath((float)frame / frameCount);
+		std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+
+		loader.pump(2.0);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		scene.render(glm::lookAt(eye, lookat, up), projectionMatrix, eye, glm::radians(FoV), aspect, zNear, framebuffer, width, height, frameTime);
+		glFinish();
+
+		frameMs[frame] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+
+		// Indirect draws only know their triangle count on the GPU, so it is queried
+		GLuint primitives = 0, shadowPrimitives = 0;
+		glGetQueryObjectuiv(scene.primitivesQuery, GL_QUERY_RESULT, &primitives);
+		glGetQueryObjectuiv(scene.shadowPrimitivesQuery, GL_QUERY_RESULT, &shadowPrimitives);
+		triangles += primitives;
+		shadowTriangles += shadowPrimitives;
+		drawCalls += scene.renderQueue.stats.draws;
+		shadowDrawCalls += scene.shadowDraws;
+		OcclusionStats occlusion = scene.occlusionStats();
+		occlusionTested += occlusion.tested;
+		occlusionHidden += occlusion.occluded;
+		CullStats culled;
+		scene.tree.readCullStats(culled);
+		instancesDrawn += culled.instancesVisible;
+	}
+	scene.primitivesQuery = 0;
+	scene.shadowPrimitivesQuery = 0;
+	glDeleteQueries(2, primitivesQueries);
+
+	std::vector<double> sorted(frameMs);
+	std::sort(sorted.begin(), sorted.end());
+	double total = 0.0;
+	for (size_t i = 0; i < sorted.size(); ++i) {
+		total += sorted[i];
+	}
+
+	const TextureStreamStats& streamed = SharedTextureStreamer().stats;
+	std::stringstream json;
+	json << "{\n"
+		<< "\t\"renderer\": \"" << (const char*)glGetString(GL_RENDERER) << "\",\n"
+		<< "\t\"gpuDriven\": " << (gpuDriven ? "true" : "false") << ",\n"
+		<< "\t\"width\": " << width << ",\n"
+		<< "\t\"height\": " << height << ",\n"
+		<< "\t\"frames\": " << frameCount << ",\n"
+		<< "\t\"loadingFrames\": " << loadingFrames << ",\n"
+		<< "\t\"frameTimeMs\": {\n"
+		<< "\t\t\"mean\": " << total / frameCount << ",\n"
+		<< "\t\t\"p50\": " << percentile(sorted, 50.0) << ",\n"
+		<< "\t\t\"p95\": " << percentile(sorted, 95.0) << ",\n"
+		<< "\t\t\"p99\": " << percentile(sorted, 99.0) << ",\n"
+		<< "\t\t\"min\": " << sorted.front() << ",\n"
+		<< "\t\t\"max\": " << sorted.back() << "\n"
+		<< "\t},\n"
+		<< "\t\"drawCallsPerFrame\": " << drawCalls / frameCount << ",\n"
+		<< "\t\"trianglesPerFrame\": " << triangles / frameCount << ",\n"
+		<< "\t\"shadowDrawCallsPerFrame\": " << shadowDrawCalls / frameCount << ",\n"
+		<< "\t\"shadowTrianglesPerFrame\": " << shadowTriangles / frameCount << ",\n"
+		<< "\t\"treesDrawnPerFrame\": " << instancesDrawn / frameCount << ",\n"
+		<< "\t\"occludedPercent\": " << (occlusionTested > 0.0 ? 100.0 * occlusionHidden / occlusionTested : 0.0) << ",\n"
+		<< "\t\"textureBudgetMB\": " << textureBudgetMB << ",\n"
+		<< "\t\"textureResidentMB\": " << streamed.residentBytes / (double)(1 << 20) << ",\n"
+		<< "\t\"textureBudgetBias\": " << streamed.budgetBias << "\n"
+		<< "}\n";
+
+	if (outputPath.empty()) {
+		std::cout << json.str();
+	}
+	else {
+		std::ofstream stream(outputPath.c_str());
+		stream << json.str();
+		if (!stream) {
+			std::cerr << "Failed to write " << outputPath << std::endl;
+			return 1;
+		}
+	}
+
+	loader.shutdown();
+	scene.cleanup();
+	glDeleteRenderbuffers(1, &colorBuffer);
+	glDeleteRenderbuffers(1, &depthBuffer);
+	glDeleteFramebuffers(1, &framebuffer);
+	SharedProfiler().cleanup();
+	eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+	eglDestroyContext(display, context);
+	eglTerminate(display);
+	return 0;
+}
@@ -0,0 +1,61 @@
+// Offline texture cooker: encodes images to BC1/BC3 with a precomputed mip chain and
+// writes them next to the source as .ctex, where LoadTexture() picks them up.
+//
+//   cook_textures [-j threads] image...
+//
+// Images whose name ends in _NRM are treated as data (normal maps) and filtered
+// without the sRGB conversion.
+
+#include <render/texture_cook.h>
+
+#include <chrono>
+
+static bool isLinearData(const std::string& path) {
+	size_t dot = path.find_last_of('.');
+	std::string stem = path.substr(0, dot);
+	return stem.size() >= 4 && stem.compare(stem.size() - 4, 4, "_NRM") == 0;
+}
+
+int main(int argc, char* argv[]) {
+	int threadCount = 0;
+	int failures = 0;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg(argv[i]);
+		if (arg == "-j" && i + 1 < argc) {
+			threadCount = atoi(argv[++i]);
+			continue;
+		}
+
+		std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+
+		int w, h, channels;
+		unsigned char* img = stbi_load(arg.c_str(), &w, &h, &channels, 4);
+		if (img == NULL) {
+			std::cout << "Failed to load texture " << arg << std::endl;
+			failures++;
+			continue;
+		}
+
+		CookedTexture cooked;
+		CookTexture(img, w, h, !isLinearData(arg), threadCount, cooked);
+		stbi_image_free(img);
+
+		std::string output = CookedTexturePath(arg.c_str());
+		if (!WriteCookedTexture(output.c_str(), cooked)) {
+			failures++;
+			continue;
+		}
+
+		size_t bytes = 0;
+		for (size_t level = 0; level < cooked.levels.size(); ++level) {
+			bytes += cooked.levels[level].size();
+		}
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+		std::cout << output << ": " << w << "x" << h << (cooked.format == COOKED_BC3 ? " BC3" : " BC1")
+			<< (cooked.srgb ? " sRGB, " : ", ") << cooked.levels.size() << " levels, " << bytes / 1024 << " KB (RGBA8 with mips "
+			<< (size_t)w * h * 4 * 4 / 3 / 1024 << " KB), " << ms << " ms" << std::endl;
+	}
+
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,79 @@
+#ifndef _EGL_CONTEXT_H_
+#define _EGL_CONTEXT_H_
+
+// Windowless GL context for the headless tools (bench, bake_impostors)
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <iostream>
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+// Surfaceless Mesa first, then a pbuffer on the default display. Tries GL 4.3 for the
+// GPU-driven path and falls back to 3.3.
+static bool createContext(EGLDisplay& display, EGLContext& context) {
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+		(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	display = EGL_NO_DISPLAY;
+	bool surfaceless = false;
+	if (getPlatformDisplay) {
+		display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+		surfaceless = display != EGL_NO_DISPLAY && eglInitialize(display, NULL, NULL);
+	}
+	if (!surfaceless) {
+		display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+		if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL)) {
+			std::cerr << "Failed to initialize EGL." << std::endl;
+			return false;
+		}
+	}
+	if (!eglBindAPI(EGL_OPENGL_API)) {
+		std::cerr << "EGL has no desktop OpenGL." << std::endl;
+		return false;
+	}
+
+	const EGLint configAttributes[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_NONE
+	};
+	EGLConfig config = (EGLConfig)0;
+	EGLint configCount = 0;
+	if (!surfaceless && (!eglChooseConfig(display, configAttributes, &config, 1, &configCount) || configCount == 0)) {
+		std::cerr << "No pbuffer EGL config." << std::endl;
+		return false;
+	}
+
+	const int versions[2][2] = { { 4, 3 }, { 3, 3 } };
+	context = EGL_NO_CONTEXT;
+	for (int v = 0; v < 2 && context == EGL_NO_CONTEXT; ++v) {
+		const EGLint contextAttributes[] = {
+			EGL_CONTEXT_MAJOR_VERSION, versions[v][0],
+			EGL_CONTEXT_MINOR_VERSION, versions[v][1],
+			EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+			EGL_NONE
+		};
+		context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+	}
+	if (context == EGL_NO_CONTEXT) {
+		std::cerr << "Failed to create an OpenGL 3.3 context." << std::endl;
+		return false;
+	}
+
+	// Everything is drawn into a framebuffer object, the surface is never used
+	EGLSurface surface = EGL_NO_SURFACE;
+	if (!surfaceless) {
+		const EGLint pbufferAttributes[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+		surface = eglCreatePbufferSurface(display, config, pbufferAttributes);
+	}
+	if (!eglMakeCurrent(display, surface, surface, context)) {
+		std::cerr << "Failed to make the EGL context current." << std::endl;
+		return false;
+	}
+	return true;
+}
+
+#endif
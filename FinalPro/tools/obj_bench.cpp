@@ -0,0 +1,130 @@
+// OBJ import benchmark: loads each file through Assimp, with the flags the renderer used
+// to import OBJ with, and through LoadObj on one thread and on a worker pool. Prints
+// the median load time of every path with the vertex and triangle counts it produced.
+//
+//   obj_bench [--runs n] [--threads n] [file.obj...]
+//
+// Run it from the build directory like main; without files it loads both trees.
+
+#include <render/obj_loader.h>
+
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+
+#include <algorithm>
+#include <chrono>
+
+struct LoadResult {
+	double milliseconds;
+	size_t vertices;
+	size_t triangles;
+};
+
+static double elapsedMs(std::chrono::steady_clock::time_point begin) {
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+}
+
+static bool loadAssimp(const std::string& path, LoadResult& result) {
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	Assimp::Importer importer;
+	const aiScene* scene = importer.ReadFile(path.c_str(),
+		aiProcess_Triangulate | aiProcess_JoinIdenticalVertices | aiProcess_GenSmoothNormals | aiProcess_FlipUVs);
+	result.milliseconds = elapsedMs(begin);
+	if (scene == NULL) {
+		std::cout << "Assimp failed on " << path << ": " << importer.GetErrorString() << std::endl;
+		return false;
+	}
+
+	result.vertices = result.triangles = 0;
+	for (unsigned int m = 0; m < scene->mNumMeshes; ++m) {
+		result.vertices += scene->mMeshes[m]->mNumVertices;
+		result.triangles += scene->mMeshes[m]->mNumFaces;
+	}
+	return true;
+}
+
+static bool loadObj(const std::string& path, WorkerPool* workers, LoadResult& result) {
+	std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+	std::vector<MeshPrimitive> meshes;
+	std::vector<ObjMaterial> materials;
+	bool loaded = LoadObj(path.c_str(), meshes, materials, workers);
+	result.milliseconds = elapsedMs(begin);
+
+	result.vertices = result.triangles = 0;
+	for (size_t m = 0; m < meshes.size(); ++m) {
+		result.vertices += meshes[m].vertices.size();
+		result.triangles += meshes[m].indices.size() / 3;
+	}
+	return loaded;
+}
+
+// Median time of runs loads, counts from the last one
+template <typename Load>
+static bool measure(int runs, Load load, LoadResult& result) {
+	std::vector<double> times;
+	for (int r = 0; r < runs; ++r) {
+		if (!load(result)) {
+			return false;
+		}
+		times.push_back(result.milliseconds);
+	}
+	std::sort(times.begin(), times.end());
+	result.milliseconds = times[times.size() / 2];
+	return true;
+}
+
+static void report(const char* name, const LoadResult& result, double baseline) {
+	printf("  %-22s %9.2f ms  %5.2fx  %8zu vertices  %8zu triangles\n",
+		name, result.milliseconds, baseline / result.milliseconds, result.vertices, result.triangles);
+}
+
+int main(int argc, char* argv[]) {
+	int runs = 5;
+	int threadCount = (int)std::max(std::thread::hardware_concurrency(), 1u);
+	std::vector<std::string> files;
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg(argv[i]);
+		if (arg == "--runs" && i + 1 < argc) {
+			runs = std::max(atoi(argv[++i]), 1);
+		}
+		else if (arg == "--threads" && i + 1 < argc) {
+			threadCount = std::max(atoi(argv[++i]), 1);
+		}
+		else {
+			files.push_back(arg);
+		}
+	}
+	if (files.empty()) {
+		files.push_back("../FinalPro/assets/Tree/Tree.obj");
+		files.push_back("../FinalPro/assets/Tree 02/Tree.obj");
+	}
+
+	// The calling thread takes part in ParallelFor, so it counts as one of them
+	WorkerPool workers;
+	workers.start(threadCount - 1);
+
+	int failures = 0;
+	for (size_t f = 0; f < files.size(); ++f) {
+		const std::string& path = files[f];
+		LoadResult assimp, serial, parallel;
+		bool loaded = measure(runs, [&path](LoadResult& result) { return loadAssimp(path, result); }, assimp) &&
+			measure(runs, [&path](LoadResult& result) { return loadObj(path, NULL, result); }, serial) &&
+			measure(runs, [&path, &workers](LoadResult& result) { return loadObj(path, &workers, result); }, parallel);
+		if (!loaded) {
+			failures++;
+			continue;
+		}
+
+		printf("%s, median of %d runs\n", path.c_str(), runs);
+		report("Assimp", assimp, assimp.milliseconds);
+		report("LoadObj, 1 thread", serial, assimp.milliseconds);
+		char name[32];
+		snprintf(name, sizeof(name), "LoadObj, %d threads", threadCount);
+		report(name, parallel, assimp.milliseconds);
+	}
+
+	workers.stop();
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,641 @@
+// Deterministic checks of the CPU-only parts of the renderer. Needs no GL context;
+// every input is generated from fixed seeds, so a failure reproduces exactly. Prints
+// one line per check and exits non-zero when any fails.
+//
+//   tests
+
+#include <render/mesh.h>
+#include <render/simplify.h>
+#include <render/mesh_optimize.h>
+#include <render/render_queue.h>
+#include <render/scatter.h>
+#include <render/buildings.h>
+#include <render/frustum.h>
+#include <render/occlusion.h>
+#include <render/texture_streaming.h>
+#include <render/animation.h>
+#include <render/scene_graph.h>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#define _USE_MATH_DEFINES
+#include <math.h>
+#include <string.h>
+
+static int failures = 0;
+
+// GL entry points the CPU code touches on its way out; without a context they do nothing
+static void GLAD_API_PTR fakeDeleteTextures(GLsizei, const GLuint*) {}
+static void GLAD_API_PTR fakeBindTexture(GLenum, GLuint) {}
+static void GLAD_API_PTR fakeTexParameteri(GLenum, GLenum, GLint) {}
+static void GLAD_API_PTR fakeTexImage2D(GLenum, GLint, GLint, GLsizei, GLsizei, GLint, GLenum, GLenum, const void*) {}
+static void GLAD_API_PTR fakePixelStorei(GLenum, GLint) {}
+
+static void installFakeGL() {
+	glad_glDeleteTextures = fakeDeleteTextures;
+	glad_glBindTexture = fakeBindTexture;
+	glad_glTexParameteri = fakeTexParameteri;
+	glad_glTexImage2D = fakeTexImage2D;
+	glad_glPixelStorei = fakePixelStorei;
+}
+
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			std::cout << "  " << __FILE__ << ":" << __LINE__ << ": " << #condition << std::endl; \
+			failures++; \
+		} \
+	} while (0)
+
+// Small LCG so the inputs are the same on every platform
+struct Random {
+	unsigned int state;
+
+	explicit Random(unsigned int seed) : state(seed) {}
+
+	unsigned int next() {
+		state = state * 1664525u + 1013904223u;
+		return state >> 8;
+	}
+
+	float uniform() {
+		return (next() & 0xffffff) / (float)0x1000000;
+	}
+};
+
+// Rolling heightfield of size x size vertices with smooth normals and continuous uvs,
+// so it has no seams and only its border is held by the simplifier
+static void makeGrid(int size, MeshPrimitive& mesh) {
+	mesh = MeshPrimitive();
+	for (int z = 0; z < size; ++z) {
+		for (int x = 0; x < size; ++x) {
+			float u = x / (float)(size - 1), v = z / (float)(size - 1);
+			float h = 0.1f * sinf(u * 2.0f * (float)M_PI) * cosf(v * 3.0f * (float)M_PI);
+			float dx = 0.1f * 2.0f * (float)M_PI * cosf(u * 2.0f * (float)M_PI) * cosf(v * 3.0f * (float)M_PI);
+			float dz = -0.1f * 3.0f * (float)M_PI * sinf(u * 2.0f * (float)M_PI) * sinf(v * 3.0f * (float)M_PI);
+			MeshVertex vertex;
+			vertex.position = glm::vec3(u, h, v);
+			vertex.normal = glm::normalize(glm::vec3(-dx, 1.0f, -dz));
+			vertex.uv = glm::vec2(u, v);
+			mesh.vertices.push_back(vertex);
+		}
+	}
+	for (int z = 0; z + 1 < size; ++z) {
+		for (int x = 0; x + 1 < size; ++x) {
+			unsigned int i = (unsigned int)(z * size + x);
+			unsigned int quad[6] = { i, i + size, i + 1, i + 1, i + size, i + size + 1 };
+			mesh.indices.insert(mesh.indices.end(), quad, quad + 6);
+		}
+	}
+	mesh.bounds = ComputeMeshBounds(mesh.vertices);
+	mesh.material = 0;
+}
+
+static bool indicesInRange(const MeshPrimitive& mesh) {
+	for (size_t i = 0; i < mesh.indices.size(); ++i) {
+		if (mesh.indices[i] >= mesh.vertices.size()) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Each level has at most its target share of triangles plus some slack, fewer than the
+// level before, and a bounded, growing error
+static void testSimplify() {
+	MeshPrimitive mesh;
+	makeGrid(48, mesh);
+	size_t triangles = mesh.indices.size() / 3;
+	std::vector<float> ratios;
+	ratios.push_back(0.5f);
+	ratios.push_back(0.25f);
+	ratios.push_back(0.1f);
+	BuildMeshLods(mesh, ratios);
+
+	CHECK(mesh.lods.size() == ratios.size() + 1);
+	CHECK(indicesInRange(mesh));
+	for (size_t l = 1; l < mesh.lods.size(); ++l) {
+		size_t levelTriangles = mesh.lods[l].indexCount / 3;
+		CHECK(mesh.lods[l].indexOffset + mesh.lods[l].indexCount <= mesh.indices.size());
+		CHECK(levelTriangles < mesh.lods[l - 1].indexCount / 3);
+		CHECK(levelTriangles <= triangles * ratios[l - 1] * 1.2f + 8);
+		CHECK(mesh.lods[l].error >= mesh.lods[l - 1].error);
+		CHECK(mesh.lods[l].error < 0.05f);
+	}
+}
+
+// The grid with its triangles shuffled is far from cache friendly; the optimizer must
+// recover most of it and keep every triangle
+static void testVertexCache() {
+	MeshPrimitive mesh;
+	makeGrid(64, mesh);
+	size_t triangleCount = mesh.indices.size() / 3;
+	Random random(7);
+	for (size_t t = triangleCount - 1; t > 0; --t) {
+		size_t other = random.next() % (t + 1);
+		for (int k = 0; k < 3; ++k) {
+			std::swap(mesh.indices[t * 3 + k], mesh.indices[other * 3 + k]);
+		}
+	}
+	std::vector<float> ratios;
+	BuildMeshLods(mesh, ratios);
+
+	VertexCacheStats before = AnalyzeVertexCache(&mesh.indices[0], mesh.indices.size(), mesh.vertices.size());
+	OptimizeMesh(mesh);
+	VertexCacheStats after = AnalyzeVertexCache(&mesh.indices[0], mesh.lods[0].indexCount, mesh.vertices.size());
+
+	std::cout << "  ACMR " << before.acmr() << " -> " << after.acmr() << std::endl;
+	CHECK(after.triangles == triangleCount);
+	CHECK(indicesInRange(mesh));
+	CHECK(after.acmr() < before.acmr() * 0.5f);
+	CHECK(after.acmr() < 0.8f);
+}
+
+// Decodes like the vertex shaders do and compares against the floats
+static void testPackedVertices() {
+	MeshPrimitive mesh;
+	Random random(11);
+	for (int v = 0; v < 2000; ++v) {
+		MeshVertex vertex;
+		vertex.position = glm::vec3(random.uniform() * 40.0f - 20.0f, random.uniform() * 3.0f, random.uniform() * 0.5f);
+		glm::vec3 normal(random.uniform() * 2.0f - 1.0f, random.uniform() * 2.0f - 1.0f, random.uniform() * 2.0f - 1.0f);
+		vertex.normal = glm::length(normal) > 1e-3f ? glm::normalize(normal) : glm::vec3(0.0f, 1.0f, 0.0f);
+		vertex.uv = glm::vec2(random.uniform() * 4.0f - 1.0f, random.uniform());
+		mesh.vertices.push_back(vertex);
+	}
+	QuantizationError error = QuantizeMesh(mesh);
+	const VertexQuantization& q = mesh.quantization;
+
+	CHECK(mesh.packed.size() == mesh.vertices.size());
+	CHECK(QuantizationAcceptable(error, q));
+	float largestNormalDegrees = 0.0f;
+	for (size_t v = 0; v < mesh.vertices.size(); ++v) {
+		const PackedVertex& packed = mesh.packed[v];
+		const MeshVertex& vertex = mesh.vertices[v];
+		for (int k = 0; k < 3; ++k) {
+			float decoded = q.positionOffset[k] + q.positionScale[k] * (packed.position[k] / 65535.0f);
+			CHECK(fabsf(decoded - vertex.position[k]) <= q.positionScale[k] * (0.5f / 65535.0f) + 1e-5f);
+		}
+		for (int k = 0; k < 2; ++k) {
+			float decoded = q.uvOffset[k] + q.uvScale[k] * (packed.uv[k] / 65535.0f);
+			CHECK(fabsf(decoded - vertex.uv[k]) <= q.uvScale[k] * (0.5f / 65535.0f) + 1e-6f);
+		}
+
+		// Sign-extended 10-bit x and y, octahedral
+		int x = (int)(packed.normal << 22) >> 22, y = (int)(packed.normal << 12) >> 22;
+		glm::vec2 e(std::max(x / 511.0f, -1.0f), std::max(y / 511.0f, -1.0f));
+		glm::vec3 n(e.x, e.y, 1.0f - fabsf(e.x) - fabsf(e.y));
+		if (n.z < 0.0f) {
+			float nx = (1.0f - fabsf(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+			float ny = (1.0f - fabsf(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+			n.x = nx;
+			n.y = ny;
+		}
+		float cosine = std::min(glm::dot(glm::normalize(n), vertex.normal), 1.0f);
+		largestNormalDegrees = std::max(largestNormalDegrees, acosf(cosine) * (180.0f / (float)M_PI));
+	}
+	CHECK(largestNormalDegrees <= 1.0f);
+	CHECK(fabsf(largestNormalDegrees - error.normalDegrees) < 0.01f);
+}
+
+// The radix sort must order by the whole key and keep submission order for equal keys;
+// opaque items come front to back, then the sky, then transparent ones back to front
+static void testRenderQueueOrder() {
+	RenderQueue queue;
+	queue.depthRange = 1000.0f;
+	Random random(3);
+	for (int i = 0; i < 3000; ++i) {
+		DrawItem item = DrawItem();
+		int pass = (int)(random.next() % 3);
+		item.program = random.next() % 4;
+		item.texture = random.next() % 8;
+		item.vertexArray = random.next() % 3;
+		item.blend = pass == PASS_TRANSPARENT;
+		item.userData[0] = i;
+		item.key = queue.makeKey(pass, item.blend, item.program, item.texture, item.vertexArray, random.uniform() * 1000.0f);
+		queue.submit(item);
+	}
+	queue.sort();
+
+	CHECK(queue.order.size() == queue.items.size());
+	std::vector<unsigned char> seen(queue.items.size(), 0);
+	for (size_t i = 0; i < queue.order.size(); ++i) {
+		CHECK(queue.order[i] < queue.items.size() && !seen[queue.order[i]]);
+		seen[queue.order[i]] = 1;
+		if (i > 0) {
+			const DrawItem& previous = queue.items[queue.order[i - 1]];
+			const DrawItem& item = queue.items[queue.order[i]];
+			CHECK(previous.key < item.key || (previous.key == item.key && previous.userData[0] < item.userData[0]));
+		}
+	}
+
+	unsigned long long near = queue.makeKey(PASS_OPAQUE, false, 1, 1, 1, 10.0f);
+	unsigned long long far = queue.makeKey(PASS_OPAQUE, false, 1, 1, 1, 900.0f);
+	unsigned long long sky = queue.makeKey(PASS_SKY, false, 1, 1, 1, 0.0f);
+	unsigned long long nearBlended = queue.makeKey(PASS_TRANSPARENT, true, 1, 1, 1, 10.0f);
+	unsigned long long farBlended = queue.makeKey(PASS_TRANSPARENT, true, 1, 1, 1, 900.0f);
+	CHECK(near < far);
+	CHECK(far < sky);
+	CHECK(sky < farBlended);
+	CHECK(farBlended < nearBlended);
+}
+
+static float flatGround(float, float) {
+	return 0.0f;
+}
+
+// No two instances closer than the spacing, also across cell borders, and the same
+// result on any number of threads
+static void testScatterSpacing() {
+	ScatterSpecies species;
+	DefaultScatterSpecies(species);
+	species.spacing = 6.0f;
+	species.seed = 5;
+	ScatterRegion region;
+	region.min = glm::vec2(-100.0f, -80.0f);
+	region.max = glm::vec2(100.0f, 80.0f);
+	region.cellSize = 32.0f;
+	region.height = flatGround;
+
+	std::vector<glm::mat4> single, parallel;
+	Scatter(region, species, single, 1);
+	Scatter(region, species, parallel, 4);
+
+	std::cout << "  " << single.size() << " instances" << std::endl;
+	CHECK(single.size() > 200);
+	CHECK(single.size() == parallel.size() &&
+		(single.empty() || memcmp(&single[0], &parallel[0], single.size() * sizeof(glm::mat4)) == 0));
+	float closest = 1e30f;
+	for (size_t a = 0; a < single.size(); ++a) {
+		glm::vec3 pa(single[a][3]);
+		for (size_t b = a + 1; b < single.size(); ++b) {
+			glm::vec3 pb(single[b][3]);
+			closest = std::min(closest, glm::length(glm::vec2(pa.x - pb.x, pa.z - pb.z)));
+		}
+	}
+	CHECK(closest >= species.spacing * 0.999f);
+}
+
+static bool sameBlock(const CityBlock& a, const CityBlock& b) {
+	return a.buildingCount == b.buildingCount && a.vertices.size() == b.vertices.size() &&
+		a.indices == b.indices && a.occluderIndices == b.occluderIndices && a.occluder.size() == b.occluder.size() &&
+		(a.vertices.empty() || memcmp(&a.vertices[0], &b.vertices[0], a.vertices.size() * sizeof(BuildingVertex)) == 0) &&
+		(a.occluder.empty() || memcmp(&a.occluder[0], &b.occluder[0], a.occluder.size() * sizeof(glm::vec3)) == 0);
+}
+
+// A block depends only on the settings and its coordinates, whatever was built before
+static void testCityBlocks() {
+	CitySettings settings;
+	DefaultCitySettings(settings);
+	CityBlock first, other, again;
+	GenerateCityBlock(settings, 1, 2, flatGround, first);
+	GenerateCityBlock(settings, 3, 0, flatGround, other);
+	GenerateCityBlock(settings, 1, 2, flatGround, again);
+
+	CHECK(first.buildingCount > 0);
+	CHECK(first.blockX == 1 && first.blockZ == 2);
+	CHECK(sameBlock(first, again));
+	CHECK(!sameBlock(first, other));
+	for (size_t i = 0; i < first.indices.size(); ++i) {
+		CHECK(first.indices[i] < first.vertices.size());
+	}
+
+	glm::vec2 areaMin, areaMax;
+	CityBlockArea(settings, 1, 2, areaMin, areaMax);
+	for (size_t v = 0; v < first.vertices.size(); ++v) {
+		const glm::vec3& p = first.vertices[v].position;
+		CHECK(p.x >= areaMin.x - 1e-3f && p.x <= areaMax.x + 1e-3f && p.z >= areaMin.y - 1e-3f && p.z <= areaMax.y + 1e-3f);
+	}
+}
+
+// Boxes wholly outside one plane are culled, any box with a corner inside the frustum
+// is kept, and the batched test agrees with the single one
+static void testFrustumCulling() {
+	glm::mat4 projection = glm::perspective(glm::radians(60.0f), 4.0f / 3.0f, 0.5f, 200.0f);
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 2.0f, 0.0f), glm::vec3(0.0f, 2.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	glm::mat4 vp = projection * view;
+	Frustum frustum = ExtractFrustum(vp);
+
+	AABB ahead = { glm::vec3(-1.0f, 1.0f, -20.0f), glm::vec3(1.0f, 3.0f, -18.0f) };
+	AABB behind = { glm::vec3(-1.0f, 1.0f, 5.0f), glm::vec3(1.0f, 3.0f, 7.0f) };
+	AABB left = { glm::vec3(-80.0f, 1.0f, -20.0f), glm::vec3(-70.0f, 3.0f, -18.0f) };
+	AABB beyondFar = { glm::vec3(-1.0f, 1.0f, -260.0f), glm::vec3(1.0f, 3.0f, -250.0f) };
+	AABB aroundEye = { glm::vec3(-1.0f), glm::vec3(1.0f, 3.0f, 1.0f) };
+	CHECK(IsAABBVisible(frustum, ahead));
+	CHECK(!IsAABBVisible(frustum, behind));
+	CHECK(!IsAABBVisible(frustum, left));
+	CHECK(!IsAABBVisible(frustum, beyondFar));
+	CHECK(IsAABBVisible(frustum, aroundEye));
+
+	Random random(13);
+	AABBList boxes;
+	std::vector<AABB> list;
+	for (int i = 0; i < 2000; ++i) {
+		glm::vec3 center(random.uniform() * 300.0f - 150.0f, random.uniform() * 60.0f - 30.0f, random.uniform() * 300.0f - 250.0f);
+		glm::vec3 extent(random.uniform() * 5.0f, random.uniform() * 5.0f, random.uniform() * 5.0f);
+		AABB box = { center - extent, center + extent };
+		boxes.push_back(box);
+		list.push_back(box);
+	}
+	std::vector<unsigned char> visible;
+	size_t visibleCount = CullAABBs(frustum, boxes, visible);
+	size_t counted = 0, cornersInside = 0;
+	for (size_t i = 0; i < list.size(); ++i) {
+		CHECK((visible[i] != 0) == IsAABBVisible(frustum, list[i]));
+		counted += visible[i] ? 1 : 0;
+		for (int c = 0; c < 8; ++c) {
+			glm::vec3 corner(c & 1 ? list[i].max.x : list[i].min.x, c & 2 ? list[i].max.y : list[i].min.y,
+				c & 4 ? list[i].max.z : list[i].min.z);
+			glm::vec4 clip = vp * glm::vec4(corner, 1.0f);
+			if (clip.w > 0.0f && fabsf(clip.x) < clip.w && fabsf(clip.y) < clip.w && fabsf(clip.z) < clip.w) {
+				CHECK(visible[i]);
+				cornersInside++;
+				break;
+			}
+		}
+	}
+	CHECK(visibleCount == counted);
+	CHECK(cornersInside > 0 && visibleCount < list.size());
+
+	// A rotated and moved box still holds every corner it was built from
+	glm::mat4 transform = glm::rotate(glm::translate(glm::mat4(1.0f), glm::vec3(3.0f, -2.0f, 7.0f)), 0.7f, glm::vec3(0.3f, 1.0f, 0.2f));
+	AABB moved = TransformAABB(ahead, transform);
+	for (int c = 0; c < 8; ++c) {
+		glm::vec3 corner(c & 1 ? ahead.max.x : ahead.min.x, c & 2 ? ahead.max.y : ahead.min.y, c & 4 ? ahead.max.z : ahead.min.z);
+		glm::vec3 p(transform * glm::vec4(corner, 1.0f));
+		CHECK(glm::all(glm::greaterThanEqual(p, moved.min - 1e-4f)) && glm::all(glm::lessThanEqual(p, moved.max + 1e-4f)));
+	}
+}
+
+// Boxes wholly behind a wall are hidden, boxes in front of it or past its edge are
+// not, and the raster does not depend on the number of threads
+static void testOcclusion() {
+	glm::mat4 projection = glm::perspective(glm::radians(60.0f), 4.0f / 3.0f, 0.5f, 200.0f);
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	glm::mat4 vp = projection * view;
+	glm::vec3 wall[4] = { glm::vec3(-5.0f, -5.0f, -10.0f), glm::vec3(5.0f, -5.0f, -10.0f),
+		glm::vec3(5.0f, 5.0f, -10.0f), glm::vec3(-5.0f, 5.0f, -10.0f) };
+	unsigned int wallIndices[6] = { 0, 1, 2, 0, 2, 3 };
+
+	OcclusionBuffer single, parallel;
+	single.initialize(64, 48, 1);
+	parallel.initialize(64, 48, 3);
+	OcclusionBuffer* buffers[2] = { &single, &parallel };
+	for (int b = 0; b < 2; ++b) {
+		buffers[b]->begin(vp);
+		buffers[b]->addOccluder(wall, wallIndices, 6);
+		buffers[b]->finish();
+	}
+	CHECK(single.stats.occluderTriangles == 2);
+	CHECK(single.levels.size() == parallel.levels.size());
+	for (size_t l = 0; l < single.levels.size() && l < parallel.levels.size(); ++l) {
+		CHECK(single.levels[l] == parallel.levels[l]);
+	}
+
+	AABB hidden = { glm::vec3(-2.0f, -2.0f, -32.0f), glm::vec3(2.0f, 2.0f, -28.0f) };
+	AABB inFront = { glm::vec3(-1.0f, -1.0f, -6.0f), glm::vec3(1.0f, 1.0f, -4.0f) };
+	AABB pastEdge = { glm::vec3(13.0f, -2.0f, -32.0f), glm::vec3(17.0f, 2.0f, -28.0f) };
+	AABB aside = { glm::vec3(18.0f, -2.0f, -32.0f), glm::vec3(19.0f, 2.0f, -28.0f) };
+	CHECK(!single.isVisible(hidden));
+	CHECK(single.isVisible(inFront));
+	CHECK(single.isVisible(pastEdge));
+	CHECK(single.isVisible(aside));
+
+	AABBList boxes;
+	boxes.push_back(hidden);
+	boxes.push_back(inFront);
+	boxes.push_back(pastEdge);
+	std::vector<unsigned char> visible(3, 1);
+	CHECK(parallel.cullAABBs(boxes, visible) == 2);
+	CHECK(visible[0] == 0 && visible[1] == 1 && visible[2] == 1);
+	CHECK(parallel.stats.tested == 3 && parallel.stats.occluded == 1);
+
+	single.cleanup();
+	parallel.cleanup();
+}
+
+// A 256x256 RGBA8 chain; the streamer only looks at the sizes
+static void makeChain(MipChain& chain) {
+	chain.target = GL_TEXTURE_2D;
+	chain.width = 256;
+	chain.height = 256;
+	chain.internalFormat = GL_RGBA8;
+	chain.format = GL_RGBA;
+	for (int level = 0; level < 9; ++level) {
+		chain.levels.push_back(std::vector<unsigned char>((size_t)chain.levelWidth(level) * chain.levelHeight(level) * 4));
+	}
+}
+
+// Under a budget too small for every need, visible textures give up the same number
+// of levels, and room for a newly visible one comes from the texture unseen longest
+static void testTextureStreaming() {
+	const size_t level0 = 256 * 256 * 4, level1 = level0 / 4;
+	size_t tail = 0;			// Levels 2 to 8
+	for (size_t bytes = level1 / 4; bytes >= 4; bytes /= 4) {
+		tail += bytes;
+	}
+	TextureStreamer streamer;
+	streamer.initialize(3 * tail + 2 * level1 + level1 / 2);
+	GLuint a = 1, b = 2, c = 3;
+	GLuint ids[3] = { a, b, c };
+	for (int t = 0; t < 3; ++t) {
+		MipChain chain;
+		makeChain(chain);
+		CHECK(streamer.add(ids[t], chain) == ids[t]);
+	}
+	CHECK(streamer.residentBytes == 3 * tail);
+	const TextureStreamer::StreamedTexture& ta = streamer.textures[streamer.indices[a]];
+	const TextureStreamer::StreamedTexture& tb = streamer.textures[streamer.indices[b]];
+	const TextureStreamer::StreamedTexture& tc = streamer.textures[streamer.indices[c]];
+	CHECK(ta.tailLevel == 2);
+
+	// One texel per pixel wants level 0
+	glm::mat4 projection = glm::perspective(glm::radians(60.0f), 1.0f, 0.5f, 200.0f);
+	float uvPerUnit = 1.0f / 256.0f;
+
+	// a and b both want level 0, which does not fit; a bias of one level does
+	streamer.beginFrame(projection, 256);
+	streamer.request(a, uvPerUnit, 1.0f);
+	streamer.request(b, uvPerUnit, 1.0f);
+	streamer.update();
+	CHECK(streamer.stats.wantedBytes == 2 * (level0 + level1 + tail) + tail);
+	CHECK(streamer.stats.budgetBias == 1);
+	CHECK(ta.residentLevel == 1 && tb.residentLevel == 1 && tc.residentLevel == 2);
+	CHECK(streamer.stats.visible == 2 && streamer.stats.sharp == 0);
+	CHECK(streamer.residentBytes <= streamer.budgetBytes);
+
+	// a goes out of view but keeps its level while nothing needs the room
+	streamer.beginFrame(projection, 256);
+	streamer.request(b, uvPerUnit, 1.0f);
+	streamer.update();
+	CHECK(ta.residentLevel == 1 && streamer.stats.levelsDropped == 0);
+
+	// c comes into view; its level 1 only fits once a gives its own back
+	streamer.beginFrame(projection, 256);
+	streamer.request(b, uvPerUnit, 1.0f);
+	streamer.request(c, uvPerUnit, 1.0f);
+	streamer.update();
+	CHECK(streamer.stats.budgetBias == 1);
+	CHECK(streamer.stats.levelsLoaded == 1 && streamer.stats.levelsDropped == 1);
+	CHECK(ta.residentLevel == 2 && tb.residentLevel == 1 && tc.residentLevel == 1);
+	CHECK(streamer.residentBytes <= streamer.budgetBytes);
+	CHECK(streamer.settled());
+
+	streamer.cleanup();
+}
+
+// One node; x of its translation follows the channel
+static AnimationChannel makeChannel(AnimationInterpolation interpolation, const float* times, const float* values, int keys) {
+	AnimationChannel channel;
+	channel.node = 0;
+	channel.path = ANIMATION_TRANSLATION;
+	channel.interpolation = interpolation;
+	int stride = interpolation == ANIMATION_CUBICSPLINE ? 3 : 1;
+	for (int k = 0; k < keys; ++k) {
+		channel.times.push_back(times[k]);
+		for (int v = 0; v < stride; ++v) {
+			channel.values.push_back(glm::vec4(values[k * stride + v], 0.0f, 0.0f, 0.0f));
+		}
+	}
+	return channel;
+}
+
+static float sampleX(const AnimationChannel& channel, float time) {
+	AnimationClip clip;
+	clip.duration = channel.times.back();
+	clip.channels.push_back(channel);
+	Pose pose;
+	pose.translations.assign(1, glm::vec3(0.0f));
+	pose.rotations.assign(1, glm::quat());
+	pose.scales.assign(1, glm::vec3(1.0f));
+	SampleClip(clip, time, pose);
+	return pose.translations[0].x;
+}
+
+static bool near(float a, float b) {
+	return fabsf(a - b) < 1e-5f;
+}
+
+// Keyframes interpolate as glTF specifies and hold at either end; poses blend per
+// component; palettes undo the bind pose
+static void testAnimation() {
+	const float times[3] = { 0.0f, 1.0f, 2.0f };
+	const float values[3] = { 0.0f, 4.0f, 6.0f };
+	AnimationChannel step = makeChannel(ANIMATION_STEP, times, values, 3);
+	CHECK(near(sampleX(step, 0.5f), 0.0f));
+	CHECK(near(sampleX(step, 1.5f), 4.0f));
+	AnimationChannel linear = makeChannel(ANIMATION_LINEAR, times, values, 3);
+	CHECK(near(sampleX(linear, 0.25f), 1.0f));
+	CHECK(near(sampleX(linear, 1.5f), 5.0f));
+	CHECK(near(sampleX(linear, -1.0f), 0.0f));
+	CHECK(near(sampleX(linear, 3.0f), 6.0f));
+
+	// In-tangent, value, out-tangent per key. Tangents of one unit per second over a
+	// two second interval trace x = t exactly; flat ones ease in and out.
+	const float cubicTimes[2] = { 0.0f, 2.0f };
+	const float straight[6] = { 1.0f, 0.0f, 1.0f, 1.0f, 2.0f, 1.0f };
+	AnimationChannel cubic = makeChannel(ANIMATION_CUBICSPLINE, cubicTimes, straight, 2);
+	CHECK(near(sampleX(cubic, 0.5f), 0.5f));
+	CHECK(near(sampleX(cubic, 1.5f), 1.5f));
+	CHECK(near(sampleX(cubic, -1.0f), 0.0f));
+	CHECK(near(sampleX(cubic, 5.0f), 2.0f));
+	const float flat[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 2.0f, 0.0f };
+	AnimationChannel eased = makeChannel(ANIMATION_CUBICSPLINE, cubicTimes, flat, 2);
+	CHECK(near(sampleX(eased, 0.5f), 2.0f * 0.15625f));
+	CHECK(near(sampleX(eased, 1.0f), 1.0f));
+
+	glm::quat quarterTurn = glm::angleAxis(glm::radians(90.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	Pose a, b, blended;
+	a.translations.assign(1, glm::vec3(0.0f));
+	a.rotations.assign(1, glm::quat());
+	a.scales.assign(1, glm::vec3(1.0f));
+	b.translations.assign(1, glm::vec3(2.0f, 0.0f, 0.0f));
+	b.rotations.assign(1, quarterTurn);
+	b.scales.assign(1, glm::vec3(3.0f));
+	BlendPoses(a, b, 0.25f, blended);
+	CHECK(near(blended.translations[0].x, 0.5f));
+	CHECK(near(blended.scales[0].y, 1.5f));
+	glm::quat blendedTurn = glm::angleAxis(glm::radians(22.5f), glm::vec3(0.0f, 1.0f, 0.0f));
+	CHECK(near(blended.rotations[0].w, blendedTurn.w) && near(blended.rotations[0].y, blendedTurn.y));
+	BlendPoses(a, b, 1.0f, a);
+	CHECK(near(a.translations[0].x, 2.0f) && near(a.scales[0].z, 3.0f));
+
+	// A two joint chain skinned twice, the second skin on a node moved up by one
+	Skeleton skeleton;
+	skeleton.parents.push_back(-1);
+	skeleton.parents.push_back(0);
+	skeleton.restPose.translations.push_back(glm::vec3(1.0f, 0.0f, 0.0f));
+	skeleton.restPose.translations.push_back(glm::vec3(0.0f, 2.0f, 0.0f));
+	skeleton.restPose.rotations.assign(2, quarterTurn);
+	skeleton.restPose.scales.assign(2, glm::vec3(1.0f));
+	glm::mat4 rest0 = ComposeTransform(skeleton.restPose.translations[0], quarterTurn, glm::vec3(1.0f));
+	glm::mat4 rest1 = rest0 * ComposeTransform(skeleton.restPose.translations[1], quarterTurn, glm::vec3(1.0f));
+	SkinBinding skin;
+	skin.joints.push_back(0);
+	skin.joints.push_back(1);
+	skin.inverseBindMatrices.push_back(glm::inverse(rest0));
+	skin.inverseBindMatrices.push_back(glm::inverse(rest1));
+	skin.inverseNodeTransform = glm::mat4(1.0f);
+	skin.paletteOffset = 0;
+	skeleton.skins.push_back(skin);
+	glm::mat4 lifted = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	skin.joints[0] = -1;
+	skin.inverseNodeTransform = glm::inverse(lifted);
+	skin.paletteOffset = 2;
+	skeleton.skins.push_back(skin);
+	skeleton.paletteSize = 4;
+
+	std::vector<glm::mat4> worlds;
+	glm::mat4 palette[4];
+	BuildJointPalette(skeleton, skeleton.restPose, worlds, palette);
+	float restError = 0.0f;
+	for (int c = 0; c < 4; ++c) {
+		restError = std::max(restError, glm::length(palette[0][c] - glm::mat4(1.0f)[c]));
+		restError = std::max(restError, glm::length(palette[1][c] - glm::mat4(1.0f)[c]));
+	}
+	CHECK(restError < 1e-5f);
+
+	// Moving the root carries the child along
+	Pose moved = skeleton.restPose;
+	moved.translations[0] += glm::vec3(0.0f, 0.0f, 3.0f);
+	BuildJointPalette(skeleton, moved, worlds, palette);
+	glm::vec4 tip = rest1 * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+	glm::vec3 skinned = glm::vec3(palette[1] * tip);
+	CHECK(glm::length(skinned - (glm::vec3(tip) + glm::vec3(0.0f, 0.0f, 3.0f))) < 1e-5f);
+	CHECK(glm::length(glm::vec3(palette[3] * tip) - glm::vec3(glm::inverse(lifted) * glm::vec4(skinned, 1.0f))) < 1e-5f);
+	CHECK(glm::length(glm::vec3(palette[2][3]) - glm::vec3(glm::inverse(lifted * rest0)[3])) < 1e-5f);
+}
+
+int main() {
+	struct Test {
+		const char* name;
+		void (*run)();
+	};
+	const Test tests[] = {
+		{ "simplify", testSimplify },
+		{ "vertex cache", testVertexCache },
+		{ "packed vertices", testPackedVertices },
+		{ "render queue order", testRenderQueueOrder },
+		{ "scatter spacing", testScatterSpacing },
+		{ "city blocks", testCityBlocks },
+		{ "frustum culling", testFrustumCulling },
+		{ "occlusion", testOcclusion },
+		{ "texture streaming", testTextureStreaming },
+		{ "animation", testAnimation },
+	};
+
+	installFakeGL();
+	int failed = 0;
+	for (size_t t = 0; t < sizeof(tests) / sizeof(tests[0]); ++t) {
+		int before = failures;
+		tests[t].run();
+		bool ok = failures == before;
+		std::cout << tests[t].name << ": " << (ok ? "ok" : "FAILED") << std::endl;
+		failed += ok ? 0 : 1;
+	}
+	std::cout << failed << " of " << sizeof(tests) / sizeof(tests[0]) << " checks failed" << std::endl;
+	return failed == 0 ? 0 : 1;
+}